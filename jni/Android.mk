@@ -4,6 +4,7 @@ include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES:= \
     com_android_bluetooth_btservice_AdapterService.cpp \
+    com_android_bluetooth_CallbackEnv.cpp \
     com_android_bluetooth_hfp.cpp \
     com_android_bluetooth_iap2.cpp \
     com_android_bluetooth_a2dp.cpp \
@@ -30,3 +31,27 @@ LOCAL_MODULE := libbluetooth_jni
 LOCAL_MODULE_TAGS := optional
 
 include $(BUILD_SHARED_LIBRARY)
+
+# Mock stack replaying callback streams into libbluetooth_jni, loaded in
+# place of the real stack with bluetooth.mock_stack set to 1. See
+# bench/bluetooth_bench_hal.c for the streams and what is measured.
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    bench/bluetooth_bench_hal.c
+
+LOCAL_C_INCLUDES += \
+    $(JNI_H_INCLUDE) \
+
+LOCAL_CFLAGS += -std=gnu99
+
+LOCAL_SHARED_LIBRARIES := \
+    libnativehelper \
+    libcutils \
+    liblog
+
+LOCAL_MODULE := bluetooth_test.default
+LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_SHARED_LIBRARY)
@@ -0,0 +1,832 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Mock Bluetooth stack for benchmarking libbluetooth_jni.
+ *
+ * Built as the BT_STACK_TEST_MODULE_ID module, which AdapterService loads
+ * in place of the real stack when bluetooth.mock_stack is 1. It implements
+ * the adapter, GATT and iAP2 interfaces well enough for the services to
+ * start, and no other profile. Once the adapter is enabled it replays the
+ * streams listed in bluetooth.mock_stack.bench, separated by commas:
+ *
+ *     scan[:count]      LE scan results from 64 devices
+ *     notify[:count]    20 byte GATT notifications on one connection
+ *     iap2[:count]      512 byte iAP2 data packets
+ *     <path>            a recorded stream, see below
+ *
+ * The callbacks are made on the mock's own callback thread, like the real
+ * stack makes them, and the results of each stream are logged:
+ *
+ *     callbacks/s       callbacks per second spent in the JNI layer
+ *     objects/cb        Java objects allocated per callback, all threads
+ *     heap bytes/cb     growth of the native heap per callback
+ *     p50 p99 p99.9 max time a single callback took, in microseconds
+ *
+ * With async callbacks configured the latencies only cover queueing the
+ * upcall, not making it.
+ *
+ * A recorded stream is a file of records, each a little endian header
+ *     uint8_t kind, uint8_t reserved, uint16_t len, uint32_t delay_us
+ * followed by len bytes of payload, replayed delay_us after the record
+ * before it. The payload of each kind is
+ *     MOCK_RECORD_SCAN     bt_bdaddr_t, int8_t rssi, adv data
+ *     MOCK_RECORD_NOTIFY   uint16_t conn_id, uint8_t is_notify, value
+ *     MOCK_RECORD_IAP2     data
+ */
+
+#define LOG_TAG "BluetoothBenchHal"
+
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cutils/log.h>
+#include <cutils/properties.h>
+#include <hardware/bluetooth.h>
+#include <hardware/bt_gatt.h>
+#include <hardware/bt_iap2.h>
+
+#include "jni.h"
+
+#define MOCK_RECORD_SCAN 1
+#define MOCK_RECORD_NOTIFY 2
+#define MOCK_RECORD_IAP2 3
+
+#define MOCK_RECORD_HEADER_LEN 8
+#define MOCK_ADV_DATA_LEN 62
+#define MOCK_MAX_RECORD_LEN BTGATT_MAX_ATTR_LEN
+#define MOCK_MAX_STREAM_LEN (16 * 1024 * 1024)
+#define MOCK_MAX_EVENTS 200000
+#define MOCK_DEFAULT_EVENTS 20000
+#define MOCK_SCAN_DEVICES 64
+#define MOCK_NOTIFY_LEN 20
+#define MOCK_IAP2_LEN 512
+#define MOCK_PROFILE_WAIT_MS 10000
+
+// dalvik.system.VMDebug.KIND_GLOBAL_ALLOCATED_OBJECTS
+#define VMDEBUG_KIND_GLOBAL_ALLOCATED_OBJECTS 1
+#define VMDEBUG_KIND_ALL_COUNTS 0xffffffff
+
+// Commands for the callback thread
+#define MOCK_CMD_ENABLE 0x01
+#define MOCK_CMD_DISABLE 0x02
+#define MOCK_CMD_PROPERTIES 0x04
+#define MOCK_CMD_REGISTER_CLIENT 0x08
+#define MOCK_CMD_QUIT 0x10
+
+typedef struct {
+    const char *name;
+    int count;
+    uint64_t busy_ns;
+    uint32_t *latencies_ns;
+    int java_objects;
+    int heap_bytes;
+} mock_stream_stats_t;
+
+static pthread_mutex_t sLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sCond = PTHREAD_COND_INITIALIZER;
+static pthread_t sThread;
+static int sThreadRunning = 0;
+static int sCommands = 0;
+static bt_uuid_t sPendingClientUuid;
+
+static bt_callbacks_t *sCallbacks = NULL;
+static const btgatt_callbacks_t *sGattCallbacks = NULL;
+static const btiap2_callbacks_t *sIap2Callbacks = NULL;
+static int sNextClientIf = 1;
+
+static const bt_bdaddr_t sLocalAddress = {{0x00, 0x11, 0x22, 0x33, 0x44, 0x55}};
+static const bt_bdaddr_t sRemoteAddress = {{0x00, 0x66, 0x77, 0x88, 0x99, 0x00}};
+static const char sLocalName[] = "Bluetooth Bench";
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void post_command(int cmd) {
+    pthread_mutex_lock(&sLock);
+    sCommands |= cmd;
+    pthread_cond_signal(&sCond);
+    pthread_mutex_unlock(&sLock);
+}
+
+/*
+ * Streams
+ */
+
+static uint8_t *put_record(uint8_t *p, int kind, int len, uint32_t delay_us) {
+    p[0] = (uint8_t) kind;
+    p[1] = 0;
+    p[2] = (uint8_t) len;
+    p[3] = (uint8_t) (len >> 8);
+    p[4] = (uint8_t) delay_us;
+    p[5] = (uint8_t) (delay_us >> 8);
+    p[6] = (uint8_t) (delay_us >> 16);
+    p[7] = (uint8_t) (delay_us >> 24);
+    return p + MOCK_RECORD_HEADER_LEN;
+}
+
+// Builds count records of a synthetic stream, returns NULL for an unknown one
+static uint8_t *build_stream(const char *name, int count, size_t *len) {
+    int payload;
+    if (!strcmp(name, "scan")) {
+        payload = sizeof(bt_bdaddr_t) + 1 + MOCK_ADV_DATA_LEN;
+    } else if (!strcmp(name, "notify")) {
+        payload = 3 + MOCK_NOTIFY_LEN;
+    } else if (!strcmp(name, "iap2")) {
+        payload = MOCK_IAP2_LEN;
+    } else {
+        return NULL;
+    }
+
+    *len = (size_t) count * (MOCK_RECORD_HEADER_LEN + payload);
+    uint8_t *stream = (uint8_t *) malloc(*len);
+    if (stream == NULL) return NULL;
+
+    uint8_t *p = stream;
+    for (int i = 0; i < count; i++) {
+        if (!strcmp(name, "scan")) {
+            p = put_record(p, MOCK_RECORD_SCAN, payload, 0);
+            memcpy(p, sRemoteAddress.address, sizeof(bt_bdaddr_t));
+            p[5] = (uint8_t) (i % MOCK_SCAN_DEVICES);
+            p[6] = (uint8_t) (-40 - i % 50);
+            // Flags, then a manufacturer field changing with every result
+            memset(p + 7, 0, MOCK_ADV_DATA_LEN);
+            p[7] = 2; p[8] = 0x01; p[9] = 0x06;
+            p[10] = 5; p[11] = 0xff; p[12] = 0xe0; p[13] = 0x00;
+            p[14] = (uint8_t) i; p[15] = (uint8_t) (i >> 8);
+        } else if (!strcmp(name, "notify")) {
+            p = put_record(p, MOCK_RECORD_NOTIFY, payload, 0);
+            p[0] = 1; p[1] = 0;
+            p[2] = 1;
+            for (int j = 0; j < MOCK_NOTIFY_LEN; j++) p[3 + j] = (uint8_t) (i + j);
+        } else {
+            p = put_record(p, MOCK_RECORD_IAP2, payload, 0);
+            for (int j = 0; j < MOCK_IAP2_LEN; j++) p[j] = (uint8_t) (i + j);
+        }
+        p += payload;
+    }
+    return stream;
+}
+
+static uint8_t *read_stream(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        ALOGE("%s: Cannot open %s: %s", __FUNCTION__, path, strerror(errno));
+        return NULL;
+    }
+    uint8_t *stream = NULL;
+    long size;
+    if (fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) > 0 && size <= MOCK_MAX_STREAM_LEN &&
+        fseek(f, 0, SEEK_SET) == 0 && (stream = (uint8_t *) malloc(size)) != NULL) {
+        if (fread(stream, 1, size, f) == (size_t) size) {
+            *len = size;
+        } else {
+            free(stream);
+            stream = NULL;
+        }
+    }
+    fclose(f);
+    if (stream == NULL) ALOGE("%s: Cannot read %s", __FUNCTION__, path);
+    return stream;
+}
+
+static int stream_needs_gatt(const uint8_t *stream, size_t len) {
+    return len >= MOCK_RECORD_HEADER_LEN && stream[0] != MOCK_RECORD_IAP2;
+}
+
+/*
+ * Makes the callback for one record and returns how long it took, or 0 if
+ * the record was skipped.
+ */
+static uint64_t replay_record(int kind, const uint8_t *payload, int len) {
+    uint64_t start;
+
+    switch (kind) {
+    case MOCK_RECORD_SCAN: {
+        bt_bdaddr_t bda;
+        uint8_t adv_data[MOCK_ADV_DATA_LEN];
+        if (len < (int) sizeof(bt_bdaddr_t) + 1 || !sGattCallbacks) return 0;
+        int adv_len = len - sizeof(bt_bdaddr_t) - 1;
+        if (adv_len > MOCK_ADV_DATA_LEN) adv_len = MOCK_ADV_DATA_LEN;
+        memcpy(&bda, payload, sizeof(bt_bdaddr_t));
+        memset(adv_data, 0, sizeof(adv_data));
+        memcpy(adv_data, payload + sizeof(bt_bdaddr_t) + 1, adv_len);
+        start = now_ns();
+        sGattCallbacks->client->scan_result_cb(&bda, (int8_t) payload[sizeof(bt_bdaddr_t)],
+                                               adv_data);
+        return now_ns() - start;
+    }
+    case MOCK_RECORD_NOTIFY: {
+        btgatt_notify_params_t params;
+        if (len < 3 || !sGattCallbacks) return 0;
+        memset(&params, 0, sizeof(params));
+        params.bda = sRemoteAddress;
+        params.is_notify = payload[2];
+        params.len = len - 3;
+        if (params.len > BTGATT_MAX_ATTR_LEN) params.len = BTGATT_MAX_ATTR_LEN;
+        memcpy(params.value, payload + 3, params.len);
+        start = now_ns();
+        sGattCallbacks->client->notify_cb(payload[0] | (payload[1] << 8), &params);
+        return now_ns() - start;
+    }
+    case MOCK_RECORD_IAP2: {
+        uint8_t data[MOCK_MAX_RECORD_LEN];
+        if (!sIap2Callbacks || len > MOCK_MAX_RECORD_LEN) return 0;
+        memcpy(data, payload, len);
+        start = now_ns();
+        sIap2Callbacks->data_cb(len, data);
+        return now_ns() - start;
+    }
+    }
+    return 0;
+}
+
+static int compare_latency(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static void log_stats(mock_stream_stats_t *stats) {
+    if (stats->count == 0) {
+        ALOGI("%s: no callbacks made", stats->name);
+        return;
+    }
+    qsort(stats->latencies_ns, stats->count, sizeof(uint32_t), compare_latency);
+    uint32_t *l = stats->latencies_ns;
+    int n = stats->count;
+    ALOGI("%s: %d callbacks, %llu callbacks/s, %.2f objects/cb, %.1f heap bytes/cb, "
+          "p50 %u us, p99 %u us, p99.9 %u us, max %u us", stats->name, n,
+          stats->busy_ns ? (unsigned long long) (n * 1000000000LL / stats->busy_ns) : 0ULL,
+          (double) stats->java_objects / n, (double) stats->heap_bytes / n,
+          l[n / 2] / 1000, l[(int) (n * 0.99)] / 1000, l[(int) (n * 0.999)] / 1000,
+          l[n - 1] / 1000);
+}
+
+/*
+ * Java allocation counting through dalvik.system.VMDebug, returns -1 if it
+ * is not available.
+ */
+static int vmdebug_alloc_count(JNIEnv *env, int reset) {
+    if (env == NULL) return -1;
+    jclass clazz = (*env)->FindClass(env, "dalvik/system/VMDebug");
+    if (clazz == NULL) {
+        (*env)->ExceptionClear(env);
+        return -1;
+    }
+    int count = -1;
+    if (reset) {
+        jmethodID start = (*env)->GetStaticMethodID(env, clazz, "startAllocCounting", "()V");
+        jmethodID clear = (*env)->GetStaticMethodID(env, clazz, "resetAllocCount", "(I)V");
+        if (start && clear) {
+            (*env)->CallStaticVoidMethod(env, clazz, start);
+            (*env)->CallStaticVoidMethod(env, clazz, clear, (jint) VMDEBUG_KIND_ALL_COUNTS);
+            count = 0;
+        }
+    } else {
+        jmethodID get = (*env)->GetStaticMethodID(env, clazz, "getAllocCount", "(I)I");
+        jmethodID stop = (*env)->GetStaticMethodID(env, clazz, "stopAllocCounting", "()V");
+        if (get && stop) {
+            count = (*env)->CallStaticIntMethod(env, clazz, get,
+                                                (jint) VMDEBUG_KIND_GLOBAL_ALLOCATED_OBJECTS);
+            (*env)->CallStaticVoidMethod(env, clazz, stop);
+        }
+    }
+    if ((*env)->ExceptionCheck(env)) {
+        (*env)->ExceptionClear(env);
+        count = -1;
+    }
+    (*env)->DeleteLocalRef(env, clazz);
+    return count;
+}
+
+static JNIEnv *get_jni_env(void) {
+    JavaVM *vm;
+    jsize count = 0;
+    JNIEnv *env = NULL;
+    if (JNI_GetCreatedJavaVMs(&vm, 1, &count) != JNI_OK || count == 0) return NULL;
+    if ((*vm)->GetEnv(vm, (void **) &env, JNI_VERSION_1_6) != JNI_OK) return NULL;
+    return env;
+}
+
+// Returns 0 once the profile the stream needs is up, waiting for it to start
+static int wait_for_profile(int gatt) {
+    for (int waited = 0; waited < MOCK_PROFILE_WAIT_MS; waited += 100) {
+        if (gatt ? sGattCallbacks != NULL : sIap2Callbacks != NULL) return 0;
+        usleep(100 * 1000);
+    }
+    return -1;
+}
+
+static int quit_requested(void) {
+    pthread_mutex_lock(&sLock);
+    int quit = sCommands & (MOCK_CMD_QUIT | MOCK_CMD_DISABLE);
+    pthread_mutex_unlock(&sLock);
+    return quit;
+}
+
+static void run_stream(JNIEnv *env, const char *name) {
+    char type[PROPERTY_VALUE_MAX];
+    int count = MOCK_DEFAULT_EVENTS;
+    size_t len = 0;
+    uint8_t *stream;
+
+    strncpy(type, name, sizeof(type) - 1);
+    type[sizeof(type) - 1] = '\0';
+    char *colon = strchr(type, ':');
+    if (colon) {
+        *colon = '\0';
+        count = atoi(colon + 1);
+        if (count <= 0 || count > MOCK_MAX_EVENTS) count = MOCK_DEFAULT_EVENTS;
+    }
+    stream = type[0] == '/' ? read_stream(type, &len) : build_stream(type, count, &len);
+    if (stream == NULL) {
+        ALOGE("%s: Unknown stream %s", __FUNCTION__, name);
+        return;
+    }
+
+    mock_stream_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.name = name;
+    stats.latencies_ns = (uint32_t *) malloc(MOCK_MAX_EVENTS * sizeof(uint32_t));
+    if (stats.latencies_ns == NULL || wait_for_profile(stream_needs_gatt(stream, len))) {
+        ALOGE("%s: Cannot run %s", __FUNCTION__, name);
+        free(stats.latencies_ns);
+        free(stream);
+        return;
+    }
+
+    int objects = vmdebug_alloc_count(env, 1);
+    struct mallinfo heap = mallinfo();
+
+    size_t off = 0;
+    while (off + MOCK_RECORD_HEADER_LEN <= len && stats.count < MOCK_MAX_EVENTS) {
+        const uint8_t *p = stream + off;
+        int rec_len = p[2] | (p[3] << 8);
+        uint32_t delay_us = p[4] | (p[5] << 8) | (p[6] << 16) | ((uint32_t) p[7] << 24);
+        if (off + MOCK_RECORD_HEADER_LEN + rec_len > len) break;
+        off += MOCK_RECORD_HEADER_LEN + rec_len;
+
+        if (delay_us) usleep(delay_us);
+        if ((stats.count & 0xff) == 0 && quit_requested()) break;
+        uint64_t elapsed = replay_record(p[0], p + MOCK_RECORD_HEADER_LEN, rec_len);
+        if (elapsed == 0) continue;
+        stats.latencies_ns[stats.count++] = elapsed > UINT32_MAX ? UINT32_MAX : elapsed;
+        stats.busy_ns += elapsed;
+    }
+
+    stats.heap_bytes = mallinfo().uordblks - heap.uordblks;
+    if (objects >= 0) {
+        int total = vmdebug_alloc_count(env, 0);
+        stats.java_objects = total >= 0 ? total : 0;
+    }
+    log_stats(&stats);
+
+    free(stats.latencies_ns);
+    free(stream);
+}
+
+static void run_bench(JNIEnv *env) {
+    char value[PROPERTY_VALUE_MAX];
+    char *save = NULL;
+
+    property_get("bluetooth.mock_stack.bench", value, "");
+    for (char *name = strtok_r(value, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+        if (quit_requested()) return;
+        run_stream(env, name);
+    }
+}
+
+/*
+ * Callback thread
+ */
+
+static void report_properties(void) {
+    bt_property_t props[2];
+    props[0].type = BT_PROPERTY_BDADDR;
+    props[0].len = sizeof(sLocalAddress);
+    props[0].val = (void *) &sLocalAddress;
+    props[1].type = BT_PROPERTY_BDNAME;
+    props[1].len = strlen(sLocalName);
+    props[1].val = (void *) sLocalName;
+    sCallbacks->adapter_properties_cb(BT_STATUS_SUCCESS, 2, props);
+}
+
+static void *mock_thread(void *arg) {
+    sCallbacks->thread_evt_cb(ASSOCIATE_JVM);
+    JNIEnv *env = get_jni_env();
+
+    pthread_mutex_lock(&sLock);
+    while (!(sCommands & MOCK_CMD_QUIT)) {
+        if (sCommands == 0) {
+            pthread_cond_wait(&sCond, &sLock);
+            continue;
+        }
+        int cmds = sCommands;
+        bt_uuid_t uuid = sPendingClientUuid;
+        sCommands &= MOCK_CMD_QUIT;
+        pthread_mutex_unlock(&sLock);
+
+        if (cmds & MOCK_CMD_DISABLE) {
+            sCallbacks->adapter_state_changed_cb(BT_STATE_OFF);
+        } else if (cmds & MOCK_CMD_ENABLE) {
+            sCallbacks->adapter_state_changed_cb(BT_STATE_ON);
+            report_properties();
+            run_bench(env);
+        }
+        if (cmds & MOCK_CMD_PROPERTIES) report_properties();
+        if ((cmds & MOCK_CMD_REGISTER_CLIENT) && sGattCallbacks) {
+            sGattCallbacks->client->register_client_cb(0, sNextClientIf++, &uuid);
+        }
+
+        pthread_mutex_lock(&sLock);
+    }
+    pthread_mutex_unlock(&sLock);
+
+    sCallbacks->thread_evt_cb(DISASSOCIATE_JVM);
+    return NULL;
+}
+
+/*
+ * GATT interface
+ */
+
+static bt_status_t gattc_register_client(bt_uuid_t *uuid) {
+    pthread_mutex_lock(&sLock);
+    sPendingClientUuid = *uuid;
+    pthread_mutex_unlock(&sLock);
+    post_command(MOCK_CMD_REGISTER_CLIENT);
+    return BT_STATUS_SUCCESS;
+}
+
+static bt_status_t gattc_unregister_client(int client_if) { return BT_STATUS_SUCCESS; }
+static bt_status_t gattc_scan(int client_if, bool start) { return BT_STATUS_SUCCESS; }
+static bt_status_t gattc_connect(int client_if, const bt_bdaddr_t *bd_addr, bool is_direct) {
+    return BT_STATUS_SUCCESS;
+}
+static bt_status_t gattc_disconnect(int client_if, const bt_bdaddr_t *bd_addr, int conn_id) {
+    return BT_STATUS_SUCCESS;
+}
+static bt_status_t gattc_listen(int client_if, bool start) { return BT_STATUS_SUCCESS; }
+static bt_status_t gattc_refresh(int client_if, const bt_bdaddr_t *bd_addr) {
+    return BT_STATUS_SUCCESS;
+}
+static bt_status_t gattc_search_service(int conn_id, bt_uuid_t *filter_uuid) {
+    return BT_STATUS_SUCCESS;
+}
+static bt_status_t gattc_get_included_service(int conn_id, btgatt_srvc_id_t *srvc_id,
+                                              btgatt_srvc_id_t *start_incl_srvc_id) {
+    return BT_STATUS_SUCCESS;
+}
+static bt_status_t gattc_get_characteristic(int conn_id, btgatt_srvc_id_t *srvc_id,
+                                            btgatt_gatt_id_t *start_char_id) {
+    return BT_STATUS_SUCCESS;
+}
+static bt_status_t gattc_get_descriptor(int conn_id, btgatt_srvc_id_t *srvc_id,
+                                        btgatt_gatt_id_t *char_id,
+                                        btgatt_gatt_id_t *start_descr_id) {
+    return BT_STATUS_SUCCESS;
+}
+static bt_status_t gattc_read_characteristic(int conn_id, btgatt_srvc_id_t *srvc_id,
+                                             btgatt_gatt_id_t *char_id, int auth_req) {
+    return BT_STATUS_SUCCESS;
+}
+static bt_status_t gattc_write_characteristic(int conn_id, btgatt_srvc_id_t *srvc_id,
+                                              btgatt_gatt_id_t *char_id, int write_type,
+                                              int len, int auth_req, char *p_value) {
+    return BT_STATUS_SUCCESS;
+}
+static bt_status_t gattc_read_descriptor(int conn_id, btgatt_srvc_id_t *srvc_id,
+                                         btgatt_gatt_id_t *char_id, btgatt_gatt_id_t *descr_id,
+                                         int auth_req) {
+    return BT_STATUS_SUCCESS;
+}
+static bt_status_t gattc_write_descriptor(int conn_id, btgatt_srvc_id_t *srvc_id,
+                                          btgatt_gatt_id_t *char_id, btgatt_gatt_id_t *descr_id,
+                                          int write_type, int len, int auth_req, char *p_value) {
+    return BT_STATUS_SUCCESS;
+}
+static bt_status_t gattc_execute_write(int conn_id, int execute) { return BT_STATUS_SUCCESS; }
+static bt_status_t gattc_register_for_notification(int client_if, const bt_bdaddr_t *bd_addr,
+                                                   btgatt_srvc_id_t *srvc_id,
+                                                   btgatt_gatt_id_t *char_id) {
+    return BT_STATUS_SUCCESS;
+}
+static bt_status_t gattc_deregister_for_notification(int client_if, const bt_bdaddr_t *bd_addr,
+                                                     btgatt_srvc_id_t *srvc_id,
+                                                     btgatt_gatt_id_t *char_id) {
+    return BT_STATUS_SUCCESS;
+}
+static bt_status_t gattc_read_remote_rssi(int client_if, const bt_bdaddr_t *bd_addr) {
+    return BT_STATUS_SUCCESS;
+}
+static int gattc_get_device_type(const bt_bdaddr_t *bd_addr) { return 2; }
+static bt_status_t gattc_set_adv_data(int server_if, bool set_scan_rsp, bool include_name,
+                                      bool include_txpower, int min_interval, int max_interval,
+                                      int appearance, uint16_t manufacturer_len,
+                                      char *manufacturer_data, uint16_t service_data_len,
+                                      char *service_data, uint16_t service_uuid_len,
+                                      char *service_uuid) {
+    return BT_STATUS_SUCCESS;
+}
+static bt_status_t gattc_test_command(int command, btgatt_test_params_t *params) {
+    return BT_STATUS_SUCCESS;
+}
+
+static const btgatt_client_interface_t sGattClientInterface = {
+    .register_client = gattc_register_client,
+    .unregister_client = gattc_unregister_client,
+    .scan = gattc_scan,
+    .connect = gattc_connect,
+    .disconnect = gattc_disconnect,
+    .listen = gattc_listen,
+    .refresh = gattc_refresh,
+    .search_service = gattc_search_service,
+    .get_included_service = gattc_get_included_service,
+    .get_characteristic = gattc_get_characteristic,
+    .get_descriptor = gattc_get_descriptor,
+    .read_characteristic = gattc_read_characteristic,
+    .write_characteristic = gattc_write_characteristic,
+    .read_descriptor = gattc_read_descriptor,
+    .write_descriptor = gattc_write_descriptor,
+    .execute_write = gattc_execute_write,
+    .register_for_notification = gattc_register_for_notification,
+    .deregister_for_notification = gattc_deregister_for_notification,
+    .read_remote_rssi = gattc_read_remote_rssi,
+    .get_device_type = gattc_get_device_type,
+    .set_adv_data = gattc_set_adv_data,
+    .test_command = gattc_test_command,
+};
+
+static bt_status_t gatts_register_server(bt_uuid_t *uuid) { return BT_STATUS_SUCCESS; }
+static bt_status_t gatts_unregister_server(int server_if) { return BT_STATUS_SUCCESS; }
+static bt_status_t gatts_connect(int server_if, const bt_bdaddr_t *bd_addr, bool is_direct) {
+    return BT_STATUS_SUCCESS;
+}
+static bt_status_t gatts_disconnect(int server_if, const bt_bdaddr_t *bd_addr, int conn_id) {
+    return BT_STATUS_SUCCESS;
+}
+static bt_status_t gatts_add_service(int server_if, btgatt_srvc_id_t *srvc_id, int num_handles) {
+    return BT_STATUS_SUCCESS;
+}
+static bt_status_t gatts_add_included_service(int server_if, int service_handle,
+                                              int included_handle) {
+    return BT_STATUS_SUCCESS;
+}
+static bt_status_t gatts_add_characteristic(int server_if, int service_handle, bt_uuid_t *uuid,
+                                            int properties, int permissions) {
+    return BT_STATUS_SUCCESS;
+}
+static bt_status_t gatts_add_descriptor(int server_if, int service_handle, bt_uuid_t *uuid,
+                                        int permissions) {
+    return BT_STATUS_SUCCESS;
+}
+static bt_status_t gatts_start_service(int server_if, int service_handle, int transport) {
+    return BT_STATUS_SUCCESS;
+}
+static bt_status_t gatts_stop_service(int server_if, int service_handle) {
+    return BT_STATUS_SUCCESS;
+}
+static bt_status_t gatts_delete_service(int server_if, int service_handle) {
+    return BT_STATUS_SUCCESS;
+}
+static bt_status_t gatts_send_indication(int server_if, int attribute_handle, int conn_id,
+                                         int len, int confirm, char *p_value) {
+    return BT_STATUS_SUCCESS;
+}
+static bt_status_t gatts_send_response(int conn_id, int trans_id, int status,
+                                       btgatt_response_t *response) {
+    return BT_STATUS_SUCCESS;
+}
+
+static const btgatt_server_interface_t sGattServerInterface = {
+    .register_server = gatts_register_server,
+    .unregister_server = gatts_unregister_server,
+    .connect = gatts_connect,
+    .disconnect = gatts_disconnect,
+    .add_service = gatts_add_service,
+    .add_included_service = gatts_add_included_service,
+    .add_characteristic = gatts_add_characteristic,
+    .add_descriptor = gatts_add_descriptor,
+    .start_service = gatts_start_service,
+    .stop_service = gatts_stop_service,
+    .delete_service = gatts_delete_service,
+    .send_indication = gatts_send_indication,
+    .send_response = gatts_send_response,
+};
+
+static bt_status_t gatt_init(const btgatt_callbacks_t *callbacks) {
+    sGattCallbacks = callbacks;
+    return BT_STATUS_SUCCESS;
+}
+
+static void gatt_cleanup(void) {
+    sGattCallbacks = NULL;
+}
+
+static const btgatt_interface_t sGattInterface = {
+    .size = sizeof(btgatt_interface_t),
+    .init = gatt_init,
+    .cleanup = gatt_cleanup,
+    .client = &sGattClientInterface,
+    .server = &sGattServerInterface,
+};
+
+/*
+ * iAP2 interface
+ */
+
+static bt_status_t iap2_init(btiap2_callbacks_t *callbacks) {
+    sIap2Callbacks = callbacks;
+    return BT_STATUS_SUCCESS;
+}
+
+static bt_status_t iap2_connect(bt_bdaddr_t *bd_addr) { return BT_STATUS_SUCCESS; }
+static bt_status_t iap2_disconnect(bt_bdaddr_t *bd_addr) { return BT_STATUS_SUCCESS; }
+static bt_status_t iap2_send_data(unsigned int len, unsigned char *data) {
+    return BT_STATUS_SUCCESS;
+}
+
+static void iap2_cleanup(void) {
+    sIap2Callbacks = NULL;
+}
+
+static const btiap2_interface_t sIap2Interface = {
+    .size = sizeof(btiap2_interface_t),
+    .init = iap2_init,
+    .connect = iap2_connect,
+    .disconnect = iap2_disconnect,
+    .send_data = iap2_send_data,
+    .cleanup = iap2_cleanup,
+};
+
+/*
+ * Adapter interface
+ */
+
+static int bt_init(bt_callbacks_t *callbacks) {
+    pthread_mutex_lock(&sLock);
+    if (sThreadRunning) {
+        pthread_mutex_unlock(&sLock);
+        return BT_STATUS_DONE;
+    }
+    sCallbacks = callbacks;
+    sCommands = 0;
+    if (pthread_create(&sThread, NULL, mock_thread, NULL) != 0) {
+        pthread_mutex_unlock(&sLock);
+        ALOGE("%s: Failed to start the callback thread", __FUNCTION__);
+        return BT_STATUS_FAIL;
+    }
+    sThreadRunning = 1;
+    pthread_mutex_unlock(&sLock);
+    return BT_STATUS_SUCCESS;
+}
+
+static int bt_enable(void) {
+    post_command(MOCK_CMD_ENABLE);
+    return BT_STATUS_SUCCESS;
+}
+
+static int bt_disable(void) {
+    post_command(MOCK_CMD_DISABLE);
+    return BT_STATUS_SUCCESS;
+}
+
+static void bt_cleanup(void) {
+    pthread_mutex_lock(&sLock);
+    int running = sThreadRunning;
+    sThreadRunning = 0;
+    pthread_mutex_unlock(&sLock);
+    if (!running) return;
+
+    post_command(MOCK_CMD_QUIT);
+    pthread_join(sThread, NULL);
+    sCallbacks = NULL;
+}
+
+static int bt_get_adapter_properties(void) {
+    post_command(MOCK_CMD_PROPERTIES);
+    return BT_STATUS_SUCCESS;
+}
+
+static int bt_get_adapter_property(bt_property_type_t type) {
+    post_command(MOCK_CMD_PROPERTIES);
+    return BT_STATUS_SUCCESS;
+}
+
+static int bt_set_adapter_property(const bt_property_t *property) { return BT_STATUS_SUCCESS; }
+static int bt_get_remote_device_properties(bt_bdaddr_t *remote_addr) { return BT_STATUS_SUCCESS; }
+static int bt_get_remote_device_property(bt_bdaddr_t *remote_addr, bt_property_type_t type) {
+    return BT_STATUS_SUCCESS;
+}
+static int bt_set_remote_device_property(bt_bdaddr_t *remote_addr,
+                                         const bt_property_t *property) {
+    return BT_STATUS_SUCCESS;
+}
+static int bt_get_remote_services(bt_bdaddr_t *remote_addr) { return BT_STATUS_SUCCESS; }
+static int bt_start_discovery(void) { return BT_STATUS_SUCCESS; }
+static int bt_cancel_discovery(void) { return BT_STATUS_SUCCESS; }
+static int bt_create_bond(const bt_bdaddr_t *bd_addr) { return BT_STATUS_SUCCESS; }
+static int bt_remove_bond(const bt_bdaddr_t *bd_addr) { return BT_STATUS_SUCCESS; }
+static int bt_cancel_bond(const bt_bdaddr_t *bd_addr) { return BT_STATUS_SUCCESS; }
+static int bt_pin_reply(const bt_bdaddr_t *bd_addr, uint8_t accept, uint8_t pin_len,
+                        bt_pin_code_t *pin_code) {
+    return BT_STATUS_SUCCESS;
+}
+static int bt_ssp_reply(const bt_bdaddr_t *bd_addr, bt_ssp_variant_t variant, uint8_t accept,
+                        uint32_t passkey) {
+    return BT_STATUS_SUCCESS;
+}
+
+static const void *bt_get_profile_interface(const char *profile_id) {
+    if (!strcmp(profile_id, BT_PROFILE_GATT_ID)) return &sGattInterface;
+    if (!strcmp(profile_id, BT_PROFILE_IAP2_ID)) return &sIap2Interface;
+    return NULL;
+}
+
+static int bt_config_hci_snoop_log(uint8_t enable) { return BT_STATUS_SUCCESS; }
+
+static const bt_interface_t sBluetoothInterface = {
+    .size = sizeof(bt_interface_t),
+    .init = bt_init,
+    .enable = bt_enable,
+    .disable = bt_disable,
+    .cleanup = bt_cleanup,
+    .get_adapter_properties = bt_get_adapter_properties,
+    .get_adapter_property = bt_get_adapter_property,
+    .set_adapter_property = bt_set_adapter_property,
+    .get_remote_device_properties = bt_get_remote_device_properties,
+    .get_remote_device_property = bt_get_remote_device_property,
+    .set_remote_device_property = bt_set_remote_device_property,
+    .get_remote_services = bt_get_remote_services,
+    .start_discovery = bt_start_discovery,
+    .cancel_discovery = bt_cancel_discovery,
+    .create_bond = bt_create_bond,
+    .remove_bond = bt_remove_bond,
+    .cancel_bond = bt_cancel_bond,
+    .pin_reply = bt_pin_reply,
+    .ssp_reply = bt_ssp_reply,
+    .get_profile_interface = bt_get_profile_interface,
+    .config_hci_snoop_log = bt_config_hci_snoop_log,
+};
+
+/*
+ * Module
+ */
+
+static const bt_interface_t *get_bluetooth_interface(void) {
+    return &sBluetoothInterface;
+}
+
+static int close_bluetooth_stack(struct hw_device_t *device) {
+    free(device);
+    return 0;
+}
+
+static int open_bluetooth_stack(const struct hw_module_t *module, const char *name,
+                                struct hw_device_t **abstraction) {
+    bluetooth_device_t *stack = (bluetooth_device_t *) calloc(1, sizeof(bluetooth_device_t));
+    if (stack == NULL) return -ENOMEM;
+    stack->common.tag = HARDWARE_DEVICE_TAG;
+    stack->common.version = 0;
+    stack->common.module = (struct hw_module_t *) module;
+    stack->common.close = close_bluetooth_stack;
+    stack->get_bluetooth_interface = get_bluetooth_interface;
+    *abstraction = (struct hw_device_t *) stack;
+    return 0;
+}
+
+static struct hw_module_methods_t bt_stack_module_methods = {
+    .open = open_bluetooth_stack,
+};
+
+struct hw_module_t HAL_MODULE_INFO_SYM = {
+    .tag = HARDWARE_MODULE_TAG,
+    .version_major = 1,
+    .version_minor = 0,
+    .id = BT_STACK_TEST_MODULE_ID,
+    .name = "Bluetooth JNI Benchmark Stack",
+    .author = "The Android Open Source Project",
+    .methods = &bt_stack_module_methods
+};
@@ -31,6 +31,128 @@ const bt_interface_t* getBluetoothInterface();
 
 JNIEnv* getCallbackEnv();
 
+bool isCallbackThread();
+
+class String8;
+
+/**
+ * Looks up a Java callback method like GetMethodID and registers its name
+ * and signature so upcalls through CallbackEnv can be attributed to it.
+ */
+jmethodID getCallbackMethodID(JNIEnv *env, jclass clazz, const char *name,
+                              const char *signature);
+
+// One entry of the table of callback methods a profile looks up
+typedef struct {
+    jmethodID *id;
+    const char *name;
+    const char *signature;
+} callback_method_t;
+
+/**
+ * Looks up all methods of a table like getCallbackMethodID, registering
+ * them in one go. Every method that does not exist is logged and left
+ * NULL. Returns false if there was one, with a NoSuchMethodError naming
+ * the first pending, which callers return with to fail class init.
+ */
+bool getCallbackMethodIDs(JNIEnv *env, jclass clazz, const callback_method_t *methods,
+                          int count);
+
+// Appends call counts and latency figures for each upcall method to result
+void dumpCallbackStats(String8 &result);
+
+// Dispatch priorities of queued upcalls, highest first
+enum {
+    CALLBACK_PRIORITY_HIGH = 0,
+    CALLBACK_PRIORITY_NORMAL,
+    CALLBACK_PRIORITY_LOW,
+    CALLBACK_PRIORITY_COUNT
+};
+
+/**
+ * Sets the dispatch priority of the callback methods of clazz, which
+ * otherwise get CALLBACK_PRIORITY_NORMAL. Must be called before they are
+ * looked up with getCallbackMethodID.
+ */
+void setCallbackPriority(JNIEnv *env, jclass clazz, int priority);
+
+/**
+ * Requests asynchronous upcalls from the next time the callback thread
+ * attaches. In that mode CallbackEnv::callVoidMethod queues the call and
+ * a dispatcher thread of its own makes it, highest priority first. Calls
+ * of the same priority keep their order, calls of different priorities
+ * do not. A call whose queue stays full for a bounded time is dropped and
+ * counted in the dump, rather than holding up the stack.
+ */
+void setAsyncCallbacks(bool enable);
+
+// Start and stop the dispatcher, called on the callback thread right after
+// it attached and right before it detaches. Stopping waits a bounded time
+// for the queued calls to be made.
+void startCallbackDispatcher();
+void stopCallbackDispatcher();
+
+/**
+ * Makes an upcall like CallbackEnv::callVoidMethod from any thread attached
+ * to the VM, such as a timer thread or a Java thread in a native method. In
+ * asynchronous mode the call is queued behind the calls already posted, so
+ * it cannot overtake them. Clears any exception the callback left pending.
+ * Returns false if the queue stayed full and the call was dropped.
+ */
+bool callVoidMethodOrdered(JNIEnv *env, const char *caller, jobject obj, jmethodID method,
+                           ...);
+
+// Like callVoidMethodOrdered, but returns only once the call has been made,
+// for callers that reuse what they hand to Java right after
+void callVoidMethodNow(JNIEnv *env, const char *caller, jobject obj, jmethodID method, ...);
+
+#define CALLBACK_ENV_LOCAL_REFS 16
+
+/**
+ * Scoped JNI environment for HAL callbacks.
+ *
+ * Valid only when constructed on the Bluetooth callback thread. While in
+ * scope, local references live in a frame of their own that is popped on
+ * destruction, which also logs and clears any exception a Java callback
+ * left pending. Usage:
+ *
+ *     CallbackEnv sCallbackEnv(__FUNCTION__);
+ *     if (!sCallbackEnv.valid()) return;
+ *     sCallbackEnv.callVoidMethod(mCallbacksObj, method_onFoo, (jint) foo);
+ */
+class CallbackEnv {
+public:
+    CallbackEnv(const char *methodName, jint localRefs = CALLBACK_ENV_LOCAL_REFS);
+    ~CallbackEnv();
+
+    bool valid() const { return mEnv != NULL; }
+    JNIEnv *get() const { return mEnv; }
+    JNIEnv *operator->() const { return mEnv; }
+
+    // Returns a byte[6] holding the address, or NULL if allocation failed.
+    // Recently seen addresses map to the same cached array, which Java
+    // must treat as read-only.
+    jbyteArray newAddressArray(const bt_bdaddr_t *bd_addr);
+
+    // Returns the address as "XX:XX:XX:XX:XX:XX", or NULL if allocation failed
+    jstring newAddressString(const bt_bdaddr_t *bd_addr);
+
+    // Drops the cached address objects, must be called before the callback
+    // thread detaches
+    static void clearAddressCache(JNIEnv *env);
+
+    // Calls the method, or queues the call in asynchronous mode, and records
+    // how long it ran
+    void callVoidMethod(jobject obj, jmethodID method, ...);
+
+private:
+    JNIEnv *mEnv;
+    const char *mName;
+
+    CallbackEnv(const CallbackEnv&);
+    CallbackEnv& operator=(const CallbackEnv&);
+};
+
 int register_com_android_bluetooth_hfp(JNIEnv* env);
 
 int register_com_android_bluetooth_iap2(JNIEnv* env);
@@ -0,0 +1,805 @@
+/*
+ * Copyright (C) 2012 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "BluetoothCallbackEnv"
+
+#include "com_android_bluetooth.h"
+#include "android_runtime/AndroidRuntime.h"
+#include "cutils/atomic.h"
+#include "utils/Condition.h"
+#include "utils/Log.h"
+#include "utils/Mutex.h"
+#include "utils/String8.h"
+#include "utils/Timers.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace android {
+
+// LRU cache of the Java objects handed out for peer addresses. It is only
+// used through a valid CallbackEnv and hence only from the callback thread,
+// so it needs no locking.
+#define ADDRESS_CACHE_SIZE 32
+
+typedef struct {
+    bt_bdaddr_t bd_addr;
+    jbyteArray array;
+    jstring string;
+    uint32_t last_used;
+} address_cache_entry_t;
+
+static address_cache_entry_t sAddressCache[ADDRESS_CACHE_SIZE];
+static int sAddressCacheCount = 0;
+static uint32_t sAddressCacheClock = 0;
+
+// Returns the entry for bd_addr, evicting the least recently used one on a
+// miss. The returned entry may have neither object cached yet.
+static address_cache_entry_t *address_cache_get(JNIEnv *env, const bt_bdaddr_t *bd_addr) {
+    address_cache_entry_t *entry = NULL;
+
+    for (int i = 0; i < sAddressCacheCount; i++) {
+        if (!memcmp(&sAddressCache[i].bd_addr, bd_addr, sizeof(bt_bdaddr_t))) {
+            entry = &sAddressCache[i];
+            break;
+        }
+    }
+
+    if (entry == NULL) {
+        if (sAddressCacheCount < ADDRESS_CACHE_SIZE) {
+            entry = &sAddressCache[sAddressCacheCount++];
+        } else {
+            entry = &sAddressCache[0];
+            for (int i = 1; i < ADDRESS_CACHE_SIZE; i++) {
+                if (sAddressCache[i].last_used < entry->last_used) entry = &sAddressCache[i];
+            }
+            if (entry->array) env->DeleteGlobalRef(entry->array);
+            if (entry->string) env->DeleteGlobalRef(entry->string);
+        }
+        memcpy(&entry->bd_addr, bd_addr, sizeof(bt_bdaddr_t));
+        entry->array = NULL;
+        entry->string = NULL;
+    }
+
+    entry->last_used = ++sAddressCacheClock;
+    return entry;
+}
+
+// Upcall statistics, keyed by jmethodID in an open addressed hash table.
+// Entries are added under sCallbackStatsLock, publishing the method last,
+// and are looked up and counted without it.
+#define CALLBACK_METHOD_TABLE_SIZE 256
+#define CALLBACK_CLASS_TABLE_SIZE 16
+#define CALLBACK_LATENCY_BUCKETS 7
+#define CALLBACK_SLOW_NS 100000000LL
+
+// Upper bounds of all but the last latency bucket
+static const nsecs_t kLatencyBucketLimits[CALLBACK_LATENCY_BUCKETS - 1] = {
+    50000LL, 200000LL, 1000000LL, 5000000LL, 20000000LL, 100000000LL
+};
+static const char *kLatencyBucketNames[CALLBACK_LATENCY_BUCKETS] = {
+    "<50us", "<200us", "<1ms", "<5ms", "<20ms", "<100ms", ">=100ms"
+};
+
+typedef struct {
+    jmethodID volatile method;
+    const char *name;
+    const char *signature;
+    const char *volatile caller;
+    int priority;
+    volatile int32_t calls;
+    volatile int64_t total_time;
+    volatile int64_t max_time;
+    volatile int32_t histogram[CALLBACK_LATENCY_BUCKETS];
+} callback_method_stats_t;
+
+typedef struct {
+    jclass clazz;
+    int priority;
+} callback_class_priority_t;
+
+static Mutex sCallbackStatsLock;
+static callback_method_stats_t sCallbackStats[CALLBACK_METHOD_TABLE_SIZE];
+static callback_class_priority_t sCallbackClasses[CALLBACK_CLASS_TABLE_SIZE];
+static int sCallbackClassCount = 0;
+
+// Returns the entry of method, or NULL if it has none yet
+static callback_method_stats_t *callback_stats_find(jmethodID method) {
+    size_t idx = ((uintptr_t) method >> 3) & (CALLBACK_METHOD_TABLE_SIZE - 1);
+    for (int i = 0; i < CALLBACK_METHOD_TABLE_SIZE; i++) {
+        callback_method_stats_t *stats = &sCallbackStats[idx];
+        jmethodID entry = stats->method;
+        __sync_synchronize();
+        if (entry == method) return stats;
+        if (entry == NULL) return NULL;
+        idx = (idx + 1) & (CALLBACK_METHOD_TABLE_SIZE - 1);
+    }
+    return NULL;
+}
+
+// Returns the entry of method, adding it with the given details if it has
+// none yet, or NULL if the table is full
+static callback_method_stats_t *callback_stats_add_l(jmethodID method, const char *name,
+                                                     const char *signature, int priority) {
+    size_t idx = ((uintptr_t) method >> 3) & (CALLBACK_METHOD_TABLE_SIZE - 1);
+    for (int i = 0; i < CALLBACK_METHOD_TABLE_SIZE; i++) {
+        callback_method_stats_t *stats = &sCallbackStats[idx];
+        if (stats->method == method) return stats;
+        if (stats->method == NULL) {
+            stats->name = name;
+            stats->signature = signature;
+            stats->priority = priority;
+            __sync_synchronize();
+            stats->method = method;
+            return stats;
+        }
+        idx = (idx + 1) & (CALLBACK_METHOD_TABLE_SIZE - 1);
+    }
+    return NULL;
+}
+
+static void callback_counter_max(volatile int64_t *counter, int64_t value) {
+    int64_t old = *counter;
+    while (value > old) {
+        int64_t seen = __sync_val_compare_and_swap(counter, old, value);
+        if (seen == old) break;
+        old = seen;
+    }
+}
+
+static void callback_counter_max(volatile int32_t *counter, int32_t value) {
+    int32_t old = *counter;
+    while (value > old && android_atomic_cmpxchg(old, value, counter) != 0) {
+        old = *counter;
+    }
+}
+
+void setCallbackPriority(JNIEnv *env, jclass clazz, int priority) {
+    if (priority < 0 || priority >= CALLBACK_PRIORITY_COUNT) {
+        ALOGE("%s: Invalid priority %d", __FUNCTION__, priority);
+        return;
+    }
+
+    Mutex::Autolock lock(sCallbackStatsLock);
+    for (int i = 0; i < sCallbackClassCount; i++) {
+        if (env->IsSameObject(sCallbackClasses[i].clazz, clazz)) {
+            sCallbackClasses[i].priority = priority;
+            return;
+        }
+    }
+    if (sCallbackClassCount == CALLBACK_CLASS_TABLE_SIZE) {
+        ALOGW("%s: No room to track callback class priority", __FUNCTION__);
+        return;
+    }
+    sCallbackClasses[sCallbackClassCount].clazz = (jclass) env->NewGlobalRef(clazz);
+    sCallbackClasses[sCallbackClassCount].priority = priority;
+    sCallbackClassCount++;
+}
+
+bool getCallbackMethodIDs(JNIEnv *env, jclass clazz, const callback_method_t *methods,
+                          int count) {
+    const callback_method_t *missing = NULL;
+    for (int i = 0; i < count; i++) {
+        *methods[i].id = env->GetMethodID(clazz, methods[i].name, methods[i].signature);
+        if (*methods[i].id == NULL) {
+            // Keep looking, so that every missing method is logged
+            env->ExceptionClear();
+            ALOGE("%s: No callback %s%s", __FUNCTION__, methods[i].name, methods[i].signature);
+            if (missing == NULL) missing = &methods[i];
+        }
+    }
+
+    Mutex::Autolock lock(sCallbackStatsLock);
+    int priority = CALLBACK_PRIORITY_NORMAL;
+    for (int i = 0; i < sCallbackClassCount; i++) {
+        if (env->IsSameObject(sCallbackClasses[i].clazz, clazz)) {
+            priority = sCallbackClasses[i].priority;
+            break;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (*methods[i].id == NULL) continue;
+        if (callback_stats_add_l(*methods[i].id, methods[i].name, methods[i].signature,
+                                 priority) == NULL) {
+            ALOGW("%s: No room to track callback %s", __FUNCTION__, methods[i].name);
+        }
+    }
+    if (missing != NULL) {
+        jniThrowException(env, "java/lang/NoSuchMethodError", missing->name);
+        return false;
+    }
+    return true;
+}
+
+jmethodID getCallbackMethodID(JNIEnv *env, jclass clazz, const char *name,
+                              const char *signature) {
+    jmethodID method = NULL;
+    callback_method_t entry = { &method, name, signature };
+    return getCallbackMethodIDs(env, clazz, &entry, 1) ? method : NULL;
+}
+
+static void callback_stats_record(jmethodID method, const char *caller, nsecs_t elapsed) {
+    int bucket = 0;
+    while (bucket < CALLBACK_LATENCY_BUCKETS - 1 && elapsed >= kLatencyBucketLimits[bucket]) {
+        bucket++;
+    }
+
+    if (elapsed >= CALLBACK_SLOW_NS) {
+        ALOGW("%s: Java callback took %lld ms", caller, (long long) ns2ms(elapsed));
+    }
+
+    callback_method_stats_t *stats = callback_stats_find(method);
+    if (stats == NULL) {
+        // Not looked up through getCallbackMethodID, only counted
+        Mutex::Autolock lock(sCallbackStatsLock);
+        stats = callback_stats_add_l(method, NULL, NULL, CALLBACK_PRIORITY_NORMAL);
+        if (stats == NULL) return;
+    }
+    if (stats->caller == NULL) {
+        __sync_bool_compare_and_swap(&stats->caller, (const char *) NULL, caller);
+    }
+    android_atomic_inc(&stats->calls);
+    __sync_fetch_and_add(&stats->total_time, (int64_t) elapsed);
+    callback_counter_max(&stats->max_time, elapsed);
+    android_atomic_inc(&stats->histogram[bucket]);
+}
+
+/**
+ * Asynchronous upcalls
+ *
+ * Each priority has a bounded ring with a single consumer, the dispatcher
+ * thread, and any number of producers: the callback thread and the other
+ * threads making upcalls. Producers claim a slot by advancing the tail
+ * with a compare and swap, fill it in and publish it through the slot's
+ * round counter, so posting takes no lock. Head and tail are free running
+ * counters and each slot counts the rounds it was filled and emptied. The
+ * dispatch lock and conditions are used only when the dispatcher runs out
+ * of calls or a producer runs out of room.
+ */
+#define CALLBACK_QUEUE_SIZE 128
+#define CALLBACK_QUEUE_SHIFT 7
+#define CALLBACK_MAX_ARGS 16
+// Longest a producer waits for queued calls to be made before it makes a
+// call that cannot be queued, and the callback thread waits for the
+// dispatcher to exit
+#define CALLBACK_DRAIN_TIMEOUT_MS 1000
+// Longest a producer waits for room in a full ring before it drops the call
+#define CALLBACK_POST_TIMEOUT_MS 200
+
+static const char *kPriorityNames[CALLBACK_PRIORITY_COUNT] = {
+    "high", "normal", "low"
+};
+
+typedef struct {
+    jobject obj;
+    jmethodID method;
+    const char *caller;
+    nsecs_t posted;
+    uint32_t global_refs;   // bit n set if args[n] is a global reference
+    jvalue args[CALLBACK_MAX_ARGS];
+} callback_event_t;
+
+typedef struct {
+    callback_event_t event;
+    volatile int32_t filled;    // rounds the slot was published in
+    volatile int32_t emptied;   // rounds the slot was dispatched in
+} callback_slot_t;
+
+typedef struct {
+    callback_slot_t slots[CALLBACK_QUEUE_SIZE];
+    volatile int32_t head;      // written by the dispatcher only
+    volatile int32_t tail;      // claimed by producers
+    uint32_t dispatched;
+    volatile int32_t max_depth;
+    volatile int32_t blocked;
+    volatile int32_t dropped;
+    nsecs_t max_delay;
+} callback_queue_t;
+
+static callback_queue_t sCallbackQueues[CALLBACK_PRIORITY_COUNT];
+
+static Mutex sDispatchLock;
+static Condition sDispatchCondition;    // dispatcher waits for calls
+static Condition sSpaceCondition;       // producers wait for room or a drain
+static Condition sExitCondition;        // callback thread waits for exit
+static volatile int32_t sDispatcherIdle = 0;
+static volatile int32_t sProducersBlocked = 0;
+static bool sDispatcherStopping = false;
+static bool sDispatcherActive = false;
+static JNIEnv *volatile sDispatcherEnv = NULL;
+
+static volatile bool sAsyncCallbacksRequested = false;
+
+// Serializes switching between synchronous and asynchronous mode
+static Mutex sModeLock;
+static volatile int32_t sAsyncCallbacks = 0;
+// Producers between checking sAsyncCallbacks and publishing their call
+static volatile int32_t sPosting = 0;
+
+enum {
+    CALLBACK_POST_QUEUED,
+    CALLBACK_POST_DROPPED,
+    CALLBACK_POST_DIRECT
+};
+
+// Round of the ring position pos, wrapping along with it
+static int32_t callback_queue_round(int32_t pos) {
+    return (int32_t) ((uint32_t) pos >> CALLBACK_QUEUE_SHIFT);
+}
+
+static int32_t callback_queue_depth(callback_queue_t *queue) {
+    return android_atomic_acquire_load(&queue->tail) - android_atomic_acquire_load(&queue->head);
+}
+
+static bool callback_queues_empty() {
+    for (int i = 0; i < CALLBACK_PRIORITY_COUNT; i++) {
+        if (callback_queue_depth(&sCallbackQueues[i]) > 0) return false;
+    }
+    return true;
+}
+
+// Returns the slot at the head if its call has been published, else NULL
+static callback_slot_t *callback_queue_ready(callback_queue_t *queue) {
+    int32_t head = queue->head;
+    callback_slot_t *slot = &queue->slots[head & (CALLBACK_QUEUE_SIZE - 1)];
+    if (android_atomic_acquire_load(&slot->filled) !=
+        callback_queue_round(head + CALLBACK_QUEUE_SIZE)) {
+        return NULL;
+    }
+    return slot;
+}
+
+static void callback_event_release(JNIEnv *env, callback_event_t *event, int num_args) {
+    for (int n = 0; n < num_args; n++) {
+        if (event->global_refs & (1 << n)) env->DeleteGlobalRef(event->args[n].l);
+    }
+    event->global_refs = 0;
+}
+
+// Copies the arguments into the event as described by the method signature.
+// Objects are promoted to global references, as the caller's local frame is
+// gone by the time the call is made.
+static bool callback_event_marshal(JNIEnv *env, callback_event_t *event,
+                                   const char *signature, va_list args) {
+    const char *p = signature + 1;
+    int n = 0;
+
+    event->global_refs = 0;
+    for (; *p != ')'; p++, n++) {
+        if (n == CALLBACK_MAX_ARGS) {
+            callback_event_release(env, event, n);
+            return false;
+        }
+        switch (*p) {
+            case 'Z': event->args[n].z = (jboolean) va_arg(args, int); break;
+            case 'B': event->args[n].b = (jbyte) va_arg(args, int); break;
+            case 'C': event->args[n].c = (jchar) va_arg(args, int); break;
+            case 'S': event->args[n].s = (jshort) va_arg(args, int); break;
+            case 'I': event->args[n].i = va_arg(args, jint); break;
+            case 'J': event->args[n].j = va_arg(args, jlong); break;
+            case 'F': event->args[n].f = (jfloat) va_arg(args, double); break;
+            case 'D': event->args[n].d = va_arg(args, double); break;
+            case 'L':
+            case '[': {
+                while (*p == '[') p++;
+                if (*p == 'L') p = strchr(p, ';');
+                if (p == NULL) {
+                    callback_event_release(env, event, n);
+                    return false;
+                }
+                jobject ref = va_arg(args, jobject);
+                event->args[n].l = ref ? env->NewGlobalRef(ref) : NULL;
+                if (event->args[n].l) event->global_refs |= 1 << n;
+                break;
+            }
+            default:
+                callback_event_release(env, event, n);
+                return false;
+        }
+    }
+    return true;
+}
+
+// Claims the slot at the tail, returns NULL if the ring is full
+static callback_slot_t *callback_queue_claim(callback_queue_t *queue, int32_t *pos) {
+    for (;;) {
+        int32_t tail = android_atomic_acquire_load(&queue->tail);
+        callback_slot_t *slot = &queue->slots[tail & (CALLBACK_QUEUE_SIZE - 1)];
+        if (android_atomic_acquire_load(&slot->emptied) != callback_queue_round(tail)) {
+            return NULL;
+        }
+        if (android_atomic_cmpxchg(tail, tail + 1, &queue->tail) == 0) {
+            *pos = tail;
+            return slot;
+        }
+    }
+}
+
+// Waits, for at most CALLBACK_POST_TIMEOUT_MS, until a slot can be claimed
+static callback_slot_t *callback_queue_wait_for_space(callback_queue_t *queue, int32_t *pos) {
+    android_atomic_inc(&queue->blocked);
+    Mutex::Autolock lock(sDispatchLock);
+    nsecs_t deadline = systemTime(SYSTEM_TIME_MONOTONIC) + ms2ns(CALLBACK_POST_TIMEOUT_MS);
+    callback_slot_t *slot;
+    android_atomic_inc(&sProducersBlocked);
+    while ((slot = callback_queue_claim(queue, pos)) == NULL) {
+        nsecs_t left = deadline - systemTime(SYSTEM_TIME_MONOTONIC);
+        if (left <= 0) break;
+        sSpaceCondition.waitRelative(sDispatchLock, left);
+    }
+    android_atomic_dec(&sProducersBlocked);
+    return slot;
+}
+
+// Waits until the dispatcher has made all queued calls, or gives up after
+// CALLBACK_DRAIN_TIMEOUT_MS
+static void callback_queues_drain(const char *caller) {
+    Mutex::Autolock lock(sDispatchLock);
+    nsecs_t deadline = systemTime(SYSTEM_TIME_MONOTONIC) + ms2ns(CALLBACK_DRAIN_TIMEOUT_MS);
+    android_atomic_inc(&sProducersBlocked);
+    while (!callback_queues_empty()) {
+        nsecs_t left = deadline - systemTime(SYSTEM_TIME_MONOTONIC);
+        if (left <= 0) {
+            ALOGW("%s: Queued callbacks not drained, calling out of order", caller);
+            break;
+        }
+        sSpaceCondition.waitRelative(sDispatchLock, left);
+    }
+    android_atomic_dec(&sProducersBlocked);
+}
+
+// Queues the call, or drops it if its ring stayed full. Returns
+// CALLBACK_POST_DIRECT if it has to be made synchronously instead.
+static int callback_queue_post(JNIEnv *env, const char *caller, jobject obj,
+                               jmethodID method, va_list args) {
+    callback_method_stats_t *stats = callback_stats_find(method);
+    // Not looked up through getCallbackMethodID
+    if (stats == NULL || stats->signature == NULL) return CALLBACK_POST_DIRECT;
+
+    callback_event_t event;
+    if (!callback_event_marshal(env, &event, stats->signature, args)) {
+        ALOGE("%s: Cannot queue call with signature %s", caller, stats->signature);
+        return CALLBACK_POST_DIRECT;
+    }
+
+    callback_queue_t *queue = &sCallbackQueues[stats->priority];
+    int32_t pos;
+    callback_slot_t *slot = callback_queue_claim(queue, &pos);
+    if (slot == NULL) {
+        ALOGW("%s: %s priority callback queue full, waiting", caller,
+              kPriorityNames[stats->priority]);
+        slot = callback_queue_wait_for_space(queue, &pos);
+    }
+    if (slot == NULL) {
+        ALOGE("%s: %s priority callback queue still full, dropping call", caller,
+              kPriorityNames[stats->priority]);
+        android_atomic_inc(&queue->dropped);
+        callback_event_release(env, &event, CALLBACK_MAX_ARGS);
+        return CALLBACK_POST_DROPPED;
+    }
+
+    event.obj = env->NewGlobalRef(obj);
+    event.method = method;
+    event.caller = caller;
+    event.posted = systemTime(SYSTEM_TIME_MONOTONIC);
+    slot->event = event;
+    android_atomic_release_store(callback_queue_round(pos + CALLBACK_QUEUE_SIZE), &slot->filled);
+    callback_counter_max(&queue->max_depth, pos + 1 - android_atomic_acquire_load(&queue->head));
+
+    __sync_synchronize();
+    if (sDispatcherIdle) {
+        Mutex::Autolock lock(sDispatchLock);
+        sDispatchCondition.signal();
+    }
+    return CALLBACK_POST_QUEUED;
+}
+
+static void callback_event_dispatch(JNIEnv *env, callback_queue_t *queue,
+                                    callback_event_t *event) {
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    env->CallVoidMethodA(event->obj, event->method, event->args);
+    nsecs_t elapsed = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+    checkAndClearExceptionFromCallback(env, event->caller);
+    callback_stats_record(event->method, event->caller, elapsed);
+
+    callback_event_release(env, event, CALLBACK_MAX_ARGS);
+    env->DeleteGlobalRef(event->obj);
+    event->obj = NULL;
+
+    queue->dispatched++;
+    if (start - event->posted > queue->max_delay) queue->max_delay = start - event->posted;
+}
+
+// Returns the highest priority queue with a published call at its head
+static callback_queue_t *callback_queues_next() {
+    for (int i = 0; i < CALLBACK_PRIORITY_COUNT; i++) {
+        if (callback_queue_ready(&sCallbackQueues[i]) != NULL) return &sCallbackQueues[i];
+    }
+    return NULL;
+}
+
+// Waits until calls are published, returns false once stopped with all
+// queues drained
+static bool callback_dispatcher_wait() {
+    Mutex::Autolock lock(sDispatchLock);
+    bool running = true;
+
+    sDispatcherIdle = 1;
+    __sync_synchronize();
+    if (callback_queues_next() == NULL) {
+        if (sDispatcherStopping && callback_queues_empty()) {
+            // Decided under the lock, so a restart cannot miss the exit
+            running = false;
+            sDispatcherActive = false;
+            sDispatcherEnv = NULL;
+            sExitCondition.signal();
+        } else {
+            sDispatchCondition.wait(sDispatchLock);
+        }
+    }
+    sDispatcherIdle = 0;
+    return running;
+}
+
+static void callback_dispatcher_thread(void *arg) {
+    JNIEnv *env = AndroidRuntime::getJNIEnv();
+    sDispatcherEnv = env;
+
+    for (;;) {
+        callback_queue_t *queue = callback_queues_next();
+        if (queue == NULL) {
+            if (!callback_dispatcher_wait()) break;
+            continue;
+        }
+
+        int32_t head = queue->head;
+        callback_slot_t *slot = &queue->slots[head & (CALLBACK_QUEUE_SIZE - 1)];
+        callback_event_dispatch(env, queue, &slot->event);
+        android_atomic_release_store(callback_queue_round(head + CALLBACK_QUEUE_SIZE),
+                                     &slot->emptied);
+        android_atomic_release_store(head + 1, &queue->head);
+
+        __sync_synchronize();
+        if (sProducersBlocked) {
+            Mutex::Autolock lock(sDispatchLock);
+            sSpaceCondition.broadcast();
+        }
+    }
+}
+
+void setAsyncCallbacks(bool enable) {
+    sAsyncCallbacksRequested = enable;
+}
+
+void startCallbackDispatcher() {
+    Mutex::Autolock modeLock(sModeLock);
+    if (!sAsyncCallbacksRequested || sAsyncCallbacks) return;
+
+    {
+        Mutex::Autolock lock(sDispatchLock);
+        sDispatcherStopping = false;
+        // A dispatcher that did not drain in time on the last stop carries on
+        if (sDispatcherActive) {
+            sDispatchCondition.signal();
+            android_atomic_release_store(1, &sAsyncCallbacks);
+            return;
+        }
+        sDispatcherActive = true;
+    }
+    if (AndroidRuntime::createJavaThread("BT Service Dispatcher Thread",
+                                         callback_dispatcher_thread, NULL) == 0) {
+        ALOGE("%s: Failed to create dispatcher thread, calling back synchronously",
+              __FUNCTION__);
+        Mutex::Autolock lock(sDispatchLock);
+        sDispatcherActive = false;
+        return;
+    }
+    android_atomic_release_store(1, &sAsyncCallbacks);
+}
+
+void stopCallbackDispatcher() {
+    {
+        Mutex::Autolock modeLock(sModeLock);
+        if (!sAsyncCallbacks) return;
+        android_atomic_release_store(0, &sAsyncCallbacks);
+    }
+    // Let producers that saw asynchronous mode publish their calls, each
+    // one waits a bounded time at most
+    while (android_atomic_acquire_load(&sPosting) > 0) {
+        usleep(1000);
+    }
+
+    // Bounded, a Java handler still queued may be waiting on the stack
+    Mutex::Autolock lock(sDispatchLock);
+    sDispatcherStopping = true;
+    sDispatchCondition.signal();
+    nsecs_t deadline = systemTime(SYSTEM_TIME_MONOTONIC) + ms2ns(CALLBACK_DRAIN_TIMEOUT_MS);
+    while (sDispatcherActive) {
+        nsecs_t left = deadline - systemTime(SYSTEM_TIME_MONOTONIC);
+        if (left <= 0) {
+            ALOGW("%s: Dispatcher still busy, leaving it to drain its queues", __FUNCTION__);
+            break;
+        }
+        sExitCondition.waitRelative(sDispatchLock, left);
+    }
+}
+
+void dumpCallbackStats(String8 &result) {
+    Mutex::Autolock lock(sCallbackStatsLock);
+
+    result.append("Bluetooth callback statistics:\n");
+    for (int i = 0; i < CALLBACK_METHOD_TABLE_SIZE; i++) {
+        const callback_method_stats_t *stats = &sCallbackStats[i];
+        if (stats->calls == 0) continue;
+
+        result.appendFormat("  %s%s from %s: calls=%u avg=%lldus max=%lldus\n   ",
+                            stats->name ? stats->name : "<unregistered>",
+                            stats->signature ? stats->signature : "",
+                            stats->caller, (uint32_t) stats->calls,
+                            (long long) ns2us(stats->total_time / stats->calls),
+                            (long long) ns2us(stats->max_time));
+        for (int b = 0; b < CALLBACK_LATENCY_BUCKETS; b++) {
+            result.appendFormat(" %s:%u", kLatencyBucketNames[b],
+                                (uint32_t) stats->histogram[b]);
+        }
+        result.append("\n");
+    }
+
+    result.appendFormat("Asynchronous callbacks: %s\n", sAsyncCallbacksRequested ?
+                        "enabled" : "disabled");
+    for (int i = 0; i < CALLBACK_PRIORITY_COUNT; i++) {
+        const callback_queue_t *queue = &sCallbackQueues[i];
+        result.appendFormat("  %s: dispatched=%u max_depth=%d blocked=%d dropped=%d"
+                            " max_delay=%lldus\n", kPriorityNames[i], queue->dispatched,
+                            queue->max_depth, queue->blocked, queue->dropped,
+                            (long long) ns2us(queue->max_delay));
+    }
+}
+
+CallbackEnv::CallbackEnv(const char *methodName, jint localRefs) :
+        mEnv(NULL),
+        mName(methodName) {
+    if (!isCallbackThread()) {
+        ALOGE("Callback: '%s' is not called on the correct thread", methodName);
+        return;
+    }
+
+    JNIEnv *env = getCallbackEnv();
+    if (env->PushLocalFrame(localRefs) != 0) {
+        ALOGE("%s: Failed to allocate %d local references", methodName, localRefs);
+        checkAndClearExceptionFromCallback(env, methodName);
+        return;
+    }
+    mEnv = env;
+}
+
+CallbackEnv::~CallbackEnv() {
+    if (mEnv == NULL) return;
+    checkAndClearExceptionFromCallback(mEnv, mName);
+    mEnv->PopLocalFrame(NULL);
+}
+
+jbyteArray CallbackEnv::newAddressArray(const bt_bdaddr_t *bd_addr) {
+    address_cache_entry_t *entry = address_cache_get(mEnv, bd_addr);
+    if (entry->array == NULL) {
+        jbyteArray addr = mEnv->NewByteArray(sizeof(bt_bdaddr_t));
+        if (addr == NULL) {
+            ALOGE("%s: Failed to allocate address array", mName);
+            return NULL;
+        }
+        mEnv->SetByteArrayRegion(addr, 0, sizeof(bt_bdaddr_t), (const jbyte *) bd_addr);
+        entry->array = (jbyteArray) mEnv->NewGlobalRef(addr);
+        if (entry->array == NULL) return addr;
+        mEnv->DeleteLocalRef(addr);
+    }
+    // Callers may delete what they get back, so hand out a local reference
+    return (jbyteArray) mEnv->NewLocalRef(entry->array);
+}
+
+jstring CallbackEnv::newAddressString(const bt_bdaddr_t *bd_addr) {
+    address_cache_entry_t *entry = address_cache_get(mEnv, bd_addr);
+    if (entry->string == NULL) {
+        char c_address[18];
+        snprintf(c_address, sizeof(c_address), "%02X:%02X:%02X:%02X:%02X:%02X",
+                 bd_addr->address[0], bd_addr->address[1], bd_addr->address[2],
+                 bd_addr->address[3], bd_addr->address[4], bd_addr->address[5]);
+
+        jstring address = mEnv->NewStringUTF(c_address);
+        if (address == NULL) {
+            ALOGE("%s: Failed to allocate address string", mName);
+            return NULL;
+        }
+        entry->string = (jstring) mEnv->NewGlobalRef(address);
+        if (entry->string == NULL) return address;
+        mEnv->DeleteLocalRef(address);
+    }
+    return (jstring) mEnv->NewLocalRef(entry->string);
+}
+
+void CallbackEnv::clearAddressCache(JNIEnv *env) {
+    for (int i = 0; i < sAddressCacheCount; i++) {
+        if (sAddressCache[i].array) env->DeleteGlobalRef(sAddressCache[i].array);
+        if (sAddressCache[i].string) env->DeleteGlobalRef(sAddressCache[i].string);
+    }
+    memset(sAddressCache, 0, sizeof(sAddressCache));
+    sAddressCacheCount = 0;
+    sAddressCacheClock = 0;
+}
+
+/**
+ * Queues the call in asynchronous mode unless wait is set. A call that is
+ * not queued is made right away, in asynchronous mode only once the calls
+ * queued before it have been made. Calls back into Java from the dispatcher
+ * itself are always made right away: the queued calls only run once they
+ * return, so the dispatcher can neither wait for them nor for room.
+ */
+// Returns false if the call was dropped
+static bool callback_upcall(JNIEnv *env, const char *caller, bool wait, jobject obj,
+                            jmethodID method, va_list args) {
+    if (env != sDispatcherEnv) {
+        android_atomic_inc(&sPosting);
+        if (android_atomic_acquire_load(&sAsyncCallbacks)) {
+            if (!wait) {
+                va_list post_args;
+                va_copy(post_args, args);
+                int posted = callback_queue_post(env, caller, obj, method, post_args);
+                va_end(post_args);
+                if (posted != CALLBACK_POST_DIRECT) {
+                    android_atomic_dec(&sPosting);
+                    return posted == CALLBACK_POST_QUEUED;
+                }
+            }
+            callback_queues_drain(caller);
+        }
+        android_atomic_dec(&sPosting);
+    }
+
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    env->CallVoidMethodV(obj, method, args);
+    callback_stats_record(method, caller, systemTime(SYSTEM_TIME_MONOTONIC) - start);
+    return true;
+}
+
+bool callVoidMethodOrdered(JNIEnv *env, const char *caller, jobject obj, jmethodID method,
+                           ...) {
+    va_list args;
+    va_start(args, method);
+    bool made = callback_upcall(env, caller, false, obj, method, args);
+    va_end(args);
+    checkAndClearExceptionFromCallback(env, caller);
+    return made;
+}
+
+void callVoidMethodNow(JNIEnv *env, const char *caller, jobject obj, jmethodID method, ...) {
+    va_list args;
+    va_start(args, method);
+    callback_upcall(env, caller, true, obj, method, args);
+    va_end(args);
+    checkAndClearExceptionFromCallback(env, caller);
+}
+
+void CallbackEnv::callVoidMethod(jobject obj, jmethodID method, ...) {
+    va_list args;
+    va_start(args, method);
+    callback_upcall(mEnv, mName, false, obj, method, args);
+    va_end(args);
+}
+
+}
@@ -31,42 +31,22 @@ static jmethodID method_onAudioStateChanged;
 
 static const btav_interface_t *sBluetoothA2dpInterface = NULL;
 static jobject mCallbacksObj = NULL;
-static JNIEnv *sCallbackEnv = NULL;
-
-static bool checkCallbackThread() {
-    // Always fetch the latest callbackEnv from AdapterService.
-    // Caching this could cause this sCallbackEnv to go out-of-sync
-    // with the AdapterService's ENV if an ASSOCIATE/DISASSOCIATE event
-    // is received
-    //if (sCallbackEnv == NULL) {
-    sCallbackEnv = getCallbackEnv();
-    //}
-
-    JNIEnv* env = AndroidRuntime::getJNIEnv();
-    if (sCallbackEnv != env || sCallbackEnv == NULL) return false;
-    return true;
-}
 
 static void bta2dp_connection_state_callback(btav_connection_state_t state, bt_bdaddr_t* bd_addr) {
     jbyteArray addr;
 
     ALOGI("%s", __FUNCTION__);
 
-    if (!checkCallbackThread()) {                                       \
-        ALOGE("Callback: '%s' is not called on the correct thread", __FUNCTION__); \
-        return;                                                         \
-    }
-    addr = sCallbackEnv->NewByteArray(sizeof(bt_bdaddr_t));
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    addr = sCallbackEnv.newAddressArray(bd_addr);
     if (!addr) {
         ALOGE("Fail to new jbyteArray bd addr for connection state");
-        checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
         return;
     }
 
-    sCallbackEnv->SetByteArrayRegion(addr, 0, sizeof(bt_bdaddr_t), (jbyte*) bd_addr);
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onConnectionStateChanged, (jint) state,
-                                 addr);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onConnectionStateChanged, (jint) state,
+                                addr);
     sCallbackEnv->DeleteLocalRef(addr);
 }
 
@@ -75,21 +55,16 @@ static void bta2dp_audio_state_callback(btav_audio_state_t state, bt_bdaddr_t* b
 
     ALOGI("%s", __FUNCTION__);
 
-    if (!checkCallbackThread()) {                                       \
-        ALOGE("Callback: '%s' is not called on the correct thread", __FUNCTION__); \
-        return;                                                         \
-    }
-    addr = sCallbackEnv->NewByteArray(sizeof(bt_bdaddr_t));
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    addr = sCallbackEnv.newAddressArray(bd_addr);
     if (!addr) {
         ALOGE("Fail to new jbyteArray bd addr for connection state");
-        checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
         return;
     }
 
-    sCallbackEnv->SetByteArrayRegion(addr, 0, sizeof(bt_bdaddr_t), (jbyte*) bd_addr);
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onAudioStateChanged, (jint) state,
-                                 addr);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onAudioStateChanged, (jint) state,
+                                addr);
     sCallbackEnv->DeleteLocalRef(addr);
 }
 
@@ -99,16 +74,21 @@ static btav_callbacks_t sBluetoothA2dpCallbacks = {
     bta2dp_audio_state_callback
 };
 
+static const callback_method_t sCallbackMethods[] = {
+    {&method_onConnectionStateChanged, "onConnectionStateChanged", "(I[B)V"},
+    {&method_onAudioStateChanged, "onAudioStateChanged", "(I[B)V"},
+};
+
 static void classInitNative(JNIEnv* env, jclass clazz) {
     int err;
     const bt_interface_t* btInf;
     bt_status_t status;
 
-    method_onConnectionStateChanged =
-        env->GetMethodID(clazz, "onConnectionStateChanged", "(I[B)V");
-
-    method_onAudioStateChanged =
-        env->GetMethodID(clazz, "onAudioStateChanged", "(I[B)V");
+    setCallbackPriority(env, clazz, CALLBACK_PRIORITY_HIGH);
+    if (!getCallbackMethodIDs(env, clazz, sCallbackMethods, NELEM(sCallbackMethods))) {
+        ALOGE("%s: Missing callback methods", __FUNCTION__);
+        return;
+    }
     /*
     if ( (btInf = getBluetoothInterface()) == NULL) {
         ALOGE("Bluetooth module is not loaded");
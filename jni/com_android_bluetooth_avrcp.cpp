@@ -22,6 +22,10 @@
 #include "hardware/bt_rc.h"
 #include "utils/Log.h"
 #include "android_runtime/AndroidRuntime.h"
+#include "utils/Condition.h"
+#include "utils/Mutex.h"
+#include "utils/SystemClock.h"
+#include "utils/Timers.h"
 
 #include <string.h>
 
@@ -32,53 +36,440 @@ static jmethodID method_getElementAttr;
 static jmethodID method_registerNotification;
 static jmethodID method_volumeChangeCallback;
 static jmethodID method_handlePassthroughCmd;
+static jmethodID method_handlePassthroughCmds;
 
 static const btrc_interface_t *sBluetoothAvrcpInterface = NULL;
 static jobject mCallbacksObj = NULL;
-static JNIEnv *sCallbackEnv = NULL;
 
-static bool checkCallbackThread() {
-    // Always fetch the latest callbackEnv from AdapterService.
-    // Caching this could cause this sCallbackEnv to go out-of-sync
-    // with the AdapterService's ENV if an ASSOCIATE/DISASSOCIATE event
-    // is received
-    sCallbackEnv = getCallbackEnv();
+/**
+ * Element attributes of the current track, indexed by attribute id - 1.
+ * Once Java has pushed them with setMetadataNative, element attribute
+ * requests are answered from here on the callback thread without an
+ * upcall. Attributes Java did not push are answered with empty text.
+ */
+static Mutex sMetadataLock;
+static bool sMetadataValid = false;
+static btrc_element_attr_val_t sMetadata[BTRC_MAX_ELEM_ATTR_SIZE];
+
+// Copies a Java string into an attribute text, truncated to fit. Returns
+// false if the string could not be read.
+static bool copy_attr_text(JNIEnv *env, jstring text, uint8_t *dest) {
+    jsize len = env->GetStringUTFLength(text);
+    if (len < BTRC_MAX_ATTR_STR_LEN) {
+        env->GetStringUTFRegion(text, 0, env->GetStringLength(text), (char *) dest);
+        dest[len] = 0;
+        return true;
+    }
+
+    const char *textStr = env->GetStringUTFChars(text, NULL);
+    if (!textStr) {
+        ALOGE("copy_attr_text: GetStringUTFChars return NULL");
+        return false;
+    }
+    ALOGE("copy_attr_text: string length exceed maximum");
+    strncpy((char *) dest, textStr, BTRC_MAX_ATTR_STR_LEN-1);
+    dest[BTRC_MAX_ATTR_STR_LEN-1] = 0;
+    env->ReleaseStringUTFChars(text, textStr);
+    return true;
+}
+
+// Returns false if the request has to go up to Java
+static bool metadata_element_attr_rsp(uint8_t num_attr, btrc_media_attr_t *p_attrs) {
+    btrc_element_attr_val_t attrs[BTRC_MAX_ELEM_ATTR_SIZE];
+
+    if (num_attr > BTRC_MAX_ELEM_ATTR_SIZE) return false;
+    {
+        Mutex::Autolock lock(sMetadataLock);
+        if (!sMetadataValid) return false;
+
+        for (int i = 0; i < num_attr; ++i) {
+            unsigned int id = p_attrs[i];
+            attrs[i].attr_id = id;
+            if (id >= 1 && id <= BTRC_MAX_ELEM_ATTR_SIZE) {
+                strcpy((char *) attrs[i].text, (const char *) sMetadata[id - 1].text);
+            } else {
+                attrs[i].text[0] = 0;
+            }
+        }
+    }
+
+    bt_status_t status;
+    if (!sBluetoothAvrcpInterface) return true;
+    if ((status = sBluetoothAvrcpInterface->get_element_attr_rsp(num_attr, attrs)) !=
+        BT_STATUS_SUCCESS) {
+        ALOGE("Failed get_element_attr_rsp, status: %d", status);
+    }
+    return true;
+}
+
+/**
+ * Play position scheduler
+ *
+ * Java hands over a playback anchor, the position at a given
+ * elapsedRealtime() and the speed it advances at, whenever the play state,
+ * position or track changes. From the first anchor on, play status
+ * requests are answered from it on the callback thread, and registrations
+ * for play position changes are served by a thread of our own that sends
+ * the changed notification once the registered interval has played out,
+ * without waking Java up. An anchor that changes the play status, jumps
+ * out of the registered interval or starts a new track sends it right
+ * away.
+ */
+
+#define PLAY_POS_UNKNOWN 0xFFFFFFFF
+
+static Mutex sSchedLock;
+static Condition sSchedCond;
+static Condition sSchedExitCond;
+static bool sSchedRunning = false;
+static bool sSchedQuit = false;
+
+static bool sAnchorValid = false;
+static int sAnchorPlayStatus;
+static uint32_t sAnchorSongLen;
+static int64_t sAnchorPos;          // ms, negative if unknown
+static int64_t sAnchorTime;         // elapsedRealtime() ms
+static float sAnchorSpeed;
+
+static bool sPlayPosRegistered = false;
+static int64_t sPlayPosPrev;
+static int64_t sPlayPosNext;
+static int64_t sPlayPosDeadline = 0;    // elapsedRealtime() ms, 0 if not armed
+
+static int64_t play_pos_now_l(int64_t now) {
+    if (sAnchorPos < 0) return -1;
+    int64_t pos = sAnchorPos + (int64_t) ((now - sAnchorTime) * sAnchorSpeed);
+    if (pos < 0) pos = 0;
+    if (sAnchorSongLen != 0 && pos > sAnchorSongLen) pos = sAnchorSongLen;
+    return pos;
+}
+
+// Arms the deadline for the end of the registered interval, if it will be reached
+static void play_pos_arm_l(int64_t now) {
+    int64_t pos = play_pos_now_l(now);
+    if (pos < 0 || sAnchorSpeed == 0) {
+        sPlayPosDeadline = 0;
+    } else {
+        int64_t target = sAnchorSpeed > 0 ? sPlayPosNext : sPlayPosPrev;
+        int64_t delay = (int64_t) ((target - pos) / sAnchorSpeed);
+        sPlayPosDeadline = now + (delay > 0 ? delay : 0);
+    }
+    sSchedCond.signal();
+}
+
+static void play_pos_send(btrc_notification_type_t type, int64_t pos) {
+    btrc_register_notification_t param;
+    bt_status_t status;
+
+    if (!sBluetoothAvrcpInterface) return;
+    param.song_pos = pos < 0 ? PLAY_POS_UNKNOWN : (uint32_t) pos;
+    if ((status = sBluetoothAvrcpInterface->register_notification_rsp(BTRC_EVT_PLAY_POS_CHANGED,
+                  type, &param)) != BT_STATUS_SUCCESS) {
+        ALOGE("Failed register_notification_rsp play position, status: %d", status);
+    }
+}
+
+// Returns false if the request has to go up to Java
+static bool play_pos_play_status_rsp() {
+    int play_status;
+    uint32_t song_len;
+    int64_t pos;
+    {
+        Mutex::Autolock lock(sSchedLock);
+        if (!sAnchorValid) return false;
+        play_status = sAnchorPlayStatus;
+        song_len = sAnchorSongLen;
+        pos = play_pos_now_l(elapsedRealtime());
+    }
+
+    bt_status_t status;
+    if (!sBluetoothAvrcpInterface) return true;
+    if ((status = sBluetoothAvrcpInterface->get_play_status_rsp((btrc_play_status_t) play_status,
+                  song_len, pos < 0 ? PLAY_POS_UNKNOWN : (uint32_t) pos)) != BT_STATUS_SUCCESS) {
+        ALOGE("Failed get_play_status_rsp, status: %d", status);
+    }
+    return true;
+}
 
-    JNIEnv* env = AndroidRuntime::getJNIEnv();
-    if (sCallbackEnv != env || sCallbackEnv == NULL) return false;
+// Returns false if the registration has to go up to Java
+static bool play_pos_register(uint32_t interval_s) {
+    int64_t pos;
+    {
+        Mutex::Autolock lock(sSchedLock);
+        if (!sAnchorValid || !sSchedRunning) return false;
+
+        int64_t now = elapsedRealtime();
+        int64_t interval = (int64_t) interval_s * 1000;
+        pos = play_pos_now_l(now);
+        sPlayPosRegistered = true;
+        sPlayPosNext = pos + interval;
+        sPlayPosPrev = pos - interval;
+        play_pos_arm_l(now);
+    }
+    play_pos_send(BTRC_NOTIFICATION_TYPE_INTERIM, pos);
     return true;
 }
 
+/**
+ * Volume and passthrough coalescing
+ *
+ * The first volume change notification or passthrough command of a burst
+ * goes up to Java at once and opens a window of AVRCP_COALESCE_MS. Volume
+ * changes arriving within the window collapse into the latest one, and
+ * passthrough commands are collected in order, which keeps press/release
+ * pairs together. Both are delivered with one upcall when the window
+ * closes, which opens another if anything was delivered. Responses to our
+ * own volume commands are never held back. Whether an event is held back
+ * and its upcall are done under sUpcallLock, on the callback thread as on
+ * the scheduler thread, so upcalls reach Java in the order of the events.
+ */
+
+#define AVRCP_COALESCE_MS 80
+#define PASSTHROUGH_MAX_BATCH 16
+
+// AVRC response codes, from avrc_defs.h
+#define AVRC_RSP_ACCEPT 9
+#define AVRC_RSP_REJ 10
+#define AVRC_RSP_CHANGED 13
+#define AVRC_RSP_INTERIM 15
+
+// Taken before sSchedLock
+static Mutex sUpcallLock;
+
+static int sRemoteVolume = -1;          // as last reported by the remote
+static int64_t sVolumeDeadline = 0;
+static bool sVolumePending = false;
+static uint8_t sVolumePendingValue;
+
+static int64_t sPassthroughDeadline = 0;
+static int sPassthroughCount = 0;
+static jint sPassthroughIds[PASSTHROUGH_MAX_BATCH];
+static jint sPassthroughStates[PASSTHROUGH_MAX_BATCH];
+
+static void passthrough_deliver(JNIEnv *env, int count, const jint *ids, const jint *states) {
+    jintArray idArray = env->NewIntArray(count);
+    jintArray stateArray = env->NewIntArray(count);
+    if (idArray && stateArray) {
+        env->SetIntArrayRegion(idArray, 0, count, ids);
+        env->SetIntArrayRegion(stateArray, 0, count, states);
+        callVoidMethodOrdered(env, __FUNCTION__, mCallbacksObj, method_handlePassthroughCmds,
+                              idArray, stateArray);
+    } else {
+        ALOGE("Fail to new jintArray for passthrough commands");
+    }
+    if (idArray) env->DeleteLocalRef(idArray);
+    if (stateArray) env->DeleteLocalRef(stateArray);
+}
+
+// Returns true if the volume change is held back for the end of the window
+static bool volume_coalesce(uint8_t volume, uint8_t ctype) {
+    Mutex::Autolock lock(sSchedLock);
+    if (ctype == AVRC_RSP_ACCEPT || ctype == AVRC_RSP_CHANGED || ctype == AVRC_RSP_INTERIM) {
+        sRemoteVolume = volume;
+    }
+    if (!sSchedRunning) return false;
+
+    if (ctype != AVRC_RSP_CHANGED) {
+        // Carries a newer volume than any pending change, other than a reject
+        if (ctype != AVRC_RSP_REJ) sVolumePending = false;
+        return false;
+    }
+    if (sVolumeDeadline == 0) {
+        sVolumeDeadline = elapsedRealtime() + AVRCP_COALESCE_MS;
+        sSchedCond.signal();
+        return false;
+    }
+    sVolumePending = true;
+    sVolumePendingValue = volume;
+    return true;
+}
+
+// Returns true if the command is held back for the end of the window
+static bool passthrough_coalesce(JNIEnv *env, int id, int pressed) {
+    jint ids[PASSTHROUGH_MAX_BATCH];
+    jint states[PASSTHROUGH_MAX_BATCH];
+    int count;
+    {
+        Mutex::Autolock lock(sSchedLock);
+        if (!sSchedRunning) return false;
+
+        if (sPassthroughDeadline == 0) {
+            sPassthroughDeadline = elapsedRealtime() + AVRCP_COALESCE_MS;
+            sSchedCond.signal();
+            return false;
+        }
+        if (sPassthroughCount < PASSTHROUGH_MAX_BATCH) {
+            sPassthroughIds[sPassthroughCount] = id;
+            sPassthroughStates[sPassthroughCount] = pressed;
+            sPassthroughCount++;
+            return true;
+        }
+
+        // Full, deliver what is pending ahead of this command
+        count = sPassthroughCount;
+        memcpy(ids, sPassthroughIds, count * sizeof(jint));
+        memcpy(states, sPassthroughStates, count * sizeof(jint));
+        sPassthroughCount = 0;
+    }
+    passthrough_deliver(env, count, ids, states);
+    return false;
+}
+
+// Delivers the volume change held back once its window is over
+static void volume_flush(JNIEnv *env) {
+    Mutex::Autolock upcallLock(sUpcallLock);
+    uint8_t volume;
+    {
+        Mutex::Autolock lock(sSchedLock);
+        int64_t now = elapsedRealtime();
+        if (!sVolumeDeadline || now < sVolumeDeadline) return;
+        sVolumeDeadline = 0;
+        if (!sVolumePending) return;
+        volume = sVolumePendingValue;
+        sVolumePending = false;
+        sVolumeDeadline = now + AVRCP_COALESCE_MS;
+    }
+    callVoidMethodOrdered(env, __FUNCTION__, mCallbacksObj, method_volumeChangeCallback,
+                          (jint) volume, (jint) AVRC_RSP_CHANGED);
+}
+
+// Delivers the passthrough commands held back once their window is over
+static void passthrough_flush(JNIEnv *env) {
+    Mutex::Autolock upcallLock(sUpcallLock);
+    jint ids[PASSTHROUGH_MAX_BATCH];
+    jint states[PASSTHROUGH_MAX_BATCH];
+    int count;
+    {
+        Mutex::Autolock lock(sSchedLock);
+        int64_t now = elapsedRealtime();
+        if (!sPassthroughDeadline || now < sPassthroughDeadline) return;
+        sPassthroughDeadline = 0;
+        if (!sPassthroughCount) return;
+        count = sPassthroughCount;
+        memcpy(ids, sPassthroughIds, count * sizeof(jint));
+        memcpy(states, sPassthroughStates, count * sizeof(jint));
+        sPassthroughCount = 0;
+        sPassthroughDeadline = now + AVRCP_COALESCE_MS;
+    }
+    passthrough_deliver(env, count, ids, states);
+}
+
+/**
+ * AVRCP scheduler thread, serving the play position deadline and the
+ * coalescing windows. Attached to the VM so that it can make the upcalls
+ * for coalesced events itself.
+ */
+static void avrcp_sched_thread(void *arg) {
+    JNIEnv *env = AndroidRuntime::getJNIEnv();
+
+    Mutex::Autolock lock(sSchedLock);
+    while (!sSchedQuit) {
+        int64_t next = 0;
+        if (sPlayPosDeadline) next = sPlayPosDeadline;
+        if (sVolumeDeadline && (!next || sVolumeDeadline < next)) next = sVolumeDeadline;
+        if (sPassthroughDeadline && (!next || sPassthroughDeadline < next)) {
+            next = sPassthroughDeadline;
+        }
+        if (next == 0) {
+            sSchedCond.wait(sSchedLock);
+            continue;
+        }
+        int64_t now = elapsedRealtime();
+        if (now < next) {
+            sSchedCond.waitRelative(sSchedLock, milliseconds_to_nanoseconds(next - now));
+            continue;
+        }
+
+        if (sPlayPosDeadline && now >= sPlayPosDeadline) {
+            sPlayPosDeadline = 0;
+            if (sPlayPosRegistered) {
+                sPlayPosRegistered = false;
+                int64_t pos = play_pos_now_l(now);
+
+                sSchedLock.unlock();
+                play_pos_send(BTRC_NOTIFICATION_TYPE_CHANGED, pos);
+                sSchedLock.lock();
+            }
+        }
+
+        // The flushes take sUpcallLock, which goes before sSchedLock
+        if (sVolumeDeadline && now >= sVolumeDeadline) {
+            sSchedLock.unlock();
+            volume_flush(env);
+            sSchedLock.lock();
+        }
+
+        if (sPassthroughDeadline && now >= sPassthroughDeadline) {
+            sSchedLock.unlock();
+            passthrough_flush(env);
+            sSchedLock.lock();
+        }
+    }
+    sSchedRunning = false;
+    sSchedExitCond.signal();
+}
+
+static void avrcp_sched_start() {
+    Mutex::Autolock lock(sSchedLock);
+    if (sSchedRunning) return;
+    sSchedQuit = false;
+    sAnchorValid = false;
+    sPlayPosRegistered = false;
+    sPlayPosDeadline = 0;
+    sRemoteVolume = -1;
+    sVolumeDeadline = 0;
+    sVolumePending = false;
+    sPassthroughDeadline = 0;
+    sPassthroughCount = 0;
+    if (AndroidRuntime::createJavaThread("BT AVRCP Scheduler Thread",
+                                         avrcp_sched_thread, NULL) == 0) {
+        ALOGE("Failed to start the AVRCP scheduler thread");
+        return;
+    }
+    sSchedRunning = true;
+}
+
+// Waits for the scheduler thread to exit, which drops anything held back
+static void avrcp_sched_stop() {
+    Mutex::Autolock lock(sSchedLock);
+    if (!sSchedRunning) return;
+    sSchedQuit = true;
+    sAnchorValid = false;
+    sSchedCond.signal();
+    while (sSchedRunning) {
+        sSchedExitCond.wait(sSchedLock);
+    }
+}
+
 static void btavrcp_remote_features_callback(bt_bdaddr_t* bd_addr, btrc_remote_features_t features) {
     ALOGI("%s", __FUNCTION__);
     jbyteArray addr;
 
-    if (!checkCallbackThread()) {
-        ALOGE("Callback: '%s' is not called on the correct thread", __FUNCTION__);
-        return;
+    {
+        Mutex::Autolock lock(sSchedLock);
+        sRemoteVolume = -1;
     }
-    addr = sCallbackEnv->NewByteArray(sizeof(bt_bdaddr_t));
+
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    addr = sCallbackEnv.newAddressArray(bd_addr);
     if (!addr) {
         ALOGE("Fail to new jbyteArray bd addr for connection state");
-        checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
         return;
     }
 
-    sCallbackEnv->SetByteArrayRegion(addr, 0, sizeof(bt_bdaddr_t), (jbyte*) bd_addr);
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_getRcFeatures, addr, (jint)features);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_getRcFeatures, addr, (jint)features);
 }
 
 static void btavrcp_get_play_status_callback() {
     ALOGI("%s", __FUNCTION__);
 
-    if (!checkCallbackThread()) {
-        ALOGE("Callback: '%s' is not called on the correct thread", __FUNCTION__);
-        return;
-    }
+    if (play_pos_play_status_rsp()) return;
 
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_getPlayStatus);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_getPlayStatus);
 }
 
 static void btavrcp_get_element_attr_callback(uint8_t num_attr, btrc_media_attr_t *p_attrs) {
@@ -86,59 +477,56 @@ static void btavrcp_get_element_attr_callback(uint8_t num_attr, btrc_media_attr_
 
     ALOGI("%s", __FUNCTION__);
 
-    if (!checkCallbackThread()) {
-        ALOGE("Callback: '%s' is not called on the correct thread", __FUNCTION__);
-        return;
-    }
+    if (metadata_element_attr_rsp(num_attr, p_attrs)) return;
+
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
     attrs = (jintArray)sCallbackEnv->NewIntArray(num_attr);
     if (!attrs) {
         ALOGE("Fail to new jintArray for attrs");
-        checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
         return;
     }
     sCallbackEnv->SetIntArrayRegion(attrs, 0, num_attr, (jint *)p_attrs);
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_getElementAttr, (jbyte)num_attr, attrs);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_getElementAttr, (jbyte)num_attr, attrs);
     sCallbackEnv->DeleteLocalRef(attrs);
 }
 
 static void btavrcp_register_notification_callback(btrc_event_id_t event_id, uint32_t param) {
     ALOGI("%s", __FUNCTION__);
 
-    if (!checkCallbackThread()) {
-        ALOGE("Callback: '%s' is not called on the correct thread", __FUNCTION__);
-        return;
-    }
+    if (event_id == BTRC_EVT_PLAY_POS_CHANGED && play_pos_register(param)) return;
+
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
 
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_registerNotification,
-                                 (jint)event_id, (jint)param);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_registerNotification,
+                                (jint)event_id, (jint)param);
 }
 
 static void btavrcp_volume_change_callback(uint8_t volume, uint8_t ctype) {
     ALOGI("%s", __FUNCTION__);
 
-    if (!checkCallbackThread()) {
-        ALOGE("Callback: '%s' is not called on the correct thread", __FUNCTION__);
-        return;
-    }
+    Mutex::Autolock upcallLock(sUpcallLock);
+    if (volume_coalesce(volume, ctype)) return;
 
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_volumeChangeCallback, (jint)volume,
-                                                                             (jint)ctype);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_volumeChangeCallback, (jint)volume,
+                                                                            (jint)ctype);
 }
 
 static void btavrcp_passthrough_command_callback(int id, int pressed) {
     ALOGI("%s", __FUNCTION__);
 
-    if (!checkCallbackThread()) {
-        ALOGE("Callback: '%s' is not called on the correct thread", __FUNCTION__);
-        return;
-    }
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
 
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_handlePassthroughCmd, (jint)id,
-                                                                             (jint)pressed);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    Mutex::Autolock upcallLock(sUpcallLock);
+    if (passthrough_coalesce(sCallbackEnv.get(), id, pressed)) return;
+
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_handlePassthroughCmd, (jint)id,
+                                                                            (jint)pressed);
 }
 
 static btrc_callbacks_t sBluetoothAvrcpCallbacks = {
@@ -157,23 +545,21 @@ static btrc_callbacks_t sBluetoothAvrcpCallbacks = {
     btavrcp_passthrough_command_callback
 };
 
-static void classInitNative(JNIEnv* env, jclass clazz) {
-    method_getRcFeatures =
-        env->GetMethodID(clazz, "getRcFeatures", "([BI)V");
-    method_getPlayStatus =
-        env->GetMethodID(clazz, "getPlayStatus", "()V");
-
-    method_getElementAttr =
-        env->GetMethodID(clazz, "getElementAttr", "(B[I)V");
-
-    method_registerNotification =
-        env->GetMethodID(clazz, "registerNotification", "(II)V");
-
-    method_volumeChangeCallback =
-        env->GetMethodID(clazz, "volumeChangeCallback", "(II)V");
+static const callback_method_t sCallbackMethods[] = {
+    {&method_getRcFeatures, "getRcFeatures", "([BI)V"},
+    {&method_getPlayStatus, "getPlayStatus", "()V"},
+    {&method_getElementAttr, "getElementAttr", "(B[I)V"},
+    {&method_registerNotification, "registerNotification", "(II)V"},
+    {&method_volumeChangeCallback, "volumeChangeCallback", "(II)V"},
+    {&method_handlePassthroughCmd, "handlePassthroughCmd", "(II)V"},
+    {&method_handlePassthroughCmds, "handlePassthroughCmds", "([I[I)V"},
+};
 
-    method_handlePassthroughCmd =
-        env->GetMethodID(clazz, "handlePassthroughCmd", "(II)V");
+static void classInitNative(JNIEnv* env, jclass clazz) {
+    if (!getCallbackMethodIDs(env, clazz, sCallbackMethods, NELEM(sCallbackMethods))) {
+        ALOGE("%s: Missing callback methods", __FUNCTION__);
+        return;
+    }
 
     ALOGI("%s: succeeds", __FUNCTION__);
 }
@@ -213,6 +599,7 @@ static void initNative(JNIEnv *env, jobject object) {
     }
 
     mCallbacksObj = env->NewGlobalRef(object);
+    avrcp_sched_start();
 }
 
 static void cleanupNative(JNIEnv *env, jobject object) {
@@ -223,6 +610,8 @@ static void cleanupNative(JNIEnv *env, jobject object) {
         return;
     }
 
+    avrcp_sched_stop();
+
     if (sBluetoothAvrcpInterface !=NULL) {
         sBluetoothAvrcpInterface->cleanup();
         sBluetoothAvrcpInterface = NULL;
@@ -232,6 +621,9 @@ static void cleanupNative(JNIEnv *env, jobject object) {
         env->DeleteGlobalRef(mCallbacksObj);
         mCallbacksObj = NULL;
     }
+
+    Mutex::Autolock lock(sMetadataLock);
+    sMetadataValid = false;
 }
 
 static jboolean getPlayStatusRspNative(JNIEnv *env, jobject object, jint playStatus,
@@ -249,14 +641,13 @@ static jboolean getPlayStatusRspNative(JNIEnv *env, jobject object, jint playSta
     return (status == BT_STATUS_SUCCESS) ? JNI_TRUE : JNI_FALSE;
 }
 
-  static jboolean getElementAttrRspNative(JNIEnv *env, jobject object, jbyte numAttr,
-                                          jintArray attrIds, jobjectArray textArray) {
+static jboolean getElementAttrRspNative(JNIEnv *env, jobject object, jbyte numAttr,
+                                        jintArray attrIds, jobjectArray textArray) {
     jint *attr;
     bt_status_t status;
     jstring text;
     int i;
-    btrc_element_attr_val_t *pAttrs = NULL;
-    const char* textStr;
+    btrc_element_attr_val_t pAttrs[BTRC_MAX_ELEM_ATTR_SIZE];
 
     if (!sBluetoothAvrcpInterface) return JNI_FALSE;
 
@@ -265,43 +656,22 @@ static jboolean getPlayStatusRspNative(JNIEnv *env, jobject object, jint playSta
         return JNI_FALSE;
     }
 
-    pAttrs = new btrc_element_attr_val_t[numAttr];
-    if (!pAttrs) {
-        ALOGE("get_element_attr_rsp: not have enough memeory");
-        return JNI_FALSE;
-    }
-
     attr = env->GetIntArrayElements(attrIds, NULL);
     if (!attr) {
-        delete[] pAttrs;
         jniThrowIOException(env, EINVAL);
         return JNI_FALSE;
     }
 
     for (i = 0; i < numAttr; ++i) {
         text = (jstring) env->GetObjectArrayElement(textArray, i);
-        textStr = env->GetStringUTFChars(text, NULL);
-        if (!textStr) {
-            ALOGE("get_element_attr_rsp: GetStringUTFChars return NULL");
-            env->DeleteLocalRef(text);
-            break;
-        }
-
         pAttrs[i].attr_id = attr[i];
-        if (strlen(textStr) >= BTRC_MAX_ATTR_STR_LEN) {
-            ALOGE("get_element_attr_rsp: string length exceed maximum");
-            strncpy((char *)pAttrs[i].text, textStr, BTRC_MAX_ATTR_STR_LEN-1);
-            pAttrs[i].text[BTRC_MAX_ATTR_STR_LEN-1] = 0;
-        } else {
-            strcpy((char *)pAttrs[i].text, textStr);
-        }
-        env->ReleaseStringUTFChars(text, textStr);
+        bool copied = copy_attr_text(env, text, pAttrs[i].text);
         env->DeleteLocalRef(text);
+        if (!copied) break;
     }
+    env->ReleaseIntArrayElements(attrIds, attr, JNI_ABORT);
 
     if (i < numAttr) {
-        delete[] pAttrs;
-        env->ReleaseIntArrayElements(attrIds, attr, 0);
         return JNI_FALSE;
     }
 
@@ -310,11 +680,56 @@ static jboolean getPlayStatusRspNative(JNIEnv *env, jobject object, jint playSta
         ALOGE("Failed get_element_attr_rsp, status: %d", status);
     }
 
-    delete[] pAttrs;
-    env->ReleaseIntArrayElements(attrIds, attr, 0);
     return (status == BT_STATUS_SUCCESS) ? JNI_TRUE : JNI_FALSE;
 }
 
+static jboolean setMetadataNative(JNIEnv *env, jobject object, jintArray attrIds,
+                                  jobjectArray textArray) {
+    btrc_element_attr_val_t metadata[BTRC_MAX_ELEM_ATTR_SIZE];
+    jint *attr;
+    int numAttr = env->GetArrayLength(attrIds);
+    int i;
+
+    if (env->GetArrayLength(textArray) != numAttr) {
+        ALOGE("%s: %d attributes but %d texts", __FUNCTION__, numAttr,
+              env->GetArrayLength(textArray));
+        Mutex::Autolock lock(sMetadataLock);
+        sMetadataValid = false;
+        return JNI_FALSE;
+    }
+
+    attr = env->GetIntArrayElements(attrIds, NULL);
+    if (!attr) {
+        jniThrowIOException(env, EINVAL);
+        return JNI_FALSE;
+    }
+
+    for (i = 0; i < BTRC_MAX_ELEM_ATTR_SIZE; ++i) {
+        metadata[i].attr_id = i + 1;
+        metadata[i].text[0] = 0;
+    }
+
+    for (i = 0; i < numAttr; ++i) {
+        if (attr[i] < 1 || attr[i] > BTRC_MAX_ELEM_ATTR_SIZE) continue;
+        jstring text = (jstring) env->GetObjectArrayElement(textArray, i);
+        if (text == NULL) continue;     // Answered with empty text
+        bool copied = copy_attr_text(env, text, metadata[attr[i] - 1].text);
+        env->DeleteLocalRef(text);
+        if (!copied) break;
+    }
+    env->ReleaseIntArrayElements(attrIds, attr, JNI_ABORT);
+
+    Mutex::Autolock lock(sMetadataLock);
+    if (i < numAttr) {
+        // Let Java answer rather than serve a partial update
+        sMetadataValid = false;
+        return JNI_FALSE;
+    }
+    memcpy(sMetadata, metadata, sizeof(sMetadata));
+    sMetadataValid = true;
+    return JNI_TRUE;
+}
+
 static jboolean registerNotificationRspPlayStatusNative(JNIEnv *env, jobject object,
                                                         jint type, jint playStatus) {
     bt_status_t status;
@@ -378,6 +793,39 @@ static jboolean registerNotificationRspPlayPosNative(JNIEnv *env, jobject object
     return (status == BT_STATUS_SUCCESS) ? JNI_TRUE : JNI_FALSE;
 }
 
+static void setPlaybackAnchorNative(JNIEnv *env, jobject object, jint playStatus,
+                                    jint songLen, jlong position, jlong anchorTime,
+                                    jfloat speed, jboolean trackChanged) {
+    bool changed = false;
+    int64_t pos;
+    {
+        Mutex::Autolock lock(sSchedLock);
+        int64_t now = elapsedRealtime();
+        int64_t oldPos = sAnchorValid ? play_pos_now_l(now) : -1;
+        bool statusChanged = sAnchorValid && sAnchorPlayStatus != playStatus;
+
+        sAnchorValid = true;
+        sAnchorPlayStatus = playStatus;
+        sAnchorSongLen = (uint32_t) songLen;
+        sAnchorPos = position;
+        sAnchorTime = anchorTime;
+        sAnchorSpeed = speed;
+
+        if (!sPlayPosRegistered) return;
+
+        pos = play_pos_now_l(now);
+        changed = trackChanged || statusChanged || ((oldPos < 0) != (pos < 0))
+                  || (pos >= 0 && (pos >= sPlayPosNext || pos <= sPlayPosPrev));
+        if (changed) {
+            sPlayPosRegistered = false;
+            sPlayPosDeadline = 0;
+        } else {
+            play_pos_arm_l(now);
+        }
+    }
+    if (changed) play_pos_send(BTRC_NOTIFICATION_TYPE_CHANGED, pos);
+}
+
 static jboolean setVolumeNative(JNIEnv *env, jobject object, jint volume) {
     bt_status_t status;
 
@@ -387,6 +835,14 @@ static jboolean setVolumeNative(JNIEnv *env, jobject object, jint volume) {
     ALOGI("%s: sBluetoothAvrcpInterface: %p", __FUNCTION__, sBluetoothAvrcpInterface);
     if (!sBluetoothAvrcpInterface) return JNI_FALSE;
 
+    {
+        Mutex::Autolock lock(sSchedLock);
+        if (volume == sRemoteVolume) {
+            ALOGV("%s: remote already at volume %d", __FUNCTION__, volume);
+            return JNI_FALSE;
+        }
+    }
+
     if ((status = sBluetoothAvrcpInterface->set_volume((uint8_t)volume)) != BT_STATUS_SUCCESS) {
         ALOGE("Failed set_volume, status: %d", status);
     }
@@ -400,12 +856,14 @@ static JNINativeMethod sMethods[] = {
     {"cleanupNative", "()V", (void *) cleanupNative},
     {"getPlayStatusRspNative", "(III)Z", (void *) getPlayStatusRspNative},
     {"getElementAttrRspNative", "(B[I[Ljava/lang/String;)Z", (void *) getElementAttrRspNative},
+    {"setMetadataNative", "([I[Ljava/lang/String;)Z", (void *) setMetadataNative},
     {"registerNotificationRspPlayStatusNative", "(II)Z",
      (void *) registerNotificationRspPlayStatusNative},
     {"registerNotificationRspTrackChangeNative", "(I[B)Z",
      (void *) registerNotificationRspTrackChangeNative},
     {"registerNotificationRspPlayPosNative", "(II)Z",
      (void *) registerNotificationRspPlayPosNative},
+    {"setPlaybackAnchorNative", "(IIJJFZ)V", (void *) setPlaybackAnchorNative},
     {"setVolumeNative", "(I)Z",
      (void *) setVolumeNative}
 };
@@ -19,23 +19,28 @@
 #include "hardware/bt_sock.h"
 #include "utils/Log.h"
 #include "utils/misc.h"
+#include "utils/String8.h"
+#include "utils/Mutex.h"
+#include "utils/Condition.h"
+#include "utils/Timers.h"
 #include "cutils/properties.h"
 #include "android_runtime/AndroidRuntime.h"
 #include "android_runtime/Log.h"
 
 #include <string.h>
 #include <pthread.h>
+#include <unistd.h>
 
 #include <sys/stat.h>
 #include <fcntl.h>
 
 namespace android {
 
-#define ADDITIONAL_NREFS 50
 static jmethodID method_stateChangeCallback;
 static jmethodID method_adapterPropertyChangedCallback;
 static jmethodID method_devicePropertyChangedCallback;
 static jmethodID method_deviceFoundCallback;
+static jmethodID method_devicesFoundCallback;
 static jmethodID method_pinRequestCallback;
 static jmethodID method_sspRequestCallback;
 static jmethodID method_bondStateChangeCallback;
@@ -45,6 +50,7 @@ static jmethodID method_discoveryStateChangeCallback;
 static const bt_interface_t *sBluetoothInterface = NULL;
 static const btsock_interface_t *sBluetoothSocketInterface = NULL;
 static JNIEnv *callbackEnv = NULL;
+static pthread_t sCallbackThread;
 
 static jobject sJniCallbacksObj;
 static jfieldID sJniCallbacksField;
@@ -67,116 +73,385 @@ void checkAndClearExceptionFromCallback(JNIEnv* env,
     }
 }
 
-static bool checkCallbackThread() {
-    JNIEnv* env = AndroidRuntime::getJNIEnv();
-    if (callbackEnv != env || callbackEnv == NULL) {
-        ALOGE("Callback env check fail: env: %p, callback: %p", env, callbackEnv);
-        return false;
+bool isCallbackThread() {
+    return callbackEnv != NULL && pthread_equal(pthread_self(), sCallbackThread);
+}
+
+/*
+ * Sockets
+ */
+#define SOCK_ADDRESS_LEN 6
+#define SOCK_UUID_LEN 16
+#define SOCK_SERVICE_NAME_LEN 256
+#define SOCK_MAX_BATCH 16
+
+// Returns the socket fd, or -1 if the connection could not be set up
+static int sock_connect(const bt_bdaddr_t *bd_addr, int type, const uint8_t *uuid, int channel,
+                        int flag) {
+    int socket_fd = -1;
+    bt_status_t status;
+
+    if ( (status = sBluetoothSocketInterface->connect(bd_addr, (btsock_type_t) type, uuid,
+                       channel, &socket_fd, flag)) != BT_STATUS_SUCCESS) {
+        ALOGE("Socket connection failed: %d", status);
+        return -1;
     }
-    return true;
+    if (socket_fd < 0) {
+        ALOGE("Fail to creat file descriptor on socket fd");
+        return -1;
+    }
+    return socket_fd;
 }
 
-static void adapter_state_change_callback(bt_state_t status) {
-    if (!checkCallbackThread()) {
-       ALOGE("Callback: '%s' is not called on the correct thread", __FUNCTION__);
-       return;
+// Returns the socket fd, or -1 if the channel could not be set up
+static int sock_listen(int type, const char *service_name, const uint8_t *uuid, int channel,
+                       int flag) {
+    int socket_fd = -1;
+    bt_status_t status;
+
+    ALOGV("%s: flag %x", __FUNCTION__, flag);
+    if ( (status = sBluetoothSocketInterface->listen((btsock_type_t) type, service_name, uuid,
+                       channel, &socket_fd, flag)) != BT_STATUS_SUCCESS) {
+        ALOGE("Socket listen failed: %d", status);
+        return -1;
     }
-    ALOGV("%s: Status is: %d", __FUNCTION__, status);
+    if (socket_fd < 0) {
+        ALOGE("Fail to creat file descriptor on socket fd");
+        return -1;
+    }
+    return socket_fd;
+}
 
-    callbackEnv->CallVoidMethod(sJniCallbacksObj, method_stateChangeCallback, (jint)status);
+/*
+ * Listening channel pool
+ *
+ * The stack advertises every listening channel as soon as it is set up,
+ * and a peer may connect to any of them, so a pooled channel must never
+ * sit next to the open server channel of its service: a connection could
+ * land on it and never be accepted. The pool thread therefore watches the
+ * server channel it handed out last, and only once that is closed sets up
+ * one channel for the next listen of the service, such as the one a server
+ * makes after closing its listener for an accepted connection. A peer
+ * connecting in between finds that channel instead of no listener at all.
+ * The channel is closed unless a listen takes it within
+ * SOCK_POOL_LINGER_MS. The pool is dropped on a depth of 0 and when the
+ * adapter turns off, as the stack closes all channels then.
+ */
+#define SOCK_POOL_MAX_SERVICES 4
+// More than one channel would be advertised next to each other
+#define SOCK_POOL_MAX_DEPTH 1
+#define SOCK_POOL_CHECK_MS 500
+#define SOCK_POOL_LINGER_MS 2000
+
+typedef struct {
+    bool in_use;
+    bool refill_failed;
+    uint32_t generation;
+    int type;
+    int channel;
+    int flag;
+    uint8_t uuid[SOCK_UUID_LEN];
+    char service_name[SOCK_SERVICE_NAME_LEN];
+    int depth;
+    int count;
+    int fds[SOCK_POOL_MAX_DEPTH];
+    // Server channel handed out last, told apart from a reuse of its fd number by its inode
+    bool server_open;
+    bool lingering;             // server closed less than SOCK_POOL_LINGER_MS ago
+    int server_fd;
+    dev_t server_dev;
+    ino_t server_ino;
+    nsecs_t server_closed_at;
+} sock_pool_t;
+
+static Mutex sSockPoolLock;
+static Condition sSockPoolCond;
+static Condition sSockPoolExitCond;
+static bool sSockPoolRunning = false;
+static bool sSockPoolQuit = false;
+static bool sSockPoolEnabled = false;
+static uint32_t sSockPoolGeneration = 0;
+static sock_pool_t sSockPool[SOCK_POOL_MAX_SERVICES];
+
+static sock_pool_t *sock_pool_find_l(int type, const char *service_name, const uint8_t *uuid,
+                                     int channel, int flag) {
+    for (int i = 0; i < SOCK_POOL_MAX_SERVICES; i++) {
+        sock_pool_t *pool = &sSockPool[i];
+        if (pool->in_use && pool->type == type && pool->channel == channel &&
+            pool->flag == flag && !memcmp(pool->uuid, uuid, SOCK_UUID_LEN)) {
+            if (service_name && strncmp(pool->service_name, service_name,
+                                        SOCK_SERVICE_NAME_LEN)) {
+                return NULL;
+            }
+            return pool;
+        }
+    }
+    return NULL;
+}
 
-    checkAndClearExceptionFromCallback(callbackEnv, __FUNCTION__);
+static void sock_pool_flush_l(sock_pool_t *pool) {
+    for (int i = 0; i < pool->count; i++) {
+        close(pool->fds[i]);
+    }
+    pool->count = 0;
 }
 
-static int get_properties(int num_properties, bt_property_t *properties, jintArray *types,
-                        jobjectArray *props) {
-    jbyteArray propVal;
-    for (int i = 0; i < num_properties; i++) {
-        propVal = callbackEnv->NewByteArray(properties[i].len);
-        if (propVal == NULL) goto Fail;
+static bool sock_pool_server_open_l(const sock_pool_t *pool) {
+    struct stat st;
+    if (fstat(pool->server_fd, &st) < 0) return false;
+    return st.st_dev == pool->server_dev && st.st_ino == pool->server_ino;
+}
 
-        callbackEnv->SetByteArrayRegion(propVal, 0, properties[i].len,
-                                             (jbyte*)properties[i].val);
-        callbackEnv->SetObjectArrayElement(*props, i, propVal);
-        // Delete reference to propVal
-        callbackEnv->DeleteLocalRef(propVal);
-        callbackEnv->SetIntArrayRegion(*types, i, 1, (jint *)&properties[i].type);
+/**
+ * Sets up a listening channel for the service, taking it from the pool
+ * where possible. A channel of a pooled service opens its server, which
+ * has the pool thread set up channels for the next listen.
+ */
+static int sock_pool_listen(int type, const char *service_name, const uint8_t *uuid, int channel,
+                            int flag) {
+    const char *name = service_name ? service_name : "";
+    int fd = -1;
+    uint32_t generation;
+    {
+        Mutex::Autolock lock(sSockPoolLock);
+        sock_pool_t *pool = sock_pool_find_l(type, name, uuid, channel, flag);
+        if (pool == NULL) return sock_listen(type, service_name, uuid, channel, flag);
+        generation = pool->generation;
+        if (pool->count > 0) {
+            fd = pool->fds[0];
+            pool->count--;
+            memmove(pool->fds, pool->fds + 1, pool->count * sizeof(int));
+        }
     }
-    return 0;
-Fail:
-    if (propVal) callbackEnv->DeleteLocalRef(propVal);
-    ALOGE("Error while allocation of array in %s", __FUNCTION__);
-    return -1;
+
+    if (fd < 0) fd = sock_listen(type, service_name, uuid, channel, flag);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) return fd;
+    Mutex::Autolock lock(sSockPoolLock);
+    sock_pool_t *pool = sock_pool_find_l(type, name, uuid, channel, flag);
+    if (pool == NULL || pool->generation != generation) return fd;
+    pool->server_open = true;
+    pool->lingering = false;
+    pool->server_fd = fd;
+    pool->server_dev = st.st_dev;
+    pool->server_ino = st.st_ino;
+    pool->refill_failed = false;
+    sSockPoolCond.signal();
+    return fd;
 }
 
-static void adapter_properties_callback(bt_status_t status, int num_properties,
-                                        bt_property_t *properties) {
-    jobjectArray props;
-    jintArray types;
-    jbyteArray val;
-    jclass mclass;
+/**
+ * Notes the services whose server was closed, and closes the pooled
+ * channels of those closed for SOCK_POOL_LINGER_MS. Returns whether any
+ * server or lingering service is left to check on.
+ */
+static bool sock_pool_check_l(nsecs_t now) {
+    bool pending = false;
+    for (int i = 0; i < SOCK_POOL_MAX_SERVICES; i++) {
+        sock_pool_t *pool = &sSockPool[i];
+        if (!pool->in_use) continue;
+        if (pool->server_open && !sock_pool_server_open_l(pool)) {
+            pool->server_open = false;
+            pool->lingering = true;
+            pool->server_closed_at = now;
+        }
+        if (pool->server_open) {
+            pending = true;
+        } else if (pool->lingering) {
+            if (now - pool->server_closed_at >= ms2ns(SOCK_POOL_LINGER_MS)) {
+                sock_pool_flush_l(pool);
+                pool->lingering = false;
+            } else {
+                pending = true;
+            }
+        }
+    }
+    return pending;
+}
 
-    if (!checkCallbackThread()) {
-       ALOGE("Callback: '%s' is not called on the correct thread", __FUNCTION__);
-       return;
+// Returns the service whose server just closed that is short of channels,
+// or NULL if there is none
+static sock_pool_t *sock_pool_next_l() {
+    if (!sSockPoolEnabled || sBluetoothSocketInterface == NULL) return NULL;
+    for (int i = 0; i < SOCK_POOL_MAX_SERVICES; i++) {
+        sock_pool_t *pool = &sSockPool[i];
+        if (pool->in_use && pool->lingering && !pool->refill_failed &&
+            pool->count < pool->depth) {
+            return pool;
+        }
     }
+    return NULL;
+}
 
-    ALOGV("%s: Status is: %d, Properties: %d", __FUNCTION__, status, num_properties);
+/**
+ * Pool thread, setting up the channel for the next listen of services
+ * whose server just closed and closing it once it lingered too long. A
+ * failed set up is not retried until the next listen of the same service.
+ */
+static void sock_pool_thread(void *arg) {
+    Mutex::Autolock lock(sSockPoolLock);
+    while (!sSockPoolQuit) {
+        bool pending = sock_pool_check_l(systemTime(SYSTEM_TIME_MONOTONIC));
+        sock_pool_t *pool = sock_pool_next_l();
+        if (pool == NULL) {
+            if (pending) {
+                sSockPoolCond.waitRelative(sSockPoolLock, ms2ns(SOCK_POOL_CHECK_MS));
+            } else {
+                sSockPoolCond.wait(sSockPoolLock);
+            }
+            continue;
+        }
 
-    if (status != BT_STATUS_SUCCESS) {
-        ALOGE("%s: Status %d is incorrect", __FUNCTION__, status);
-        return;
+        sock_pool_t params = *pool;
+        sSockPoolLock.unlock();
+        int fd = sock_listen(params.type, params.service_name, params.uuid, params.channel,
+                             params.flag);
+        sSockPoolLock.lock();
+
+        // The service may have been reconfigured, listened again, lingered too long or the
+        // adapter turned off
+        if (!pool->in_use || pool->generation != params.generation || !sSockPoolEnabled ||
+            !pool->lingering || pool->count >= pool->depth) {
+            if (fd >= 0) close(fd);
+            continue;
+        }
+        if (fd < 0) {
+            pool->refill_failed = true;
+            continue;
+        }
+        pool->fds[pool->count++] = fd;
     }
+    sSockPoolRunning = false;
+    sSockPoolExitCond.signal();
+}
 
-    val = (jbyteArray) callbackEnv->NewByteArray(num_properties);
-    if (val == NULL) {
-        ALOGE("%s: Error allocating byteArray", __FUNCTION__);
+static void sock_pool_start_l() {
+    if (sSockPoolRunning) return;
+    sSockPoolQuit = false;
+    if (AndroidRuntime::createJavaThread("BT Socket Pool Thread", sock_pool_thread, NULL) == 0) {
+        ALOGE("Failed to start the socket pool thread");
         return;
     }
+    sSockPoolRunning = true;
+}
 
-    mclass = callbackEnv->GetObjectClass(val);
+// Closes all pooled channels, stopping the pool thread when quit is set
+static void sock_pool_reset(bool quit) {
+    Mutex::Autolock lock(sSockPoolLock);
+    for (int i = 0; i < SOCK_POOL_MAX_SERVICES; i++) {
+        sock_pool_flush_l(&sSockPool[i]);
+        sSockPool[i].refill_failed = false;
+        sSockPool[i].server_open = false;
+        sSockPool[i].lingering = false;
+        sSockPool[i].generation = ++sSockPoolGeneration;
+        if (quit) sSockPool[i].in_use = false;
+    }
+    if (!quit || !sSockPoolRunning) return;
+    sSockPoolQuit = true;
+    sSockPoolCond.signal();
+    while (sSockPoolRunning) {
+        sSockPoolExitCond.wait(sSockPoolLock);
+    }
+}
 
-    /* (BT) Initialize the jobjectArray and jintArray here itself and send the
-     initialized array pointers alone to get_properties */
+static void sock_pool_state_changed(bt_state_t state) {
+    {
+        Mutex::Autolock lock(sSockPoolLock);
+        sSockPoolEnabled = state == BT_STATE_ON;
+        sSockPoolCond.signal();
+    }
+    if (state != BT_STATE_ON) sock_pool_reset(false);
+}
 
-    props = callbackEnv->NewObjectArray(num_properties, mclass,
-                                             NULL);
-    if (props == NULL) {
-        ALOGE("%s: Error allocating object Array for properties", __FUNCTION__);
-        return;
+static void adapter_state_change_callback(bt_state_t status) {
+    sock_pool_state_changed(status);
+
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    ALOGV("%s: Status is: %d", __FUNCTION__, status);
+
+    sCallbackEnv.callVoidMethod(sJniCallbacksObj, method_stateChangeCallback, (jint)status);
+}
+
+#define PROPERTY_HEADER_LEN 4
+#define PROPERTY_MAX_LEN 0xFFFF
+
+// Type and length of a packed property have to fit in 16 bits each
+static bool property_packable(const bt_property_t *property) {
+    return (unsigned) property->type <= PROPERTY_MAX_LEN && property->len >= 0 &&
+           property->len <= PROPERTY_MAX_LEN;
+}
+
+// Writes one packed property record and returns the end of it
+static uint8_t *write_property(uint8_t *p, int type, int len, const void *val) {
+    p[0] = (uint8_t) type;
+    p[1] = (uint8_t) (type >> 8);
+    p[2] = (uint8_t) len;
+    p[3] = (uint8_t) (len >> 8);
+    memcpy(p + PROPERTY_HEADER_LEN, val, len);
+    return p + PROPERTY_HEADER_LEN + len;
+}
+
+/**
+ * Packs the properties into a single byte[] of records
+ *     uint16_t type, uint16_t len (both little endian), val[len]
+ * Properties that do not fit that header are left out. Returns NULL if
+ * allocation failed.
+ */
+static jbyteArray pack_properties(JNIEnv *env, int num_properties, bt_property_t *properties) {
+    int total = 0;
+    for (int i = 0; i < num_properties; i++) {
+        if (property_packable(&properties[i])) total += PROPERTY_HEADER_LEN + properties[i].len;
     }
 
-    types = (jintArray)callbackEnv->NewIntArray(num_properties);
+    jbyteArray packed = env->NewByteArray(total);
+    if (packed == NULL) {
+        ALOGE("Error while allocation of array in %s", __FUNCTION__);
+        return NULL;
+    }
 
-    if (types == NULL) {
-        ALOGE("%s: Error allocating int Array for values", __FUNCTION__);
-        return;
+    uint8_t *base = (uint8_t *) env->GetPrimitiveArrayCritical(packed, NULL);
+    if (base == NULL) {
+        env->DeleteLocalRef(packed);
+        return NULL;
     }
-    // Delete the reference to val and mclass
-    callbackEnv->DeleteLocalRef(mclass);
-    callbackEnv->DeleteLocalRef(val);
+    uint8_t *p = base;
+    for (int i = 0; i < num_properties; i++) {
+        if (!property_packable(&properties[i])) {
+            ALOGE("%s: dropping property %d of length %d", __FUNCTION__, properties[i].type,
+                  properties[i].len);
+            continue;
+        }
+        p = write_property(p, properties[i].type, properties[i].len, properties[i].val);
+    }
+    env->ReleasePrimitiveArrayCritical(packed, base, 0);
+    return packed;
+}
+
+static void adapter_properties_callback(bt_status_t status, int num_properties,
+                                        bt_property_t *properties) {
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+
+    ALOGV("%s: Status is: %d, Properties: %d", __FUNCTION__, status, num_properties);
 
-    if (get_properties(num_properties, properties, &types, &props) < 0) {
-        if (props) callbackEnv->DeleteLocalRef(props);
-        if (types) callbackEnv->DeleteLocalRef(types);
+    if (status != BT_STATUS_SUCCESS) {
+        ALOGE("%s: Status %d is incorrect", __FUNCTION__, status);
         return;
     }
 
-    callbackEnv->CallVoidMethod(sJniCallbacksObj, method_adapterPropertyChangedCallback, types,
-                                props);
-    checkAndClearExceptionFromCallback(callbackEnv, __FUNCTION__);
-    callbackEnv->DeleteLocalRef(props);
-    callbackEnv->DeleteLocalRef(types);
-    return;
+    jbyteArray props = pack_properties(sCallbackEnv.get(), num_properties, properties);
+    if (props == NULL) return;
 
+    sCallbackEnv.callVoidMethod(sJniCallbacksObj, method_adapterPropertyChangedCallback, props);
 }
 
 static void remote_device_properties_callback(bt_status_t status, bt_bdaddr_t *bd_addr,
                                               int num_properties, bt_property_t *properties) {
-    if (!checkCallbackThread()) {
-       ALOGE("Callback: '%s' is not called on the correct thread", __FUNCTION__);
-       return;
-    }
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
 
     ALOGV("%s: Status is: %d, Properties: %d", __FUNCTION__, status, num_properties);
 
@@ -185,231 +460,393 @@ static void remote_device_properties_callback(bt_status_t status, bt_bdaddr_t *b
         return;
     }
 
-    callbackEnv->PushLocalFrame(ADDITIONAL_NREFS);
+    jbyteArray addr = sCallbackEnv.newAddressArray(bd_addr);
+    if (addr == NULL) return;
 
-    jobjectArray props;
-    jbyteArray addr;
-    jintArray types;
-    jbyteArray val;
-    jclass mclass;
+    jbyteArray props = pack_properties(sCallbackEnv.get(), num_properties, properties);
+    if (props == NULL) return;
 
-    val = (jbyteArray) callbackEnv->NewByteArray(num_properties);
-    if (val == NULL) {
-        ALOGE("%s: Error allocating byteArray", __FUNCTION__);
-        return;
+    sCallbackEnv.callVoidMethod(sJniCallbacksObj, method_devicePropertyChangedCallback, addr,
+                                props);
+}
+
+
+/**
+ * Discovery result aggregation
+ *
+ * When a report interval is configured, inquiry results are merged per
+ * address in a table that also records when each device was first and
+ * last seen and its latest RSSI. A result only marks its device for
+ * reporting if the device is new to this discovery or one of its
+ * properties other than RSSI changed. Marked devices are handed to Java
+ * in one devicesFoundCallback once the interval has passed since the
+ * oldest of them was marked, kept by a timer thread, and when discovery
+ * stops. A device stays marked until the upcall carrying it was made or
+ * queued, unless it changed again meanwhile. Each device is a record of
+ *     uint16_t len (little endian), bd_addr[6], packed properties
+ * with the properties as in pack_properties and RSSI last.
+ */
+
+#define DISCOVERY_MAX_DEVICES 64
+#define DISCOVERY_MAX_PROPS_LEN 480
+#define DISCOVERY_RECORD_HEADER_LEN 8
+#define DISCOVERY_RSSI_LEN (PROPERTY_HEADER_LEN + 1)
+
+typedef struct {
+    bool in_use;
+    bool pending;
+    uint32_t changed;           // sDiscoveryChanges when last marked
+    nsecs_t pending_since;
+    bt_bdaddr_t bda;
+    nsecs_t first_seen;
+    nsecs_t last_seen;
+    int8_t rssi;
+    uint32_t results;
+    uint16_t props_len;
+    uint8_t props[DISCOVERY_MAX_PROPS_LEN];     // packed, without RSSI
+} discovery_device_t;
+
+static Mutex sDiscoveryLock;
+static nsecs_t sDiscoveryInterval = 0;
+static nsecs_t sDiscoveryPendingSince = 0;
+static int sDiscoveryPending = 0;
+static uint32_t sDiscoveryChanges = 0;
+static discovery_device_t sDiscoveryDevices[DISCOVERY_MAX_DEVICES];
+// Serializes flushes, so records and the discovery state reach Java in order
+static Mutex sDiscoveryFlushLock;
+static Condition sDiscoveryCond;
+static Condition sDiscoveryExitCond;
+static bool sDiscoveryThreadRunning = false;
+static bool sDiscoveryThreadQuit = false;
+
+static discovery_device_t *discovery_device_get_l(const bt_bdaddr_t *bda) {
+    discovery_device_t *slot = NULL;
+    for (int i = 0; i < DISCOVERY_MAX_DEVICES; i++) {
+        discovery_device_t *dev = &sDiscoveryDevices[i];
+        if (!dev->in_use) {
+            if (slot == NULL || slot->in_use) slot = dev;
+            continue;
+        }
+        if (!memcmp(&dev->bda, bda, sizeof(bt_bdaddr_t))) return dev;
+        // Otherwise evict the device seen least recently that is not pending
+        if (!dev->pending && (slot == NULL || (slot->in_use && dev->last_seen < slot->last_seen))) {
+            slot = dev;
+        }
     }
+    if (slot == NULL) return NULL;
 
-    mclass = callbackEnv->GetObjectClass(val);
+    memset(slot, 0, sizeof(discovery_device_t));
+    slot->in_use = true;
+    slot->bda = *bda;
+    return slot;
+}
+
+/**
+ * Merges an inquiry result into the table. Returns -1 if the result has to
+ * be reported right away, 1 if pending devices are due for reporting and 0
+ * otherwise.
+ */
+static int discovery_merge(const bt_bdaddr_t *bda, int num_properties,
+                           bt_property_t *properties) {
+    uint8_t props[DISCOVERY_MAX_PROPS_LEN];
+    uint8_t *p = props;
+    int rssi = 0;
 
-    /* Initialize the jobjectArray and jintArray here itself and send the
-     initialized array pointers alone to get_properties */
+    Mutex::Autolock lock(sDiscoveryLock);
+    if (sDiscoveryInterval == 0) return -1;
 
-    props = callbackEnv->NewObjectArray(num_properties, mclass,
-                                             NULL);
-    if (props == NULL) {
-        ALOGE("%s: Error allocating object Array for properties", __FUNCTION__);
-        return;
+    for (int i = 0; i < num_properties; i++) {
+        if (properties[i].type == BT_PROPERTY_REMOTE_RSSI) {
+            if (properties[i].len > 0) rssi = *(int8_t *) properties[i].val;
+            continue;
+        }
+        if (p + PROPERTY_HEADER_LEN + properties[i].len > props + DISCOVERY_MAX_PROPS_LEN) {
+            return -1;
+        }
+        p = write_property(p, properties[i].type, properties[i].len, properties[i].val);
+    }
+    int len = p - props;
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    discovery_device_t *dev = discovery_device_get_l(bda);
+    if (dev == NULL) return -1;
+
+    if (dev->results == 0) dev->first_seen = now;
+    dev->last_seen = now;
+    dev->rssi = (int8_t) rssi;
+    dev->results++;
+
+    if (dev->results == 1 || len != dev->props_len || memcmp(props, dev->props, len)) {
+        memcpy(dev->props, props, len);
+        dev->props_len = len;
+        dev->changed = ++sDiscoveryChanges;
+        if (!dev->pending) {
+            dev->pending = true;
+            dev->pending_since = now;
+            if (sDiscoveryPending++ == 0) {
+                sDiscoveryPendingSince = now;
+                sDiscoveryCond.signal();
+            }
+        }
     }
+    return sDiscoveryPending > 0 && now - sDiscoveryPendingSince >= sDiscoveryInterval;
+}
 
-    types = (jintArray)callbackEnv->NewIntArray(num_properties);
+/**
+ * Hands the marked devices to Java. Works on any thread attached to the VM,
+ * the upcall is ordered behind those already posted.
+ */
+static void discovery_flush(JNIEnv *env) {
+    Mutex::Autolock flush(sDiscoveryFlushLock);
+    jbyteArray records = NULL;
+    uint32_t changes;
+    {
+        Mutex::Autolock lock(sDiscoveryLock);
+        if (sDiscoveryPending == 0) return;
+
+        int total = 0;
+        for (int i = 0; i < DISCOVERY_MAX_DEVICES; i++) {
+            discovery_device_t *dev = &sDiscoveryDevices[i];
+            if (dev->in_use && dev->pending) {
+                total += DISCOVERY_RECORD_HEADER_LEN + dev->props_len + DISCOVERY_RSSI_LEN;
+            }
+        }
 
-    if (types == NULL) {
-        ALOGE("%s: Error allocating int Array for values", __FUNCTION__);
-        return;
+        records = env->NewByteArray(total);
+        if (records == NULL) {
+            ALOGE("Error while allocation of array in %s", __FUNCTION__);
+            return;
+        }
+        uint8_t *base = (uint8_t *) env->GetPrimitiveArrayCritical(records, NULL);
+        if (base == NULL) {
+            env->DeleteLocalRef(records);
+            return;
+        }
+
+        uint8_t *p = base;
+        for (int i = 0; i < DISCOVERY_MAX_DEVICES; i++) {
+            discovery_device_t *dev = &sDiscoveryDevices[i];
+            if (!dev->in_use || !dev->pending) continue;
+
+            int len = sizeof(bt_bdaddr_t) + dev->props_len + DISCOVERY_RSSI_LEN;
+            p[0] = (uint8_t) len;
+            p[1] = (uint8_t) (len >> 8);
+            memcpy(p + 2, &dev->bda, sizeof(bt_bdaddr_t));
+            memcpy(p + DISCOVERY_RECORD_HEADER_LEN, dev->props, dev->props_len);
+            p = write_property(p + DISCOVERY_RECORD_HEADER_LEN + dev->props_len,
+                               BT_PROPERTY_REMOTE_RSSI, 1, &dev->rssi);
+        }
+        env->ReleasePrimitiveArrayCritical(records, base, 0);
+        changes = sDiscoveryChanges;
     }
-    // Delete the reference to val and mclass
-    callbackEnv->DeleteLocalRef(mclass);
-    callbackEnv->DeleteLocalRef(val);
 
-    addr = callbackEnv->NewByteArray(sizeof(bt_bdaddr_t));
-    if (addr == NULL) goto Fail;
-    if (addr) callbackEnv->SetByteArrayRegion(addr, 0, sizeof(bt_bdaddr_t), (jbyte*)bd_addr);
+    bool made = callVoidMethodOrdered(env, __FUNCTION__, sJniCallbacksObj,
+                                      method_devicesFoundCallback, records);
+    env->DeleteLocalRef(records);
+    if (!made) return;
+
+    Mutex::Autolock lock(sDiscoveryLock);
+    sDiscoveryPending = 0;
+    for (int i = 0; i < DISCOVERY_MAX_DEVICES; i++) {
+        discovery_device_t *dev = &sDiscoveryDevices[i];
+        if (!dev->in_use || !dev->pending) continue;
+        // Devices that changed again since the records were built stay marked
+        if ((int32_t) (dev->changed - changes) <= 0) {
+            dev->pending = false;
+            continue;
+        }
+        if (sDiscoveryPending++ == 0 || dev->pending_since < sDiscoveryPendingSince) {
+            sDiscoveryPendingSince = dev->pending_since;
+        }
+    }
+}
 
-    if (get_properties(num_properties, properties, &types, &props) < 0) {
-        if (props) callbackEnv->DeleteLocalRef(props);
-        if (types) callbackEnv->DeleteLocalRef(types);
-        callbackEnv->PopLocalFrame(NULL);
-        return;
+// Flushes the marked devices once the interval ran out without a further
+// result
+static void discovery_timer_thread(void *arg) {
+    JNIEnv *env = AndroidRuntime::getJNIEnv();
+
+    sDiscoveryLock.lock();
+    while (!sDiscoveryThreadQuit) {
+        if (sDiscoveryPending == 0 || sDiscoveryInterval == 0) {
+            sDiscoveryCond.wait(sDiscoveryLock);
+            continue;
+        }
+        nsecs_t wait = sDiscoveryPendingSince + sDiscoveryInterval -
+                       systemTime(SYSTEM_TIME_MONOTONIC);
+        if (wait > 0) {
+            sDiscoveryCond.waitRelative(sDiscoveryLock, wait);
+            continue;
+        }
+        nsecs_t since = sDiscoveryPendingSince;
+        sDiscoveryLock.unlock();
+        discovery_flush(env);
+        sDiscoveryLock.lock();
+        // Delivery failed, retry once the interval ran out again
+        if (sDiscoveryPending > 0 && sDiscoveryPendingSince == since) {
+            sDiscoveryPendingSince = systemTime(SYSTEM_TIME_MONOTONIC);
+        }
     }
+    sDiscoveryThreadRunning = false;
+    sDiscoveryExitCond.signal();
+    sDiscoveryLock.unlock();
+}
 
-    callbackEnv->CallVoidMethod(sJniCallbacksObj, method_devicePropertyChangedCallback, addr,
-                                types, props);
-    checkAndClearExceptionFromCallback(callbackEnv, __FUNCTION__);
-    callbackEnv->DeleteLocalRef(props);
-    callbackEnv->DeleteLocalRef(types);
-    callbackEnv->DeleteLocalRef(addr);
-    callbackEnv->PopLocalFrame(NULL);
-    return;
+static void discovery_timer_start_l() {
+    if (sDiscoveryThreadRunning) return;
+    sDiscoveryThreadQuit = false;
+    if (AndroidRuntime::createJavaThread("BT Discovery Timer Thread",
+                                         discovery_timer_thread, NULL) == 0) {
+        ALOGE("%s: failed to start the discovery timer thread", __FUNCTION__);
+        return;
+    }
+    sDiscoveryThreadRunning = true;
+}
 
-Fail:
-    ALOGE("Error while allocation byte array in %s", __FUNCTION__);
+static void discovery_timer_stop_l() {
+    if (!sDiscoveryThreadRunning) return;
+    sDiscoveryThreadQuit = true;
+    sDiscoveryCond.signal();
+    while (sDiscoveryThreadRunning) sDiscoveryExitCond.wait(sDiscoveryLock);
 }
 
+static void discovery_reset() {
+    Mutex::Autolock lock(sDiscoveryLock);
+    memset(sDiscoveryDevices, 0, sizeof(sDiscoveryDevices));
+    sDiscoveryPending = 0;
+}
 
 static void device_found_callback(int num_properties, bt_property_t *properties) {
     jbyteArray addr = NULL;
-    int addr_index;
+    int addr_index = -1;
+
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
 
     for (int i = 0; i < num_properties; i++) {
         if (properties[i].type == BT_PROPERTY_BDADDR) {
-            addr = callbackEnv->NewByteArray(properties[i].len);
-            if (addr) {
-                callbackEnv->SetByteArrayRegion(addr, 0, properties[i].len,
-                                                (jbyte*)properties[i].val);
-                addr_index = i;
-            } else {
-                ALOGE("Address is NULL (unable to allocate) in %s", __FUNCTION__);
-                return;
-            }
+            addr_index = i;
         }
     }
-    if (addr == NULL) {
+    if (addr_index < 0) {
         ALOGE("Address is NULL in %s", __FUNCTION__);
         return;
     }
 
+    int merged = discovery_merge((bt_bdaddr_t *)properties[addr_index].val,
+                                 num_properties, properties);
+    if (merged >= 0) {
+        if (merged) discovery_flush(sCallbackEnv.get());
+        return;
+    }
+
+    addr = sCallbackEnv.newAddressArray((bt_bdaddr_t *)properties[addr_index].val);
+    if (addr == NULL) return;
+
     ALOGV("%s: Properties: %d, Address: %s", __FUNCTION__, num_properties,
         (const char *)properties[addr_index].val);
 
     remote_device_properties_callback(BT_STATUS_SUCCESS, (bt_bdaddr_t *)properties[addr_index].val,
                                       num_properties, properties);
 
-    callbackEnv->CallVoidMethod(sJniCallbacksObj, method_deviceFoundCallback, addr);
-    checkAndClearExceptionFromCallback(callbackEnv, __FUNCTION__);
-    callbackEnv->DeleteLocalRef(addr);
+    sCallbackEnv.callVoidMethod(sJniCallbacksObj, method_deviceFoundCallback, addr);
 }
 
 static void bond_state_changed_callback(bt_status_t status, bt_bdaddr_t *bd_addr,
                                         bt_bond_state_t state) {
     jbyteArray addr;
-    int i;
-    if (!checkCallbackThread()) {
-       ALOGE("Callback: '%s' is not called on the correct thread", __FUNCTION__);
-       return;
-    }
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
     if (!bd_addr) {
         ALOGE("Address is null in %s", __FUNCTION__);
         return;
     }
-    addr = callbackEnv->NewByteArray(sizeof(bt_bdaddr_t));
-    if (addr == NULL) {
-       ALOGE("Address allocation failed in %s", __FUNCTION__);
-       return;
-    }
-    callbackEnv->SetByteArrayRegion(addr, 0, sizeof(bt_bdaddr_t), (jbyte *)bd_addr);
+    addr = sCallbackEnv.newAddressArray(bd_addr);
+    if (addr == NULL) return;
 
-    callbackEnv->CallVoidMethod(sJniCallbacksObj, method_bondStateChangeCallback, (jint) status,
+    sCallbackEnv.callVoidMethod(sJniCallbacksObj, method_bondStateChangeCallback, (jint) status,
                                 addr, (jint)state);
-    checkAndClearExceptionFromCallback(callbackEnv, __FUNCTION__);
-    callbackEnv->DeleteLocalRef(addr);
 }
 
 static void acl_state_changed_callback(bt_status_t status, bt_bdaddr_t *bd_addr,
                                        bt_acl_state_t state)
 {
     jbyteArray addr;
-    int i;
-    if (!checkCallbackThread()) {
-       ALOGE("Callback: '%s' is not called on the correct thread", __FUNCTION__);
-       return;
-    }
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
     if (!bd_addr) {
         ALOGE("Address is null in %s", __FUNCTION__);
         return;
     }
-    addr = callbackEnv->NewByteArray(sizeof(bt_bdaddr_t));
-    if (addr == NULL) {
-       ALOGE("Address allocation failed in %s", __FUNCTION__);
-       return;
-    }
-    callbackEnv->SetByteArrayRegion(addr, 0, sizeof(bt_bdaddr_t), (jbyte *)bd_addr);
+    addr = sCallbackEnv.newAddressArray(bd_addr);
+    if (addr == NULL) return;
 
-    callbackEnv->CallVoidMethod(sJniCallbacksObj, method_aclStateChangeCallback, (jint) status,
+    sCallbackEnv.callVoidMethod(sJniCallbacksObj, method_aclStateChangeCallback, (jint) status,
                                 addr, (jint)state);
-    checkAndClearExceptionFromCallback(callbackEnv, __FUNCTION__);
-    callbackEnv->DeleteLocalRef(addr);
 }
 
 static void discovery_state_changed_callback(bt_discovery_state_t state) {
-    jbyteArray addr;
-    if (!checkCallbackThread()) {
-       ALOGE("Callback: '%s' is not called on the correct thread", __FUNCTION__);
-       return;
-    }
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
 
     ALOGV("%s: DiscoveryState:%d ", __FUNCTION__, state);
 
-    callbackEnv->CallVoidMethod(sJniCallbacksObj, method_discoveryStateChangeCallback,
-                                (jint)state);
+    if (state == BT_DISCOVERY_STARTED) {
+        discovery_reset();
+    } else {
+        discovery_flush(sCallbackEnv.get());
+    }
 
-    checkAndClearExceptionFromCallback(callbackEnv, __FUNCTION__);
+    sCallbackEnv.callVoidMethod(sJniCallbacksObj, method_discoveryStateChangeCallback,
+                                (jint)state);
 }
 
 static void pin_request_callback(bt_bdaddr_t *bd_addr, bt_bdname_t *bdname, uint32_t cod) {
     jbyteArray addr, devname;
-    if (!checkCallbackThread()) {
-       ALOGE("Callback: '%s' is not called on the correct thread", __FUNCTION__);
-       return;
-    }
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
     if (!bd_addr) {
         ALOGE("Address is null in %s", __FUNCTION__);
         return;
     }
 
-    addr = callbackEnv->NewByteArray(sizeof(bt_bdaddr_t));
+    addr = sCallbackEnv.newAddressArray(bd_addr);
     if (addr == NULL) goto Fail;
-    callbackEnv->SetByteArrayRegion(addr, 0, sizeof(bt_bdaddr_t), (jbyte*)bd_addr);
 
-    devname = callbackEnv->NewByteArray(sizeof(bt_bdname_t));
+    devname = sCallbackEnv->NewByteArray(sizeof(bt_bdname_t));
     if (devname == NULL) goto Fail;
 
-    callbackEnv->SetByteArrayRegion(devname, 0, sizeof(bt_bdname_t), (jbyte*)bdname);
+    sCallbackEnv->SetByteArrayRegion(devname, 0, sizeof(bt_bdname_t), (jbyte*)bdname);
 
-    callbackEnv->CallVoidMethod(sJniCallbacksObj, method_pinRequestCallback, addr, devname, cod);
-
-    checkAndClearExceptionFromCallback(callbackEnv, __FUNCTION__);
-    callbackEnv->DeleteLocalRef(addr);
-    callbackEnv->DeleteLocalRef(devname);
+    sCallbackEnv.callVoidMethod(sJniCallbacksObj, method_pinRequestCallback, addr, devname, cod);
     return;
 
 Fail:
-    if (addr) callbackEnv->DeleteLocalRef(addr);
-    if (devname) callbackEnv->DeleteLocalRef(devname);
     ALOGE("Error while allocating in: %s", __FUNCTION__);
 }
 
 static void ssp_request_callback(bt_bdaddr_t *bd_addr, bt_bdname_t *bdname, uint32_t cod,
                                  bt_ssp_variant_t pairing_variant, uint32_t pass_key) {
     jbyteArray addr, devname;
-    if (!checkCallbackThread()) {
-       ALOGE("Callback: '%s' is not called on the correct thread", __FUNCTION__);
-       return;
-    }
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
     if (!bd_addr) {
         ALOGE("Address is null in %s", __FUNCTION__);
         return;
     }
 
-    addr = callbackEnv->NewByteArray(sizeof(bt_bdaddr_t));
+    addr = sCallbackEnv.newAddressArray(bd_addr);
     if (addr == NULL) goto Fail;
-    callbackEnv->SetByteArrayRegion(addr, 0, sizeof(bt_bdaddr_t), (jbyte *)bd_addr);
 
-    devname = callbackEnv->NewByteArray(sizeof(bt_bdname_t));
+    devname = sCallbackEnv->NewByteArray(sizeof(bt_bdname_t));
     if (devname == NULL) goto Fail;
-    callbackEnv->SetByteArrayRegion(devname, 0, sizeof(bt_bdname_t), (jbyte*)bdname);
+    sCallbackEnv->SetByteArrayRegion(devname, 0, sizeof(bt_bdname_t), (jbyte*)bdname);
 
-    callbackEnv->CallVoidMethod(sJniCallbacksObj, method_sspRequestCallback, addr, devname, cod,
+    sCallbackEnv.callVoidMethod(sJniCallbacksObj, method_sspRequestCallback, addr, devname, cod,
                                 (jint) pairing_variant, pass_key);
-
-    checkAndClearExceptionFromCallback(callbackEnv, __FUNCTION__);
-    callbackEnv->DeleteLocalRef(addr);
-    callbackEnv->DeleteLocalRef(devname);
     return;
 
 Fail:
-    if (addr) callbackEnv->DeleteLocalRef(addr);
-    if (devname) callbackEnv->DeleteLocalRef(devname);
-
     ALOGE("Error while allocating in: %s", __FUNCTION__);
 }
 
@@ -422,13 +859,18 @@ static void callback_thread_event(bt_cb_thread_evt event) {
         args.name = name;
         args.group = NULL;
         vm->AttachCurrentThread(&callbackEnv, &args);
+        sCallbackThread = pthread_self();
         ALOGV("Callback thread attached: %p", callbackEnv);
+        startCallbackDispatcher();
     } else if (event == DISASSOCIATE_JVM) {
-        if (!checkCallbackThread()) {
+        if (!isCallbackThread()) {
             ALOGE("Callback: '%s' is not called on the correct thread", __FUNCTION__);
             return;
         }
+        stopCallbackDispatcher();
+        CallbackEnv::clearAddressCache(callbackEnv);
         vm->DetachCurrentThread();
+        callbackEnv = NULL;
     }
 }
 
@@ -456,6 +898,19 @@ bt_callbacks_t sBluetoothCallbacks = {
     le_test_mode_recv_callback
 };
 
+static const callback_method_t sCallbackMethods[] = {
+    {&method_stateChangeCallback, "stateChangeCallback", "(I)V"},
+    {&method_adapterPropertyChangedCallback, "adapterPropertyChangedCallback", "([B)V"},
+    {&method_discoveryStateChangeCallback, "discoveryStateChangeCallback", "(I)V"},
+    {&method_devicePropertyChangedCallback, "devicePropertyChangedCallback", "([B[B)V"},
+    {&method_deviceFoundCallback, "deviceFoundCallback", "([B)V"},
+    {&method_devicesFoundCallback, "devicesFoundCallback", "([B)V"},
+    {&method_pinRequestCallback, "pinRequestCallback", "([B[BI)V"},
+    {&method_sspRequestCallback, "sspRequestCallback", "([B[BIII)V"},
+    {&method_bondStateChangeCallback, "bondStateChangeCallback", "(I[BI)V"},
+    {&method_aclStateChangeCallback, "aclStateChangeCallback", "(I[BI)V"},
+};
+
 static void classInitNative(JNIEnv* env, jclass clazz) {
     int err;
     hw_module_t* module;
@@ -465,28 +920,11 @@ static void classInitNative(JNIEnv* env, jclass clazz) {
     sJniCallbacksField = env->GetFieldID(clazz, "mJniCallbacks",
         "Lcom/android/bluetooth/btservice/JniCallbacks;");
 
-    method_stateChangeCallback = env->GetMethodID(jniCallbackClass, "stateChangeCallback", "(I)V");
-
-    method_adapterPropertyChangedCallback = env->GetMethodID(jniCallbackClass,
-                                                             "adapterPropertyChangedCallback",
-                                                             "([I[[B)V");
-    method_discoveryStateChangeCallback = env->GetMethodID(jniCallbackClass,
-                                                           "discoveryStateChangeCallback", "(I)V");
-
-    method_devicePropertyChangedCallback = env->GetMethodID(jniCallbackClass,
-                                                            "devicePropertyChangedCallback",
-                                                            "([B[I[[B)V");
-    method_deviceFoundCallback = env->GetMethodID(jniCallbackClass, "deviceFoundCallback", "([B)V");
-    method_pinRequestCallback = env->GetMethodID(jniCallbackClass, "pinRequestCallback",
-                                                 "([B[BI)V");
-    method_sspRequestCallback = env->GetMethodID(jniCallbackClass, "sspRequestCallback",
-                                                 "([B[BIII)V");
-
-    method_bondStateChangeCallback = env->GetMethodID(jniCallbackClass,
-                                                     "bondStateChangeCallback", "(I[BI)V");
+    if (!getCallbackMethodIDs(env, jniCallbackClass, sCallbackMethods, NELEM(sCallbackMethods))) {
+        ALOGE("%s: Missing callback methods", __FUNCTION__);
+        return;
+    }
 
-    method_aclStateChangeCallback = env->GetMethodID(jniCallbackClass,
-                                                    "aclStateChangeCallback", "(I[BI)V");
     char value[PROPERTY_VALUE_MAX];
     property_get("bluetooth.mock_stack", value, "");
 
@@ -535,6 +973,11 @@ static bool cleanupNative(JNIEnv *env, jobject obj) {
     jboolean result = JNI_FALSE;
     if (!sBluetoothInterface) return result;
 
+    sock_pool_reset(true);
+    {
+        Mutex::Autolock lock(sDiscoveryLock);
+        discovery_timer_stop_l();
+    }
     sBluetoothInterface->cleanup();
     ALOGI("%s: return from cleanup",__FUNCTION__);
 
@@ -611,6 +1054,33 @@ static jboolean createBondNative(JNIEnv* env, jobject obj, jbyteArray address) {
     return result;
 }
 
+static void dump_discovery(String8 &result) {
+    Mutex::Autolock lock(sDiscoveryLock);
+    if (sDiscoveryInterval == 0) return;
+
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    result.append("\nDiscovered devices\n");
+    result.appendFormat("  %-17s %10s %10s %5s %8s\n", "address", "first(ms)", "last(ms)",
+                        "rssi", "results");
+    for (int i = 0; i < DISCOVERY_MAX_DEVICES; i++) {
+        discovery_device_t *dev = &sDiscoveryDevices[i];
+        if (!dev->in_use) continue;
+        const uint8_t *a = dev->bda.address;
+        result.appendFormat("  %02X:%02X:%02X:%02X:%02X:%02X %10lld %10lld %5d %8u\n",
+                            a[0], a[1], a[2], a[3], a[4], a[5],
+                            (long long) ns2ms(now - dev->first_seen),
+                            (long long) ns2ms(now - dev->last_seen), dev->rssi, dev->results);
+    }
+}
+
+static jstring dumpCallbackStatsNative(JNIEnv* env, jobject obj) {
+    String8 result;
+
+    dumpCallbackStats(result);
+    dump_discovery(result);
+    return env->NewStringUTF(result.string());
+}
+
 static jboolean removeBondNative(JNIEnv* env, jobject obj, jbyteArray address) {
     ALOGV("%s:",__FUNCTION__);
 
@@ -827,82 +1297,212 @@ static jboolean getRemoteServicesNative(JNIEnv *env, jobject obj, jbyteArray add
 
 static int connectSocketNative(JNIEnv *env, jobject object, jbyteArray address, jint type,
                                    jbyteArray uuidObj, jint channel, jint flag) {
-    jbyte *addr = NULL, *uuid = NULL;
-    int socket_fd;
-    bt_status_t status;
+    bt_bdaddr_t bd_addr;
+    uint8_t uuid[SOCK_UUID_LEN];
 
     if (!sBluetoothSocketInterface) return -1;
 
-    addr = env->GetByteArrayElements(address, NULL);
-    if (!addr) {
+    env->GetByteArrayRegion(address, 0, SOCK_ADDRESS_LEN, (jbyte *) &bd_addr);
+    if (env->ExceptionCheck()) {
         ALOGE("failed to get Bluetooth device address");
-        goto Fail;
+        env->ExceptionClear();
+        return -1;
     }
 
-    uuid = env->GetByteArrayElements(uuidObj, NULL);
-    if (!uuid) {
+    env->GetByteArrayRegion(uuidObj, 0, SOCK_UUID_LEN, (jbyte *) uuid);
+    if (env->ExceptionCheck()) {
         ALOGE("failed to get uuid");
-        goto Fail;
+        env->ExceptionClear();
+        return -1;
     }
 
-    if ( (status = sBluetoothSocketInterface->connect((bt_bdaddr_t *) addr, (btsock_type_t) type,
-                       (const uint8_t*) uuid, channel, &socket_fd, flag)) != BT_STATUS_SUCCESS) {
-        ALOGE("Socket connection failed: %d", status);
-        goto Fail;
-    }
+    return sock_connect(&bd_addr, type, uuid, channel, flag);
+}
 
+static int createSocketChannelNative(JNIEnv *env, jobject object, jint type,
+                                     jstring name_str, jbyteArray uuidObj, jint channel, jint flag) {
+    const char *service_name = NULL;
+    uint8_t uuid[SOCK_UUID_LEN];
+    int socket_fd;
 
-    if (socket_fd < 0) {
-        ALOGE("Fail to creat file descriptor on socket fd");
-        goto Fail;
+    if (!sBluetoothSocketInterface) return -1;
+
+    env->GetByteArrayRegion(uuidObj, 0, SOCK_UUID_LEN, (jbyte *) uuid);
+    if (env->ExceptionCheck()) {
+        ALOGE("failed to get uuid");
+        env->ExceptionClear();
+        return -1;
     }
-    env->ReleaseByteArrayElements(address, addr, 0);
-    env->ReleaseByteArrayElements(uuidObj, uuid, 0);
+
+    if (name_str) service_name = env->GetStringUTFChars(name_str, NULL);
+
+    socket_fd = sock_pool_listen(type, service_name, uuid, channel, flag);
+
+    if (service_name) env->ReleaseStringUTFChars(name_str, service_name);
     return socket_fd;
+}
 
-Fail:
-    if (addr) env->ReleaseByteArrayElements(address, addr, 0);
-    if (uuid) env->ReleaseByteArrayElements(uuidObj, uuid, 0);
+/**
+ * Connects count sockets, the address and UUID of socket i at offset
+ * i * 6 of addresses and i * 16 of uuids. Returns the fds, -1 for each
+ * socket that failed, or NULL if the arguments do not match.
+ */
+static jintArray connectSocketsNative(JNIEnv *env, jobject object, jbyteArray addresses,
+                                      jint type, jbyteArray uuids, jintArray channels, jint flag) {
+    bt_bdaddr_t bd_addrs[SOCK_MAX_BATCH];
+    uint8_t uuid[SOCK_MAX_BATCH][SOCK_UUID_LEN];
+    jint channel[SOCK_MAX_BATCH];
+    jint fds[SOCK_MAX_BATCH];
+
+    if (!sBluetoothSocketInterface) return NULL;
+
+    jsize count = env->GetArrayLength(channels);
+    if (count > SOCK_MAX_BATCH ||
+        env->GetArrayLength(addresses) != count * SOCK_ADDRESS_LEN ||
+        env->GetArrayLength(uuids) != count * SOCK_UUID_LEN) {
+        jniThrowException(env, "java/lang/IllegalArgumentException", "bad socket batch");
+        return NULL;
+    }
+
+    env->GetByteArrayRegion(addresses, 0, count * SOCK_ADDRESS_LEN, (jbyte *) bd_addrs);
+    env->GetByteArrayRegion(uuids, 0, count * SOCK_UUID_LEN, (jbyte *) uuid);
+    env->GetIntArrayRegion(channels, 0, count, channel);
+
+    for (int i = 0; i < count; i++) {
+        fds[i] = sock_connect(&bd_addrs[i], type, uuid[i], channel[i], flag);
+    }
 
-    return -1;
+    jintArray result = env->NewIntArray(count);
+    if (result == NULL) {
+        for (int i = 0; i < count; i++) {
+            if (fds[i] >= 0) close(fds[i]);
+        }
+        return NULL;
+    }
+    env->SetIntArrayRegion(result, 0, count, fds);
+    return result;
 }
 
-static int createSocketChannelNative(JNIEnv *env, jobject object, jint type,
-                                     jstring name_str, jbyteArray uuidObj, jint channel, jint flag) {
-    const char *service_name;
-    jbyte *uuid = NULL;
-    int socket_fd;
-    bt_status_t status;
+/**
+ * Sets up count listening channels, the UUID of channel i at offset i * 16
+ * of uuids, taking them out of the pool where possible. Returns the fds, -1
+ * for each channel that failed, or NULL if the arguments do not match.
+ */
+static jintArray createSocketChannelsNative(JNIEnv *env, jobject object, jint type,
+                                            jobjectArray names, jbyteArray uuids,
+                                            jintArray channels, jint flag) {
+    uint8_t uuid[SOCK_MAX_BATCH][SOCK_UUID_LEN];
+    jint channel[SOCK_MAX_BATCH];
+    jint fds[SOCK_MAX_BATCH];
+
+    if (!sBluetoothSocketInterface) return NULL;
+
+    jsize count = env->GetArrayLength(channels);
+    if (count > SOCK_MAX_BATCH || env->GetArrayLength(names) != count ||
+        env->GetArrayLength(uuids) != count * SOCK_UUID_LEN) {
+        jniThrowException(env, "java/lang/IllegalArgumentException", "bad socket batch");
+        return NULL;
+    }
 
-    if (!sBluetoothSocketInterface) return -1;
+    env->GetByteArrayRegion(uuids, 0, count * SOCK_UUID_LEN, (jbyte *) uuid);
+    env->GetIntArrayRegion(channels, 0, count, channel);
+
+    for (int i = 0; i < count; i++) {
+        jstring name_str = (jstring) env->GetObjectArrayElement(names, i);
+        const char *service_name = NULL;
+        if (name_str) service_name = env->GetStringUTFChars(name_str, NULL);
+
+        fds[i] = sock_pool_listen(type, service_name, uuid[i], channel[i], flag);
 
-    service_name = env->GetStringUTFChars(name_str, NULL);
+        if (service_name) env->ReleaseStringUTFChars(name_str, service_name);
+        if (name_str) env->DeleteLocalRef(name_str);
+    }
+
+    jintArray result = env->NewIntArray(count);
+    if (result == NULL) {
+        for (int i = 0; i < count; i++) {
+            if (fds[i] >= 0) close(fds[i]);
+        }
+        return NULL;
+    }
+    env->SetIntArrayRegion(result, 0, count, fds);
+    return result;
+}
+
+/**
+ * Pools the next listening channel of the service, depth is capped at
+ * SOCK_POOL_MAX_DEPTH, or drops the pool of the service for a depth of 0.
+ * Returns false if there is no room for another service.
+ */
+static jboolean configSocketPoolNative(JNIEnv *env, jobject object, jint type, jstring name_str,
+                                       jbyteArray uuidObj, jint channel, jint flag, jint depth) {
+    ALOGV("%s:",__FUNCTION__);
+
+    if (!sBluetoothSocketInterface) return JNI_FALSE;
 
-    uuid = env->GetByteArrayElements(uuidObj, NULL);
-    if (!uuid) {
+    uint8_t uuid[SOCK_UUID_LEN];
+    env->GetByteArrayRegion(uuidObj, 0, SOCK_UUID_LEN, (jbyte *) uuid);
+    if (env->ExceptionCheck()) {
         ALOGE("failed to get uuid");
-        goto Fail;
+        env->ExceptionClear();
+        return JNI_FALSE;
     }
-    ALOGE("SOCK FLAG = %x ***********************",flag);
-    if ( (status = sBluetoothSocketInterface->listen((btsock_type_t) type, service_name,
-                       (const uint8_t*) uuid, channel, &socket_fd, flag)) != BT_STATUS_SUCCESS) {
-        ALOGE("Socket listen failed: %d", status);
-        goto Fail;
+    if (depth > SOCK_POOL_MAX_DEPTH) depth = SOCK_POOL_MAX_DEPTH;
+
+    Mutex::Autolock lock(sSockPoolLock);
+    sock_pool_t *pool = sock_pool_find_l(type, NULL, uuid, channel, flag);
+    if (pool == NULL) {
+        if (depth <= 0) return JNI_TRUE;
+        for (int i = 0; i < SOCK_POOL_MAX_SERVICES && pool == NULL; i++) {
+            if (!sSockPool[i].in_use) pool = &sSockPool[i];
+        }
+        if (pool == NULL) {
+            ALOGE("%s: No room to pool another service", __FUNCTION__);
+            return JNI_FALSE;
+        }
     }
 
-    if (socket_fd < 0) {
-        ALOGE("Fail to creat file descriptor on socket fd");
-        goto Fail;
+    sock_pool_flush_l(pool);
+    pool->in_use = depth > 0;
+    pool->refill_failed = false;
+    pool->server_open = false;
+    pool->lingering = false;
+    pool->generation = ++sSockPoolGeneration;
+    pool->type = type;
+    pool->channel = channel;
+    pool->flag = flag;
+    pool->depth = depth;
+    memcpy(pool->uuid, uuid, SOCK_UUID_LEN);
+    pool->service_name[0] = '\0';
+    if (name_str) {
+        const char *service_name = env->GetStringUTFChars(name_str, NULL);
+        if (service_name) {
+            strncpy(pool->service_name, service_name, SOCK_SERVICE_NAME_LEN - 1);
+            pool->service_name[SOCK_SERVICE_NAME_LEN - 1] = '\0';
+            env->ReleaseStringUTFChars(name_str, service_name);
+        }
     }
-    if (service_name) env->ReleaseStringUTFChars(name_str, service_name);
-    if (uuid) env->ReleaseByteArrayElements(uuidObj, uuid, 0);
-    return socket_fd;
 
-Fail:
-    if (service_name) env->ReleaseStringUTFChars(name_str, service_name);
-    if (uuid) env->ReleaseByteArrayElements(uuidObj, uuid, 0);
+    if (pool->in_use) sock_pool_start_l();
+    sSockPoolCond.signal();
+    return JNI_TRUE;
+}
+
+static void configAsyncCallbacksNative(JNIEnv* env, jobject obj, jboolean enable) {
+    ALOGV("%s:",__FUNCTION__);
+
+    setAsyncCallbacks(enable == JNI_TRUE);
+}
+
+static void configDiscoveryAggregationNative(JNIEnv* env, jobject obj, jint interval_ms) {
+    ALOGV("%s:",__FUNCTION__);
 
-    return -1;
+    Mutex::Autolock lock(sDiscoveryLock);
+    sDiscoveryInterval = interval_ms > 0 ? milliseconds_to_nanoseconds(interval_ms) : 0;
+    memset(sDiscoveryDevices, 0, sizeof(sDiscoveryDevices));
+    sDiscoveryPending = 0;
+    if (sDiscoveryInterval > 0) discovery_timer_start_l();
+    sDiscoveryCond.signal();
 }
 
 static jboolean configHciSnoopLogNative(JNIEnv* env, jobject obj, jboolean enable) {
@@ -942,7 +1542,14 @@ static JNINativeMethod sMethods[] = {
     {"connectSocketNative", "([BI[BII)I", (void*) connectSocketNative},
     {"createSocketChannelNative", "(ILjava/lang/String;[BII)I",
      (void*) createSocketChannelNative},
-    {"configHciSnoopLogNative", "(Z)Z", (void*) configHciSnoopLogNative}
+    {"connectSocketsNative", "([BI[B[II)[I", (void*) connectSocketsNative},
+    {"createSocketChannelsNative", "(I[Ljava/lang/String;[B[II)[I",
+     (void*) createSocketChannelsNative},
+    {"configSocketPoolNative", "(ILjava/lang/String;[BIII)Z", (void*) configSocketPoolNative},
+    {"configHciSnoopLogNative", "(Z)Z", (void*) configHciSnoopLogNative},
+    {"dumpCallbackStatsNative", "()Ljava/lang/String;", (void*) dumpCallbackStatsNative},
+    {"configAsyncCallbacksNative", "(Z)V", (void*) configAsyncCallbacksNative},
+    {"configDiscoveryAggregationNative", "(I)V", (void*) configDiscoveryAggregationNative}
 };
 
 int register_com_android_bluetooth_btservice_AdapterService(JNIEnv* env)
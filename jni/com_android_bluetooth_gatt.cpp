@@ -19,18 +19,23 @@
 
 #define LOG_NDEBUG 0
 
-#define CHECK_CALLBACK_ENV                                                      \
-   if (!checkCallbackThread()) {                                                \
-       error("Callback: '%s' is not called on the correct thread", __FUNCTION__);\
-       return;                                                                  \
-   }
-
 #include "com_android_bluetooth.h"
 #include "hardware/bt_gatt.h"
+#include "utils/Condition.h"
 #include "utils/Log.h"
+#include "utils/Mutex.h"
+#include "utils/Timers.h"
 #include "android_runtime/AndroidRuntime.h"
 
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <cutils/log.h>
 #define info(fmt, ...)  ALOGI ("%s(L%d): " fmt,__FUNCTION__, __LINE__,  ## __VA_ARGS__)
@@ -40,6 +45,7 @@
 #define asrt(s) if(!(s)) ALOGE ("%s(L%d): ASSERT %s failed! ##",__FUNCTION__, __LINE__, #s)
 
 #define BD_ADDR_LEN 6
+#define SCAN_ADV_DATA_LEN 62
 
 #define UUID_PARAMS(uuid_ptr) \
     uuid_lsb(uuid_ptr),  uuid_msb(uuid_ptr)
@@ -54,143 +60,1639 @@
     GATT_ID_PARAMS((&srvc_ptr->id))
 
 
+/**
+ * UUID codec
+ *
+ * Java hands UUIDs over as two longs and bt_uuid_t holds the same 128 bits
+ * little endian, so each half is a single 64 bit load or store on little
+ * endian targets. The byte offset is a template argument so the accessors
+ * reduce to a constant-offset copy.
+ */
+#define BASE_UUID_LSB 0x800000805F9B34FBULL
+#define BASE_UUID_MSB 0x0000000000001000ULL
+#define BASE_UUID_16BIT_MASK 0x0000FFFF00000000ULL
+
+template <int OFFSET>
+static inline uint64_t uuid_load(const uint8_t* uu)
+{
+    uint64_t v;
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+    memcpy(&v, uu + OFFSET, sizeof(v));
+#else
+    v = 0;
+    for (int i = 7; i >= 0; i--) v = (v << 8) | uu[OFFSET + i];
+#endif
+    return v;
+}
+
+template <int OFFSET>
+static inline void uuid_store(uint8_t* uu, uint64_t v)
+{
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+    memcpy(uu + OFFSET, &v, sizeof(v));
+#else
+    for (int i = 0; i != 8; ++i) uu[OFFSET + i] = (v >> (8 * i)) & 0xFF;
+#endif
+}
+
 static void set_uuid(uint8_t* uuid, jlong uuid_msb, jlong uuid_lsb)
 {
-    for (int i = 0; i != 8; ++i)
+    uuid_store<0>(uuid, uuid_lsb);
+    uuid_store<8>(uuid, uuid_msb);
+}
+
+static uint64_t uuid_lsb(bt_uuid_t* uuid)
+{
+    return uuid_load<0>(uuid->uu);
+}
+
+static uint64_t uuid_msb(bt_uuid_t* uuid)
+{
+    return uuid_load<8>(uuid->uu);
+}
+
+// Returns the 16 bit alias of a uuid derived from the Bluetooth base uuid, or -1
+static int uuid_16bit(const bt_uuid_t* uuid)
+{
+    if (uuid_load<0>(uuid->uu) != BASE_UUID_LSB) return -1;
+    uint64_t msb = uuid_load<8>(uuid->uu);
+    if ((msb & ~BASE_UUID_16BIT_MASK) != BASE_UUID_MSB) return -1;
+    return (int) ((msb & BASE_UUID_16BIT_MASK) >> 32);
+}
+
+static void bd_addr_str_to_addr(const char* str, uint8_t *bd_addr)
+{
+    int    i;
+    char   c;
+
+    c = *str++;
+    for (i = 0; i < BD_ADDR_LEN; i++)
+    {
+        if (c >= '0' && c <= '9')
+            bd_addr[i] = c - '0';
+        else if (c >= 'a' && c <= 'z')
+            bd_addr[i] = c - 'a' + 10;
+        else   // (c >= 'A' && c <= 'Z')
+            bd_addr[i] = c - 'A' + 10;
+
+        c = *str++;
+        if (c != ':')
+        {
+            bd_addr[i] <<= 4;
+            if (c >= '0' && c <= '9')
+                bd_addr[i] |= c - '0';
+            else if (c >= 'a' && c <= 'z')
+                bd_addr[i] |= c - 'a' + 10;
+            else   // (c >= 'A' && c <= 'Z')
+                bd_addr[i] |= c - 'A' + 10;
+
+            c = *str++;
+        }
+
+        c = *str++;
+    }
+}
+
+static void jstr2bdaddr(JNIEnv* env, bt_bdaddr_t *bda, jstring address)
+{
+    const char* c_bda = env->GetStringUTFChars(address, NULL);
+    if (c_bda != NULL && bda != NULL && strlen(c_bda) == 17)
     {
-        uuid[i]     = (uuid_lsb >> (8 * i)) & 0xFF;
-        uuid[i + 8] = (uuid_msb >> (8 * i)) & 0xFF;
+        bd_addr_str_to_addr(c_bda, bda->address);
+        env->ReleaseStringUTFChars(address, c_bda);
     }
 }
 
-static uint64_t uuid_lsb(bt_uuid_t* uuid)
+namespace android {
+
+/**
+ * Client callback methods
+ */
+
+static jmethodID method_onClientRegistered;
+static jmethodID method_onScanResult;
+static jmethodID method_onBatchScanResults;
+static jmethodID method_onConnected;
+static jmethodID method_onDisconnected;
+static jmethodID method_onReadCharacteristic;
+static jmethodID method_onWriteCharacteristic;
+static jmethodID method_onExecuteCompleted;
+static jmethodID method_onSearchCompleted;
+static jmethodID method_onSearchResult;
+static jmethodID method_onReadDescrExtProp;
+static jmethodID method_onReadDescriptor;
+static jmethodID method_onWriteDescriptor;
+static jmethodID method_onNotify;
+static jmethodID method_onNotifyBatch;
+static jmethodID method_onDatabaseDiscovered;
+static jmethodID method_onWriteBatchCompleted;
+static jmethodID method_onGetCharacteristic;
+static jmethodID method_onGetDescriptor;
+static jmethodID method_onGetIncludedService;
+static jmethodID method_onRegisterForNotifications;
+static jmethodID method_onReadRemoteRssi;
+static jmethodID method_onAdvertiseCallback;
+
+/**
+ * Server callback methods
+ */
+static jmethodID method_onServerRegistered;
+static jmethodID method_onClientConnected;
+static jmethodID method_onServiceAdded;
+static jmethodID method_onIncludedServiceAdded;
+static jmethodID method_onCharacteristicAdded;
+static jmethodID method_onDescriptorAdded;
+static jmethodID method_onServiceStarted;
+static jmethodID method_onServiceStopped;
+static jmethodID method_onServiceDeleted;
+static jmethodID method_onResponseSendCompleted;
+static jmethodID method_onAttributeRead;
+static jmethodID method_onAttributeWrite;
+static jmethodID method_onExecuteWrite;
+
+/**
+ * Static variables
+ */
+
+static const btgatt_interface_t *sGattIf = NULL;
+static jobject mCallbacksObj = NULL;
+
+/**
+ * Batched scan result delivery
+ *
+ * When enabled, scan results are accumulated in a ring buffer and handed to
+ * Java as one packed array of scan_batch_record_t once either the configured
+ * number of results or the configured delay since the oldest pending result
+ * is reached. The delay is kept by a timer thread, so the batch also goes out
+ * when no further result arrives. Pending results are also flushed when
+ * scanning stops.
+ */
+
+#define SCAN_BATCH_MAX_RESULTS 256
+
+typedef struct {
+    uint8_t bda[BD_ADDR_LEN];
+    int8_t  rssi;
+    uint8_t adv_data[SCAN_ADV_DATA_LEN];
+} scan_batch_record_t;
+
+static Mutex sScanBatchLock;
+static scan_batch_record_t sScanBatch[SCAN_BATCH_MAX_RESULTS];
+static int sScanBatchHead = 0;
+static int sScanBatchCount = 0;
+static int sScanBatchSize = 0;          // 0: batching disabled
+static nsecs_t sScanBatchMaxDelay = 0;
+static nsecs_t sScanBatchOldest = 0;
+static Condition sScanBatchCond;
+static Condition sScanBatchExitCond;
+static bool sScanBatchThreadRunning = false;
+static bool sScanBatchThreadQuit = false;
+
+static void scan_batch_flush(JNIEnv* env);
+
+/**
+ * Queues a scan result if batching is enabled.
+ * Returns -1 if batching is disabled, 1 if the batch is due for delivery
+ * and 0 otherwise.
+ */
+static int scan_batch_add(bt_bdaddr_t* bda, int rssi, uint8_t* adv_data)
+{
+    Mutex::Autolock lock(sScanBatchLock);
+    if (sScanBatchSize == 0) return -1;
+
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    if (sScanBatchCount == SCAN_BATCH_MAX_RESULTS) {
+        // Previous delivery failed; drop the oldest result
+        sScanBatchHead = (sScanBatchHead + 1) % SCAN_BATCH_MAX_RESULTS;
+        --sScanBatchCount;
+    }
+    if (sScanBatchCount == 0) {
+        sScanBatchOldest = now;
+        if (sScanBatchMaxDelay > 0) sScanBatchCond.signal();
+    }
+
+    scan_batch_record_t *rec =
+        &sScanBatch[(sScanBatchHead + sScanBatchCount) % SCAN_BATCH_MAX_RESULTS];
+    memcpy(rec->bda, bda->address, BD_ADDR_LEN);
+    rec->rssi = (int8_t) rssi;
+    memcpy(rec->adv_data, adv_data, SCAN_ADV_DATA_LEN);
+    ++sScanBatchCount;
+
+    if (sScanBatchCount >= sScanBatchSize) return 1;
+    if (sScanBatchMaxDelay > 0 && now - sScanBatchOldest >= sScanBatchMaxDelay) return 1;
+    return 0;
+}
+
+static void scan_batch_flush(JNIEnv* env)
 {
-    uint64_t  lsb = 0;
-    int i;
+    jbyteArray jb;
+    int num_results;
 
-    for (i = 7; i >= 0; i--)
     {
-        lsb <<= 8;
-        lsb |= uuid->uu[i];
+        Mutex::Autolock lock(sScanBatchLock);
+        num_results = sScanBatchCount;
+        if (num_results == 0 || mCallbacksObj == NULL) return;
+
+        jb = env->NewByteArray(num_results * sizeof(scan_batch_record_t));
+        if (jb == NULL) {
+            error("Failed to allocate scan batch of %d results", num_results);
+            checkAndClearExceptionFromCallback(env, __FUNCTION__);
+            return;
+        }
+
+        int first = SCAN_BATCH_MAX_RESULTS - sScanBatchHead;
+        if (first > num_results) first = num_results;
+        env->SetByteArrayRegion(jb, 0, first * sizeof(scan_batch_record_t),
+                                (jbyte *) &sScanBatch[sScanBatchHead]);
+        if (num_results > first) {
+            env->SetByteArrayRegion(jb, first * sizeof(scan_batch_record_t),
+                                    (num_results - first) * sizeof(scan_batch_record_t),
+                                    (jbyte *) &sScanBatch[0]);
+        }
+        sScanBatchHead = 0;
+        sScanBatchCount = 0;
     }
 
-    return lsb;
+    callVoidMethodOrdered(env, __FUNCTION__, mCallbacksObj, method_onBatchScanResults,
+                          num_results, jb);
+    env->DeleteLocalRef(jb);
 }
 
-static uint64_t uuid_msb(bt_uuid_t* uuid)
+// Flushes the batch once its delay ran out without a further result
+static void scan_batch_timer_thread(void *arg)
 {
-    uint64_t msb = 0;
-    int i;
+    JNIEnv *env = AndroidRuntime::getJNIEnv();
 
-    for (i = 15; i >= 8; i--)
+    sScanBatchLock.lock();
+    while (!sScanBatchThreadQuit)
     {
-        msb <<= 8;
-        msb |= uuid->uu[i];
+        if (sScanBatchCount == 0 || sScanBatchMaxDelay == 0)
+        {
+            sScanBatchCond.wait(sScanBatchLock);
+            continue;
+        }
+        nsecs_t wait = sScanBatchOldest + sScanBatchMaxDelay - systemTime(SYSTEM_TIME_MONOTONIC);
+        if (wait > 0)
+        {
+            sScanBatchCond.waitRelative(sScanBatchLock, wait);
+            continue;
+        }
+        nsecs_t oldest = sScanBatchOldest;
+        sScanBatchLock.unlock();
+        scan_batch_flush(env);
+        sScanBatchLock.lock();
+        // Delivery failed, retry once the delay ran out again
+        if (sScanBatchCount > 0 && sScanBatchOldest == oldest)
+            sScanBatchOldest = systemTime(SYSTEM_TIME_MONOTONIC);
     }
+    sScanBatchThreadRunning = false;
+    sScanBatchExitCond.signal();
+    sScanBatchLock.unlock();
+}
 
-    return msb;
+static void scan_batch_timer_start_l()
+{
+    if (sScanBatchThreadRunning) return;
+    sScanBatchThreadQuit = false;
+    if (AndroidRuntime::createJavaThread("BT GATT Scan Batch Timer Thread",
+                                         scan_batch_timer_thread, NULL) == 0)
+    {
+        error("Failed to start the scan batch timer thread");
+        return;
+    }
+    sScanBatchThreadRunning = true;
 }
 
-static void bd_addr_str_to_addr(const char* str, uint8_t *bd_addr)
+static void scan_batch_timer_stop_l()
 {
-    int    i;
-    char   c;
+    if (!sScanBatchThreadRunning) return;
+    sScanBatchThreadQuit = true;
+    sScanBatchCond.signal();
+    while (sScanBatchThreadRunning) sScanBatchExitCond.wait(sScanBatchLock);
+}
 
-    c = *str++;
-    for (i = 0; i < BD_ADDR_LEN; i++)
+/**
+ * Scan result duplicate filter
+ *
+ * When enabled, a result whose advertising data is unchanged since the last
+ * report for the same device is suppressed for the configured window, unless
+ * its RSSI moved by at least the configured threshold. Runs ahead of batching
+ * and of any JNI allocation.
+ */
+
+#define SCAN_DEDUP_MAX_DEVICES 64
+
+typedef struct {
+    bt_bdaddr_t bda;
+    uint32_t adv_hash;
+    int rssi;
+    nsecs_t reported;
+    bool in_use;
+} scan_dedup_entry_t;
+
+static Mutex sScanDedupLock;
+static scan_dedup_entry_t sScanDedup[SCAN_DEDUP_MAX_DEVICES];
+static nsecs_t sScanDedupWindow = 0;    // 0: filtering disabled
+static int sScanDedupRssiThreshold = 0;
+
+static uint32_t scan_adv_hash(uint8_t* adv_data)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i != SCAN_ADV_DATA_LEN; ++i)
+    {
+        hash ^= adv_data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void scan_dedup_reset()
+{
+    Mutex::Autolock lock(sScanDedupLock);
+    memset(sScanDedup, 0, sizeof(sScanDedup));
+}
+
+/**
+ * Returns true if the result duplicates the last one reported for this
+ * device and should be dropped.
+ */
+static bool scan_dedup_check(bt_bdaddr_t* bda, int rssi, uint8_t* adv_data)
+{
+    Mutex::Autolock lock(sScanDedupLock);
+    if (sScanDedupWindow == 0) return false;
+
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    uint32_t hash = scan_adv_hash(adv_data);
+    scan_dedup_entry_t *entry = NULL;
+    scan_dedup_entry_t *oldest = &sScanDedup[0];
+
+    for (int i = 0; i != SCAN_DEDUP_MAX_DEVICES; ++i)
+    {
+        scan_dedup_entry_t *e = &sScanDedup[i];
+        if (!e->in_use) {
+            if (oldest->in_use) oldest = e;
+            continue;
+        }
+        if (!memcmp(&e->bda, bda, sizeof(bt_bdaddr_t))) {
+            entry = e;
+            break;
+        }
+        if (oldest->in_use && e->reported < oldest->reported) oldest = e;
+    }
+
+    if (entry != NULL && entry->adv_hash == hash
+            && now - entry->reported < sScanDedupWindow) {
+        int delta = rssi - entry->rssi;
+        if (delta < 0) delta = -delta;
+        // A threshold of 0 suppresses RSSI-only changes entirely
+        if (sScanDedupRssiThreshold == 0 || delta < sScanDedupRssiThreshold)
+            return true;
+    }
+
+    if (entry == NULL) {
+        entry = oldest;
+        memcpy(&entry->bda, bda, sizeof(bt_bdaddr_t));
+        entry->in_use = true;
+    }
+    entry->adv_hash = hash;
+    entry->rssi = rssi;
+    entry->reported = now;
+    return false;
+}
+
+/**
+ * Notification fast path
+ *
+ * Java may register a direct ByteBuffer as a ring for the notifications of
+ * one characteristic on one connection. Each notification is copied into
+ * the ring as a record of
+ *     uint16_t length (little endian), uint8_t is_notify, uint8_t reserved,
+ *     value[length]
+ * and complete batches of records are announced with a single
+ * onNotifyBatch(id, offset, count, length) upcall. A batch is due once it
+ * holds the configured number of records or after the configured delay,
+ * which the notify timer thread enforces when no further notification
+ * arrives. Records still pending are announced when the ring is
+ * unregistered and before its connection is reported closed. Batches never
+ * wrap around the end of the ring and stay reserved until Java releases
+ * them in order. When the ring has no room the notification goes through
+ * onNotify as before.
+ *
+ * Due batches are appended to one announce queue under sNotifyLock and
+ * handed to Java by whichever thread finds nobody else doing so, with no
+ * lock held across the upcalls, so batches keep their order without a
+ * profile lock standing in the way of a full upcall queue. An unregistered
+ * ring stays allocated until Java released its last batch.
+ */
+
+#define NOTIFY_MAX_RINGS 16
+#define NOTIFY_MAX_INFLIGHT 16
+#define NOTIFY_RECORD_HEADER_LEN 4
+#define NOTIFY_MAX_ANNOUNCE (NOTIFY_MAX_RINGS * NOTIFY_MAX_INFLIGHT)
+
+typedef struct {
+    int id;                 // 0: slot unused
+    bool closing;           // unregistered, waiting for its batches to be released
+    int conn_id;
+    btgatt_srvc_id_t srvc_id;
+    btgatt_gatt_id_t char_id;
+    jobject buffer;
+    uint8_t *data;
+    int capacity;
+    int batch_size;
+    nsecs_t max_delay;
+
+    int tail;               // where the next record goes
+    int used;               // bytes neither released nor free, from tail backwards
+    int pending_offset;     // records written but not yet announced
+    int pending_count;
+    int pending_length;
+    nsecs_t pending_oldest;
+    int inflight[NOTIFY_MAX_INFLIGHT];  // bytes held by each announced batch
+    int inflight_head;
+    int inflight_count;
+} notify_ring_t;
+
+typedef struct {
+    int id;
+    int offset;
+    int count;
+    int length;
+} notify_batch_t;
+
+static Mutex sNotifyLock;
+static notify_ring_t sNotifyRings[NOTIFY_MAX_RINGS];
+static int sNotifyNextId = 1;
+
+// Batches taken but not yet announced, every one of them is in flight on
+// its ring, so they always fit
+static notify_batch_t sNotifyAnnounce[NOTIFY_MAX_ANNOUNCE];
+static uint32_t sNotifyAnnounceTaken = 0;
+static uint32_t sNotifyAnnouncePosted = 0;
+static bool sNotifyAnnouncing = false;
+static Condition sNotifyPostedCond;
+
+static Condition sNotifyCond;
+static Condition sNotifyExitCond;
+static bool sNotifyThreadRunning = false;
+static bool sNotifyThreadQuit = false;
+
+static bool gatt_id_equals(const btgatt_gatt_id_t *a, const btgatt_gatt_id_t *b)
+{
+    return a->inst_id == b->inst_id && !memcmp(&a->uuid, &b->uuid, sizeof(bt_uuid_t));
+}
+
+static notify_ring_t *notify_ring_find_l(int conn_id, btgatt_srvc_id_t *srvc_id,
+                                         btgatt_gatt_id_t *char_id)
+{
+    for (int i = 0; i != NOTIFY_MAX_RINGS; ++i)
+    {
+        notify_ring_t *ring = &sNotifyRings[i];
+        if (ring->id != 0 && !ring->closing && ring->conn_id == conn_id
+                && ring->srvc_id.is_primary == srvc_id->is_primary
+                && gatt_id_equals(&ring->srvc_id.id, &srvc_id->id)
+                && gatt_id_equals(&ring->char_id, char_id))
+            return ring;
+    }
+    return NULL;
+}
+
+static notify_ring_t *notify_ring_get_l(int id)
+{
+    for (int i = 0; i != NOTIFY_MAX_RINGS; ++i)
+    {
+        if (sNotifyRings[i].id == id) return &sNotifyRings[i];
+    }
+    return NULL;
+}
+
+// Queues the pending records for announcement, returns false if too many
+// batches are out
+static bool notify_ring_deliver_l(notify_ring_t *ring)
+{
+    if (ring->pending_count == 0 || ring->inflight_count == NOTIFY_MAX_INFLIGHT) return false;
+
+    ring->inflight[(ring->inflight_head + ring->inflight_count) % NOTIFY_MAX_INFLIGHT] =
+        ring->pending_length;
+    ++ring->inflight_count;
+
+    notify_batch_t *batch = &sNotifyAnnounce[sNotifyAnnounceTaken++ % NOTIFY_MAX_ANNOUNCE];
+    batch->id = ring->id;
+    batch->offset = ring->pending_offset;
+    batch->count = ring->pending_count;
+    batch->length = ring->pending_length;
+    ring->pending_count = 0;
+    ring->pending_length = 0;
+    return true;
+}
+
+/**
+ * Hands the queued batches to Java in order, unless another thread is at
+ * it already. With wait set, returns only once that thread handed over the
+ * batches queued so far. Called with sNotifyLock held, which is released
+ * around each upcall.
+ */
+static void notify_announce_l(JNIEnv *env, bool wait)
+{
+    if (sNotifyAnnouncing)
+    {
+        uint32_t queued = sNotifyAnnounceTaken;
+        while (wait && (int32_t) (sNotifyAnnouncePosted - queued) < 0)
+            sNotifyPostedCond.wait(sNotifyLock);
+        return;
+    }
+
+    sNotifyAnnouncing = true;
+    while (sNotifyAnnouncePosted != sNotifyAnnounceTaken)
+    {
+        notify_batch_t batch = sNotifyAnnounce[sNotifyAnnouncePosted % NOTIFY_MAX_ANNOUNCE];
+        sNotifyLock.unlock();
+        callVoidMethodOrdered(env, __FUNCTION__, mCallbacksObj, method_onNotifyBatch, batch.id,
+                              batch.offset, batch.count, batch.length);
+        sNotifyLock.lock();
+        ++sNotifyAnnouncePosted;
+        sNotifyPostedCond.broadcast();
+    }
+    sNotifyAnnouncing = false;
+}
+
+/**
+ * Copies a notification into its ring and queues the batches now due, at
+ * most two. Returns false if it has to go through onNotify instead.
+ */
+static bool notify_ring_add_l(int conn_id, btgatt_notify_params_t *p_data)
+{
+    notify_ring_t *ring = notify_ring_find_l(conn_id, &p_data->srvc_id, &p_data->char_id);
+    if (ring == NULL) return false;
+
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    int size = NOTIFY_RECORD_HEADER_LEN + p_data->len;
+    uint8_t *rec;
+
+    if (ring->tail + size > ring->capacity)
+    {
+        // Wrap around, the skipped bytes are released with the batch before
+        if (ring->used > ring->tail) goto full;
+        if (ring->pending_count > 0 && !notify_ring_deliver_l(ring)) goto full;
+        if (ring->inflight_count > 0)
+        {
+            int skip = ring->capacity - ring->tail;
+            ring->inflight[(ring->inflight_head + ring->inflight_count - 1)
+                           % NOTIFY_MAX_INFLIGHT] += skip;
+            ring->used += skip;
+        }
+        ring->tail = 0;
+    }
+    if (ring->capacity - ring->used < size) goto full;
+
+    rec = ring->data + ring->tail;
+    rec[0] = p_data->len & 0xFF;
+    rec[1] = p_data->len >> 8;
+    rec[2] = p_data->is_notify;
+    rec[3] = 0;
+    memcpy(rec + NOTIFY_RECORD_HEADER_LEN, p_data->value, p_data->len);
+
+    if (ring->pending_count == 0)
+    {
+        ring->pending_offset = ring->tail;
+        ring->pending_oldest = now;
+        if (ring->max_delay > 0) sNotifyCond.signal();
+    }
+    ++ring->pending_count;
+    ring->pending_length += size;
+    ring->tail += size;
+    ring->used += size;
+
+    if (ring->pending_count >= ring->batch_size
+            || (ring->max_delay > 0 && now - ring->pending_oldest >= ring->max_delay))
+        notify_ring_deliver_l(ring);
+    return true;
+
+full:
+    // Announce what is already queued so it is not overtaken by onNotify
+    notify_ring_deliver_l(ring);
+    warn("Notification ring %d full", ring->id);
+    return false;
+}
+
+static void notify_ring_release_l(JNIEnv *env, notify_ring_t *ring)
+{
+    if (ring->buffer != NULL) env->DeleteGlobalRef(ring->buffer);
+    memset(ring, 0, sizeof(notify_ring_t));
+}
+
+/**
+ * Queues the pending records of the rings of conn_id, or with conn_id -1 of
+ * the rings whose delay ran out by now, as batches, at most one per ring.
+ */
+static void notify_rings_take_l(int conn_id, nsecs_t now)
+{
+    for (int i = 0; i != NOTIFY_MAX_RINGS; ++i)
+    {
+        notify_ring_t *ring = &sNotifyRings[i];
+        if (ring->id == 0 || ring->pending_count == 0) continue;
+        if (conn_id >= 0 && ring->conn_id != conn_id) continue;
+        if (conn_id < 0 && (ring->max_delay == 0 || now - ring->pending_oldest < ring->max_delay))
+            continue;
+        notify_ring_deliver_l(ring);
+    }
+}
+
+/**
+ * Notification timer thread. Announces the batches whose delay ran out
+ * while no further notification arrived for them, and those queued by
+ * threads that do not announce themselves.
+ */
+static void notify_timer_thread(void *arg)
+{
+    JNIEnv *env = AndroidRuntime::getJNIEnv();
+
+    Mutex::Autolock lock(sNotifyLock);
+    while (!sNotifyThreadQuit)
+    {
+        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        nsecs_t next = 0;
+        bool due = false;
+
+        for (int i = 0; i != NOTIFY_MAX_RINGS; ++i)
+        {
+            notify_ring_t *ring = &sNotifyRings[i];
+            if (ring->id == 0 || ring->pending_count == 0 || ring->max_delay == 0) continue;
+            // Waits for a release to make room
+            if (ring->inflight_count == NOTIFY_MAX_INFLIGHT) continue;
+            nsecs_t deadline = ring->pending_oldest + ring->max_delay;
+            if (deadline <= now) due = true;
+            else if (next == 0 || deadline < next) next = deadline;
+        }
+
+        if (due) notify_rings_take_l(-1, now);
+        if (due || (!sNotifyAnnouncing && sNotifyAnnouncePosted != sNotifyAnnounceTaken))
+        {
+            notify_announce_l(env, false);
+            continue;
+        }
+
+        if (next == 0) sNotifyCond.wait(sNotifyLock);
+        else sNotifyCond.waitRelative(sNotifyLock, next - now);
+    }
+    sNotifyThreadRunning = false;
+    sNotifyExitCond.signal();
+}
+
+static void notify_timer_start_l()
+{
+    if (sNotifyThreadRunning) return;
+    sNotifyThreadQuit = false;
+    if (AndroidRuntime::createJavaThread("BT GATT Notify Timer Thread",
+                                         notify_timer_thread, NULL) == 0)
+    {
+        error("Failed to start the notification timer thread");
+        return;
+    }
+    sNotifyThreadRunning = true;
+}
+
+static void notify_timer_stop_l()
+{
+    if (!sNotifyThreadRunning) return;
+    sNotifyThreadQuit = true;
+    sNotifyCond.signal();
+    while (sNotifyThreadRunning) sNotifyExitCond.wait(sNotifyLock);
+}
+
+// Announces the records still pending on the rings of conn_id, and
+// returns once all batches queued before are handed to Java
+static void notify_rings_flush(CallbackEnv &callbackEnv, int conn_id)
+{
+    Mutex::Autolock lock(sNotifyLock);
+    notify_rings_take_l(conn_id, 0);
+    notify_announce_l(callbackEnv.get(), true);
+}
+
+/**
+ * Attribute database discovery
+ *
+ * gattClientDiscoverDatabaseNative walks the whole database of a
+ * connection without involving Java: services, then per service its
+ * characteristics, included services and the descriptors of each
+ * characteristic. While a walk is in progress the search and get_*
+ * callbacks of that connection feed it instead of calling up. The result is
+ * delivered through one onDatabaseDiscovered(conn_id, status, records)
+ * upcall, see db_discovery_records_l() for the record layout.
+ *
+ * Once configured with a directory, complete databases of bonded peers are
+ * also kept there in one file per peer address. A later discovery for that
+ * peer still has the stack search the services, which also refills the
+ * stack's own attribute cache that later reads and writes rely on. If the
+ * services found match the cached ones, the cached characteristics and
+ * descriptors are used instead of walking them one by one, otherwise the
+ * file is dropped and the walk goes ahead. A cached database is also
+ * dropped when the peer indicates Service Changed or the client refreshes
+ * it. Peers that are not bonded are never cached, as they are not told
+ * about changes.
+ */
+
+#define DB_MAX_DISCOVERIES 8
+#define DB_INITIAL_ATTRS 32
+#define DB_RECORD_WORDS 3
+#define DB_MAX_CONNECTIONS 16
+#define DB_CACHE_MAGIC 0x31424447   // "GDB1"
+#define DB_CACHE_MAX_ATTRS 65536
+
+// Record types, services use BTGATT_SERVICE_TYPE_*
+#define DB_ATTR_INCLUDED_SERVICE 2
+#define DB_ATTR_CHARACTERISTIC 3
+#define DB_ATTR_DESCRIPTOR 4
+
+typedef struct {
+    uint8_t type;
+    uint8_t inst_id;
+    uint16_t properties;    // characteristic properties or included service type
+    bt_uuid_t uuid;
+    int parent;             // index of the owning service or characteristic
+} db_attr_t;
+
+typedef struct {
+    bool active;
+    int conn_id;
+    bt_bdaddr_t bda;
+    bool cacheable;         // peer known and bonded, no Service Changed seen meanwhile
+    db_attr_t *attrs;
+    int count;
+    int capacity;
+    db_attr_t *cached;      // loaded from the cache, used if the services match
+    int cached_count;
+    int service;            // index of the service being walked
+    int characteristic;     // index of the characteristic being walked
+} db_discovery_t;
+
+typedef struct {
+    bool in_use;
+    int conn_id;
+    bt_bdaddr_t bda;
+} db_connection_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t record_size;
+    uint32_t count;
+} db_cache_header_t;
+
+static Mutex sDbDiscoveryLock;
+static db_discovery_t sDbDiscoveries[DB_MAX_DISCOVERIES];
+static db_connection_t sDbConnections[DB_MAX_CONNECTIONS];
+static char sDbCacheDir[PATH_MAX];      // empty: no caching
+
+static db_discovery_t *db_discovery_get_l(int conn_id)
+{
+    for (int i = 0; i != DB_MAX_DISCOVERIES; ++i)
+    {
+        if (sDbDiscoveries[i].active && sDbDiscoveries[i].conn_id == conn_id)
+            return &sDbDiscoveries[i];
+    }
+    return NULL;
+}
+
+static void db_discovery_free_l(db_discovery_t *d)
+{
+    delete[] d->attrs;
+    delete[] d->cached;
+    memset(d, 0, sizeof(db_discovery_t));
+}
+
+static db_attr_t *db_discovery_alloc_l(db_discovery_t *d)
+{
+    if (d->count == d->capacity)
+    {
+        int capacity = d->capacity ? d->capacity * 2 : DB_INITIAL_ATTRS;
+        db_attr_t *attrs = new db_attr_t[capacity];
+        if (d->count) memcpy(attrs, d->attrs, d->count * sizeof(db_attr_t));
+        delete[] d->attrs;
+        d->attrs = attrs;
+        d->capacity = capacity;
+    }
+
+    db_attr_t *attr = &d->attrs[d->count++];
+    // Cleared so cache files do not pick up stale padding
+    memset(attr, 0, sizeof(db_attr_t));
+    return attr;
+}
+
+static db_attr_t *db_discovery_add_l(db_discovery_t *d, uint8_t type, btgatt_gatt_id_t *id,
+                                     uint16_t properties, int parent)
+{
+    db_attr_t *attr = db_discovery_alloc_l(d);
+    attr->type = type;
+    attr->inst_id = id->inst_id;
+    attr->properties = properties;
+    memcpy(&attr->uuid, &id->uuid, sizeof(bt_uuid_t));
+    attr->parent = parent;
+    return attr;
+}
+
+static void db_attr_to_gatt_id(db_attr_t *attr, btgatt_gatt_id_t *id)
+{
+    id->inst_id = attr->inst_id;
+    memcpy(&id->uuid, &attr->uuid, sizeof(bt_uuid_t));
+}
+
+static void db_attr_to_srvc_id(db_attr_t *attr, btgatt_srvc_id_t *srvc_id)
+{
+    db_attr_to_gatt_id(attr, &srvc_id->id);
+    srvc_id->is_primary = (attr->type == BTGATT_SERVICE_TYPE_PRIMARY ? 1 : 0);
+}
+
+static int db_attrs_next_service(const db_attr_t *attrs, int count, int from)
+{
+    for (int i = from + 1; i < count; ++i)
+    {
+        if (attrs[i].type <= BTGATT_SERVICE_TYPE_SECONDARY) return i;
+    }
+    return -1;
+}
+
+static int db_discovery_next_service_l(db_discovery_t *d, int from)
+{
+    return db_attrs_next_service(d->attrs, d->count, from);
+}
+
+static int db_discovery_next_l(db_discovery_t *d, int from, uint8_t type, int parent)
+{
+    for (int i = from + 1; i < d->count; ++i)
+    {
+        if (d->attrs[i].type == type && d->attrs[i].parent == parent) return i;
+    }
+    return -1;
+}
+
+static jlong *db_record_put(jlong *words, db_attr_t *attr)
+{
+    *words++ = attr->type | (attr->inst_id << 8) | (attr->properties << 16);
+    *words++ = uuid_lsb(&attr->uuid);
+    *words++ = uuid_msb(&attr->uuid);
+    return words;
+}
+
+/**
+ * Returns the database as a long[] of DB_RECORD_WORDS words per
+ * attribute: type | inst_id << 8 | properties << 16, uuid lsb, uuid msb.
+ * Each service is followed by its included services, then by its
+ * characteristics, each followed by its descriptors.
+ */
+static jlongArray db_discovery_records_l(JNIEnv *env, db_discovery_t *d)
+{
+    jlongArray records = env->NewLongArray(d->count * DB_RECORD_WORDS);
+    jlong *words = records ? env->GetLongArrayElements(records, NULL) : NULL;
+    if (words == NULL)
+    {
+        error("Failed to allocate %d database records", d->count);
+        if (records) env->DeleteLocalRef(records);
+        return NULL;
+    }
+
+    jlong *w = words;
+    for (int s = db_discovery_next_service_l(d, -1); s >= 0;
+         s = db_discovery_next_service_l(d, s))
+    {
+        w = db_record_put(w, &d->attrs[s]);
+        for (int i = db_discovery_next_l(d, s, DB_ATTR_INCLUDED_SERVICE, s); i >= 0;
+             i = db_discovery_next_l(d, i, DB_ATTR_INCLUDED_SERVICE, s))
+            w = db_record_put(w, &d->attrs[i]);
+        for (int c = db_discovery_next_l(d, s, DB_ATTR_CHARACTERISTIC, s); c >= 0;
+             c = db_discovery_next_l(d, c, DB_ATTR_CHARACTERISTIC, s))
+        {
+            w = db_record_put(w, &d->attrs[c]);
+            for (int i = db_discovery_next_l(d, c, DB_ATTR_DESCRIPTOR, c); i >= 0;
+                 i = db_discovery_next_l(d, i, DB_ATTR_DESCRIPTOR, c))
+                w = db_record_put(w, &d->attrs[i]);
+        }
+    }
+    env->ReleaseLongArrayElements(records, words, 0);
+    return records;
+}
+
+static bool db_cache_path_l(const bt_bdaddr_t *bda, char *path, size_t len)
+{
+    if (sDbCacheDir[0] == 0) return false;
+    snprintf(path, len, "%s/%02x%02x%02x%02x%02x%02x", sDbCacheDir,
+             bda->address[0], bda->address[1], bda->address[2],
+             bda->address[3], bda->address[4], bda->address[5]);
+    return true;
+}
+
+// Loads the cached database of the peer into d->cached
+static bool db_cache_load_l(db_discovery_t *d)
+{
+    char path[PATH_MAX];
+    if (!db_cache_path_l(&d->bda, path, sizeof(path))) return false;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    bool loaded = false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(db_cache_header_t))
+    {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED)
+        {
+            const db_cache_header_t *hdr = (const db_cache_header_t *) map;
+            const db_attr_t *attrs = (const db_attr_t *) (hdr + 1);
+            if (hdr->magic == DB_CACHE_MAGIC && hdr->record_size == sizeof(db_attr_t)
+                    && hdr->count <= DB_CACHE_MAX_ATTRS
+                    && (size_t) st.st_size == sizeof(*hdr) + hdr->count * sizeof(db_attr_t))
+            {
+                for (uint32_t i = 0; i != hdr->count; ++i)
+                    memcpy(db_discovery_alloc_l(d), &attrs[i], sizeof(db_attr_t));
+                loaded = true;
+            }
+            munmap(map, st.st_size);
+        }
+    }
+    close(fd);
+
+    if (!loaded)
+    {
+        warn("Dropping unusable GATT cache %s", path);
+        unlink(path);
+    }
+    d->cached = d->attrs;
+    d->cached_count = d->count;
+    d->attrs = NULL;
+    d->count = 0;
+    d->capacity = 0;
+    return loaded;
+}
+
+/**
+ * Checks the services found by the search against the cached database and
+ * returns whether the cache is still good, dropping it otherwise. The
+ * search results hold nothing but services, in the order found.
+ */
+static bool db_cache_matches_l(db_discovery_t *d)
+{
+    int s = -1;
+    bool matches = true;
+    for (int i = 0; i != d->count && matches; ++i)
+    {
+        s = db_attrs_next_service(d->cached, d->cached_count, s);
+        const db_attr_t *found = &d->attrs[i];
+        matches = s >= 0 && d->cached[s].type == found->type
+                && d->cached[s].inst_id == found->inst_id
+                && !memcmp(&d->cached[s].uuid, &found->uuid, sizeof(bt_uuid_t));
+    }
+    if (matches && db_attrs_next_service(d->cached, d->cached_count, s) < 0) return true;
+
+    char path[PATH_MAX];
+    warn("Cached GATT database of conn_id %d is stale", d->conn_id);
+    if (db_cache_path_l(&d->bda, path, sizeof(path))) unlink(path);
+    delete[] d->cached;
+    d->cached = NULL;
+    d->cached_count = 0;
+    return false;
+}
+
+static void db_cache_save_l(db_discovery_t *d)
+{
+    char path[PATH_MAX];
+    char tmp[PATH_MAX];
+    if (!db_cache_path_l(&d->bda, path, sizeof(path))) return;
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+    {
+        warn("Cannot create %s: %s", tmp, strerror(errno));
+        return;
+    }
+
+    db_cache_header_t hdr;
+    hdr.magic = DB_CACHE_MAGIC;
+    hdr.record_size = sizeof(db_attr_t);
+    hdr.count = d->count;
+    ssize_t len = d->count * sizeof(db_attr_t);
+    bool written = write(fd, &hdr, sizeof(hdr)) == (ssize_t) sizeof(hdr)
+            && write(fd, d->attrs, len) == len;
+    close(fd);
+
+    if (!written || rename(tmp, path) != 0)
+    {
+        warn("Cannot write %s: %s", path, strerror(errno));
+        unlink(tmp);
+    }
+}
+
+static void db_cache_invalidate(const bt_bdaddr_t *bda)
+{
+    Mutex::Autolock lock(sDbDiscoveryLock);
+    for (int i = 0; i != DB_MAX_DISCOVERIES; ++i)
+    {
+        db_discovery_t *d = &sDbDiscoveries[i];
+        if (d->active && !memcmp(&d->bda, bda, sizeof(bt_bdaddr_t))) d->cacheable = false;
+    }
+
+    char path[PATH_MAX];
+    if (db_cache_path_l(bda, path, sizeof(path))) unlink(path);
+}
+
+// Service Changed characteristic of the Generic Attribute service
+static bool db_is_service_changed(btgatt_srvc_id_t *srvc_id, btgatt_gatt_id_t *char_id)
+{
+    return uuid_16bit(&srvc_id->id.uuid) == 0x1801 && uuid_16bit(&char_id->uuid) == 0x2A05;
+}
+
+static void db_connection_opened(int conn_id, bt_bdaddr_t *bda)
+{
+    Mutex::Autolock lock(sDbDiscoveryLock);
+    db_connection_t *slot = NULL;
+    for (int i = 0; i != DB_MAX_CONNECTIONS; ++i)
+    {
+        db_connection_t *conn = &sDbConnections[i];
+        if (conn->in_use && conn->conn_id == conn_id) slot = conn;
+        if (slot == NULL && !conn->in_use) slot = conn;
+    }
+    if (slot == NULL) return;
+
+    slot->in_use = true;
+    slot->conn_id = conn_id;
+    memcpy(&slot->bda, bda, sizeof(bt_bdaddr_t));
+}
+
+static void db_discovery_finish(int conn_id, int status)
+{
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+
+    jlongArray records;
+    {
+        Mutex::Autolock lock(sDbDiscoveryLock);
+        db_discovery_t *d = db_discovery_get_l(conn_id);
+        if (d == NULL) return;
+
+        if (status == 0 && d->cacheable) db_cache_save_l(d);
+        records = db_discovery_records_l(sCallbackEnv.get(), d);
+        db_discovery_free_l(d);
+    }
+    if (records == NULL) return;
+
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onDatabaseDiscovered, conn_id, status,
+                                records);
+    sCallbackEnv->DeleteLocalRef(records);
+}
+
+/**
+ * Issues the next request of the walk, starting after the service and
+ * characteristic the walk is at. Returns false when the walk is complete.
+ */
+static bool db_discovery_continue_l(db_discovery_t *d, bool next_service)
+{
+    btgatt_srvc_id_t srvc_id;
+    btgatt_gatt_id_t char_id;
+
+    if (next_service)
+    {
+        d->service = db_discovery_next_service_l(d, d->service);
+        if (d->service < 0) return false;
+        d->characteristic = -1;
+        db_attr_to_srvc_id(&d->attrs[d->service], &srvc_id);
+        sGattIf->client->get_characteristic(d->conn_id, &srvc_id, 0);
+        return true;
+    }
+
+    d->characteristic = db_discovery_next_l(d, d->characteristic, DB_ATTR_CHARACTERISTIC,
+                                            d->service);
+    if (d->characteristic < 0) return db_discovery_continue_l(d, true);
+    db_attr_to_srvc_id(&d->attrs[d->service], &srvc_id);
+    db_attr_to_gatt_id(&d->attrs[d->characteristic], &char_id);
+    sGattIf->client->get_descriptor(d->conn_id, &srvc_id, &char_id, 0);
+    return true;
+}
+
+static bool db_discovery_search_result(int conn_id, btgatt_srvc_id_t *srvc_id)
+{
+    Mutex::Autolock lock(sDbDiscoveryLock);
+    db_discovery_t *d = db_discovery_get_l(conn_id);
+    if (d == NULL) return false;
+
+    db_discovery_add_l(d, srvc_id->is_primary ? BTGATT_SERVICE_TYPE_PRIMARY
+                                              : BTGATT_SERVICE_TYPE_SECONDARY,
+                       &srvc_id->id, 0, -1);
+    return true;
+}
+
+static bool db_discovery_search_complete(int conn_id, int status)
+{
+    bool done;
+    {
+        Mutex::Autolock lock(sDbDiscoveryLock);
+        db_discovery_t *d = db_discovery_get_l(conn_id);
+        if (d == NULL) return false;
+
+        d->service = -1;
+        if (status == 0 && d->cached != NULL && db_cache_matches_l(d))
+        {
+            debug("Database for conn_id %d served from cache", conn_id);
+            delete[] d->attrs;
+            d->attrs = d->cached;
+            d->count = d->capacity = d->cached_count;
+            d->cached = NULL;
+            d->cacheable = false;   // nothing new to save
+            done = true;
+        }
+        else
+        {
+            done = (status != 0 || sGattIf == NULL || !db_discovery_continue_l(d, true));
+        }
+    }
+    if (done) db_discovery_finish(conn_id, status);
+    return true;
+}
+
+static bool db_discovery_characteristic(int conn_id, int status, btgatt_srvc_id_t *srvc_id,
+                                        btgatt_gatt_id_t *char_id, int char_prop)
+{
+    bool done = false;
+    {
+        Mutex::Autolock lock(sDbDiscoveryLock);
+        db_discovery_t *d = db_discovery_get_l(conn_id);
+        if (d == NULL) return false;
+
+        if (sGattIf == NULL) {
+            done = true;
+        } else if (status == 0) {
+            db_discovery_add_l(d, DB_ATTR_CHARACTERISTIC, char_id, char_prop, d->service);
+            sGattIf->client->get_characteristic(conn_id, srvc_id, char_id);
+        } else {
+            sGattIf->client->get_included_service(conn_id, srvc_id, 0);
+        }
+    }
+    if (done) db_discovery_finish(conn_id, 0);
+    return true;
+}
+
+static bool db_discovery_included_service(int conn_id, int status, btgatt_srvc_id_t *srvc_id,
+                                          btgatt_srvc_id_t *incl_srvc_id)
+{
+    bool done = false;
+    {
+        Mutex::Autolock lock(sDbDiscoveryLock);
+        db_discovery_t *d = db_discovery_get_l(conn_id);
+        if (d == NULL) return false;
+
+        if (sGattIf == NULL) {
+            done = true;
+        } else if (status == 0) {
+            db_discovery_add_l(d, DB_ATTR_INCLUDED_SERVICE, &incl_srvc_id->id,
+                               incl_srvc_id->is_primary ? BTGATT_SERVICE_TYPE_PRIMARY
+                                                        : BTGATT_SERVICE_TYPE_SECONDARY,
+                               d->service);
+            sGattIf->client->get_included_service(conn_id, srvc_id, incl_srvc_id);
+        } else {
+            done = !db_discovery_continue_l(d, false);
+        }
+    }
+    if (done) db_discovery_finish(conn_id, 0);
+    return true;
+}
+
+static bool db_discovery_descriptor(int conn_id, int status, btgatt_srvc_id_t *srvc_id,
+                                    btgatt_gatt_id_t *char_id, btgatt_gatt_id_t *descr_id)
+{
+    bool done = false;
+    {
+        Mutex::Autolock lock(sDbDiscoveryLock);
+        db_discovery_t *d = db_discovery_get_l(conn_id);
+        if (d == NULL) return false;
+
+        if (sGattIf == NULL) {
+            done = true;
+        } else if (status == 0) {
+            db_discovery_add_l(d, DB_ATTR_DESCRIPTOR, descr_id, 0, d->characteristic);
+            sGattIf->client->get_descriptor(conn_id, srvc_id, char_id, descr_id);
+        } else {
+            done = !db_discovery_continue_l(d, false);
+        }
+    }
+    if (done) db_discovery_finish(conn_id, 0);
+    return true;
+}
+
+static void db_discovery_cancel(int conn_id)
+{
+    Mutex::Autolock lock(sDbDiscoveryLock);
+    db_discovery_t *d = db_discovery_get_l(conn_id);
+    if (d != NULL) db_discovery_free_l(d);
+
+    for (int i = 0; i != DB_MAX_CONNECTIONS; ++i)
+    {
+        if (sDbConnections[i].in_use && sDbConnections[i].conn_id == conn_id)
+            memset(&sDbConnections[i], 0, sizeof(db_connection_t));
+    }
+}
+
+/**
+ * Write pipeline
+ *
+ * gattClientWriteBatchNative queues a batch of characteristic writes for
+ * one connection and issues them back to back from the write callbacks, so
+ * Java sees a single onWriteBatchCompleted(conn_id, status, written) once
+ * the batch is done or failed. Values longer than one ATT packet are sent
+ * by the stack as long writes. A reliable batch is sent entirely as
+ * prepared writes and committed with one execute write, or cancelled if
+ * any of them fails.
+ */
+
+#define WRITE_MAX_PIPELINES 8
+#define WRITE_ENTRY_WORDS 5
+#define WRITE_TYPE_PREPARE 3
+
+typedef struct {
+    btgatt_srvc_id_t srvc_id;
+    btgatt_gatt_id_t char_id;
+    int write_type;
+    int len;
+    int offset;             // into the value buffer
+} write_entry_t;
+
+typedef struct {
+    bool active;
+    int conn_id;
+    int auth_req;
+    bool reliable;
+    bool executing;         // execute write sent, waiting for its callback
+    int status;
+    write_entry_t *entries;
+    int count;
+    int next;               // entry in flight
+    uint8_t *values;
+} write_pipeline_t;
+
+static Mutex sWritePipelineLock;
+static write_pipeline_t sWritePipelines[WRITE_MAX_PIPELINES];
+
+static write_pipeline_t *write_pipeline_get_l(int conn_id)
+{
+    for (int i = 0; i != WRITE_MAX_PIPELINES; ++i)
+    {
+        if (sWritePipelines[i].active && sWritePipelines[i].conn_id == conn_id)
+            return &sWritePipelines[i];
+    }
+    return NULL;
+}
+
+static void write_pipeline_free_l(write_pipeline_t *wp)
+{
+    delete[] wp->entries;
+    delete[] wp->values;
+    memset(wp, 0, sizeof(write_pipeline_t));
+}
+
+static void write_pipeline_issue_l(write_pipeline_t *wp)
+{
+    write_entry_t *entry = &wp->entries[wp->next];
+    sGattIf->client->write_characteristic(wp->conn_id, &entry->srvc_id, &entry->char_id,
+        wp->reliable ? WRITE_TYPE_PREPARE : entry->write_type, entry->len, wp->auth_req,
+        (char *) wp->values + entry->offset);
+}
+
+static void write_pipeline_finish(int conn_id)
+{
+    int status;
+    int written;
+    {
+        Mutex::Autolock lock(sWritePipelineLock);
+        write_pipeline_t *wp = write_pipeline_get_l(conn_id);
+        if (wp == NULL) return;
+        status = wp->status;
+        written = wp->next;
+        write_pipeline_free_l(wp);
+    }
+
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onWriteBatchCompleted,
+                                conn_id, status, written);
+}
+
+// Returns false if no batch is being written on conn_id
+static bool write_pipeline_written(int conn_id, int status)
+{
+    bool done = false;
+    {
+        Mutex::Autolock lock(sWritePipelineLock);
+        write_pipeline_t *wp = write_pipeline_get_l(conn_id);
+        if (wp == NULL || wp->executing) return false;
+
+        if (status == 0) ++wp->next;
+        else wp->status = status;
+
+        if (sGattIf == NULL) {
+            done = true;
+        } else if (status == 0 && wp->next < wp->count) {
+            write_pipeline_issue_l(wp);
+        } else if (wp->reliable) {
+            wp->executing = true;
+            sGattIf->client->execute_write(conn_id, status == 0 ? 1 : 0);
+        } else {
+            done = true;
+        }
+    }
+    if (done) write_pipeline_finish(conn_id);
+    return true;
+}
+
+static bool write_pipeline_executed(int conn_id, int status)
+{
+    {
+        Mutex::Autolock lock(sWritePipelineLock);
+        write_pipeline_t *wp = write_pipeline_get_l(conn_id);
+        if (wp == NULL || !wp->executing) return false;
+        if (wp->status == 0) wp->status = status;
+    }
+    write_pipeline_finish(conn_id);
+    return true;
+}
+
+static void write_pipeline_cancel(int conn_id)
+{
+    Mutex::Autolock lock(sWritePipelineLock);
+    write_pipeline_t *wp = write_pipeline_get_l(conn_id);
+    if (wp != NULL) write_pipeline_free_l(wp);
+}
+
+/**
+ * Server attribute value cache
+ *
+ * A server app may hand the value of one of its attributes down to be
+ * answered natively. Read requests for a cached handle are then served
+ * with send_response straight from the callback thread, offset included,
+ * and never reach Java. A static value is kept until it is replaced or its
+ * service goes away. Any other cached value is refreshed by notifications
+ * and indications sent for the handle and dropped on the first write
+ * request to it, which goes to the app as before.
+ */
+
+#define ATTR_CACHE_MAX_VALUES 64
+#define GATT_INVALID_OFFSET 0x07
+
+typedef struct {
+    bool in_use;
+    bool is_static;
+    int server_if;
+    int srvc_handle;
+    int attr_handle;
+    uint16_t len;
+    uint8_t *value;
+} attr_cache_value_t;
+
+static Mutex sAttrCacheLock;
+static attr_cache_value_t sAttrCache[ATTR_CACHE_MAX_VALUES];
+
+static attr_cache_value_t *attr_cache_find_l(int attr_handle)
+{
+    for (int i = 0; i != ATTR_CACHE_MAX_VALUES; ++i)
+    {
+        if (sAttrCache[i].in_use && sAttrCache[i].attr_handle == attr_handle)
+            return &sAttrCache[i];
+    }
+    return NULL;
+}
+
+static void attr_cache_free_l(attr_cache_value_t *cv)
+{
+    delete[] cv->value;
+    memset(cv, 0, sizeof(attr_cache_value_t));
+}
+
+static void attr_cache_update_l(attr_cache_value_t *cv, const jbyte *value, int len)
+{
+    if (len != cv->len)
+    {
+        delete[] cv->value;
+        cv->value = len ? new uint8_t[len] : NULL;
+        cv->len = (uint16_t) len;
+    }
+    if (len) memcpy(cv->value, value, len);
+}
+
+// Returns false if the read has to go up to Java
+static bool attr_cache_read(int conn_id, int trans_id, int attr_handle, int offset)
+{
+    btgatt_response_t response;
+    int status = 0;
+    {
+        Mutex::Autolock lock(sAttrCacheLock);
+        attr_cache_value_t *cv = attr_cache_find_l(attr_handle);
+        if (cv == NULL || sGattIf == NULL) return false;
+
+        response.attr_value.handle = attr_handle;
+        response.attr_value.auth_req = 0;
+        response.attr_value.offset = offset;
+        response.attr_value.len = 0;
+
+        if (offset > cv->len) {
+            status = GATT_INVALID_OFFSET;
+        } else if (offset < cv->len) {
+            response.attr_value.len = cv->len - offset;
+            memcpy(response.attr_value.value, cv->value + offset, response.attr_value.len);
+        }
+    }
+    sGattIf->server->send_response(conn_id, trans_id, status, &response);
+    return true;
+}
+
+static void attr_cache_written(int attr_handle)
+{
+    Mutex::Autolock lock(sAttrCacheLock);
+    attr_cache_value_t *cv = attr_cache_find_l(attr_handle);
+    if (cv != NULL && !cv->is_static) attr_cache_free_l(cv);
+}
+
+static void attr_cache_sent(int attr_handle, const jbyte *value, int len)
+{
+    Mutex::Autolock lock(sAttrCacheLock);
+    attr_cache_value_t *cv = attr_cache_find_l(attr_handle);
+    if (cv != NULL && !cv->is_static && len <= BTGATT_MAX_ATTR_LEN)
+        attr_cache_update_l(cv, value, len);
+}
+
+/**
+ * Server subscription tracking
+ *
+ * The Client Characteristic Configuration descriptors a server adds are
+ * recorded along with the characteristic they follow, and the values
+ * remote clients write to them are mirrored per connection. This lets
+ * gattServerSendFanOutNative push one value to every subscriber of a
+ * characteristic without Java keeping track of them.
+ */
+
+#define SUBS_MAX_CCCDS 64
+#define SUBS_MAX_SUBSCRIPTIONS 256
+#define SUBS_MAX_SERVERS 8
+#define GATT_UUID_CHAR_CLIENT_CONFIG 0x2902
+#define GATT_CLIENT_CONFIG_NOTIFICATION 0x0001
+#define GATT_CLIENT_CONFIG_INDICATION 0x0002
+
+typedef struct {
+    bool in_use;
+    int server_if;
+    int srvc_handle;
+    int cccd_handle;
+    int char_handle;
+} subs_cccd_t;
+
+typedef struct {
+    bool in_use;
+    int conn_id;
+    int char_handle;
+    uint16_t config;
+} subs_subscription_t;
+
+typedef struct {
+    int server_if;          // 0 if unused
+    int char_handle;        // last characteristic added
+} subs_server_t;
+
+static Mutex sSubsLock;
+static subs_cccd_t sSubsCccds[SUBS_MAX_CCCDS];
+static subs_subscription_t sSubscriptions[SUBS_MAX_SUBSCRIPTIONS];
+static subs_server_t sSubsServers[SUBS_MAX_SERVERS];
+
+static subs_server_t *subs_server_get_l(int server_if, bool create)
+{
+    subs_server_t *slot = NULL;
+    for (int i = 0; i != SUBS_MAX_SERVERS; ++i)
+    {
+        if (sSubsServers[i].server_if == server_if) return &sSubsServers[i];
+        if (slot == NULL && sSubsServers[i].server_if == 0) slot = &sSubsServers[i];
+    }
+    if (!create || slot == NULL) return NULL;
+    slot->server_if = server_if;
+    slot->char_handle = 0;
+    return slot;
+}
+
+static void subs_characteristic_added(int server_if, int char_handle)
+{
+    Mutex::Autolock lock(sSubsLock);
+    subs_server_t *ss = subs_server_get_l(server_if, true);
+    if (ss != NULL) ss->char_handle = char_handle;
+}
+
+static void subs_descriptor_added(int server_if, bt_uuid_t *descr_id,
+                                  int srvc_handle, int descr_handle)
+{
+    if (uuid_16bit(descr_id) != GATT_UUID_CHAR_CLIENT_CONFIG) return;
+
+    Mutex::Autolock lock(sSubsLock);
+    subs_server_t *ss = subs_server_get_l(server_if, false);
+    if (ss == NULL || ss->char_handle == 0) return;
+
+    for (int i = 0; i != SUBS_MAX_CCCDS; ++i)
+    {
+        subs_cccd_t *cccd = &sSubsCccds[i];
+        if (cccd->in_use) continue;
+        cccd->in_use = true;
+        cccd->server_if = server_if;
+        cccd->srvc_handle = srvc_handle;
+        cccd->cccd_handle = descr_handle;
+        cccd->char_handle = ss->char_handle;
+        return;
+    }
+    warn("No room to track descriptor %d", descr_handle);
+}
+
+static void subs_written(int conn_id, int attr_handle, int offset, int length,
+                         bool is_prep, uint8_t *value)
+{
+    if (is_prep || offset != 0 || length != 2) return;
+
+    Mutex::Autolock lock(sSubsLock);
+    int char_handle = 0;
+    for (int i = 0; i != SUBS_MAX_CCCDS && char_handle == 0; ++i)
     {
-        if (c >= '0' && c <= '9')
-            bd_addr[i] = c - '0';
-        else if (c >= 'a' && c <= 'z')
-            bd_addr[i] = c - 'a' + 10;
-        else   // (c >= 'A' && c <= 'Z')
-            bd_addr[i] = c - 'A' + 10;
+        if (sSubsCccds[i].in_use && sSubsCccds[i].cccd_handle == attr_handle)
+            char_handle = sSubsCccds[i].char_handle;
+    }
+    if (char_handle == 0) return;
 
-        c = *str++;
-        if (c != ':')
+    uint16_t config = value[0] | (value[1] << 8);
+    subs_subscription_t *slot = NULL;
+    for (int i = 0; i != SUBS_MAX_SUBSCRIPTIONS; ++i)
+    {
+        subs_subscription_t *sub = &sSubscriptions[i];
+        if (sub->in_use && sub->conn_id == conn_id && sub->char_handle == char_handle)
         {
-            bd_addr[i] <<= 4;
-            if (c >= '0' && c <= '9')
-                bd_addr[i] |= c - '0';
-            else if (c >= 'a' && c <= 'z')
-                bd_addr[i] |= c - 'a' + 10;
-            else   // (c >= 'A' && c <= 'Z')
-                bd_addr[i] |= c - 'A' + 10;
-
-            c = *str++;
+            slot = sub;
+            break;
         }
+        if (slot == NULL && !sub->in_use) slot = sub;
+    }
 
-        c = *str++;
+    if (slot == NULL) {
+        warn("No room to track the subscription of conn %d", conn_id);
+    } else if (config == 0) {
+        memset(slot, 0, sizeof(subs_subscription_t));
+    } else {
+        slot->in_use = true;
+        slot->conn_id = conn_id;
+        slot->char_handle = char_handle;
+        slot->config = config;
     }
 }
 
-static void jstr2bdaddr(JNIEnv* env, bt_bdaddr_t *bda, jstring address)
+static void subs_disconnected(int conn_id)
 {
-    const char* c_bda = env->GetStringUTFChars(address, NULL);
-    if (c_bda != NULL && bda != NULL && strlen(c_bda) == 17)
+    Mutex::Autolock lock(sSubsLock);
+    for (int i = 0; i != SUBS_MAX_SUBSCRIPTIONS; ++i)
     {
-        bd_addr_str_to_addr(c_bda, bda->address);
-        env->ReleaseStringUTFChars(address, c_bda);
+        if (sSubscriptions[i].in_use && sSubscriptions[i].conn_id == conn_id)
+            memset(&sSubscriptions[i], 0, sizeof(subs_subscription_t));
     }
 }
 
-namespace android {
-
-/**
- * Client callback methods
- */
-
-static jmethodID method_onClientRegistered;
-static jmethodID method_onScanResult;
-static jmethodID method_onConnected;
-static jmethodID method_onDisconnected;
-static jmethodID method_onReadCharacteristic;
-static jmethodID method_onWriteCharacteristic;
-static jmethodID method_onExecuteCompleted;
-static jmethodID method_onSearchCompleted;
-static jmethodID method_onSearchResult;
-static jmethodID method_onReadDescrExtProp;
-static jmethodID method_onReadDescriptor;
-static jmethodID method_onWriteDescriptor;
-static jmethodID method_onNotify;
-static jmethodID method_onGetCharacteristic;
-static jmethodID method_onGetDescriptor;
-static jmethodID method_onGetIncludedService;
-static jmethodID method_onRegisterForNotifications;
-static jmethodID method_onReadRemoteRssi;
-static jmethodID method_onAdvertiseCallback;
-
-/**
- * Server callback methods
- */
-static jmethodID method_onServerRegistered;
-static jmethodID method_onClientConnected;
-static jmethodID method_onServiceAdded;
-static jmethodID method_onIncludedServiceAdded;
-static jmethodID method_onCharacteristicAdded;
-static jmethodID method_onDescriptorAdded;
-static jmethodID method_onServiceStarted;
-static jmethodID method_onServiceStopped;
-static jmethodID method_onServiceDeleted;
-static jmethodID method_onResponseSendCompleted;
-static jmethodID method_onAttributeRead;
-static jmethodID method_onAttributeWrite;
-static jmethodID method_onExecuteWrite;
+static void subs_service_deleted(int server_if, int srvc_handle)
+{
+    Mutex::Autolock lock(sSubsLock);
+    for (int i = 0; i != SUBS_MAX_CCCDS; ++i)
+    {
+        subs_cccd_t *cccd = &sSubsCccds[i];
+        if (!cccd->in_use || cccd->server_if != server_if
+            || cccd->srvc_handle != srvc_handle)
+            continue;
 
-/**
- * Static variables
- */
+        for (int j = 0; j != SUBS_MAX_SUBSCRIPTIONS; ++j)
+        {
+            if (sSubscriptions[j].in_use
+                && sSubscriptions[j].char_handle == cccd->char_handle)
+                memset(&sSubscriptions[j], 0, sizeof(subs_subscription_t));
+        }
+        memset(cccd, 0, sizeof(subs_cccd_t));
+    }
+}
 
-static const btgatt_interface_t *sGattIf = NULL;
-static jobject mCallbacksObj = NULL;
-static JNIEnv *sCallbackEnv = NULL;
+static void subs_server_unregistered(int server_if)
+{
+    Mutex::Autolock lock(sSubsLock);
+    subs_server_t *ss = subs_server_get_l(server_if, false);
+    if (ss != NULL) memset(ss, 0, sizeof(subs_server_t));
+}
 
-static bool checkCallbackThread() {
-    sCallbackEnv = getCallbackEnv();
+// Collects up to max connections subscribed to char_handle for the given kind
+static int subs_collect(int char_handle, bool confirm, int *conn_ids, int max)
+{
+    uint16_t bit = confirm ? GATT_CLIENT_CONFIG_INDICATION : GATT_CLIENT_CONFIG_NOTIFICATION;
+    int count = 0;
 
-    JNIEnv* env = AndroidRuntime::getJNIEnv();
-    if (sCallbackEnv != env || sCallbackEnv == NULL) return false;
-    return true;
+    Mutex::Autolock lock(sSubsLock);
+    for (int i = 0; i != SUBS_MAX_SUBSCRIPTIONS && count < max; ++i)
+    {
+        subs_subscription_t *sub = &sSubscriptions[i];
+        if (sub->in_use && sub->char_handle == char_handle && (sub->config & bit))
+            conn_ids[count++] = sub->conn_id;
+    }
+    return count;
 }
 
 /**
@@ -199,145 +1701,161 @@ static bool checkCallbackThread() {
 
 void btgattc_register_app_cb(int status, int clientIf, bt_uuid_t *app_uuid)
 {
-    CHECK_CALLBACK_ENV
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onClientRegistered, status,
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onClientRegistered, status,
         clientIf, UUID_PARAMS(app_uuid));
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
 }
 
 void btgattc_scan_result_cb(bt_bdaddr_t* bda, int rssi, uint8_t* adv_data)
 {
-    CHECK_CALLBACK_ENV
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
 
-    char c_address[32];
-    snprintf(c_address, sizeof(c_address),"%02X:%02X:%02X:%02X:%02X:%02X",
-        bda->address[0], bda->address[1], bda->address[2],
-        bda->address[3], bda->address[4], bda->address[5]);
+    if (scan_dedup_check(bda, rssi, adv_data)) return;
+
+    int batched = scan_batch_add(bda, rssi, adv_data);
+    if (batched >= 0) {
+        if (batched) scan_batch_flush(sCallbackEnv.get());
+        return;
+    }
 
-    jstring address = sCallbackEnv->NewStringUTF(c_address);
+    jstring address = sCallbackEnv.newAddressString(bda);
     jbyteArray jb = sCallbackEnv->NewByteArray(62);
     sCallbackEnv->SetByteArrayRegion(jb, 0, 62, (jbyte *) adv_data);
 
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onScanResult
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onScanResult
         , address, rssi, jb);
 
     sCallbackEnv->DeleteLocalRef(address);
     sCallbackEnv->DeleteLocalRef(jb);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
 }
 
 void btgattc_open_cb(int conn_id, int status, int clientIf, bt_bdaddr_t* bda)
 {
-    CHECK_CALLBACK_ENV
+    if (status == 0) db_connection_opened(conn_id, bda);
 
-    char c_address[32];
-    snprintf(c_address, sizeof(c_address),"%02X:%02X:%02X:%02X:%02X:%02X",
-        bda->address[0], bda->address[1], bda->address[2],
-        bda->address[3], bda->address[4], bda->address[5]);
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
 
-    jstring address = sCallbackEnv->NewStringUTF(c_address);
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onConnected,
+    jstring address = sCallbackEnv.newAddressString(bda);
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onConnected,
         clientIf, conn_id, status, address);
     sCallbackEnv->DeleteLocalRef(address);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
 }
 
 void btgattc_close_cb(int conn_id, int status, int clientIf, bt_bdaddr_t* bda)
 {
-    CHECK_CALLBACK_ENV
-    char c_address[32];
-    snprintf(c_address, sizeof(c_address),"%02X:%02X:%02X:%02X:%02X:%02X",
-        bda->address[0], bda->address[1], bda->address[2],
-        bda->address[3], bda->address[4], bda->address[5]);
+    db_discovery_cancel(conn_id);
+    write_pipeline_cancel(conn_id);
 
-    jstring address = sCallbackEnv->NewStringUTF(c_address);
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onDisconnected,
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    notify_rings_flush(sCallbackEnv, conn_id);
+    jstring address = sCallbackEnv.newAddressString(bda);
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onDisconnected,
         clientIf, conn_id, status, address);
     sCallbackEnv->DeleteLocalRef(address);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
 }
 
 void btgattc_search_complete_cb(int conn_id, int status)
 {
-    CHECK_CALLBACK_ENV
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onSearchCompleted,
-                                 conn_id, status);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    if (db_discovery_search_complete(conn_id, status)) return;
+
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onSearchCompleted,
+                                conn_id, status);
 }
 
 void btgattc_search_result_cb(int conn_id, btgatt_srvc_id_t *srvc_id)
 {
-    CHECK_CALLBACK_ENV
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onSearchResult, conn_id,
+    if (db_discovery_search_result(conn_id, srvc_id)) return;
+
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onSearchResult, conn_id,
         SRVC_ID_PARAMS(srvc_id));
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
 }
 
 void btgattc_get_characteristic_cb(int conn_id, int status,
                 btgatt_srvc_id_t *srvc_id, btgatt_gatt_id_t *char_id,
                 int char_prop)
 {
-    CHECK_CALLBACK_ENV
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onGetCharacteristic
+    if (db_discovery_characteristic(conn_id, status, srvc_id, char_id, char_prop)) return;
+
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onGetCharacteristic
         , conn_id, status, SRVC_ID_PARAMS(srvc_id), GATT_ID_PARAMS(char_id)
         , char_prop);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
 }
 
 void btgattc_get_descriptor_cb(int conn_id, int status,
                 btgatt_srvc_id_t *srvc_id, btgatt_gatt_id_t *char_id,
                 btgatt_gatt_id_t *descr_id)
 {
-    CHECK_CALLBACK_ENV
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onGetDescriptor
+    if (db_discovery_descriptor(conn_id, status, srvc_id, char_id, descr_id)) return;
+
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onGetDescriptor
         , conn_id, status, SRVC_ID_PARAMS(srvc_id), GATT_ID_PARAMS(char_id)
         , GATT_ID_PARAMS(descr_id));
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
 }
 
 void btgattc_get_included_service_cb(int conn_id, int status,
                 btgatt_srvc_id_t *srvc_id, btgatt_srvc_id_t *incl_srvc_id)
 {
-    CHECK_CALLBACK_ENV
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onGetIncludedService
+    if (db_discovery_included_service(conn_id, status, srvc_id, incl_srvc_id)) return;
+
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onGetIncludedService
         , conn_id, status, SRVC_ID_PARAMS(srvc_id), SRVC_ID_PARAMS(incl_srvc_id));
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
 }
 
 void btgattc_register_for_notification_cb(int conn_id, int registered, int status,
                                           btgatt_srvc_id_t *srvc_id, btgatt_gatt_id_t *char_id)
 {
-    CHECK_CALLBACK_ENV
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onRegisterForNotifications
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onRegisterForNotifications
         , conn_id, status, registered, SRVC_ID_PARAMS(srvc_id), GATT_ID_PARAMS(char_id));
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
 }
 
 void btgattc_notify_cb(int conn_id, btgatt_notify_params_t *p_data)
 {
-    CHECK_CALLBACK_ENV
+    if (db_is_service_changed(&p_data->srvc_id, &p_data->char_id))
+        db_cache_invalidate(&p_data->bda);
 
-    char c_address[32];
-    snprintf(c_address, sizeof(c_address), "%02X:%02X:%02X:%02X:%02X:%02X",
-        p_data->bda.address[0], p_data->bda.address[1], p_data->bda.address[2],
-        p_data->bda.address[3], p_data->bda.address[4], p_data->bda.address[5]);
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+
+    {
+        Mutex::Autolock lock(sNotifyLock);
+        bool queued = notify_ring_add_l(conn_id, p_data);
+        // Batches queued before must reach Java ahead of onNotify
+        notify_announce_l(sCallbackEnv.get(), !queued);
+        if (queued) return;
+    }
 
-    jstring address = sCallbackEnv->NewStringUTF(c_address);
+    jstring address = sCallbackEnv.newAddressString(&p_data->bda);
     jbyteArray jb = sCallbackEnv->NewByteArray(p_data->len);
     sCallbackEnv->SetByteArrayRegion(jb, 0, p_data->len, (jbyte *) p_data->value);
 
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onNotify
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onNotify
         , conn_id, address, SRVC_ID_PARAMS((&p_data->srvc_id))
         , GATT_ID_PARAMS((&p_data->char_id)), p_data->is_notify, jb);
 
     sCallbackEnv->DeleteLocalRef(address);
     sCallbackEnv->DeleteLocalRef(jb);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
 }
 
 void btgattc_read_characteristic_cb(int conn_id, int status, btgatt_read_params_t *p_data)
 {
-    CHECK_CALLBACK_ENV
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
 
     jbyteArray jb;
     if ( status == 0 )      //successful
@@ -351,33 +1869,37 @@ void btgattc_read_characteristic_cb(int conn_id, int status, btgatt_read_params_
         sCallbackEnv->SetByteArrayRegion(jb, 0, 1, (jbyte *) &value);
     }
 
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onReadCharacteristic
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onReadCharacteristic
         , conn_id, status, SRVC_ID_PARAMS((&p_data->srvc_id))
         , GATT_ID_PARAMS((&p_data->char_id)), p_data->value_type, jb);
     sCallbackEnv->DeleteLocalRef(jb);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
 }
 
 void btgattc_write_characteristic_cb(int conn_id, int status, btgatt_write_params_t *p_data)
 {
-    CHECK_CALLBACK_ENV
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onWriteCharacteristic
+    if (write_pipeline_written(conn_id, status)) return;
+
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onWriteCharacteristic
         , conn_id, status, SRVC_ID_PARAMS((&p_data->srvc_id))
         , GATT_ID_PARAMS((&p_data->char_id)));
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
 }
 
 void btgattc_execute_write_cb(int conn_id, int status)
 {
-    CHECK_CALLBACK_ENV
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onExecuteCompleted
+    if (write_pipeline_executed(conn_id, status)) return;
+
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onExecuteCompleted
         , conn_id, status);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
 }
 
 void btgattc_read_descriptor_cb(int conn_id, int status, btgatt_read_params_t *p_data)
 {
-    CHECK_CALLBACK_ENV
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
 
     jbyteArray jb;
     if ( p_data->value.len != 0 )
@@ -389,45 +1911,40 @@ void btgattc_read_descriptor_cb(int conn_id, int status, btgatt_read_params_t *p
         jb = sCallbackEnv->NewByteArray(1);
     }
 
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onReadDescriptor
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onReadDescriptor
         , conn_id, status, SRVC_ID_PARAMS((&p_data->srvc_id))
         , GATT_ID_PARAMS((&p_data->char_id)), GATT_ID_PARAMS((&p_data->descr_id))
         , p_data->value_type, jb);
 
     sCallbackEnv->DeleteLocalRef(jb);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
 }
 
 void btgattc_write_descriptor_cb(int conn_id, int status, btgatt_write_params_t *p_data)
 {
-    CHECK_CALLBACK_ENV
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onWriteDescriptor
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onWriteDescriptor
         , conn_id, status, SRVC_ID_PARAMS((&p_data->srvc_id))
         , GATT_ID_PARAMS((&p_data->char_id))
         , GATT_ID_PARAMS((&p_data->descr_id)));
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
 }
 
 void btgattc_remote_rssi_cb(int client_if,bt_bdaddr_t* bda, int rssi, int status)
 {
-    CHECK_CALLBACK_ENV
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
 
-    char c_address[32];
-    snprintf(c_address, sizeof(c_address),"%02X:%02X:%02X:%02X:%02X:%02X",
-        bda->address[0], bda->address[1], bda->address[2],
-        bda->address[3], bda->address[4], bda->address[5]);
-    jstring address = sCallbackEnv->NewStringUTF(c_address);
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onReadRemoteRssi,
+    jstring address = sCallbackEnv.newAddressString(bda);
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onReadRemoteRssi,
        client_if, address, rssi, status);
     sCallbackEnv->DeleteLocalRef(address);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
 }
 
 void btgattc_advertise_cb(int status, int client_if)
 {
-    CHECK_CALLBACK_ENV
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onAdvertiseCallback, status, client_if);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onAdvertiseCallback, status, client_if);
 }
 
 static const btgatt_client_callbacks_t sGattClientCallbacks = {
@@ -458,109 +1975,109 @@ static const btgatt_client_callbacks_t sGattClientCallbacks = {
 
 void btgatts_register_app_cb(int status, int server_if, bt_uuid_t *uuid)
 {
-    CHECK_CALLBACK_ENV
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onServerRegistered
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onServerRegistered
         , status, server_if, UUID_PARAMS(uuid));
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
 }
 
 void btgatts_connection_cb(int conn_id, int server_if, int connected, bt_bdaddr_t *bda)
 {
-    CHECK_CALLBACK_ENV
+    if (!connected) subs_disconnected(conn_id);
 
-    char c_address[32];
-    sprintf(c_address, "%02X:%02X:%02X:%02X:%02X:%02X",
-            bda->address[0], bda->address[1], bda->address[2],
-            bda->address[3], bda->address[4], bda->address[5]);
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
 
-    jstring address = sCallbackEnv->NewStringUTF(c_address);
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onClientConnected,
-                                 address, connected, conn_id, server_if);
+    jstring address = sCallbackEnv.newAddressString(bda);
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onClientConnected,
+                                address, connected, conn_id, server_if);
     sCallbackEnv->DeleteLocalRef(address);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
 }
 
 void btgatts_service_added_cb(int status, int server_if,
                               btgatt_srvc_id_t *srvc_id, int srvc_handle)
 {
-    CHECK_CALLBACK_ENV
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onServiceAdded, status,
-                                 server_if, SRVC_ID_PARAMS(srvc_id),
-                                 srvc_handle);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onServiceAdded, status,
+                                server_if, SRVC_ID_PARAMS(srvc_id),
+                                srvc_handle);
 }
 
 void btgatts_included_service_added_cb(int status, int server_if,
                                    int srvc_handle,
                                    int incl_srvc_handle)
 {
-    CHECK_CALLBACK_ENV
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onIncludedServiceAdded,
-                                 status, server_if, srvc_handle, incl_srvc_handle);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onIncludedServiceAdded,
+                                status, server_if, srvc_handle, incl_srvc_handle);
 }
 
 void btgatts_characteristic_added_cb(int status, int server_if, bt_uuid_t *char_id,
                                      int srvc_handle, int char_handle)
 {
-    CHECK_CALLBACK_ENV
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onCharacteristicAdded,
-                                 status, server_if, UUID_PARAMS(char_id),
-                                 srvc_handle, char_handle);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    if (status == 0) subs_characteristic_added(server_if, char_handle);
+
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onCharacteristicAdded,
+                                status, server_if, UUID_PARAMS(char_id),
+                                srvc_handle, char_handle);
 }
 
 void btgatts_descriptor_added_cb(int status, int server_if,
                                  bt_uuid_t *descr_id, int srvc_handle,
                                  int descr_handle)
 {
-    CHECK_CALLBACK_ENV
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onDescriptorAdded,
-                                 status, server_if, UUID_PARAMS(descr_id),
-                                 srvc_handle, descr_handle);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    if (status == 0) subs_descriptor_added(server_if, descr_id, srvc_handle, descr_handle);
+
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onDescriptorAdded,
+                                status, server_if, UUID_PARAMS(descr_id),
+                                srvc_handle, descr_handle);
 }
 
 void btgatts_service_started_cb(int status, int server_if, int srvc_handle)
 {
-    CHECK_CALLBACK_ENV
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onServiceStarted, status,
-                                 server_if, srvc_handle);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onServiceStarted, status,
+                                server_if, srvc_handle);
 }
 
 void btgatts_service_stopped_cb(int status, int server_if, int srvc_handle)
 {
-    CHECK_CALLBACK_ENV
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onServiceStopped, status,
-                                 server_if, srvc_handle);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onServiceStopped, status,
+                                server_if, srvc_handle);
 }
 
 void btgatts_service_deleted_cb(int status, int server_if, int srvc_handle)
 {
-    CHECK_CALLBACK_ENV
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onServiceDeleted, status,
-                                 server_if, srvc_handle);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    if (status == 0) subs_service_deleted(server_if, srvc_handle);
+
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onServiceDeleted, status,
+                                server_if, srvc_handle);
 }
 
 void btgatts_request_read_cb(int conn_id, int trans_id, bt_bdaddr_t *bda,
                              int attr_handle, int offset, bool is_long)
 {
-    CHECK_CALLBACK_ENV
+    if (attr_cache_read(conn_id, trans_id, attr_handle, offset)) return;
 
-    char c_address[32];
-    sprintf(c_address, "%02X:%02X:%02X:%02X:%02X:%02X",
-            bda->address[0], bda->address[1], bda->address[2],
-            bda->address[3], bda->address[4], bda->address[5]);
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
 
-    jstring address = sCallbackEnv->NewStringUTF(c_address);
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onAttributeRead,
-                                 address, conn_id, trans_id, attr_handle,
-                                 offset, is_long);
+    jstring address = sCallbackEnv.newAddressString(bda);
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onAttributeRead,
+                                address, conn_id, trans_id, attr_handle,
+                                offset, is_long);
     sCallbackEnv->DeleteLocalRef(address);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
 }
 
 void btgatts_request_write_cb(int conn_id, int trans_id,
@@ -568,48 +2085,41 @@ void btgatts_request_write_cb(int conn_id, int trans_id,
                               int offset, int length,
                               bool need_rsp, bool is_prep, uint8_t* value)
 {
-    CHECK_CALLBACK_ENV
+    attr_cache_written(attr_handle);
+    subs_written(conn_id, attr_handle, offset, length, is_prep, value);
 
-    char c_address[32];
-    sprintf(c_address, "%02X:%02X:%02X:%02X:%02X:%02X",
-            bda->address[0], bda->address[1], bda->address[2],
-            bda->address[3], bda->address[4], bda->address[5]);
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
 
-    jstring address = sCallbackEnv->NewStringUTF(c_address);
+    jstring address = sCallbackEnv.newAddressString(bda);
 
     jbyteArray val = sCallbackEnv->NewByteArray(length);
     if (val) sCallbackEnv->SetByteArrayRegion(val, 0, length, (jbyte*)value);
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onAttributeWrite,
-                                 address, conn_id, trans_id, attr_handle,
-                                 offset, length, need_rsp, is_prep, val);
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onAttributeWrite,
+                                address, conn_id, trans_id, attr_handle,
+                                offset, length, need_rsp, is_prep, val);
     sCallbackEnv->DeleteLocalRef(address);
     sCallbackEnv->DeleteLocalRef(val);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
 }
 
 void btgatts_request_exec_write_cb(int conn_id, int trans_id,
                                    bt_bdaddr_t *bda, int exec_write)
 {
-    CHECK_CALLBACK_ENV
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
 
-    char c_address[32];
-    sprintf(c_address, "%02X:%02X:%02X:%02X:%02X:%02X",
-            bda->address[0], bda->address[1], bda->address[2],
-            bda->address[3], bda->address[4], bda->address[5]);
-
-    jstring address = sCallbackEnv->NewStringUTF(c_address);
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onExecuteWrite,
-                                 address, conn_id, trans_id, exec_write);
+    jstring address = sCallbackEnv.newAddressString(bda);
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onExecuteWrite,
+                                address, conn_id, trans_id, exec_write);
     sCallbackEnv->DeleteLocalRef(address);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
 }
 
 void btgatts_response_confirmation_cb(int status, int handle)
 {
-    CHECK_CALLBACK_ENV
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onResponseSendCompleted,
-                                 status, handle);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onResponseSendCompleted,
+                                status, handle);
 }
 
 static const btgatt_server_callbacks_t sGattServerCallbacks = {
@@ -642,44 +2152,56 @@ static const btgatt_callbacks_t sGattCallbacks = {
  * Native function definitions
  */
 
+static const callback_method_t sCallbackMethods[] = {
+    // Client callbacks
+    {&method_onClientRegistered, "onClientRegistered", "(IIJJ)V"},
+    {&method_onScanResult, "onScanResult", "(Ljava/lang/String;I[B)V"},
+    {&method_onBatchScanResults, "onBatchScanResults", "(I[B)V"},
+    {&method_onConnected, "onConnected", "(IIILjava/lang/String;)V"},
+    {&method_onDisconnected, "onDisconnected", "(IIILjava/lang/String;)V"},
+    {&method_onReadCharacteristic, "onReadCharacteristic", "(IIIIJJIJJI[B)V"},
+    {&method_onWriteCharacteristic, "onWriteCharacteristic", "(IIIIJJIJJ)V"},
+    {&method_onExecuteCompleted, "onExecuteCompleted", "(II)V"},
+    {&method_onSearchCompleted, "onSearchCompleted", "(II)V"},
+    {&method_onSearchResult, "onSearchResult", "(IIIJJ)V"},
+    {&method_onReadDescriptor, "onReadDescriptor", "(IIIIJJIJJIJJI[B)V"},
+    {&method_onWriteDescriptor, "onWriteDescriptor", "(IIIIJJIJJIJJ)V"},
+    {&method_onNotify, "onNotify", "(ILjava/lang/String;IIJJIJJZ[B)V"},
+    {&method_onNotifyBatch, "onNotifyBatch", "(IIII)V"},
+    {&method_onDatabaseDiscovered, "onDatabaseDiscovered", "(II[J)V"},
+    {&method_onWriteBatchCompleted, "onWriteBatchCompleted", "(III)V"},
+    {&method_onGetCharacteristic, "onGetCharacteristic", "(IIIIJJIJJI)V"},
+    {&method_onGetDescriptor, "onGetDescriptor", "(IIIIJJIJJIJJ)V"},
+    {&method_onGetIncludedService, "onGetIncludedService", "(IIIIJJIIJJ)V"},
+    {&method_onRegisterForNotifications, "onRegisterForNotifications", "(IIIIIJJIJJ)V"},
+    {&method_onReadRemoteRssi, "onReadRemoteRssi", "(ILjava/lang/String;II)V"},
+
+    // Server callbacks
+    {&method_onServerRegistered, "onServerRegistered", "(IIJJ)V"},
+    {&method_onClientConnected, "onClientConnected", "(Ljava/lang/String;ZII)V"},
+    {&method_onServiceAdded, "onServiceAdded", "(IIIIJJI)V"},
+    {&method_onIncludedServiceAdded, "onIncludedServiceAdded", "(IIII)V"},
+    {&method_onCharacteristicAdded, "onCharacteristicAdded", "(IIJJII)V"},
+    {&method_onDescriptorAdded, "onDescriptorAdded", "(IIJJII)V"},
+    {&method_onServiceStarted, "onServiceStarted", "(III)V"},
+    {&method_onServiceStopped, "onServiceStopped", "(III)V"},
+    {&method_onServiceDeleted, "onServiceDeleted", "(III)V"},
+    {&method_onResponseSendCompleted, "onResponseSendCompleted", "(II)V"},
+    {&method_onAttributeRead, "onAttributeRead", "(Ljava/lang/String;IIIIZ)V"},
+    {&method_onAttributeWrite, "onAttributeWrite", "(Ljava/lang/String;IIIIIZZ[B)V"},
+    {&method_onExecuteWrite, "onExecuteWrite", "(Ljava/lang/String;III)V"},
+    {&method_onAdvertiseCallback, "onAdvertiseCallback", "(II)V"},
+};
+
 static void classInitNative(JNIEnv* env, jclass clazz) {
 
-    // Client callbacks
+    // Scan traffic must not hold up audio state changes of other profiles
+    setCallbackPriority(env, clazz, CALLBACK_PRIORITY_LOW);
 
-    method_onClientRegistered = env->GetMethodID(clazz, "onClientRegistered", "(IIJJ)V");
-    method_onScanResult = env->GetMethodID(clazz, "onScanResult", "(Ljava/lang/String;I[B)V");
-    method_onConnected   = env->GetMethodID(clazz, "onConnected", "(IIILjava/lang/String;)V");
-    method_onDisconnected = env->GetMethodID(clazz, "onDisconnected", "(IIILjava/lang/String;)V");
-    method_onReadCharacteristic = env->GetMethodID(clazz, "onReadCharacteristic", "(IIIIJJIJJI[B)V");
-    method_onWriteCharacteristic = env->GetMethodID(clazz, "onWriteCharacteristic", "(IIIIJJIJJ)V");
-    method_onExecuteCompleted = env->GetMethodID(clazz, "onExecuteCompleted",  "(II)V");
-    method_onSearchCompleted = env->GetMethodID(clazz, "onSearchCompleted",  "(II)V");
-    method_onSearchResult = env->GetMethodID(clazz, "onSearchResult", "(IIIJJ)V");
-    method_onReadDescriptor = env->GetMethodID(clazz, "onReadDescriptor", "(IIIIJJIJJIJJI[B)V");
-    method_onWriteDescriptor = env->GetMethodID(clazz, "onWriteDescriptor", "(IIIIJJIJJIJJ)V");
-    method_onNotify = env->GetMethodID(clazz, "onNotify", "(ILjava/lang/String;IIJJIJJZ[B)V");
-    method_onGetCharacteristic = env->GetMethodID(clazz, "onGetCharacteristic", "(IIIIJJIJJI)V");
-    method_onGetDescriptor = env->GetMethodID(clazz, "onGetDescriptor", "(IIIIJJIJJIJJ)V");
-    method_onGetIncludedService = env->GetMethodID(clazz, "onGetIncludedService", "(IIIIJJIIJJ)V");
-    method_onRegisterForNotifications = env->GetMethodID(clazz, "onRegisterForNotifications", "(IIIIIJJIJJ)V");
-    method_onReadRemoteRssi = env->GetMethodID(clazz, "onReadRemoteRssi", "(ILjava/lang/String;II)V");
-
-     // Server callbacks
-
-    method_onServerRegistered = env->GetMethodID(clazz, "onServerRegistered", "(IIJJ)V");
-    method_onClientConnected = env->GetMethodID(clazz, "onClientConnected", "(Ljava/lang/String;ZII)V");
-    method_onServiceAdded = env->GetMethodID(clazz, "onServiceAdded", "(IIIIJJI)V");
-    method_onIncludedServiceAdded = env->GetMethodID(clazz, "onIncludedServiceAdded", "(IIII)V");
-    method_onCharacteristicAdded  = env->GetMethodID(clazz, "onCharacteristicAdded", "(IIJJII)V");
-    method_onDescriptorAdded = env->GetMethodID(clazz, "onDescriptorAdded", "(IIJJII)V");
-    method_onServiceStarted = env->GetMethodID(clazz, "onServiceStarted", "(III)V");
-    method_onServiceStopped = env->GetMethodID(clazz, "onServiceStopped", "(III)V");
-    method_onServiceDeleted = env->GetMethodID(clazz, "onServiceDeleted", "(III)V");
-    method_onResponseSendCompleted = env->GetMethodID(clazz, "onResponseSendCompleted", "(II)V");
-    method_onAttributeRead= env->GetMethodID(clazz, "onAttributeRead", "(Ljava/lang/String;IIIIZ)V");
-    method_onAttributeWrite= env->GetMethodID(clazz, "onAttributeWrite", "(Ljava/lang/String;IIIIIZZ[B)V");
-    method_onExecuteWrite= env->GetMethodID(clazz, "onExecuteWrite", "(Ljava/lang/String;III)V");
-    method_onAdvertiseCallback = env->GetMethodID(clazz, "onAdvertiseCallback", "(II)V");
+    if (!getCallbackMethodIDs(env, clazz, sCallbackMethods, NELEM(sCallbackMethods))) {
+        error("Missing callback methods");
+        return;
+    }
 
     info("classInitNative: Success!");
 }
@@ -727,6 +2249,48 @@ static void cleanupNative(JNIEnv *env, jobject object) {
     bt_status_t status;
     if (!btIf) return;
 
+    {
+        Mutex::Autolock lock(sScanBatchLock);
+        scan_batch_timer_stop_l();
+        sScanBatchSize = 0;
+        sScanBatchHead = 0;
+        sScanBatchCount = 0;
+    }
+    {
+        Mutex::Autolock lock(sScanDedupLock);
+        sScanDedupWindow = 0;
+    }
+    {
+        Mutex::Autolock lock(sNotifyLock);
+        notify_timer_stop_l();
+        for (int i = 0; i != NOTIFY_MAX_RINGS; ++i)
+            notify_ring_release_l(env, &sNotifyRings[i]);
+        // Queued batches refer to rings released by now, leave the one being
+        // announced to its thread
+        sNotifyAnnounceTaken = sNotifyAnnouncePosted + (sNotifyAnnouncing ? 1 : 0);
+    }
+    {
+        Mutex::Autolock lock(sDbDiscoveryLock);
+        for (int i = 0; i != DB_MAX_DISCOVERIES; ++i)
+            db_discovery_free_l(&sDbDiscoveries[i]);
+    }
+    {
+        Mutex::Autolock lock(sWritePipelineLock);
+        for (int i = 0; i != WRITE_MAX_PIPELINES; ++i)
+            write_pipeline_free_l(&sWritePipelines[i]);
+    }
+    {
+        Mutex::Autolock lock(sAttrCacheLock);
+        for (int i = 0; i != ATTR_CACHE_MAX_VALUES; ++i)
+            attr_cache_free_l(&sAttrCache[i]);
+    }
+    {
+        Mutex::Autolock lock(sSubsLock);
+        memset(sSubsCccds, 0, sizeof(sSubsCccds));
+        memset(sSubscriptions, 0, sizeof(sSubscriptions));
+        memset(sSubsServers, 0, sizeof(sSubsServers));
+    }
+
     if (sGattIf != NULL) {
         sGattIf->cleanup();
         sGattIf = NULL;
@@ -770,7 +2334,142 @@ static void gattClientUnregisterAppNative(JNIEnv* env, jobject object, jint clie
 static void gattClientScanNative(JNIEnv* env, jobject object, jint clientIf, jboolean start)
 {
     if (!sGattIf) return;
+    if (start) scan_dedup_reset();
     sGattIf->client->scan(clientIf, start);
+    if (!start) scan_batch_flush(env);
+}
+
+static void gattClientConfigureBatchScanNative(JNIEnv* env, jobject object,
+                                               jint batch_size, jint max_delay_ms)
+{
+    if (batch_size < 0) batch_size = 0;
+    if (batch_size > SCAN_BATCH_MAX_RESULTS) batch_size = SCAN_BATCH_MAX_RESULTS;
+    if (max_delay_ms < 0) max_delay_ms = 0;
+
+    // Deliver anything queued under the previous configuration first
+    scan_batch_flush(env);
+
+    Mutex::Autolock lock(sScanBatchLock);
+    sScanBatchSize = batch_size;
+    sScanBatchMaxDelay = milliseconds_to_nanoseconds(max_delay_ms);
+    if (sScanBatchSize > 0 && sScanBatchMaxDelay > 0) scan_batch_timer_start_l();
+    sScanBatchCond.signal();
+}
+
+static void gattClientConfigureScanFilterNative(JNIEnv* env, jobject object,
+                                                jint window_ms, jint rssi_threshold)
+{
+    if (window_ms < 0) window_ms = 0;
+    if (rssi_threshold < 0) rssi_threshold = 0;
+
+    Mutex::Autolock lock(sScanDedupLock);
+    memset(sScanDedup, 0, sizeof(sScanDedup));
+    sScanDedupWindow = milliseconds_to_nanoseconds(window_ms);
+    sScanDedupRssiThreshold = rssi_threshold;
+}
+
+static jint gattClientRegisterNotifyBufferNative(JNIEnv* env, jobject object,
+    jint conn_id, jint service_type, jint service_id_inst_id,
+    jlong service_id_uuid_lsb, jlong service_id_uuid_msb,
+    jint char_id_inst_id,
+    jlong char_id_uuid_lsb, jlong char_id_uuid_msb,
+    jobject buffer, jint batch_size, jint max_delay_ms)
+{
+    uint8_t *data = (uint8_t *) env->GetDirectBufferAddress(buffer);
+    jlong capacity = env->GetDirectBufferCapacity(buffer);
+    if (data == NULL || capacity < NOTIFY_RECORD_HEADER_LEN + BTGATT_MAX_ATTR_LEN)
+    {
+        error("Notification buffer must be direct and hold at least %d bytes",
+              NOTIFY_RECORD_HEADER_LEN + BTGATT_MAX_ATTR_LEN);
+        return -1;
+    }
+    if (capacity > 0x7FFFFFFF) capacity = 0x7FFFFFFF;
+    if (batch_size < 1) batch_size = 1;
+    if (max_delay_ms < 0) max_delay_ms = 0;
+
+    btgatt_srvc_id_t srvc_id;
+    srvc_id.id.inst_id = (uint8_t) service_id_inst_id;
+    srvc_id.is_primary = (service_type == BTGATT_SERVICE_TYPE_PRIMARY ? 1 : 0);
+    set_uuid(srvc_id.id.uuid.uu, service_id_uuid_msb, service_id_uuid_lsb);
+
+    btgatt_gatt_id_t char_id;
+    char_id.inst_id = (uint8_t) char_id_inst_id;
+    set_uuid(char_id.uuid.uu, char_id_uuid_msb, char_id_uuid_lsb);
+
+    Mutex::Autolock lock(sNotifyLock);
+    if (notify_ring_find_l(conn_id, &srvc_id, &char_id) != NULL)
+    {
+        error("Notification buffer already registered for conn_id %d", conn_id);
+        return -1;
+    }
+
+    notify_ring_t *ring = notify_ring_get_l(0);     // first free slot
+    if (ring == NULL)
+    {
+        error("No room for another notification buffer");
+        return -1;
+    }
+
+    ring->buffer = env->NewGlobalRef(buffer);
+    if (ring->buffer == NULL) return -1;
+    ring->conn_id = conn_id;
+    ring->srvc_id = srvc_id;
+    ring->char_id = char_id;
+    ring->data = data;
+    ring->capacity = (int) capacity;
+    ring->batch_size = batch_size;
+    ring->max_delay = milliseconds_to_nanoseconds(max_delay_ms);
+    ring->id = sNotifyNextId++;
+    if (sNotifyNextId <= 0) sNotifyNextId = 1;
+    // Also announces the last batches of unregistered rings
+    notify_timer_start_l();
+    return ring->id;
+}
+
+/**
+ * Records not yet announced go out as a last batch, which the notify timer
+ * thread announces, as the caller may be the thread making the upcalls.
+ * Returns whether the buffer is no longer used, otherwise it is once
+ * gattClientReleaseNotifyBufferNative says so.
+ */
+static jboolean gattClientUnregisterNotifyBufferNative(JNIEnv* env, jobject object, jint id)
+{
+    Mutex::Autolock lock(sNotifyLock);
+    notify_ring_t *ring = notify_ring_get_l(id);
+    if (ring == NULL) return JNI_TRUE;
+    if (ring->closing) return JNI_FALSE;
+
+    ring->closing = true;
+    if (ring->pending_count > 0 && !notify_ring_deliver_l(ring))
+        warn("Notification ring %d dropping %d records", id, ring->pending_count);
+    if (ring->inflight_count == 0)
+    {
+        notify_ring_release_l(env, ring);
+        return JNI_TRUE;
+    }
+    sNotifyCond.signal();
+    return JNI_FALSE;
+}
+
+// Returns whether the buffer is no longer used
+static jboolean gattClientReleaseNotifyBufferNative(JNIEnv* env, jobject object, jint id)
+{
+    Mutex::Autolock lock(sNotifyLock);
+    notify_ring_t *ring = notify_ring_get_l(id);
+    if (ring == NULL) return JNI_TRUE;
+    if (ring->inflight_count == 0) return JNI_FALSE;
+
+    ring->used -= ring->inflight[ring->inflight_head];
+    ring->inflight_head = (ring->inflight_head + 1) % NOTIFY_MAX_INFLIGHT;
+    --ring->inflight_count;
+    if (ring->used == 0) ring->tail = 0;
+    if (ring->pending_count > 0 && ring->max_delay > 0) sNotifyCond.signal();
+    if (ring->closing && ring->inflight_count == 0)
+    {
+        notify_ring_release_l(env, ring);
+        return JNI_TRUE;
+    }
+    return JNI_FALSE;
 }
 
 static void gattClientConnectNative(JNIEnv* env, jobject object, jint clientif,
@@ -799,6 +2498,7 @@ static void gattClientRefreshNative(JNIEnv* env, jobject object, jint clientIf,
 
     bt_bdaddr_t bda;
     jstr2bdaddr(env, &bda, address);
+    db_cache_invalidate(&bda);
     sGattIf->client->refresh(clientIf, &bda);
 }
 
@@ -812,6 +2512,57 @@ static void gattClientSearchServiceNative(JNIEnv* env, jobject object, jint conn
     sGattIf->client->search_service(conn_id, search_all ? 0 : &uuid);
 }
 
+static jboolean gattClientDiscoverDatabaseNative(JNIEnv* env, jobject object, jint conn_id,
+                                                 jboolean bonded)
+{
+    if (!sGattIf) return JNI_FALSE;
+
+    Mutex::Autolock lock(sDbDiscoveryLock);
+    // A walk in progress will report back already
+    if (db_discovery_get_l(conn_id) != NULL) return JNI_TRUE;
+
+    db_discovery_t *d = NULL;
+    for (int i = 0; i != DB_MAX_DISCOVERIES && d == NULL; ++i)
+    {
+        if (!sDbDiscoveries[i].active) d = &sDbDiscoveries[i];
+    }
+    if (d == NULL)
+    {
+        warn("Too many database discoveries in progress");
+        return JNI_FALSE;
+    }
+
+    d->active = true;
+    d->conn_id = conn_id;
+    d->service = -1;
+    d->characteristic = -1;
+    for (int i = 0; i != DB_MAX_CONNECTIONS && bonded; ++i)
+    {
+        if (sDbConnections[i].in_use && sDbConnections[i].conn_id == conn_id)
+        {
+            memcpy(&d->bda, &sDbConnections[i].bda, sizeof(bt_bdaddr_t));
+            d->cacheable = true;
+        }
+    }
+
+    // The search runs either way, the cache only saves the walk
+    if (d->cacheable) db_cache_load_l(d);
+    sGattIf->client->search_service(conn_id, 0);
+    return JNI_TRUE;
+}
+
+static void gattClientConfigureDbCacheNative(JNIEnv* env, jobject object, jstring dir)
+{
+    Mutex::Autolock lock(sDbDiscoveryLock);
+    sDbCacheDir[0] = 0;
+    if (dir == NULL) return;
+
+    const char *c_dir = env->GetStringUTFChars(dir, NULL);
+    if (c_dir == NULL) return;
+    if (strlen(c_dir) + 16 < sizeof(sDbCacheDir)) strcpy(sDbCacheDir, c_dir);
+    env->ReleaseStringUTFChars(dir, c_dir);
+}
+
 static void gattClientGetCharacteristicNative(JNIEnv* env, jobject object,
     jint conn_id,
     jint  service_type, jint  service_id_inst_id,
@@ -972,6 +2723,86 @@ static void gattClientWriteCharacteristicNative(JNIEnv* env, jobject object,
     env->ReleaseByteArrayElements(value, p_value, 0);
 }
 
+/**
+ * Each entry takes WRITE_ENTRY_WORDS words of ids:
+ * service type | service inst_id << 8 | char inst_id << 16 | write type << 24,
+ * service uuid lsb, service uuid msb, char uuid lsb, char uuid msb,
+ * and lengths[i] bytes of the concatenated values.
+ */
+static jboolean gattClientWriteBatchNative(JNIEnv* env, jobject object, jint conn_id,
+    jlongArray ids, jintArray lengths, jbyteArray values, jint auth_req, jboolean reliable)
+{
+    if (!sGattIf) return JNI_FALSE;
+
+    int count = env->GetArrayLength(lengths);
+    int values_len = env->GetArrayLength(values);
+    if (count == 0 || env->GetArrayLength(ids) != count * WRITE_ENTRY_WORDS) return JNI_FALSE;
+
+    Mutex::Autolock lock(sWritePipelineLock);
+    if (write_pipeline_get_l(conn_id) != NULL)
+    {
+        error("A write batch is already in progress on conn_id %d", conn_id);
+        return JNI_FALSE;
+    }
+
+    write_pipeline_t *wp = NULL;
+    for (int i = 0; i != WRITE_MAX_PIPELINES && wp == NULL; ++i)
+    {
+        if (!sWritePipelines[i].active) wp = &sWritePipelines[i];
+    }
+    if (wp == NULL)
+    {
+        warn("Too many write batches in progress");
+        return JNI_FALSE;
+    }
+
+    jlong *words = env->GetLongArrayElements(ids, NULL);
+    jint *len = env->GetIntArrayElements(lengths, NULL);
+    if (words == NULL || len == NULL)
+    {
+        if (words) env->ReleaseLongArrayElements(ids, words, JNI_ABORT);
+        return JNI_FALSE;
+    }
+
+    wp->entries = new write_entry_t[count];
+    int offset = 0;
+    bool valid = true;
+    for (int i = 0; i != count && valid; ++i)
+    {
+        jlong *w = words + i * WRITE_ENTRY_WORDS;
+        write_entry_t *entry = &wp->entries[i];
+        valid = len[i] >= 0 && len[i] <= BTGATT_MAX_ATTR_LEN && offset + len[i] <= values_len;
+        entry->srvc_id.is_primary = ((w[0] & 0xFF) == BTGATT_SERVICE_TYPE_PRIMARY ? 1 : 0);
+        entry->srvc_id.id.inst_id = (uint8_t) (w[0] >> 8);
+        entry->char_id.inst_id = (uint8_t) (w[0] >> 16);
+        entry->write_type = (int) ((w[0] >> 24) & 0xFF);
+        set_uuid(entry->srvc_id.id.uuid.uu, w[2], w[1]);
+        set_uuid(entry->char_id.uuid.uu, w[4], w[3]);
+        entry->len = len[i];
+        entry->offset = offset;
+        offset += len[i];
+    }
+    env->ReleaseLongArrayElements(ids, words, JNI_ABORT);
+    env->ReleaseIntArrayElements(lengths, len, JNI_ABORT);
+
+    if (!valid)
+    {
+        error("Invalid write batch of %d entries", count);
+        write_pipeline_free_l(wp);
+        return JNI_FALSE;
+    }
+
+    wp->values = new uint8_t[offset > 0 ? offset : 1];
+    env->GetByteArrayRegion(values, 0, offset, (jbyte *) wp->values);
+    wp->active = true;
+    wp->conn_id = conn_id;
+    wp->auth_req = auth_req;
+    wp->reliable = reliable;
+    wp->count = count;
+    write_pipeline_issue_l(wp);
+    return JNI_TRUE;
+}
+
 static void gattClientExecuteWriteNative(JNIEnv* env, jobject object,
     jint conn_id, jboolean execute)
 {
@@ -1105,6 +2936,7 @@ static void gattServerRegisterAppNative(JNIEnv* env, jobject object,
 static void gattServerUnregisterAppNative(JNIEnv* env, jobject object, jint serverIf)
 {
     if (!sGattIf) return;
+    subs_server_unregistered(serverIf);
     sGattIf->server->unregister_server(serverIf);
 }
 
@@ -1210,6 +3042,7 @@ static void gattServerSendIndicationNative (JNIEnv *env, jobject object,
 
     sGattIf->server->send_indication(server_if, attr_handle, conn_id, val_len,
                                      /*confirm*/ 1, (char*)array);
+    attr_cache_sent(attr_handle, array, val_len);
     env->ReleaseByteArrayElements(val, array, JNI_ABORT);
 }
 
@@ -1223,7 +3056,48 @@ static void gattServerSendNotificationNative (JNIEnv *env, jobject object,
 
     sGattIf->server->send_indication(server_if, attr_handle, conn_id, val_len,
                                      /*confirm*/ 0, (char*)array);
+    attr_cache_sent(attr_handle, array, val_len);
+    env->ReleaseByteArrayElements(val, array, JNI_ABORT);
+}
+
+/**
+ * Sends one value to each connection in conn_ids, or to every connection
+ * subscribed to attr_handle for that kind of update if conn_ids is null.
+ * The value is copied out of the Java array once for all of them. Returns
+ * the number of connections it was sent to.
+ */
+static jint gattServerSendFanOutNative (JNIEnv *env, jobject object,
+        jint server_if, jint attr_handle, jintArray conn_ids, jboolean confirm,
+        jbyteArray val)
+{
+    if (!sGattIf) return 0;
+
+    int subscribers[SUBS_MAX_SUBSCRIPTIONS];
+    jint *ids = NULL;
+    int count;
+
+    if (conn_ids == NULL) {
+        count = subs_collect(attr_handle, confirm, subscribers, SUBS_MAX_SUBSCRIPTIONS);
+    } else {
+        count = env->GetArrayLength(conn_ids);
+        ids = env->GetIntArrayElements(conn_ids, NULL);
+        if (ids == NULL) return 0;
+    }
+
+    jbyte* array = env->GetByteArrayElements(val, 0);
+    int val_len = env->GetArrayLength(val);
+
+    for (int i = 0; i != count; ++i)
+    {
+        sGattIf->server->send_indication(server_if, attr_handle,
+                                         ids ? ids[i] : subscribers[i], val_len,
+                                         confirm ? 1 : 0, (char*)array);
+    }
+    if (count) attr_cache_sent(attr_handle, array, val_len);
+
     env->ReleaseByteArrayElements(val, array, JNI_ABORT);
+    if (ids) env->ReleaseIntArrayElements(conn_ids, ids, JNI_ABORT);
+    return count;
 }
 
 static void gattServerSendResponseNative (JNIEnv *env, jobject object,
@@ -1252,6 +3126,60 @@ static void gattServerSendResponseNative (JNIEnv *env, jobject object,
     sGattIf->server->send_response(conn_id, trans_id, status, &response);
 }
 
+static jboolean gattServerSetCachedValueNative(JNIEnv *env, jobject object,
+        jint server_if, jint srvc_handle, jint attr_handle, jboolean is_static,
+        jbyteArray val)
+{
+    Mutex::Autolock lock(sAttrCacheLock);
+    attr_cache_value_t *cv = attr_cache_find_l(attr_handle);
+
+    if (val == NULL)
+    {
+        if (cv != NULL) attr_cache_free_l(cv);
+        return JNI_TRUE;
+    }
+
+    int len = env->GetArrayLength(val);
+    if (len > BTGATT_MAX_ATTR_LEN) return JNI_FALSE;
+
+    if (cv == NULL)
+    {
+        for (int i = 0; i != ATTR_CACHE_MAX_VALUES && cv == NULL; ++i)
+        {
+            if (!sAttrCache[i].in_use) cv = &sAttrCache[i];
+        }
+        if (cv == NULL)
+        {
+            warn("No room to cache the value of handle %d", attr_handle);
+            return JNI_FALSE;
+        }
+        cv->in_use = true;
+        cv->attr_handle = attr_handle;
+    }
+
+    cv->server_if = server_if;
+    cv->srvc_handle = srvc_handle;
+    cv->is_static = is_static;
+
+    jbyte* array = env->GetByteArrayElements(val, 0);
+    attr_cache_update_l(cv, array, len);
+    env->ReleaseByteArrayElements(val, array, JNI_ABORT);
+    return JNI_TRUE;
+}
+
+static void gattServerClearCachedValuesNative(JNIEnv *env, jobject object,
+        jint server_if, jint srvc_handle)
+{
+    Mutex::Autolock lock(sAttrCacheLock);
+    for (int i = 0; i != ATTR_CACHE_MAX_VALUES; ++i)
+    {
+        attr_cache_value_t *cv = &sAttrCache[i];
+        if (cv->in_use && cv->server_if == server_if
+            && (srvc_handle == 0 || cv->srvc_handle == srvc_handle))
+            attr_cache_free_l(cv);
+    }
+}
+
 static void gattTestNative(JNIEnv *env, jobject object, jint command,
                            jlong uuid1_lsb, jlong uuid1_msb, jstring bda1,
                            jint p1, jint p2, jint p3, jint p4, jint p5 )
@@ -1288,10 +3216,14 @@ static JNINativeMethod sMethods[] = {
     {"gattClientRegisterAppNative", "(JJ)V", (void *) gattClientRegisterAppNative},
     {"gattClientUnregisterAppNative", "(I)V", (void *) gattClientUnregisterAppNative},
     {"gattClientScanNative", "(IZ)V", (void *) gattClientScanNative},
+    {"gattClientConfigureBatchScanNative", "(II)V", (void *) gattClientConfigureBatchScanNative},
+    {"gattClientConfigureScanFilterNative", "(II)V", (void *) gattClientConfigureScanFilterNative},
     {"gattClientConnectNative", "(ILjava/lang/String;Z)V", (void *) gattClientConnectNative},
     {"gattClientDisconnectNative", "(ILjava/lang/String;I)V", (void *) gattClientDisconnectNative},
     {"gattClientRefreshNative", "(ILjava/lang/String;)V", (void *) gattClientRefreshNative},
     {"gattClientSearchServiceNative", "(IZJJ)V", (void *) gattClientSearchServiceNative},
+    {"gattClientDiscoverDatabaseNative", "(IZ)Z", (void *) gattClientDiscoverDatabaseNative},
+    {"gattClientConfigureDbCacheNative", "(Ljava/lang/String;)V", (void *) gattClientConfigureDbCacheNative},
     {"gattClientGetCharacteristicNative", "(IIIJJIJJ)V", (void *) gattClientGetCharacteristicNative},
     {"gattClientGetDescriptorNative", "(IIIJJIJJIJJ)V", (void *) gattClientGetDescriptorNative},
     {"gattClientGetIncludedServiceNative", "(IIIJJIIJJ)V", (void *) gattClientGetIncludedServiceNative},
@@ -1300,7 +3232,11 @@ static JNINativeMethod sMethods[] = {
     {"gattClientWriteCharacteristicNative", "(IIIJJIJJII[B)V", (void *) gattClientWriteCharacteristicNative},
     {"gattClientWriteDescriptorNative", "(IIIJJIJJIJJII[B)V", (void *) gattClientWriteDescriptorNative},
     {"gattClientExecuteWriteNative", "(IZ)V", (void *) gattClientExecuteWriteNative},
+    {"gattClientWriteBatchNative", "(I[J[I[BIZ)Z", (void *) gattClientWriteBatchNative},
     {"gattClientRegisterForNotificationsNative", "(ILjava/lang/String;IIJJIJJZ)V", (void *) gattClientRegisterForNotificationsNative},
+    {"gattClientRegisterNotifyBufferNative", "(IIIJJIJJLjava/nio/ByteBuffer;II)I", (void *) gattClientRegisterNotifyBufferNative},
+    {"gattClientUnregisterNotifyBufferNative", "(I)Z", (void *) gattClientUnregisterNotifyBufferNative},
+    {"gattClientReleaseNotifyBufferNative", "(I)Z", (void *) gattClientReleaseNotifyBufferNative},
     {"gattClientReadRemoteRssiNative", "(ILjava/lang/String;)V", (void *) gattClientReadRemoteRssiNative},
     {"gattAdvertiseNative", "(IZ)V", (void *) gattAdvertiseNative},
 
@@ -1317,7 +3253,10 @@ static JNINativeMethod sMethods[] = {
     {"gattServerDeleteServiceNative", "(II)V", (void *) gattServerDeleteServiceNative},
     {"gattServerSendIndicationNative", "(III[B)V", (void *) gattServerSendIndicationNative},
     {"gattServerSendNotificationNative", "(III[B)V", (void *) gattServerSendNotificationNative},
+    {"gattServerSendFanOutNative", "(II[IZ[B)I", (void *) gattServerSendFanOutNative},
     {"gattServerSendResponseNative", "(IIIIII[BI)V", (void *) gattServerSendResponseNative},
+    {"gattServerSetCachedValueNative", "(IIIZ[B)Z", (void *) gattServerSetCachedValueNative},
+    {"gattServerClearCachedValuesNative", "(II)V", (void *) gattServerClearCachedValuesNative},
 
     {"gattSetAdvDataNative", "(IZZZIII[B[B[B)V", (void *) gattSetAdvDataNative},
     {"gattTestNative", "(IJJLjava/lang/String;IIIII)V", (void *) gattTestNative},
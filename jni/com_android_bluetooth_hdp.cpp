@@ -18,45 +18,248 @@
 
 #define LOG_NDEBUG 0
 
-#define CHECK_CALLBACK_ENV                                                      \
-   if (!checkCallbackThread()) {                                                \
-       ALOGE("Callback: '%s' is not called on the correct thread", __FUNCTION__);\
-       return;                                                                  \
-   }
-
 #include "com_android_bluetooth.h"
 #include "hardware/bt_hl.h"
 #include "utils/Log.h"
 #include "android_runtime/AndroidRuntime.h"
+#include "utils/Condition.h"
+#include "utils/Mutex.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 namespace android {
 
 static jmethodID method_onAppRegistrationState;
 static jmethodID method_onChannelStateChanged;
+static jmethodID method_onChannelData;
 
 static const bthl_interface_t *sBluetoothHdpInterface = NULL;
 static jobject mCallbacksObj = NULL;
-static JNIEnv *sCallbackEnv = NULL;
 
-static bool checkCallbackThread() {
-    sCallbackEnv = getCallbackEnv();
+/**
+ * Channel streaming
+ *
+ * Channels Java hands over with startChannelStreamNative are read by one
+ * thread of ours, which waits on all of them with epoll instead of a
+ * blocking reader per channel. Whatever the ready channels have to offer
+ * is read straight into the direct buffer Java registered, as records of
+ * a 4 byte channel id and a 4 byte length in host order followed by the
+ * data, and the whole batch is passed up with one onChannelData call. A
+ * record of length 0 tells that the channel ended, after which it is no
+ * longer streamed. The fd is dup()ed and owned by the reader thread, which
+ * is also the only one closing it, so that it cannot be reused under a
+ * pending read. The dup shares its file status flags with the fd Java
+ * holds, so they are left alone and reads do not block with MSG_DONTWAIT.
+ */
+
+#define HDP_MAX_STREAM_CHANNELS 64
+#define HDP_STREAM_RECORD_HEADER_LEN 8
+#define HDP_STREAM_MIN_READ 256
+
+// epoll data of the wake pipe, channels are tagged with their id
+#define HDP_STREAM_WAKE_TOKEN 0xFFFFFFFFFFFFFFFFULL
+
+typedef struct {
+    bool in_use;
+    bool closing;           // stopped, to be closed by the reader thread
+    int channel_id;
+    int fd;
+} stream_channel_t;
+
+static Mutex sStreamLock;
+static Condition sStreamExitCond;
+static bool sStreamRunning = false;
+static bool sStreamQuit = false;
+static int sStreamEpollFd = -1;
+static int sStreamWakeFds[2] = { -1, -1 };
+static stream_channel_t sStreamChannels[HDP_MAX_STREAM_CHANNELS];
+
+static jobject sStreamBuffer = NULL;
+static uint8_t *sStreamBufferData = NULL;
+static int sStreamBufferLen = 0;
+
+static stream_channel_t *stream_channel_find_l(int channel_id) {
+    for (int i = 0; i < HDP_MAX_STREAM_CHANNELS; i++) {
+        if (sStreamChannels[i].in_use && sStreamChannels[i].channel_id == channel_id) {
+            return &sStreamChannels[i];
+        }
+    }
+    return NULL;
+}
+
+static void stream_channel_close_l(stream_channel_t *c) {
+    epoll_ctl(sStreamEpollFd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    c->in_use = false;
+}
+
+static void stream_wake() {
+    char c = 0;
+    if (write(sStreamWakeFds[1], &c, 1) < 0 && errno != EAGAIN) {
+        ALOGE("Failed to wake the HDP reader thread: %s", strerror(errno));
+    }
+}
+
+static int stream_put_record(uint8_t *p, int channel_id, int len) {
+    memcpy(p, &channel_id, 4);
+    memcpy(p + 4, &len, 4);
+    return HDP_STREAM_RECORD_HEADER_LEN + len;
+}
+
+// Reads channel c into the buffer at used, returns the bytes added. The
+// channel is closed with an end record on EOF or error.
+static int stream_read_l(stream_channel_t *c, int used) {
+    uint8_t *p = sStreamBufferData + used;
+    int room = sStreamBufferLen - used - HDP_STREAM_RECORD_HEADER_LEN;
+
+    ssize_t n = recv(c->fd, p + HDP_STREAM_RECORD_HEADER_LEN, room, MSG_DONTWAIT);
+    if (n > 0) return stream_put_record(p, c->channel_id, (int) n);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) return 0;
+
+    if (n < 0) ALOGE("Failed to read HDP channel %d: %s", c->channel_id, strerror(errno));
+    int channel_id = c->channel_id;
+    stream_channel_close_l(c);
+    return stream_put_record(p, channel_id, 0);
+}
+
+static void stream_flush(JNIEnv *env, int used) {
+    if (used == 0) return;
+    callVoidMethodNow(env, __FUNCTION__, mCallbacksObj, method_onChannelData, (jint) used);
+}
+
+/**
+ * HDP reader thread. Attached to the VM so that it can pass the batches up
+ * itself. The buffer is only written here, and Java is done with a batch
+ * once onChannelData returns.
+ */
+static void hdp_stream_thread(void *arg) {
+    JNIEnv *env = AndroidRuntime::getJNIEnv();
+    struct epoll_event events[HDP_MAX_STREAM_CHANNELS + 1];
+
+    for (;;) {
+        int count = epoll_wait(sStreamEpollFd, events, NELEM(events), -1);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            ALOGE("HDP reader epoll_wait failed: %s", strerror(errno));
+            break;
+        }
+
+        int used = 0;
+        {
+            Mutex::Autolock lock(sStreamLock);
+            if (sStreamQuit) break;
+
+            for (int i = 0; i < count; i++) {
+                if (events[i].data.u64 == HDP_STREAM_WAKE_TOKEN) {
+                    char drain[16];
+                    while (read(sStreamWakeFds[0], drain, sizeof(drain)) > 0) {}
+                    continue;
+                }
+
+                stream_channel_t *c = stream_channel_find_l((int) events[i].data.u32);
+                if (c == NULL || c->closing) continue;
+
+                if (sStreamBufferLen - used < HDP_STREAM_RECORD_HEADER_LEN + HDP_STREAM_MIN_READ) {
+                    sStreamLock.unlock();
+                    stream_flush(env, used);
+                    sStreamLock.lock();
+                    used = 0;
+                    if (sStreamQuit) break;
+                    c = stream_channel_find_l((int) events[i].data.u32);
+                    if (c == NULL || c->closing) continue;
+                }
+                used += stream_read_l(c, used);
+            }
+
+            for (int i = 0; i < HDP_MAX_STREAM_CHANNELS; i++) {
+                if (sStreamChannels[i].in_use && sStreamChannels[i].closing) {
+                    stream_channel_close_l(&sStreamChannels[i]);
+                }
+            }
+        }
+        stream_flush(env, used);
+    }
+
+    Mutex::Autolock lock(sStreamLock);
+    for (int i = 0; i < HDP_MAX_STREAM_CHANNELS; i++) {
+        if (sStreamChannels[i].in_use) stream_channel_close_l(&sStreamChannels[i]);
+    }
+    sStreamRunning = false;
+    sStreamExitCond.signal();
+}
 
-    JNIEnv* env = AndroidRuntime::getJNIEnv();
-    if (sCallbackEnv != env || sCallbackEnv == NULL) {
-        ALOGE("Callback env check fail: env: %p, callback: %p", env, sCallbackEnv);
-        return false;
+static void hdp_stream_start() {
+    Mutex::Autolock lock(sStreamLock);
+    if (sStreamRunning) return;
+
+    if ( (sStreamEpollFd = epoll_create(HDP_MAX_STREAM_CHANNELS + 1)) < 0) {
+        ALOGE("Failed to create the HDP reader epoll fd: %s", strerror(errno));
+        return;
+    }
+    if (pipe(sStreamWakeFds) < 0) {
+        ALOGE("Failed to create the HDP reader wake pipe: %s", strerror(errno));
+        close(sStreamEpollFd);
+        sStreamEpollFd = -1;
+        return;
+    }
+    fcntl(sStreamWakeFds[0], F_SETFL, O_NONBLOCK);
+    fcntl(sStreamWakeFds[1], F_SETFL, O_NONBLOCK);
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u64 = HDP_STREAM_WAKE_TOKEN;
+    epoll_ctl(sStreamEpollFd, EPOLL_CTL_ADD, sStreamWakeFds[0], &event);
+
+    memset(sStreamChannels, 0, sizeof(sStreamChannels));
+    sStreamQuit = false;
+    if (AndroidRuntime::createJavaThread("BT HDP Reader Thread", hdp_stream_thread, NULL) == 0) {
+        ALOGE("Failed to start the HDP reader thread");
+        return;
     }
-    return true;
+    sStreamRunning = true;
+}
+
+// Waits for the reader thread to exit, which closes all streamed channels
+static void hdp_stream_stop(JNIEnv *env) {
+    Mutex::Autolock lock(sStreamLock);
+    if (sStreamRunning) {
+        sStreamQuit = true;
+        stream_wake();
+        while (sStreamRunning) {
+            sStreamExitCond.wait(sStreamLock);
+        }
+    }
+
+    if (sStreamEpollFd >= 0) {
+        close(sStreamEpollFd);
+        sStreamEpollFd = -1;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (sStreamWakeFds[i] >= 0) {
+            close(sStreamWakeFds[i]);
+            sStreamWakeFds[i] = -1;
+        }
+    }
+    if (sStreamBuffer != NULL) {
+        env->DeleteGlobalRef(sStreamBuffer);
+        sStreamBuffer = NULL;
+    }
+    sStreamBufferData = NULL;
+    sStreamBufferLen = 0;
 }
 
 // Define callback functions
 static void app_registration_state_callback(int app_id, bthl_app_reg_state_t state) {
-    CHECK_CALLBACK_ENV
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onAppRegistrationState, app_id,
-                                 (jint) state);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onAppRegistrationState, app_id,
+                                (jint) state);
 }
 
 static void channel_state_callback(int app_id, bt_bdaddr_t *bd_addr, int mdep_cfg_index,
@@ -64,17 +267,17 @@ static void channel_state_callback(int app_id, bt_bdaddr_t *bd_addr, int mdep_cf
     jbyteArray addr;
     jobject fileDescriptor = NULL;
 
-    CHECK_CALLBACK_ENV
-    addr = sCallbackEnv->NewByteArray(sizeof(bt_bdaddr_t));
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    addr = sCallbackEnv.newAddressArray(bd_addr);
     if (!addr) {
         ALOGE("Fail to new jbyteArray bd addr for channel state");
-        checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
         return;
     }
 
     // TODO(BT) check if fd is only valid for BTHH_CONN_STATE_CONNECTED state
     if (state == BTHL_CONN_STATE_CONNECTED) {
-        fileDescriptor = jniCreateFileDescriptor(sCallbackEnv, fd);
+        fileDescriptor = jniCreateFileDescriptor(sCallbackEnv.get(), fd);
         if (!fileDescriptor) {
             ALOGE("Failed to convert file descriptor, fd: %d", fd);
             sCallbackEnv->DeleteLocalRef(addr);
@@ -82,10 +285,8 @@ static void channel_state_callback(int app_id, bt_bdaddr_t *bd_addr, int mdep_cf
         }
     }
 
-    sCallbackEnv->SetByteArrayRegion(addr, 0, sizeof(bt_bdaddr_t), (jbyte*) bd_addr);
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onChannelStateChanged, app_id, addr,
-                                 mdep_cfg_index, channel_id, (jint) state, fileDescriptor);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onChannelStateChanged, app_id, addr,
+                                mdep_cfg_index, channel_id, (jint) state, fileDescriptor);
     sCallbackEnv->DeleteLocalRef(addr);
 }
 
@@ -97,14 +298,21 @@ static bthl_callbacks_t sBluetoothHdpCallbacks = {
 
 // Define native functions
 
+static const callback_method_t sCallbackMethods[] = {
+    {&method_onAppRegistrationState, "onAppRegistrationState", "(II)V"},
+    {&method_onChannelStateChanged, "onChannelStateChanged", "(I[BIIILjava/io/FileDescriptor;)V"},
+    {&method_onChannelData, "onChannelData", "(I)V"},
+};
+
 static void classInitNative(JNIEnv* env, jclass clazz) {
     int err;
 //    const bt_interface_t* btInf;
 //    bt_status_t status;
 
-    method_onAppRegistrationState = env->GetMethodID(clazz, "onAppRegistrationState", "(II)V");
-    method_onChannelStateChanged = env->GetMethodID(clazz, "onChannelStateChanged",
-                                                    "(I[BIIILjava/io/FileDescriptor;)V");
+    if (!getCallbackMethodIDs(env, clazz, sCallbackMethods, NELEM(sCallbackMethods))) {
+        ALOGE("%s: Missing callback methods", __FUNCTION__);
+        return;
+    }
 
 /*
     if ( (btInf = getBluetoothInterface()) == NULL) {
@@ -164,6 +372,7 @@ static void initializeNative(JNIEnv *env, jobject object) {
     }
 
     mCallbacksObj = env->NewGlobalRef(object);
+    hdp_stream_start();
 }
 
 static void cleanupNative(JNIEnv *env, jobject object) {
@@ -175,6 +384,8 @@ static void cleanupNative(JNIEnv *env, jobject object) {
         return;
     }
 
+    hdp_stream_stop(env);
+
     if (sBluetoothHdpInterface !=NULL) {
         ALOGW("Cleaning up Bluetooth Health Interface...");
         sBluetoothHdpInterface->cleanup();
@@ -188,38 +399,89 @@ static void cleanupNative(JNIEnv *env, jobject object) {
     }
 }
 
-static jint registerHealthAppNative(JNIEnv *env, jobject object, jint data_type,
-                                       jint role, jstring name, jint channel_type) {
+// Most MDEPs one registration may carry, the stack rejects any it cannot hold
+#define HDP_MAX_MDEPS 10
+
+// Registers an application named name with num_mdeps MDEPs, which all take
+// the name as description. Returns the app id or -1.
+static jint register_health_app(JNIEnv *env, jstring name, int num_mdeps,
+                                bthl_mdep_cfg_t *mdep_cfg) {
     bt_status_t status;
-    bthl_mdep_cfg_t mdep_cfg;
     bthl_reg_param_t reg_param;
     int app_id;
 
-    if (!sBluetoothHdpInterface) return NULL;
+    const char *c_name = env->GetStringUTFChars(name, NULL);
+    if (c_name == NULL) {
+        ALOGE("Failed to get health app name");
+        return -1;
+    }
 
-    mdep_cfg.mdep_role = (bthl_mdep_role_t) role;
-    mdep_cfg.data_type = data_type;
-    mdep_cfg.channel_type = (bthl_channel_type_t) channel_type;
     // TODO(BT) pass all the followings in from java instead of reuse name
-    mdep_cfg.mdep_description = env->GetStringUTFChars(name, NULL);
-    reg_param.application_name = env->GetStringUTFChars(name, NULL);
+    for (int i = 0; i < num_mdeps; i++) {
+        mdep_cfg[i].mdep_description = c_name;
+    }
+    reg_param.application_name = c_name;
     reg_param.provider_name = NULL;
     reg_param.srv_name = NULL;
     reg_param.srv_desp = NULL;
-    reg_param.number_of_mdeps = 1;
-    reg_param.mdep_cfg = &mdep_cfg;
+    reg_param.number_of_mdeps = num_mdeps;
+    reg_param.mdep_cfg = mdep_cfg;
 
     if ( (status = sBluetoothHdpInterface->register_application(&reg_param, &app_id)) !=
          BT_STATUS_SUCCESS) {
         ALOGE("Failed register health app, status: %d", status);
-        return -1;
+        app_id = -1;
     }
 
-    env->ReleaseStringUTFChars(name, mdep_cfg.mdep_description);
-    env->ReleaseStringUTFChars(name, reg_param.application_name);
+    env->ReleaseStringUTFChars(name, c_name);
     return app_id;
 }
 
+static jint registerHealthAppNative(JNIEnv *env, jobject object, jint data_type,
+                                       jint role, jstring name, jint channel_type) {
+    bthl_mdep_cfg_t mdep_cfg;
+
+    if (!sBluetoothHdpInterface || name == NULL) return -1;
+
+    mdep_cfg.mdep_role = (bthl_mdep_role_t) role;
+    mdep_cfg.data_type = data_type;
+    mdep_cfg.channel_type = (bthl_channel_type_t) channel_type;
+    return register_health_app(env, name, 1, &mdep_cfg);
+}
+
+// Registers one application with an MDEP for each data_types[i], roles[i]
+// and channel_types[i], the channel state callback tells them apart by
+// mdep_cfg_index
+static jint registerHealthAppMdepsNative(JNIEnv *env, jobject object, jstring name,
+                                         jintArray data_types, jintArray roles,
+                                         jintArray channel_types) {
+    bthl_mdep_cfg_t mdep_cfg[HDP_MAX_MDEPS];
+    jint types[HDP_MAX_MDEPS];
+    jint mdep_roles[HDP_MAX_MDEPS];
+    jint chan_types[HDP_MAX_MDEPS];
+
+    if (!sBluetoothHdpInterface || name == NULL) return -1;
+    if (data_types == NULL || roles == NULL || channel_types == NULL) return -1;
+
+    jsize num_mdeps = env->GetArrayLength(data_types);
+    if (num_mdeps < 1 || num_mdeps > HDP_MAX_MDEPS ||
+        env->GetArrayLength(roles) != num_mdeps ||
+        env->GetArrayLength(channel_types) != num_mdeps) {
+        ALOGE("Invalid MDEP configurations, count: %d", num_mdeps);
+        return -1;
+    }
+
+    env->GetIntArrayRegion(data_types, 0, num_mdeps, types);
+    env->GetIntArrayRegion(roles, 0, num_mdeps, mdep_roles);
+    env->GetIntArrayRegion(channel_types, 0, num_mdeps, chan_types);
+    for (int i = 0; i < num_mdeps; i++) {
+        mdep_cfg[i].mdep_role = (bthl_mdep_role_t) mdep_roles[i];
+        mdep_cfg[i].data_type = types[i];
+        mdep_cfg[i].channel_type = (bthl_channel_type_t) chan_types[i];
+    }
+    return register_health_app(env, name, num_mdeps, mdep_cfg);
+}
+
 static jboolean unregisterHealthAppNative(JNIEnv *env, jobject object, int app_id) {
     bt_status_t status;
     if (!sBluetoothHdpInterface) return JNI_FALSE;
@@ -231,7 +493,7 @@ static jboolean unregisterHealthAppNative(JNIEnv *env, jobject object, int app_i
 }
 
 static jint connectChannelNative(JNIEnv *env, jobject object,
-                                 jbyteArray address, jint app_id) {
+                                 jbyteArray address, jint app_id, jint mdep_cfg_index) {
     bt_status_t status;
     jbyte *addr;
     jint chan_id;
@@ -244,7 +506,7 @@ static jint connectChannelNative(JNIEnv *env, jobject object,
     }
 
     if ( (status = sBluetoothHdpInterface->connect_channel(app_id, (bt_bdaddr_t *) addr,
-                                                           0, &chan_id)) !=
+                                                           mdep_cfg_index, &chan_id)) !=
          BT_STATUS_SUCCESS) {
         ALOGE("Failed HDP channel connection, status: %d", status);
         chan_id = -1;
@@ -266,14 +528,104 @@ static jboolean disconnectChannelNative(JNIEnv *env, jobject object, jint channe
     return JNI_TRUE;
 }
 
+// Fails while channels are streamed
+static jboolean registerStreamBufferNative(JNIEnv *env, jobject object, jobject buffer) {
+    uint8_t *data = (uint8_t *) env->GetDirectBufferAddress(buffer);
+    jlong capacity = env->GetDirectBufferCapacity(buffer);
+    if (data == NULL || capacity < HDP_STREAM_RECORD_HEADER_LEN + HDP_STREAM_MIN_READ) {
+        ALOGE("Stream buffer must be direct and hold at least %d bytes",
+              HDP_STREAM_RECORD_HEADER_LEN + HDP_STREAM_MIN_READ);
+        return JNI_FALSE;
+    }
+    if (capacity > 0x7FFFFFFF) capacity = 0x7FFFFFFF;
+
+    Mutex::Autolock lock(sStreamLock);
+    for (int i = 0; i < HDP_MAX_STREAM_CHANNELS; i++) {
+        if (sStreamChannels[i].in_use) {
+            ALOGE("Cannot replace the stream buffer while channels are streamed");
+            return JNI_FALSE;
+        }
+    }
+
+    if (sStreamBuffer != NULL) env->DeleteGlobalRef(sStreamBuffer);
+    sStreamBuffer = env->NewGlobalRef(buffer);
+    sStreamBufferData = data;
+    sStreamBufferLen = (int) capacity;
+    return JNI_TRUE;
+}
+
+static jboolean startChannelStreamNative(JNIEnv *env, jobject object, jint channel_id,
+                                         jobject fileDescriptor) {
+    int fd = jniGetFDFromFileDescriptor(env, fileDescriptor);
+    if (fd < 0) {
+        ALOGE("Invalid file descriptor for channel %d", channel_id);
+        return JNI_FALSE;
+    }
+
+    Mutex::Autolock lock(sStreamLock);
+    if (!sStreamRunning || sStreamBufferData == NULL) return JNI_FALSE;
+    if (stream_channel_find_l(channel_id) != NULL) {
+        ALOGW("Channel %d is already streamed", channel_id);
+        return JNI_FALSE;
+    }
+
+    stream_channel_t *c = NULL;
+    for (int i = 0; i < HDP_MAX_STREAM_CHANNELS; i++) {
+        if (!sStreamChannels[i].in_use) {
+            c = &sStreamChannels[i];
+            break;
+        }
+    }
+    if (c == NULL) {
+        ALOGE("Too many streamed channels");
+        return JNI_FALSE;
+    }
+
+    if ( (fd = dup(fd)) < 0) {
+        ALOGE("Failed to dup fd of channel %d: %s", channel_id, strerror(errno));
+        return JNI_FALSE;
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u64 = (uint32_t) channel_id;
+    if (epoll_ctl(sStreamEpollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        ALOGE("Failed to watch channel %d: %s", channel_id, strerror(errno));
+        close(fd);
+        return JNI_FALSE;
+    }
+
+    c->in_use = true;
+    c->closing = false;
+    c->channel_id = channel_id;
+    c->fd = fd;
+    return JNI_TRUE;
+}
+
+static void stopChannelStreamNative(JNIEnv *env, jobject object, jint channel_id) {
+    Mutex::Autolock lock(sStreamLock);
+    stream_channel_t *c = stream_channel_find_l(channel_id);
+    if (c == NULL || c->closing) return;
+    c->closing = true;
+    stream_wake();
+}
+
 static JNINativeMethod sMethods[] = {
     {"classInitNative", "()V", (void *) classInitNative},
     {"initializeNative", "()V", (void *) initializeNative},
     {"cleanupNative", "()V", (void *) cleanupNative},
     {"registerHealthAppNative", "(IILjava/lang/String;I)I", (void *) registerHealthAppNative},
+    {"registerHealthAppMdepsNative", "(Ljava/lang/String;[I[I[I)I",
+     (void *) registerHealthAppMdepsNative},
     {"unregisterHealthAppNative", "(I)Z", (void *) unregisterHealthAppNative},
-    {"connectChannelNative", "([BI)I", (void *) connectChannelNative},
+    {"connectChannelNative", "([BII)I", (void *) connectChannelNative},
     {"disconnectChannelNative", "(I)Z", (void *) disconnectChannelNative},
+    {"registerStreamBufferNative", "(Ljava/nio/ByteBuffer;)Z",
+     (void *) registerStreamBufferNative},
+    {"startChannelStreamNative", "(ILjava/io/FileDescriptor;)Z",
+     (void *) startChannelStreamNative},
+    {"stopChannelStreamNative", "(I)V", (void *) stopChannelStreamNative},
 };
 
 int register_com_android_bluetooth_hdp(JNIEnv* env)
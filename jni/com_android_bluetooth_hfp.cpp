@@ -18,16 +18,11 @@
 
 #define LOG_NDEBUG 0
 
-#define CHECK_CALLBACK_ENV                                                      \
-   if (!checkCallbackThread()) {                                                \
-       ALOGE("Callback: '%s' is not called on the correct thread", __FUNCTION__);\
-       return;                                                                  \
-   }
-
 #include "com_android_bluetooth.h"
 #include "hardware/bt_hf.h"
 #include "utils/Log.h"
 #include "android_runtime/AndroidRuntime.h"
+#include "utils/Mutex.h"
 
 #include <string.h>
 
@@ -52,18 +47,186 @@ static jmethodID method_onKeyPressed;
 
 static const bthf_interface_t *sBluetoothHfpInterface = NULL;
 static jobject mCallbacksObj = NULL;
-static JNIEnv *sCallbackEnv = NULL;
-
-static bool checkCallbackThread() {
-    // Always fetch the latest callbackEnv from AdapterService.
-    // Caching this could cause this sCallbackEnv to go out-of-sync
-    // with the AdapterService's ENV if an ASSOCIATE/DISASSOCIATE event
-    // is received
-    //if (sCallbackEnv == NULL) {
-    sCallbackEnv = getCallbackEnv();
-    //}
-    JNIEnv* env = AndroidRuntime::getJNIEnv();
-    if (sCallbackEnv != env || sCallbackEnv == NULL) return false;
+
+/**
+ * Phone state mirror
+ *
+ * Keeps the call state and device status last sent to the stack, and the
+ * call state and operator name Java pushes along with the device status.
+ * Once a device status has been sent, AT+CIND queries are answered from
+ * the mirror on the callback thread, and so are AT+COPS queries once an
+ * operator name has been pushed, without an upcall. The mirror is reset
+ * when the headset disconnects. Call state changes are not sent while no
+ * headset is connected, so the call state is pushed again with the first
+ * device status after that.
+ *
+ * The answer Java gave to the last AT+CLCC, up to the final response with
+ * index 0, is kept until the call state changes, and the AT+CNUM answer
+ * Java pushes through setCnumResponseNative until the headset disconnects.
+ * Both are replayed for later queries.
+ */
+
+#define HFP_MAX_OPERATOR_LEN 64
+#define HFP_MAX_NUMBER_LEN 64
+#define HFP_MAX_CLCC_RESPONSES 8
+#define HFP_MAX_CNUM_LEN 96
+
+typedef struct {
+    int index;
+    int dir;
+    int state;
+    int mode;
+    bool mpty;
+    bool has_number;
+    char number[HFP_MAX_NUMBER_LEN];
+    int type;
+} clcc_response_t;
+
+typedef struct {
+    bool device_valid;
+    int service;
+    int roam;
+    int signal;
+    int battery_charge;
+    int num_active;
+    int num_held;
+    int call_state;
+    bool operator_valid;
+    char operator_name[HFP_MAX_OPERATOR_LEN];
+    bool clcc_valid;
+    bool clcc_recording;        // an AT+CLCC went up to Java
+    int clcc_count;
+    clcc_response_t clcc[HFP_MAX_CLCC_RESPONSES];
+    bool cnum_valid;
+    char cnum[HFP_MAX_CNUM_LEN];
+} phone_state_mirror_t;
+
+static Mutex sMirrorLock;
+static phone_state_mirror_t sMirror;
+
+static void mirror_reset() {
+    Mutex::Autolock lock(sMirrorLock);
+    memset(&sMirror, 0, sizeof(sMirror));
+    sMirror.call_state = BTHF_CALL_STATE_IDLE;
+}
+
+// Returns false if the query has to go up to Java
+static bool mirror_cind_response() {
+    phone_state_mirror_t m;
+    {
+        Mutex::Autolock lock(sMirrorLock);
+        if (!sMirror.device_valid) return false;
+        m = sMirror;
+    }
+
+    bt_status_t status;
+    if (!sBluetoothHfpInterface) return true;
+    if ( (status = sBluetoothHfpInterface->cind_response(m.service, m.num_active, m.num_held,
+                       (bthf_call_state_t) m.call_state,
+                       m.signal, m.roam, m.battery_charge)) != BT_STATUS_SUCCESS) {
+        ALOGE("Failed cind_response, status: %d", status);
+    }
+    return true;
+}
+
+// Returns false if the query has to go up to Java
+static bool mirror_cops_response() {
+    char operator_name[HFP_MAX_OPERATOR_LEN];
+    {
+        Mutex::Autolock lock(sMirrorLock);
+        if (!sMirror.operator_valid) return false;
+        strcpy(operator_name, sMirror.operator_name);
+    }
+
+    bt_status_t status;
+    if (!sBluetoothHfpInterface) return true;
+    if ( (status = sBluetoothHfpInterface->cops_response(operator_name)) != BT_STATUS_SUCCESS) {
+        ALOGE("Failed sending cops response, status: %d", status);
+    }
+    return true;
+}
+
+// Returns false if the query has to go up to Java, which is then recorded
+static bool mirror_clcc_response() {
+    clcc_response_t clcc[HFP_MAX_CLCC_RESPONSES];
+    int count;
+    {
+        Mutex::Autolock lock(sMirrorLock);
+        if (!sMirror.clcc_valid) {
+            sMirror.clcc_recording = true;
+            sMirror.clcc_count = 0;
+            return false;
+        }
+        count = sMirror.clcc_count;
+        memcpy(clcc, sMirror.clcc, count * sizeof(clcc_response_t));
+    }
+
+    if (!sBluetoothHfpInterface) return true;
+    for (int i = 0; i < count; i++) {
+        bt_status_t status = sBluetoothHfpInterface->clcc_response(clcc[i].index,
+                (bthf_call_direction_t) clcc[i].dir, (bthf_call_state_t) clcc[i].state,
+                (bthf_call_mode_t) clcc[i].mode,
+                clcc[i].mpty ? BTHF_CALL_MPTY_TYPE_MULTI : BTHF_CALL_MPTY_TYPE_SINGLE,
+                clcc[i].has_number ? clcc[i].number : NULL,
+                (bthf_call_addrtype_t) clcc[i].type);
+        if (status != BT_STATUS_SUCCESS) {
+            ALOGE("Failed sending CLCC response, status: %d", status);
+            break;
+        }
+    }
+    return true;
+}
+
+// Records a response to the AT+CLCC that went up to Java
+static void mirror_clcc_record(int index, int dir, int state, int mode, bool mpty,
+                               const char *number, int type) {
+    Mutex::Autolock lock(sMirrorLock);
+    if (!sMirror.clcc_recording) return;
+    if (sMirror.clcc_count == HFP_MAX_CLCC_RESPONSES ||
+        (number && strlen(number) >= HFP_MAX_NUMBER_LEN)) {
+        // Too much to keep, later queries go up to Java as well
+        sMirror.clcc_recording = false;
+        return;
+    }
+
+    clcc_response_t *r = &sMirror.clcc[sMirror.clcc_count++];
+    r->index = index;
+    r->dir = dir;
+    r->state = state;
+    r->mode = mode;
+    r->mpty = mpty;
+    r->has_number = (number != NULL);
+    strcpy(r->number, number ? number : "");
+    r->type = type;
+    if (index == 0) {
+        sMirror.clcc_recording = false;
+        // Java answers with no calls when it cannot ask the phone, keep that
+        // only if there really are none
+        sMirror.clcc_valid = sMirror.clcc_count > 1 ||
+                             (sMirror.num_active == 0 && sMirror.num_held == 0 &&
+                              sMirror.call_state == BTHF_CALL_STATE_IDLE);
+    }
+}
+
+// Returns false if the query has to go up to Java
+static bool mirror_cnum_response() {
+    char cnum[HFP_MAX_CNUM_LEN];
+    {
+        Mutex::Autolock lock(sMirrorLock);
+        if (!sMirror.cnum_valid) return false;
+        strcpy(cnum, sMirror.cnum);
+    }
+
+    bt_status_t status;
+    if (!sBluetoothHfpInterface) return true;
+    if ( (status = sBluetoothHfpInterface->formatted_at_response(cnum)) != BT_STATUS_SUCCESS) {
+        ALOGE("Failed formatted AT response, status: %d", status);
+        return true;
+    }
+    if ( (status = sBluetoothHfpInterface->at_response(BTHF_AT_RESPONSE_OK, 0)) !=
+         BT_STATUS_SUCCESS) {
+        ALOGE("Failed AT response, status: %d", status);
+    }
     return true;
 }
 
@@ -72,128 +235,134 @@ static void connection_state_callback(bthf_connection_state_t state, bt_bdaddr_t
 
     ALOGI("%s", __FUNCTION__);
 
-    CHECK_CALLBACK_ENV
-    addr = sCallbackEnv->NewByteArray(sizeof(bt_bdaddr_t));
+    if (state == BTHF_CONNECTION_STATE_DISCONNECTED) mirror_reset();
+
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    addr = sCallbackEnv.newAddressArray(bd_addr);
     if (!addr) {
         ALOGE("Fail to new jbyteArray bd addr for connection state");
-        checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
         return;
     }
 
-    sCallbackEnv->SetByteArrayRegion(addr, 0, sizeof(bt_bdaddr_t), (jbyte*) bd_addr);
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onConnectionStateChanged,
-                                 (jint) state, addr);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onConnectionStateChanged,
+                                (jint) state, addr);
     sCallbackEnv->DeleteLocalRef(addr);
 }
 
 static void audio_state_callback(bthf_audio_state_t state, bt_bdaddr_t* bd_addr) {
     jbyteArray addr;
 
-    CHECK_CALLBACK_ENV
-    addr = sCallbackEnv->NewByteArray(sizeof(bt_bdaddr_t));
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    addr = sCallbackEnv.newAddressArray(bd_addr);
     if (!addr) {
         ALOGE("Fail to new jbyteArray bd addr for audio state");
-        checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
         return;
     }
 
-    sCallbackEnv->SetByteArrayRegion(addr, 0, sizeof(bt_bdaddr_t), (jbyte *) bd_addr);
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onAudioStateChanged, (jint) state, addr);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onAudioStateChanged, (jint) state, addr);
     sCallbackEnv->DeleteLocalRef(addr);
 }
 
 static void voice_recognition_callback(bthf_vr_state_t state) {
-    CHECK_CALLBACK_ENV
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onVrStateChanged, (jint) state);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onVrStateChanged, (jint) state);
 }
 
 static void answer_call_callback() {
-    CHECK_CALLBACK_ENV
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onAnswerCall);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onAnswerCall);
 }
 
 static void hangup_call_callback() {
-    CHECK_CALLBACK_ENV
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onHangupCall);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onHangupCall);
 }
 
 static void volume_control_callback(bthf_volume_type_t type, int volume) {
-    CHECK_CALLBACK_ENV
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onVolumeChanged, (jint) type, (jint) volume);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onVolumeChanged, (jint) type, (jint) volume);
 }
 
 static void dial_call_callback(char *number) {
-    CHECK_CALLBACK_ENV
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
     jstring js_number = sCallbackEnv->NewStringUTF(number);
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onDialCall,
-                                 js_number);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onDialCall,
+                                js_number);
     sCallbackEnv->DeleteLocalRef(js_number);
 }
 
 static void dtmf_cmd_callback(char dtmf) {
-    CHECK_CALLBACK_ENV
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
     // TBD dtmf has changed from int to char
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onSendDtmf, dtmf);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onSendDtmf, dtmf);
 }
 
 static void noice_reduction_callback(bthf_nrec_t nrec) {
-    CHECK_CALLBACK_ENV
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onNoiceReductionEnable,
-                                 nrec == BTHF_NREC_START);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onNoiceReductionEnable,
+                                nrec == BTHF_NREC_START);
 }
 
 static void at_chld_callback(bthf_chld_type_t chld) {
-    CHECK_CALLBACK_ENV
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onAtChld, chld);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onAtChld, chld);
 }
 
 static void at_cnum_callback() {
-    CHECK_CALLBACK_ENV
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onAtCnum);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    if (mirror_cnum_response()) return;
+
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onAtCnum);
 }
 
 static void at_cind_callback() {
-    CHECK_CALLBACK_ENV
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onAtCind);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    if (mirror_cind_response()) return;
+
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onAtCind);
 }
 
 static void at_cops_callback() {
-    CHECK_CALLBACK_ENV
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onAtCops);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    if (mirror_cops_response()) return;
+
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onAtCops);
 }
 
 static void at_clcc_callback() {
-    CHECK_CALLBACK_ENV
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onAtClcc);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    if (mirror_clcc_response()) return;
+
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onAtClcc);
 }
 
 static void unknown_at_callback(char *at_string) {
-    CHECK_CALLBACK_ENV
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
     jstring js_at_string = sCallbackEnv->NewStringUTF(at_string);
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onUnknownAt,
-                                 js_at_string);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onUnknownAt,
+                                js_at_string);
     sCallbackEnv->DeleteLocalRef(js_at_string);
 }
 
 static void key_pressed_callback() {
-    CHECK_CALLBACK_ENV
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onKeyPressed);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onKeyPressed);
 }
 
 static bthf_callbacks_t sBluetoothHfpCallbacks = {
@@ -216,6 +385,25 @@ static bthf_callbacks_t sBluetoothHfpCallbacks = {
     key_pressed_callback
 };
 
+static const callback_method_t sCallbackMethods[] = {
+    {&method_onConnectionStateChanged, "onConnectionStateChanged", "(I[B)V"},
+    {&method_onAudioStateChanged, "onAudioStateChanged", "(I[B)V"},
+    {&method_onVrStateChanged, "onVrStateChanged", "(I)V"},
+    {&method_onAnswerCall, "onAnswerCall", "()V"},
+    {&method_onHangupCall, "onHangupCall", "()V"},
+    {&method_onVolumeChanged, "onVolumeChanged", "(II)V"},
+    {&method_onDialCall, "onDialCall", "(Ljava/lang/String;)V"},
+    {&method_onSendDtmf, "onSendDtmf", "(I)V"},
+    {&method_onNoiceReductionEnable, "onNoiceReductionEnable", "(Z)V"},
+    {&method_onAtChld, "onAtChld", "(I)V"},
+    {&method_onAtCnum, "onAtCnum", "()V"},
+    {&method_onAtCind, "onAtCind", "()V"},
+    {&method_onAtCops, "onAtCops", "()V"},
+    {&method_onAtClcc, "onAtClcc", "()V"},
+    {&method_onUnknownAt, "onUnknownAt", "(Ljava/lang/String;)V"},
+    {&method_onKeyPressed, "onKeyPressed", "()V"},
+};
+
 static void classInitNative(JNIEnv* env, jclass clazz) {
     int err;
     /*
@@ -223,23 +411,11 @@ static void classInitNative(JNIEnv* env, jclass clazz) {
     bt_status_t status;
     */
 
-    method_onConnectionStateChanged =
-        env->GetMethodID(clazz, "onConnectionStateChanged", "(I[B)V");
-    method_onAudioStateChanged = env->GetMethodID(clazz, "onAudioStateChanged", "(I[B)V");
-    method_onVrStateChanged = env->GetMethodID(clazz, "onVrStateChanged", "(I)V");
-    method_onAnswerCall = env->GetMethodID(clazz, "onAnswerCall", "()V");
-    method_onHangupCall = env->GetMethodID(clazz, "onHangupCall", "()V");
-    method_onVolumeChanged = env->GetMethodID(clazz, "onVolumeChanged", "(II)V");
-    method_onDialCall = env->GetMethodID(clazz, "onDialCall", "(Ljava/lang/String;)V");
-    method_onSendDtmf = env->GetMethodID(clazz, "onSendDtmf", "(I)V");
-    method_onNoiceReductionEnable = env->GetMethodID(clazz, "onNoiceReductionEnable", "(Z)V");
-    method_onAtChld = env->GetMethodID(clazz, "onAtChld", "(I)V");
-    method_onAtCnum = env->GetMethodID(clazz, "onAtCnum", "()V");
-    method_onAtCind = env->GetMethodID(clazz, "onAtCind", "()V");
-    method_onAtCops = env->GetMethodID(clazz, "onAtCops", "()V");
-    method_onAtClcc = env->GetMethodID(clazz, "onAtClcc", "()V");
-    method_onUnknownAt = env->GetMethodID(clazz, "onUnknownAt", "(Ljava/lang/String;)V");
-    method_onKeyPressed = env->GetMethodID(clazz, "onKeyPressed", "()V");
+    setCallbackPriority(env, clazz, CALLBACK_PRIORITY_HIGH);
+    if (!getCallbackMethodIDs(env, clazz, sCallbackMethods, NELEM(sCallbackMethods))) {
+        ALOGE("%s: Missing callback methods", __FUNCTION__);
+        return;
+    }
 
     /*
     if ( (btInf = getBluetoothInterface()) == NULL) {
@@ -299,6 +475,7 @@ static void initializeNative(JNIEnv *env, jobject object) {
     }
 
     mCallbacksObj = env->NewGlobalRef(object);
+    mirror_reset();
 }
 
 static void cleanupNative(JNIEnv *env, jobject object) {
@@ -321,6 +498,7 @@ static void cleanupNative(JNIEnv *env, jobject object) {
         env->DeleteGlobalRef(mCallbacksObj);
         mCallbacksObj = NULL;
     }
+    mirror_reset();
 }
 
 static jboolean connectHfpNative(JNIEnv *env, jobject object, jbyteArray address) {
@@ -439,6 +617,15 @@ static jboolean notifyDeviceStatusNative(JNIEnv *env, jobject object,
     bt_status_t status;
     if (!sBluetoothHfpInterface) return JNI_FALSE;
 
+    {
+        Mutex::Autolock lock(sMirrorLock);
+        sMirror.device_valid = true;
+        sMirror.service = network_state;
+        sMirror.roam = service_type;
+        sMirror.signal = signal;
+        sMirror.battery_charge = battery_charge;
+    }
+
     if ( (status = sBluetoothHfpInterface->device_status_notification
           ((bthf_network_state_t) network_state, (bthf_service_type_t) service_type,
            signal, battery_charge)) != BT_STATUS_SUCCESS) {
@@ -461,6 +648,46 @@ static jboolean copsResponseNative(JNIEnv *env, jobject object, jstring operator
     return (status == BT_STATUS_SUCCESS) ? JNI_TRUE : JNI_FALSE;
 }
 
+static void setOperatorNameNative(JNIEnv *env, jobject object, jstring operator_str) {
+    Mutex::Autolock lock(sMirrorLock);
+    if (operator_str == NULL) {
+        sMirror.operator_valid = false;
+        return;
+    }
+
+    const char *operator_name = env->GetStringUTFChars(operator_str, NULL);
+    if (!operator_name) {
+        sMirror.operator_valid = false;
+        return;
+    }
+    strncpy(sMirror.operator_name, operator_name, HFP_MAX_OPERATOR_LEN - 1);
+    sMirror.operator_name[HFP_MAX_OPERATOR_LEN - 1] = 0;
+    sMirror.operator_valid = true;
+    env->ReleaseStringUTFChars(operator_str, operator_name);
+}
+
+static void setCnumResponseNative(JNIEnv *env, jobject object, jstring response_str) {
+    Mutex::Autolock lock(sMirrorLock);
+    sMirror.cnum_valid = false;
+    if (response_str == NULL) return;
+
+    const char *response = env->GetStringUTFChars(response_str, NULL);
+    if (!response) return;
+    if (strlen(response) < HFP_MAX_CNUM_LEN) {
+        strcpy(sMirror.cnum, response);
+        sMirror.cnum_valid = true;
+    }
+    env->ReleaseStringUTFChars(response_str, response);
+}
+
+static void setCallStateNative(JNIEnv *env, jobject object, jint num_active, jint num_held,
+                               jint call_state) {
+    Mutex::Autolock lock(sMirrorLock);
+    sMirror.num_active = num_active;
+    sMirror.num_held = num_held;
+    sMirror.call_state = call_state;
+}
+
 static jboolean cindResponseNative(JNIEnv *env, jobject object,
                                    jint service, jint num_active, jint num_held, jint call_state,
                                    jint signal, jint roam, jint battery_charge) {
@@ -516,6 +743,8 @@ static jboolean clccResponseNative(JNIEnv *env, jobject object, jint index, jint
                      mpty ? BTHF_CALL_MPTY_TYPE_MULTI : BTHF_CALL_MPTY_TYPE_SINGLE,
                      number, (bthf_call_addrtype_t) type)) != BT_STATUS_SUCCESS) {
         ALOGE("Failed sending CLCC response, status: %d", status);
+    } else {
+        mirror_clcc_record(index, dir, callStatus, mode, mpty, number, type);
     }
     if (number)
         env->ReleaseStringUTFChars(number_str, number);
@@ -528,6 +757,16 @@ static jboolean phoneStateChangeNative(JNIEnv *env, jobject object, jint num_act
     const char *number;
     if (!sBluetoothHfpInterface) return JNI_FALSE;
 
+    {
+        Mutex::Autolock lock(sMirrorLock);
+        sMirror.num_active = num_active;
+        sMirror.num_held = num_held;
+        sMirror.call_state = call_state;
+        // The call list changed, and so may an answer being recorded
+        sMirror.clcc_valid = false;
+        sMirror.clcc_recording = false;
+    }
+
     number = env->GetStringUTFChars(number_str, NULL);
 
     if ( (status = sBluetoothHfpInterface->phone_state_change(num_active, num_held,
@@ -552,6 +791,9 @@ static JNINativeMethod sMethods[] = {
     {"setVolumeNative", "(II)Z", (void *) setVolumeNative},
     {"notifyDeviceStatusNative", "(IIII)Z", (void *) notifyDeviceStatusNative},
     {"copsResponseNative", "(Ljava/lang/String;)Z", (void *) copsResponseNative},
+    {"setOperatorNameNative", "(Ljava/lang/String;)V", (void *) setOperatorNameNative},
+    {"setCallStateNative", "(III)V", (void *) setCallStateNative},
+    {"setCnumResponseNative", "(Ljava/lang/String;)V", (void *) setCnumResponseNative},
     {"cindResponseNative", "(IIIIIII)Z", (void *) cindResponseNative},
     {"atResponseStringNative", "(Ljava/lang/String;)Z", (void *) atResponseStringNative},
     {"atResponseCodeNative", "(II)Z", (void *)atResponseCodeNative},
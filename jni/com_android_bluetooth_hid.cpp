@@ -18,114 +18,356 @@
 
 #define LOG_NDEBUG 0
 
-#define CHECK_CALLBACK_ENV                                                      \
-   if (!checkCallbackThread()) {                                                \
-       ALOGE("Callback: '%s' is not called on the correct thread", __FUNCTION__);\
-       return;                                                                  \
-   }
-
 #include "com_android_bluetooth.h"
 #include "hardware/bt_hh.h"
 #include "utils/Log.h"
 #include "android_runtime/AndroidRuntime.h"
+#include "utils/Condition.h"
+#include "utils/Mutex.h"
+#include "utils/SystemClock.h"
+#include "utils/Timers.h"
 
+#include <stdlib.h>
 #include <string.h>
 
 namespace android {
 
 static jmethodID method_onConnectStateChanged;
 static jmethodID method_onGetProtocolMode;
-static jmethodID method_onGetReport;
+static jmethodID method_onGetReportDone;
 static jmethodID method_onVirtualUnplug;
 
 static const bthh_interface_t *sBluetoothHidInterface = NULL;
 static jobject mCallbacksObj = NULL;
-static JNIEnv *sCallbackEnv = NULL;
 
-static bool checkCallbackThread() {
+/**
+ * Get report correlation
+ *
+ * Every get_report we issue is tracked in a table of our own, with a
+ * deadline. The stack answers the requests of a device in order without
+ * saying which one a reply is for, so a reply goes to the oldest
+ * outstanding request of its device. The report is copied into the slot of
+ * that request in the direct buffer Java registered, and Java is told with
+ * onGetReportDone(request id, slot, status, length), which needs no Java
+ * objects. Java hands the slot back with releaseReportSlotNative once it
+ * has read the report.
+ *
+ * A request that gets no reply in time is timed out by a thread of our
+ * own. It keeps its slot for HID_LATE_REPLY_MS more, so that a late reply
+ * is dropped instead of being taken for the reply to the next request.
+ * Requests of a device that disconnects fail with BTHH_ERR.
+ */
 
-    // Always fetch the latest callbackEnv from AdapterService.
-    // Caching this could cause this sCallbackEnv to go out-of-sync
-    // with the AdapterService's ENV if an ASSOCIATE/DISASSOCIATE event
-    // is received
+#define HID_MAX_REPORT_REQUESTS 32
+#define HID_REPORT_TIMEOUT_MS 5000
+#define HID_LATE_REPLY_MS 1000
 
-    sCallbackEnv = getCallbackEnv();
+// Status reported for requests that timed out, next to the bthh_status_t values
+#define HID_REPORT_STATUS_TIMEOUT -1
 
-    JNIEnv* env = AndroidRuntime::getJNIEnv();
-    if (sCallbackEnv != env || sCallbackEnv == NULL) return false;
-    return true;
+enum {
+    REPORT_REQUEST_FREE = 0,
+    REPORT_REQUEST_PENDING,         // waiting for the reply
+    REPORT_REQUEST_EXPIRED,         // timed out, waiting out a late reply
+    REPORT_REQUEST_DELIVERED        // reply in the buffer, waiting for Java
+};
+
+typedef struct {
+    int state;
+    bt_bdaddr_t bda;
+    jint request_id;
+    uint32_t seq;
+    int64_t deadline;               // elapsedRealtime() ms
+} report_request_t;
+
+static Mutex sReportLock;
+static Condition sReportCond;
+static Condition sReportExitCond;
+static bool sReportThreadRunning = false;
+static bool sReportThreadQuit = false;
+
+static report_request_t sReportRequests[HID_MAX_REPORT_REQUESTS];
+static jint sNextReportRequestId = 1;
+static uint32_t sNextReportSeq = 0;
+
+static jobject sReportBuffer = NULL;
+static uint8_t *sReportBufferData = NULL;
+static int sReportSlotSize = 0;
+static int sReportSlots = 0;
+
+// Returns the oldest request of bda the stack still owes a reply, or NULL
+static report_request_t *report_request_oldest_l(const bt_bdaddr_t *bda) {
+    report_request_t *oldest = NULL;
+    for (int i = 0; i < sReportSlots; i++) {
+        report_request_t *r = &sReportRequests[i];
+        if (r->state != REPORT_REQUEST_PENDING && r->state != REPORT_REQUEST_EXPIRED) continue;
+        if (memcmp(&r->bda, bda, sizeof(bt_bdaddr_t))) continue;
+        if (oldest == NULL || (int32_t) (r->seq - oldest->seq) < 0) oldest = r;
+    }
+    return oldest;
+}
+
+// Reserves a slot and issues the request, returns the request id or -1
+static jint report_request_send(bt_bdaddr_t *bd_addr, jint report_type, jint report_id,
+                                jint buffer_size, jint timeout_ms) {
+    bt_status_t status;
+    report_request_t *r = NULL;
+    jint request_id;
+
+    if (timeout_ms <= 0) timeout_ms = HID_REPORT_TIMEOUT_MS;
+
+    {
+        Mutex::Autolock lock(sReportLock);
+        for (int i = 0; i < sReportSlots; i++) {
+            if (sReportRequests[i].state == REPORT_REQUEST_FREE) {
+                r = &sReportRequests[i];
+                break;
+            }
+        }
+        if (r == NULL) {
+            ALOGE("Too many outstanding get report requests");
+            return -1;
+        }
+
+        request_id = sNextReportRequestId++;
+        if (sNextReportRequestId <= 0) sNextReportRequestId = 1;
+        r->state = REPORT_REQUEST_PENDING;
+        r->bda = *bd_addr;
+        r->request_id = request_id;
+        r->seq = sNextReportSeq++;
+        r->deadline = elapsedRealtime() + timeout_ms;
+        sReportCond.signal();
+    }
+
+    if ( (status = sBluetoothHidInterface->get_report(bd_addr, (bthh_report_type_t) report_type,
+                                                      (uint8_t) report_id, buffer_size)) !=
+         BT_STATUS_SUCCESS) {
+        ALOGE("Failed get report, status: %d", status);
+        Mutex::Autolock lock(sReportLock);
+        if (r->state == REPORT_REQUEST_PENDING && r->request_id == request_id) {
+            r->state = REPORT_REQUEST_FREE;
+        }
+        return -1;
+    }
+    return request_id;
+}
+
+/**
+ * Report timeout thread. Attached to the VM so that it can tell Java about
+ * timed out requests itself.
+ */
+static void report_timer_thread(void *arg) {
+    JNIEnv *env = AndroidRuntime::getJNIEnv();
+
+    Mutex::Autolock lock(sReportLock);
+    while (!sReportThreadQuit) {
+        int64_t now = elapsedRealtime();
+        int64_t next = 0;
+        report_request_t *expired = NULL;
+
+        for (int i = 0; i < sReportSlots; i++) {
+            report_request_t *r = &sReportRequests[i];
+            if (r->state != REPORT_REQUEST_PENDING && r->state != REPORT_REQUEST_EXPIRED) {
+                continue;
+            }
+            if (r->deadline <= now) {
+                if (r->state == REPORT_REQUEST_EXPIRED) {
+                    r->state = REPORT_REQUEST_FREE;
+                    continue;
+                }
+                expired = r;
+                break;
+            }
+            if (!next || r->deadline < next) next = r->deadline;
+        }
+
+        if (expired != NULL) {
+            jint request_id = expired->request_id;
+            expired->state = REPORT_REQUEST_EXPIRED;
+            expired->deadline = now + HID_LATE_REPLY_MS;
+            ALOGW("Get report request %d timed out", request_id);
+
+            sReportLock.unlock();
+            callVoidMethodOrdered(env, __FUNCTION__, mCallbacksObj, method_onGetReportDone,
+                                  request_id, (jint) -1, (jint) HID_REPORT_STATUS_TIMEOUT,
+                                  (jint) 0);
+            sReportLock.lock();
+            continue;
+        }
+
+        if (next == 0) {
+            sReportCond.wait(sReportLock);
+        } else {
+            sReportCond.waitRelative(sReportLock, milliseconds_to_nanoseconds(next - now));
+        }
+    }
+    sReportThreadRunning = false;
+    sReportExitCond.signal();
+}
+
+static void report_timer_start() {
+    Mutex::Autolock lock(sReportLock);
+    if (sReportThreadRunning) return;
+    sReportThreadQuit = false;
+    if (AndroidRuntime::createJavaThread("BT HID Report Timer Thread",
+                                         report_timer_thread, NULL) == 0) {
+        ALOGE("Failed to start the HID report timer thread");
+        return;
+    }
+    sReportThreadRunning = true;
+}
+
+// Waits for the timer thread to exit and drops all requests and the buffer
+static void report_timer_stop(JNIEnv *env) {
+    Mutex::Autolock lock(sReportLock);
+    if (sReportThreadRunning) {
+        sReportThreadQuit = true;
+        sReportCond.signal();
+        while (sReportThreadRunning) {
+            sReportExitCond.wait(sReportLock);
+        }
+    }
+
+    memset(sReportRequests, 0, sizeof(sReportRequests));
+    if (sReportBuffer != NULL) {
+        env->DeleteGlobalRef(sReportBuffer);
+        sReportBuffer = NULL;
+    }
+    sReportBufferData = NULL;
+    sReportSlotSize = 0;
+    sReportSlots = 0;
+}
+
+// Fails the requests still waiting on a device that went away
+static void report_requests_disconnected(CallbackEnv &callbackEnv, bt_bdaddr_t *bd_addr) {
+    jint failed[HID_MAX_REPORT_REQUESTS];
+    int count = 0;
+
+    {
+        Mutex::Autolock lock(sReportLock);
+        for (int i = 0; i < sReportSlots; i++) {
+            report_request_t *r = &sReportRequests[i];
+            if (r->state != REPORT_REQUEST_PENDING && r->state != REPORT_REQUEST_EXPIRED) {
+                continue;
+            }
+            if (memcmp(&r->bda, bd_addr, sizeof(bt_bdaddr_t))) continue;
+            if (r->state == REPORT_REQUEST_PENDING) failed[count++] = r->request_id;
+            r->state = REPORT_REQUEST_FREE;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        callbackEnv.callVoidMethod(mCallbacksObj, method_onGetReportDone, failed[i], (jint) -1,
+                                   (jint) BTHH_ERR, (jint) 0);
+    }
 }
 
 static void connection_state_callback(bt_bdaddr_t *bd_addr, bthh_connection_state_t state) {
     jbyteArray addr;
 
-    CHECK_CALLBACK_ENV
-    addr = sCallbackEnv->NewByteArray(sizeof(bt_bdaddr_t));
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    if (state == BTHH_CONN_STATE_DISCONNECTED) {
+        report_requests_disconnected(sCallbackEnv, bd_addr);
+    }
+
+    addr = sCallbackEnv.newAddressArray(bd_addr);
     if (!addr) {
         ALOGE("Fail to new jbyteArray bd addr for HID channel state");
-        checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
         return;
     }
-    sCallbackEnv->SetByteArrayRegion(addr, 0, sizeof(bt_bdaddr_t), (jbyte *) bd_addr);
 
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onConnectStateChanged, addr, (jint) state);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onConnectStateChanged, addr, (jint) state);
     sCallbackEnv->DeleteLocalRef(addr);
 }
 
 static void get_protocol_mode_callback(bt_bdaddr_t *bd_addr, bthh_status_t hh_status,bthh_protocol_mode_t mode) {
     jbyteArray addr;
 
-    CHECK_CALLBACK_ENV
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
     if (hh_status != BTHH_OK) {
         ALOGE("BTHH Status is not OK!");
-        checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
         return;
     }
 
-    addr = sCallbackEnv->NewByteArray(sizeof(bt_bdaddr_t));
+    addr = sCallbackEnv.newAddressArray(bd_addr);
     if (!addr) {
         ALOGE("Fail to new jbyteArray bd addr for get protocal mode callback");
-        checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
         return;
     }
-    sCallbackEnv->SetByteArrayRegion(addr, 0, sizeof(bt_bdaddr_t), (jbyte *) bd_addr);
 
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onGetProtocolMode, addr, (jint) mode);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onGetProtocolMode, addr, (jint) mode);
     sCallbackEnv->DeleteLocalRef(addr);
 }
 
+static void get_report_callback(bt_bdaddr_t *bd_addr, bthh_status_t hh_status,
+                                uint8_t *rpt_data, int rpt_size) {
+    jint request_id, slot;
+    jint length = 0;
+
+    {
+        Mutex::Autolock lock(sReportLock);
+        report_request_t *r = report_request_oldest_l(bd_addr);
+        if (r == NULL) {
+            ALOGW("Dropping get report reply without a request");
+            return;
+        }
+        if (r->state == REPORT_REQUEST_EXPIRED) {
+            ALOGW("Dropping late reply to get report request %d", r->request_id);
+            r->state = REPORT_REQUEST_FREE;
+            return;
+        }
+
+        slot = r - sReportRequests;
+        request_id = r->request_id;
+        if (hh_status == BTHH_OK && rpt_data != NULL && rpt_size > 0) {
+            length = rpt_size;
+            if (length > sReportSlotSize) {
+                ALOGW("Truncating %d byte report to %d bytes", rpt_size, sReportSlotSize);
+                length = sReportSlotSize;
+            }
+            memcpy(sReportBufferData + slot * sReportSlotSize, rpt_data, length);
+        }
+        r->state = REPORT_REQUEST_DELIVERED;
+    }
+
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) {
+        Mutex::Autolock lock(sReportLock);
+        sReportRequests[slot].state = REPORT_REQUEST_FREE;
+        return;
+    }
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onGetReportDone, request_id, slot,
+                                (jint) hh_status, length);
+}
+
 static void virtual_unplug_callback(bt_bdaddr_t *bd_addr, bthh_status_t hh_status) {
     ALOGD("call to virtual_unplug_callback");
     jbyteArray addr;
 
-    CHECK_CALLBACK_ENV
-    addr = sCallbackEnv->NewByteArray(sizeof(bt_bdaddr_t));
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    addr = sCallbackEnv.newAddressArray(bd_addr);
     if (!addr) {
         ALOGE("Fail to new jbyteArray bd addr for HID channel state");
-        checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
         return;
     }
-    sCallbackEnv->SetByteArrayRegion(addr, 0, sizeof(bt_bdaddr_t), (jbyte *) bd_addr);
 
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onVirtualUnplug, addr, (jint) hh_status);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onVirtualUnplug, addr, (jint) hh_status);
     sCallbackEnv->DeleteLocalRef(addr);
 
     /*jbyteArray addr;
     jint status = hh_status;
-    CHECK_CALLBACK_ENV
-    addr = sCallbackEnv->NewByteArray(sizeof(bt_bdaddr_t));
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    addr = sCallbackEnv.newAddressArray(bd_addr);
     if (!addr) {
         ALOGE("Fail to new jbyteArray bd addr for HID report");
-        checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
         return;
     }
-    sCallbackEnv->SetByteArrayRegion(addr, 0, sizeof(bt_bdaddr_t), (jbyte *) bd_addr);
 
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onVirtualUnplug, addr, status);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onVirtualUnplug, addr, status);
     sCallbackEnv->DeleteLocalRef(addr);*/
 }
 
@@ -136,20 +378,28 @@ static bthh_callbacks_t sBluetoothHidCallbacks = {
     NULL,
     get_protocol_mode_callback,
     NULL,
-    NULL,
+    get_report_callback,
     virtual_unplug_callback
 };
 
 // Define native functions
 
+static const callback_method_t sCallbackMethods[] = {
+    {&method_onConnectStateChanged, "onConnectStateChanged", "([BI)V"},
+    {&method_onGetProtocolMode, "onGetProtocolMode", "([BI)V"},
+    {&method_onVirtualUnplug, "onVirtualUnplug", "([BI)V"},
+    {&method_onGetReportDone, "onGetReportDone", "(IIII)V"},
+};
+
 static void classInitNative(JNIEnv* env, jclass clazz) {
     int err;
 //    const bt_interface_t* btInf;
 //    bt_status_t status;
 
-    method_onConnectStateChanged = env->GetMethodID(clazz, "onConnectStateChanged", "([BI)V");
-    method_onGetProtocolMode = env->GetMethodID(clazz, "onGetProtocolMode", "([BI)V");
-    method_onVirtualUnplug = env->GetMethodID(clazz, "onVirtualUnplug", "([BI)V");
+    if (!getCallbackMethodIDs(env, clazz, sCallbackMethods, NELEM(sCallbackMethods))) {
+        ALOGE("%s: Missing callback methods", __FUNCTION__);
+        return;
+    }
 
 /*
     if ( (btInf = getBluetoothInterface()) == NULL) {
@@ -212,6 +462,7 @@ static void initializeNative(JNIEnv *env, jobject object) {
 
 
     mCallbacksObj = env->NewGlobalRef(object);
+    report_timer_start();
 }
 
 static void cleanupNative(JNIEnv *env, jobject object) {
@@ -223,6 +474,8 @@ static void cleanupNative(JNIEnv *env, jobject object) {
         return;
     }
 
+    report_timer_stop(env);
+
     if (sBluetoothHidInterface !=NULL) {
         ALOGW("Cleaning up Bluetooth HID Interface...");
         sBluetoothHidInterface->cleanup();
@@ -380,9 +633,9 @@ static jboolean getReportNative(JNIEnv *env, jobject object, jbyteArray address,
     jint rType = reportType;
     jint rId = reportId;
 
-    if ( (status = sBluetoothHidInterface->get_report((bt_bdaddr_t *) addr, (bthh_report_type_t) rType, (uint8_t) rId, bufferSize)) !=
-             BT_STATUS_SUCCESS) {
-        ALOGE("Failed get report, status: %d", status);
+    // Tracked like any other request so that its reply is not taken for the
+    // reply to a request of getReportRequestNative
+    if (report_request_send((bt_bdaddr_t *) addr, rType, rId, bufferSize, 0) < 0) {
         ret = JNI_FALSE;
     }
     env->ReleaseByteArrayElements(address, addr, 0);
@@ -442,6 +695,245 @@ static jboolean sendDataNative(JNIEnv *env, jobject object, jbyteArray address,
 
 }
 
+/**
+ * Binary reports
+ *
+ * The stack takes reports as hex text, which the String based natives above
+ * have Java build and then convert to UTF-8 once more. The natives below take
+ * the report bytes from a byte[] range or a direct buffer and format the hex
+ * text straight into a stack buffer, so a report costs one small copy and no
+ * Java allocation. Reports longer than HID_REPORT_STACK_LEN get a heap buffer.
+ */
+
+#define HID_REPORT_STACK_LEN 256
+
+static const char sHexDigits[] = "0123456789ABCDEF";
+
+static bool get_address(JNIEnv *env, jbyteArray address, bt_bdaddr_t *bd_addr) {
+    if (address == NULL || env->GetArrayLength(address) != (jsize) sizeof(bt_bdaddr_t)) {
+        ALOGE("Bluetooth device address null");
+        return false;
+    }
+    env->GetByteArrayRegion(address, 0, sizeof(bt_bdaddr_t), (jbyte *) bd_addr);
+    return true;
+}
+
+static bool check_range(JNIEnv *env, jbyteArray array, jint offset, jint length) {
+    if (array == NULL || offset < 0 || length <= 0 ||
+        length > env->GetArrayLength(array) - offset) {
+        ALOGE("Invalid HID report range, offset: %d, length: %d", offset, length);
+        return false;
+    }
+    return true;
+}
+
+// Hands the len bytes of report to set_report, or to send_data if
+// report_type is negative
+static bt_status_t send_report(bt_bdaddr_t *bd_addr, jint report_type,
+                               const uint8_t *report, jint len) {
+    char stack_hex[2 * HID_REPORT_STACK_LEN + 1];
+    char *hex = stack_hex;
+    bt_status_t status;
+
+    if (len > HID_REPORT_STACK_LEN) {
+        hex = (char *) malloc(2 * len + 1);
+        if (hex == NULL) {
+            ALOGE("Failed to allocate hex buffer for a %d byte report", len);
+            return BT_STATUS_NOMEM;
+        }
+    }
+
+    for (jint i = 0; i < len; i++) {
+        hex[2 * i] = sHexDigits[report[i] >> 4];
+        hex[2 * i + 1] = sHexDigits[report[i] & 0x0F];
+    }
+    hex[2 * len] = 0;
+
+    if (report_type < 0) {
+        status = sBluetoothHidInterface->send_data(bd_addr, hex);
+    } else {
+        status = sBluetoothHidInterface->set_report(bd_addr, (bthh_report_type_t) report_type,
+                                                    hex);
+    }
+
+    if (hex != stack_hex) free(hex);
+    return status;
+}
+
+// Copies a byte[] range and sends it, the copy is on the stack unless the
+// report is long
+static bt_status_t send_report_range(JNIEnv *env, bt_bdaddr_t *bd_addr, jint report_type,
+                                     jbyteArray report, jint offset, jint length) {
+    uint8_t stack_report[HID_REPORT_STACK_LEN];
+    uint8_t *data = stack_report;
+    bt_status_t status;
+
+    if (length > HID_REPORT_STACK_LEN) {
+        data = (uint8_t *) malloc(length);
+        if (data == NULL) {
+            ALOGE("Failed to allocate a %d byte report", length);
+            return BT_STATUS_NOMEM;
+        }
+    }
+    env->GetByteArrayRegion(report, offset, length, (jbyte *) data);
+
+    status = send_report(bd_addr, report_type, data, length);
+    if (data != stack_report) free(data);
+    return status;
+}
+
+static jboolean setReportBytesNative(JNIEnv *env, jobject object, jbyteArray address,
+                                     jbyte reportType, jbyteArray report, jint offset,
+                                     jint length) {
+    bt_status_t status;
+    bt_bdaddr_t bd_addr;
+    if (!sBluetoothHidInterface) return JNI_FALSE;
+
+    if (!get_address(env, address, &bd_addr)) return JNI_FALSE;
+    if (!check_range(env, report, offset, length)) return JNI_FALSE;
+
+    if ( (status = send_report_range(env, &bd_addr, (jint) reportType, report, offset,
+                                     length)) != BT_STATUS_SUCCESS) {
+        ALOGE("Failed set report, status: %d", status);
+        return JNI_FALSE;
+    }
+    return JNI_TRUE;
+}
+
+static jboolean sendDataBytesNative(JNIEnv *env, jobject object, jbyteArray address,
+                                    jbyteArray report, jint offset, jint length) {
+    bt_status_t status;
+    bt_bdaddr_t bd_addr;
+    if (!sBluetoothHidInterface) return JNI_FALSE;
+
+    if (!get_address(env, address, &bd_addr)) return JNI_FALSE;
+    if (!check_range(env, report, offset, length)) return JNI_FALSE;
+
+    if ( (status = send_report_range(env, &bd_addr, -1, report, offset, length)) !=
+         BT_STATUS_SUCCESS) {
+        ALOGE("Failed send data, status: %d", status);
+        return JNI_FALSE;
+    }
+    return JNI_TRUE;
+}
+
+static jboolean sendDataBufferNative(JNIEnv *env, jobject object, jbyteArray address,
+                                     jobject buffer, jint offset, jint length) {
+    bt_status_t status;
+    bt_bdaddr_t bd_addr;
+    if (!sBluetoothHidInterface) return JNI_FALSE;
+
+    if (!get_address(env, address, &bd_addr)) return JNI_FALSE;
+
+    uint8_t *data = (uint8_t *) env->GetDirectBufferAddress(buffer);
+    jlong capacity = env->GetDirectBufferCapacity(buffer);
+    if (data == NULL || offset < 0 || length <= 0 || length > capacity - offset) {
+        ALOGE("Invalid HID report buffer, offset: %d, length: %d", offset, length);
+        return JNI_FALSE;
+    }
+
+    if ( (status = send_report(&bd_addr, -1, data + offset, length)) != BT_STATUS_SUCCESS) {
+        ALOGE("Failed send data, status: %d", status);
+        return JNI_FALSE;
+    }
+    return JNI_TRUE;
+}
+
+// Sends reports[offsets[i], offsets[i] + lengths[i]) in order and returns
+// how many were sent, stopping at the first one that fails
+static jint sendDataBatchNative(JNIEnv *env, jobject object, jbyteArray address,
+                                jbyteArray reports, jintArray offsets, jintArray lengths) {
+    bt_status_t status;
+    bt_bdaddr_t bd_addr;
+    jint sent = 0;
+    if (!sBluetoothHidInterface) return 0;
+
+    if (!get_address(env, address, &bd_addr)) return 0;
+    if (reports == NULL || offsets == NULL || lengths == NULL) return 0;
+
+    jsize count = env->GetArrayLength(offsets);
+    if (count != env->GetArrayLength(lengths)) {
+        ALOGE("HID report batch has %d offsets but %d lengths", count,
+              env->GetArrayLength(lengths));
+        return 0;
+    }
+    jsize reports_len = env->GetArrayLength(reports);
+
+    jint *offs = env->GetIntArrayElements(offsets, NULL);
+    jint *lens = env->GetIntArrayElements(lengths, NULL);
+    jbyte *data = env->GetByteArrayElements(reports, NULL);
+    if (offs == NULL || lens == NULL || data == NULL) {
+        ALOGE("Failed to access HID report batch");
+        goto Fail;
+    }
+
+    for (; sent < count; sent++) {
+        if (offs[sent] < 0 || lens[sent] <= 0 || lens[sent] > reports_len - offs[sent]) {
+            ALOGE("Invalid HID report range, offset: %d, length: %d", offs[sent], lens[sent]);
+            break;
+        }
+        if ( (status = send_report(&bd_addr, -1, (uint8_t *) data + offs[sent], lens[sent])) !=
+             BT_STATUS_SUCCESS) {
+            ALOGE("Failed send data, status: %d", status);
+            break;
+        }
+    }
+
+Fail:
+    if (data) env->ReleaseByteArrayElements(reports, data, JNI_ABORT);
+    if (lens) env->ReleaseIntArrayElements(lengths, lens, JNI_ABORT);
+    if (offs) env->ReleaseIntArrayElements(offsets, offs, JNI_ABORT);
+    return sent;
+}
+
+// Slots of slot_size bytes each are carved out of the direct buffer, one per
+// outstanding request. Fails while requests are outstanding.
+static jboolean registerReportBufferNative(JNIEnv *env, jobject object, jobject buffer,
+                                           jint slot_size) {
+    uint8_t *data = (uint8_t *) env->GetDirectBufferAddress(buffer);
+    jlong capacity = env->GetDirectBufferCapacity(buffer);
+    if (data == NULL || slot_size <= 0 || capacity < slot_size) {
+        ALOGE("Report buffer must be direct and hold at least one %d byte slot", slot_size);
+        return JNI_FALSE;
+    }
+
+    Mutex::Autolock lock(sReportLock);
+    for (int i = 0; i < sReportSlots; i++) {
+        if (sReportRequests[i].state != REPORT_REQUEST_FREE) {
+            ALOGE("Cannot replace the report buffer while requests are outstanding");
+            return JNI_FALSE;
+        }
+    }
+
+    if (sReportBuffer != NULL) env->DeleteGlobalRef(sReportBuffer);
+    sReportBuffer = env->NewGlobalRef(buffer);
+    sReportBufferData = data;
+    sReportSlotSize = slot_size;
+    sReportSlots = (int) (capacity / slot_size);
+    if (sReportSlots > HID_MAX_REPORT_REQUESTS) sReportSlots = HID_MAX_REPORT_REQUESTS;
+    return JNI_TRUE;
+}
+
+static jint getReportRequestNative(JNIEnv *env, jobject object, jbyteArray address,
+                                   jbyte reportType, jbyte reportId, jint bufferSize,
+                                   jint timeoutMs) {
+    bt_bdaddr_t bd_addr;
+    if (!sBluetoothHidInterface) return -1;
+
+    if (!get_address(env, address, &bd_addr)) return -1;
+
+    return report_request_send(&bd_addr, (jint) reportType, (jint) reportId, bufferSize,
+                               timeoutMs);
+}
+
+static void releaseReportSlotNative(JNIEnv *env, jobject object, jint slot) {
+    Mutex::Autolock lock(sReportLock);
+    if (slot < 0 || slot >= sReportSlots) return;
+    if (sReportRequests[slot].state == REPORT_REQUEST_DELIVERED) {
+        sReportRequests[slot].state = REPORT_REQUEST_FREE;
+    }
+}
+
 static JNINativeMethod sMethods[] = {
     {"classInitNative", "()V", (void *) classInitNative},
     {"initializeNative", "()V", (void *) initializeNative},
@@ -454,6 +946,14 @@ static JNINativeMethod sMethods[] = {
     {"getReportNative", "([BBBI)Z", (void *) getReportNative},
     {"setReportNative", "([BBLjava/lang/String;)Z", (void *) setReportNative},
     {"sendDataNative", "([BLjava/lang/String;)Z", (void *) sendDataNative},
+    {"setReportBytesNative", "([BB[BII)Z", (void *) setReportBytesNative},
+    {"sendDataBytesNative", "([B[BII)Z", (void *) sendDataBytesNative},
+    {"sendDataBufferNative", "([BLjava/nio/ByteBuffer;II)Z", (void *) sendDataBufferNative},
+    {"sendDataBatchNative", "([B[B[I[I)I", (void *) sendDataBatchNative},
+    {"registerReportBufferNative", "(Ljava/nio/ByteBuffer;I)Z",
+     (void *) registerReportBufferNative},
+    {"getReportRequestNative", "([BBBII)I", (void *) getReportRequestNative},
+    {"releaseReportSlotNative", "(I)V", (void *) releaseReportSlotNative},
 };
 
 int register_com_android_bluetooth_hid(JNIEnv* env)
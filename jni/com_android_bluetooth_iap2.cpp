@@ -18,17 +18,13 @@
 
 #define LOG_NDEBUG 0
 
-#define CHECK_CALLBACK_ENV                                                      \
-   if (!checkCallbackThread()) {                                                \
-       ALOGE("Callback: '%s' is not called on the correct thread", __FUNCTION__);\
-       return;                                                                  \
-   }
-
 #include "com_android_bluetooth.h"
 #include "hardware/bt_iap2.h"
 #include "utils/Log.h"
+#include "utils/Mutex.h"
 #include "android_runtime/AndroidRuntime.h"
 
+#include <stdlib.h>
 #include <string.h>
 
 namespace android {
@@ -36,42 +32,46 @@ namespace android {
 static jmethodID method_onConnectionStateChanged;
 static jmethodID method_onServiceStateChanged;
 static jmethodID method_onDataRx;
+static jmethodID method_onDataRxBuffer;
 static jmethodID method_onError;
 
 static const btiap2_interface_t *sBluetoothIap2Interface = NULL;
 static jobject mCallbacksObj = NULL;
-static JNIEnv *sCallbackEnv = NULL;
-
-static bool checkCallbackThread() {
-    // Always fetch the latest callbackEnv from AdapterService.
-    // Caching this could cause this sCallbackEnv to go out-of-sync
-    // with the AdapterService's ENV if an ASSOCIATE/DISASSOCIATE event
-    // is received
-    //if (sCallbackEnv == NULL) {
-    sCallbackEnv = getCallbackEnv();
-    //}
-    JNIEnv* env = AndroidRuntime::getJNIEnv();
-    if (sCallbackEnv != env || sCallbackEnv == NULL) return false;
-    return true;
-}
+
+// Ranges up to this size are sent from a copy on the stack
+#define IAP2_TX_STACK_LEN 1024
+
+// Pool of direct ByteBuffers registered by Java for inbound data. A buffer
+// is owned by Java from the onDataRxBuffer upcall until releaseRxBufferNative.
+#define IAP2_MAX_RX_BUFFERS 16
+
+typedef struct {
+    jobject buffer;
+    uint8_t *addr;
+    jlong capacity;
+    bool busy;
+} iap2_rx_buffer_t;
+
+static Mutex sRxBufferLock;
+static iap2_rx_buffer_t sRxBuffers[IAP2_MAX_RX_BUFFERS];
+static int sNumRxBuffers = 0;
+static int sNextRxBuffer = 0;
 
 static void connection_state_callback(btiap2_connection_state_t state, bt_bdaddr_t* bd_addr) {
     jbyteArray addr;
 
     ALOGI("%s", __FUNCTION__);
 
-    CHECK_CALLBACK_ENV
-    addr = sCallbackEnv->NewByteArray(sizeof(bt_bdaddr_t));
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    addr = sCallbackEnv.newAddressArray(bd_addr);
     if (!addr) {
         ALOGE("Fail to new jbyteArray bd addr for connection state");
-        checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
         return;
     }
 
-    sCallbackEnv->SetByteArrayRegion(addr, 0, sizeof(bt_bdaddr_t), (jbyte*) bd_addr);
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onConnectionStateChanged,
-                                 (jint) state, addr);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onConnectionStateChanged,
+                                (jint) state, addr);
     sCallbackEnv->DeleteLocalRef(addr);
 }
 
@@ -81,16 +81,16 @@ static void service_state_callback(btiap2_service_state_t state, bt_bdaddr_t* bd
 
     ALOGI("%s", __FUNCTION__);
 
-    CHECK_CALLBACK_ENV
-    addr = sCallbackEnv->NewByteArray(sizeof(bt_bdaddr_t));
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    addr = sCallbackEnv.newAddressArray(bd_addr);
     if (!addr) {
         ALOGE("Fail to new jbyteArray bd addr for connection state");
-        checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
         return;
     }
 
     if (state == BTIAP2_SERVICE_STATE_CONNECTED) {
-        fileDescriptor = jniCreateFileDescriptor(sCallbackEnv, fd);
+        fileDescriptor = jniCreateFileDescriptor(sCallbackEnv.get(), fd);
         if (!fileDescriptor) {
             ALOGE("Failed to convert file descriptor, fd: %d", fd);
             sCallbackEnv->DeleteLocalRef(addr);
@@ -98,38 +98,60 @@ static void service_state_callback(btiap2_service_state_t state, bt_bdaddr_t* bd
         }
     }
 
-    sCallbackEnv->SetByteArrayRegion(addr, 0, sizeof(bt_bdaddr_t), (jbyte*) bd_addr);
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onServiceStateChanged,
-                                 (jint) state, addr, fileDescriptor);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onServiceStateChanged,
+                                (jint) state, addr, fileDescriptor);
     sCallbackEnv->DeleteLocalRef(addr);
 }
 
+// Copies the data into a free registered buffer that fits len bytes and marks
+// it busy. Returns the index of the buffer, or -1 if there is none.
+static int copy_to_rx_buffer(unsigned int len, const unsigned char *data) {
+    Mutex::Autolock lock(sRxBufferLock);
+    for (int i = 0; i < sNumRxBuffers; i++) {
+        int idx = (sNextRxBuffer + i) % sNumRxBuffers;
+        iap2_rx_buffer_t *rx = &sRxBuffers[idx];
+        if (!rx->busy && rx->capacity >= (jlong) len) {
+            // Under the lock, so the buffer cannot be released meanwhile
+            memcpy(rx->addr, data, len);
+            rx->busy = true;
+            sNextRxBuffer = (idx + 1) % sNumRxBuffers;
+            return idx;
+        }
+    }
+    return -1;
+}
+
 static void data_callback(unsigned int len, unsigned char *data) {
     jbyteArray buf;
+    int idx;
+
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    if ((idx = copy_to_rx_buffer(len, data)) >= 0) {
+        sCallbackEnv.callVoidMethod(mCallbacksObj, method_onDataRxBuffer, (jint) idx,
+                                    (jint) len);
+        return;
+    }
 
-    CHECK_CALLBACK_ENV
     buf = sCallbackEnv->NewByteArray(len);
     if (!buf) {
         ALOGE("Fail to new jbyteArray buf for data callback");
-        checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
         return;
     }
 
     sCallbackEnv->SetByteArrayRegion(buf, 0, len, (jbyte *) data);
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onDataRx, (jint) len, buf);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onDataRx, (jint) len, buf);
     sCallbackEnv->DeleteLocalRef(buf);
 }
 
 
 static void error_callback(btiap2_error_t error_code, char *error_string) {
-    CHECK_CALLBACK_ENV
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
     jstring js_error_string = sCallbackEnv->NewStringUTF(error_string);
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onError,
-                                 (jint) error_code,
-                                 js_error_string);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onError,
+                                (jint) error_code,
+                                js_error_string);
     sCallbackEnv->DeleteLocalRef(js_error_string);
 }
 
@@ -141,19 +163,35 @@ static btiap2_callbacks_t sBluetoothIap2Callbacks = {
     error_callback,
 };
 
+static const callback_method_t sCallbackMethods[] = {
+    {&method_onConnectionStateChanged, "onConnectionStateChanged", "(I[B)V"},
+    {&method_onServiceStateChanged, "onServiceStateChanged", "(I[BLjava/io/FileDescriptor;)V"},
+    {&method_onDataRx, "onDataRx", "(I[B)V"},
+    {&method_onDataRxBuffer, "onDataRxBuffer", "(II)V"},
+    {&method_onError, "onError", "(ILjava/lang/String;)V"},
+};
+
 static void classInitNative(JNIEnv* env, jclass clazz) {
     int err;
 
-    method_onConnectionStateChanged =
-        env->GetMethodID(clazz, "onConnectionStateChanged", "(I[B)V");
-    method_onServiceStateChanged =
-        env->GetMethodID(clazz, "onServiceStateChanged", "(I[BLjava/io/FileDescriptor;)V");
-    method_onDataRx = env->GetMethodID(clazz, "onDataRx", "(I[B)V");
-    method_onError = env->GetMethodID(clazz, "onError", "(ILjava/lang/String;)V");
+    if (!getCallbackMethodIDs(env, clazz, sCallbackMethods, NELEM(sCallbackMethods))) {
+        ALOGE("%s: Missing callback methods", __FUNCTION__);
+        return;
+    }
 
     ALOGI("%s: succeeds", __FUNCTION__);
 }
 
+static void release_rx_buffers(JNIEnv *env) {
+    Mutex::Autolock lock(sRxBufferLock);
+    for (int i = 0; i < sNumRxBuffers; i++) {
+        env->DeleteGlobalRef(sRxBuffers[i].buffer);
+    }
+    memset(sRxBuffers, 0, sizeof(sRxBuffers));
+    sNumRxBuffers = 0;
+    sNextRxBuffer = 0;
+}
+
 static void initializeNative(JNIEnv *env, jobject object) {
     const bt_interface_t* btInf;
     bt_status_t status;
@@ -210,6 +248,8 @@ static void cleanupNative(JNIEnv *env, jobject object) {
         env->DeleteGlobalRef(mCallbacksObj);
         mCallbacksObj = NULL;
     }
+
+    release_rx_buffers(env);
 }
 
 static jboolean connectIap2Native(JNIEnv *env, jobject object, jbyteArray address) {
@@ -253,7 +293,6 @@ static jboolean disconnectIap2Native(JNIEnv *env, jobject object, jbyteArray add
 
 static jboolean sendDataNative(JNIEnv *env, jobject object, jint len, jbyteArray data) {
     jbyte *buf;
-    const jchar *name;
     bt_status_t status;
 
     if (!sBluetoothIap2Interface) return JNI_FALSE;
@@ -267,10 +306,109 @@ static jboolean sendDataNative(JNIEnv *env, jobject object, jint len, jbyteArray
     if ( (status = sBluetoothIap2Interface->send_data(len, (unsigned char *)buf)) != BT_STATUS_SUCCESS) {
         ALOGE("Failed IAP2 send data, status: %d", status);
     }
-    env->ReleaseByteArrayElements(data, buf, 0);
+    // send_data does not modify the buffer, no need to copy it back
+    env->ReleaseByteArrayElements(data, buf, JNI_ABORT);
     return (status == BT_STATUS_SUCCESS) ? JNI_TRUE : JNI_FALSE;
 }
 
+static jboolean sendDataRangeNative(JNIEnv *env, jobject object, jbyteArray data,
+                                    jint offset, jint len) {
+    uint8_t stack_buf[IAP2_TX_STACK_LEN];
+    uint8_t *buf;
+    bt_status_t status;
+
+    if (!sBluetoothIap2Interface) return JNI_FALSE;
+
+    if (data == NULL || offset < 0 || len < 0 ||
+        offset > env->GetArrayLength(data) - len) {
+        jniThrowIOException(env, EINVAL);
+        return JNI_FALSE;
+    }
+
+    // Copy the range out, send_data may block and the array must not stay
+    // pinned meanwhile
+    buf = len <= IAP2_TX_STACK_LEN ? stack_buf : (uint8_t *) malloc(len);
+    if (!buf) {
+        jniThrowIOException(env, ENOMEM);
+        return JNI_FALSE;
+    }
+    env->GetByteArrayRegion(data, offset, len, (jbyte *) buf);
+
+    status = sBluetoothIap2Interface->send_data(len, buf);
+    if (buf != stack_buf) free(buf);
+
+    if (status != BT_STATUS_SUCCESS) {
+        ALOGE("Failed IAP2 send data, status: %d", status);
+    }
+    return (status == BT_STATUS_SUCCESS) ? JNI_TRUE : JNI_FALSE;
+}
+
+static jboolean sendDataBufferNative(JNIEnv *env, jobject object, jobject data,
+                                     jint offset, jint len) {
+    uint8_t *buf;
+    jlong capacity;
+    bt_status_t status;
+
+    if (!sBluetoothIap2Interface) return JNI_FALSE;
+
+    buf = data ? (uint8_t *) env->GetDirectBufferAddress(data) : NULL;
+    capacity = data ? env->GetDirectBufferCapacity(data) : -1;
+    if (!buf || offset < 0 || len < 0 || (jlong) offset > capacity - len) {
+        jniThrowIOException(env, EINVAL);
+        return JNI_FALSE;
+    }
+
+    if ( (status = sBluetoothIap2Interface->send_data(len, buf + offset)) != BT_STATUS_SUCCESS) {
+        ALOGE("Failed IAP2 send data, status: %d", status);
+    }
+    return (status == BT_STATUS_SUCCESS) ? JNI_TRUE : JNI_FALSE;
+}
+
+static jboolean registerRxBuffersNative(JNIEnv *env, jobject object, jobjectArray buffers) {
+    jsize count;
+
+    release_rx_buffers(env);
+    if (buffers == NULL) return JNI_TRUE;
+
+    count = env->GetArrayLength(buffers);
+    if (count > IAP2_MAX_RX_BUFFERS) {
+        ALOGE("Too many IAP2 receive buffers: %d, max: %d", count, IAP2_MAX_RX_BUFFERS);
+        return JNI_FALSE;
+    }
+
+    Mutex::Autolock lock(sRxBufferLock);
+    for (jsize i = 0; i < count; i++) {
+        jobject buffer = env->GetObjectArrayElement(buffers, i);
+        iap2_rx_buffer_t *rx = &sRxBuffers[i];
+
+        rx->addr = buffer ? (uint8_t *) env->GetDirectBufferAddress(buffer) : NULL;
+        rx->capacity = buffer ? env->GetDirectBufferCapacity(buffer) : -1;
+        if (rx->addr == NULL || rx->capacity <= 0) {
+            ALOGE("IAP2 receive buffer %d is not a direct buffer", i);
+            if (buffer) env->DeleteLocalRef(buffer);
+            for (jsize j = 0; j < i; j++) {
+                env->DeleteGlobalRef(sRxBuffers[j].buffer);
+            }
+            memset(sRxBuffers, 0, sizeof(sRxBuffers));
+            return JNI_FALSE;
+        }
+        rx->buffer = env->NewGlobalRef(buffer);
+        rx->busy = false;
+        env->DeleteLocalRef(buffer);
+    }
+    sNumRxBuffers = count;
+    return JNI_TRUE;
+}
+
+static void releaseRxBufferNative(JNIEnv *env, jobject object, jint index) {
+    Mutex::Autolock lock(sRxBufferLock);
+    if (index < 0 || index >= sNumRxBuffers) {
+        ALOGE("Invalid IAP2 receive buffer index: %d", index);
+        return;
+    }
+    sRxBuffers[index].busy = false;
+}
+
 static JNINativeMethod sMethods[] = {
     {"classInitNative", "()V", (void *) classInitNative},
     {"initializeNative", "()V", (void *) initializeNative},
@@ -278,6 +416,10 @@ static JNINativeMethod sMethods[] = {
     {"connectIap2Native", "([B)Z", (void *) connectIap2Native},
     {"disconnectIap2Native", "([B)Z", (void *) disconnectIap2Native},
     {"sendDataNative", "(I[B)Z", (void *) sendDataNative},
+    {"sendDataRangeNative", "([BII)Z", (void *) sendDataRangeNative},
+    {"sendDataBufferNative", "(Ljava/nio/ByteBuffer;II)Z", (void *) sendDataBufferNative},
+    {"registerRxBuffersNative", "([Ljava/nio/ByteBuffer;)Z", (void *) registerRxBuffersNative},
+    {"releaseRxBufferNative", "(I)V", (void *) releaseRxBufferNative},
 };
 
 int register_com_android_bluetooth_iap2(JNIEnv* env)
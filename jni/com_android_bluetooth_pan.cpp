@@ -18,18 +18,18 @@
 
 #define LOG_NDEBUG 0
 
-#define CHECK_CALLBACK_ENV                                                      \
-   if (!checkCallbackThread()) {                                                \
-       error("Callback: '%s' is not called on the correct thread", __FUNCTION__);\
-       return;                                                                  \
-   }
-
 #include "com_android_bluetooth.h"
 #include "hardware/bt_pan.h"
 #include "utils/Log.h"
 #include "android_runtime/AndroidRuntime.h"
+#include "utils/Mutex.h"
+#include "utils/SystemClock.h"
 
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <cutils/log.h>
 #define info(fmt, ...)  ALOGI ("%s(L%d): " fmt,__FUNCTION__, __LINE__,  ## __VA_ARGS__)
@@ -46,22 +46,117 @@ static jmethodID method_onControlStateChanged;
 
 static const btpan_interface_t *sPanIf = NULL;
 static jobject mCallbacksObj = NULL;
-static JNIEnv *sCallbackEnv = NULL;
 
-static bool checkCallbackThread() {
-    sCallbackEnv = getCallbackEnv();
+/**
+ * Interface statistics
+ *
+ * The stack moves PAN traffic between L2CAP and its tap interface without
+ * passing it through here, so the only counters are those the kernel keeps
+ * for the interface, and there is no queue depth or round trip time to
+ * report. A snapshot is taken when a connection comes up, and
+ * getInterfaceStatsNative reports what the interface counters moved since,
+ * along with how long the connection is up. These are not per connection
+ * figures: all connections share the interface, so with more than one the
+ * traffic of all of them is in the counters reported for each.
+ */
+
+#define PAN_MAX_CONNECTIONS 7
+#define PAN_MAX_IFNAME_LEN 16
 
-    JNIEnv* env = AndroidRuntime::getJNIEnv();
-    if (sCallbackEnv != env || sCallbackEnv == NULL) return false;
-    return true;
+// Interface counters, in the order getInterfaceStatsNative reports them
+static const char *const sPanStatNames[] = {
+    "rx_bytes", "rx_packets", "rx_dropped", "rx_errors",
+    "tx_bytes", "tx_packets", "tx_dropped", "tx_errors",
+};
+#define PAN_STAT_COUNT NELEM(sPanStatNames)
+
+// Fields ahead of the counters: up time in ms, local role, remote role
+#define PAN_STATS_HEADER_LEN 3
+
+typedef struct {
+    bool in_use;
+    bt_bdaddr_t bda;
+    int local_role;
+    int remote_role;
+    int64_t connected_at;           // elapsedRealtime() ms
+    int64_t base[PAN_STAT_COUNT];
+} pan_conn_stats_t;
+
+static Mutex sStatsLock;
+static char sPanIfname[PAN_MAX_IFNAME_LEN];
+static pan_conn_stats_t sConnStats[PAN_MAX_CONNECTIONS];
+
+// Reads the interface counters, those that cannot be read are 0
+static void read_if_stats_l(int64_t *stats) {
+    char path[64 + PAN_MAX_IFNAME_LEN];
+    char value[32];
+
+    for (int i = 0; i < (int) PAN_STAT_COUNT; i++) {
+        stats[i] = 0;
+        if (!sPanIfname[0]) continue;
+
+        snprintf(path, sizeof(path), "/sys/class/net/%s/statistics/%s", sPanIfname,
+                 sPanStatNames[i]);
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) continue;
+        ssize_t len = read(fd, value, sizeof(value) - 1);
+        close(fd);
+        if (len <= 0) continue;
+        value[len] = 0;
+        stats[i] = strtoll(value, NULL, 10);
+    }
+}
+
+static pan_conn_stats_t *conn_stats_find_l(const bt_bdaddr_t *bda) {
+    for (int i = 0; i < PAN_MAX_CONNECTIONS; i++) {
+        if (sConnStats[i].in_use && !memcmp(&sConnStats[i].bda, bda, sizeof(bt_bdaddr_t))) {
+            return &sConnStats[i];
+        }
+    }
+    return NULL;
+}
+
+static void conn_stats_update(btpan_connection_state_t state, const bt_bdaddr_t *bd_addr,
+                              int local_role, int remote_role) {
+    Mutex::Autolock lock(sStatsLock);
+    pan_conn_stats_t *c = conn_stats_find_l(bd_addr);
+
+    if (state == BTPAN_STATE_CONNECTED) {
+        if (c == NULL) {
+            for (int i = 0; i < PAN_MAX_CONNECTIONS; i++) {
+                if (!sConnStats[i].in_use) {
+                    c = &sConnStats[i];
+                    break;
+                }
+            }
+            if (c == NULL) {
+                warn("No room for the statistics of another connection");
+                return;
+            }
+        }
+        c->in_use = true;
+        c->bda = *bd_addr;
+        c->local_role = local_role;
+        c->remote_role = remote_role;
+        c->connected_at = elapsedRealtime();
+        read_if_stats_l(c->base);
+    } else if (state == BTPAN_STATE_DISCONNECTED && c != NULL) {
+        c->in_use = false;
+    }
 }
 
 static void control_state_callback(btpan_control_state_t state, bt_status_t error, int local_role,
                 const char* ifname) {
     debug("state:%d, local_role:%d, ifname:%s", state, local_role, ifname);
-    CHECK_CALLBACK_ENV
+    if (state == BTPAN_STATE_ENABLED && ifname) {
+        Mutex::Autolock lock(sStatsLock);
+        strncpy(sPanIfname, ifname, PAN_MAX_IFNAME_LEN - 1);
+        sPanIfname[PAN_MAX_IFNAME_LEN - 1] = 0;
+    }
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
     jstring js_ifname = sCallbackEnv->NewStringUTF(ifname);
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onControlStateChanged, (jint)state, (jint)error,
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onControlStateChanged, (jint)state, (jint)error,
                                 (jint)local_role, js_ifname);
     sCallbackEnv->DeleteLocalRef(js_ifname);
 }
@@ -70,18 +165,17 @@ static void connection_state_callback(btpan_connection_state_t state, bt_status_
                                       int local_role, int remote_role) {
     jbyteArray addr;
     debug("state:%d, local_role:%d, remote_role:%d", state, local_role, remote_role);
-    CHECK_CALLBACK_ENV
-    addr = sCallbackEnv->NewByteArray(sizeof(bt_bdaddr_t));
+    conn_stats_update(state, bd_addr, local_role, remote_role);
+    CallbackEnv sCallbackEnv(__FUNCTION__);
+    if (!sCallbackEnv.valid()) return;
+    addr = sCallbackEnv.newAddressArray(bd_addr);
     if (!addr) {
         error("Fail to new jbyteArray bd addr for PAN channel state");
-        checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
         return;
     }
-    sCallbackEnv->SetByteArrayRegion(addr, 0, sizeof(bt_bdaddr_t), (jbyte *) bd_addr);
 
-    sCallbackEnv->CallVoidMethod(mCallbacksObj, method_onConnectStateChanged, addr, (jint) state,
-                                    (jint)error, (jint)local_role, (jint)remote_role);
-    checkAndClearExceptionFromCallback(sCallbackEnv, __FUNCTION__);
+    sCallbackEnv.callVoidMethod(mCallbacksObj, method_onConnectStateChanged, addr, (jint) state,
+                                   (jint)error, (jint)local_role, (jint)remote_role);
     sCallbackEnv->DeleteLocalRef(addr);
 }
 
@@ -93,14 +187,19 @@ static btpan_callbacks_t sBluetoothPanCallbacks = {
 
 // Define native functions
 
+static const callback_method_t sCallbackMethods[] = {
+    {&method_onConnectStateChanged, "onConnectStateChanged", "([BIIII)V"},
+    {&method_onControlStateChanged, "onControlStateChanged", "(IIILjava/lang/String;)V"},
+};
+
 static void classInitNative(JNIEnv* env, jclass clazz) {
     int err;
     bt_status_t status;
 
-    method_onConnectStateChanged = env->GetMethodID(clazz, "onConnectStateChanged",
-                                                    "([BIIII)V");
-    method_onControlStateChanged = env->GetMethodID(clazz, "onControlStateChanged",
-                                                    "(IIILjava/lang/String;)V");
+    if (!getCallbackMethodIDs(env, clazz, sCallbackMethods, NELEM(sCallbackMethods))) {
+        error("Missing callback methods");
+        return;
+    }
 
     info("succeeds");
 }
@@ -160,6 +259,10 @@ static void cleanupNative(JNIEnv *env, jobject object) {
         mCallbacksObj = NULL;
     }
     btIf = NULL;
+
+    Mutex::Autolock lock(sStatsLock);
+    memset(sConnStats, 0, sizeof(sConnStats));
+    sPanIfname[0] = 0;
 }
 
 static jboolean enablePanNative(JNIEnv *env, jobject object, jint local_role) {
@@ -229,6 +332,41 @@ static jboolean disconnectPanNative(JNIEnv *env, jobject object, jbyteArray addr
     return ret;
 }
 
+// Returns the up time and roles of a connection and the interface counters
+// since it came up, or null if the device is not connected
+static jlongArray getInterfaceStatsNative(JNIEnv *env, jobject object, jbyteArray address) {
+    jlong stats[PAN_STATS_HEADER_LEN + PAN_STAT_COUNT];
+    bt_bdaddr_t bd_addr;
+
+    if (address == NULL || env->GetArrayLength(address) != (jsize) sizeof(bt_bdaddr_t)) {
+        error("Bluetooth device address null");
+        return NULL;
+    }
+    env->GetByteArrayRegion(address, 0, sizeof(bt_bdaddr_t), (jbyte *) &bd_addr);
+
+    {
+        Mutex::Autolock lock(sStatsLock);
+        pan_conn_stats_t *c = conn_stats_find_l(&bd_addr);
+        if (c == NULL) return NULL;
+
+        int64_t now[PAN_STAT_COUNT];
+        read_if_stats_l(now);
+        stats[0] = elapsedRealtime() - c->connected_at;
+        stats[1] = c->local_role;
+        stats[2] = c->remote_role;
+        for (int i = 0; i < (int) PAN_STAT_COUNT; i++) {
+            // Counters restart if the interface is recreated
+            int64_t delta = now[i] - c->base[i];
+            stats[PAN_STATS_HEADER_LEN + i] = delta >= 0 ? delta : now[i];
+        }
+    }
+
+    jlongArray result = env->NewLongArray(NELEM(stats));
+    if (result == NULL) return NULL;
+    env->SetLongArrayRegion(result, 0, NELEM(stats), stats);
+    return result;
+}
+
 static JNINativeMethod sMethods[] = {
     {"classInitNative", "()V", (void *) classInitNative},
     {"initializeNative", "()V", (void *) initializeNative},
@@ -237,6 +375,7 @@ static JNINativeMethod sMethods[] = {
     {"enablePanNative", "(I)Z", (void *) enablePanNative},
     {"getPanLocalRoleNative", "()I", (void *) getPanLocalRoleNative},
     {"disconnectPanNative", "([B)Z", (void *) disconnectPanNative},
+    {"getInterfaceStatsNative", "([B)[J", (void *) getInterfaceStatsNative},
     // TBD cleanup
 };
 
@@ -122,10 +122,13 @@ final public class Utils {
     }
 
     public static ParcelUuid[] byteArrayToUuid(byte[] val) {
-        int numUuids = val.length/BD_UUID_LEN;
+        return byteArrayToUuid(val, 0, val.length);
+    }
+
+    public static ParcelUuid[] byteArrayToUuid(byte[] val, int offset, int length) {
+        int numUuids = length/BD_UUID_LEN;
         ParcelUuid[] puuids = new ParcelUuid[numUuids];
         UUID uuid;
-        int offset = 0;
 
         ByteBuffer converter = ByteBuffer.wrap(val);
         converter.order(ByteOrder.BIG_ENDIAN);
@@ -509,6 +509,18 @@ final class Avrcp {
             mPlayStatusChangedNT = NOTIFICATION_TYPE_CHANGED;
             registerNotificationRspPlayStatusNative(mPlayStatusChangedNT, newPlayStatus);
         }
+        updatePlaybackAnchor(false);
+    }
+
+    /**
+     * Hands the current position to the native layer, which answers play
+     * status requests and schedules play position notifications from it.
+     */
+    private void updatePlaybackAnchor(boolean trackChanged) {
+        float speed = (mCurrentPlayState == RemoteControlClient.PLAYSTATE_PLAYING) ? 1.0f : 0.0f;
+        setPlaybackAnchorNative(convertPlayStateToPlayStatus(mCurrentPlayState),
+                                (int)mSongLengthMs, getPlayPosition(),
+                                SystemClock.elapsedRealtime(), speed, trackChanged);
     }
 
     private void updateTransportControls(int transportControlFlags) {
@@ -541,12 +553,29 @@ final class Avrcp {
     }
 
     private void updateMetadata(Bundle data) {
+        boolean trackChanged = false;
         String oldMetadata = mMetadata.toString();
         mMetadata.artist = getMdString(data, MediaMetadataRetriever.METADATA_KEY_ALBUMARTIST);
         mMetadata.trackTitle = getMdString(data, MediaMetadataRetriever.METADATA_KEY_TITLE);
         mMetadata.albumTitle = getMdString(data, MediaMetadataRetriever.METADATA_KEY_ALBUM);
         if (!oldMetadata.equals(mMetadata.toString())) {
+            trackChanged = true;
             mTrackNumber++;
+        }
+        if (DEBUG) Log.v(TAG, "mMetadata=" + mMetadata.toString());
+
+        mSongLengthMs = getMdLong(data, MediaMetadataRetriever.METADATA_KEY_DURATION);
+        if (DEBUG) Log.v(TAG, "duration=" + mSongLengthMs);
+
+        /* the native cache answers GetElementAttributes, so it has to hold the
+         * new track before the controller is told about it */
+        String[] textArray = new String[CACHED_ATTR_IDS.length];
+        for (int i = 0; i < CACHED_ATTR_IDS.length; ++i) {
+            textArray[i] = getAttributeString(CACHED_ATTR_IDS[i]);
+        }
+        setMetadataNative(CACHED_ATTR_IDS, textArray);
+
+        if (trackChanged) {
             if (mTrackChangedNT == NOTIFICATION_TYPE_INTERIM) {
                 mTrackChangedNT = NOTIFICATION_TYPE_CHANGED;
                 sendTrackChangedRsp();
@@ -566,10 +595,7 @@ final class Avrcp {
                 mHandler.removeMessages(MESSAGE_PLAY_INTERVAL_TIMEOUT);
             }
         }
-        if (DEBUG) Log.v(TAG, "mMetadata=" + mMetadata.toString());
-
-        mSongLengthMs = getMdLong(data, MediaMetadataRetriever.METADATA_KEY_DURATION);
-        if (DEBUG) Log.v(TAG, "duration=" + mSongLengthMs);
+        updatePlaybackAnchor(trackChanged);
     }
 
     private void getRcFeatures(byte[] address, int features) {
@@ -640,6 +666,13 @@ final class Avrcp {
         }
     }
 
+    /* Called in the native layer with the commands of a burst collected in order */
+    private void handlePassthroughCmds(int[] ids, int[] keyStates) {
+        for (int i = 0; i < ids.length; i++) {
+            handlePassthroughCmd(ids[i], keyStates[i]);
+        }
+    }
+
     private void fastForward(int keyState) {
         Message msg = mHandler.obtainMessage(MESSAGE_FAST_FORWARD, keyState, 0);
         mHandler.sendMessage(msg);
@@ -845,6 +878,12 @@ final class Avrcp {
     final static int MEDIA_ATTR_GENRE = 6;
     final static int MEDIA_ATTR_PLAYING_TIME = 7;
 
+    // Element attributes handed to the native layer on every metadata update,
+    // so that remote attribute requests are answered without an upcall
+    private static final int[] CACHED_ATTR_IDS = {
+        MEDIA_ATTR_TITLE, MEDIA_ATTR_ARTIST, MEDIA_ATTR_ALBUM, MEDIA_ATTR_PLAYING_TIME
+    };
+
     // match up with btrc_event_id_t enum of bt_rc.h
     final static int EVT_PLAY_STATUS_CHANGED = 1;
     final static int EVT_TRACK_CHANGED = 2;
@@ -867,8 +906,12 @@ final class Avrcp {
     private native void cleanupNative();
     private native boolean getPlayStatusRspNative(int playStatus, int songLen, int songPos);
     private native boolean getElementAttrRspNative(byte numAttr, int[] attrIds, String[] textArray);
+    private native boolean setMetadataNative(int[] attrIds, String[] textArray);
     private native boolean registerNotificationRspPlayStatusNative(int type, int playStatus);
     private native boolean registerNotificationRspTrackChangeNative(int type, byte[] track);
     private native boolean registerNotificationRspPlayPosNative(int type, int playPos);
+    private native void setPlaybackAnchorNative(int playStatus, int songLen, long position,
+                                                long anchorTime, float speed,
+                                                boolean trackChanged);
     private native boolean setVolumeNative(int volume);
 }
@@ -430,18 +430,17 @@ class AdapterProperties {
         }
     }
 
-    void adapterPropertyChangedCallback(int[] types, byte[][] values) {
+    void adapterPropertyChangedCallback(PackedProperties props) {
         Intent intent;
         int type;
-        byte[] val;
-        for (int i = 0; i < types.length; i++) {
-            val = values[i];
-            type = types[i];
-            infoLog("adapterPropertyChangedCallback with type:" + type + " len:" + val.length);
+        while (props.next()) {
+            type = props.getType();
+            infoLog("adapterPropertyChangedCallback with type:" + type
+                    + " len:" + props.getLength());
             synchronized (mObject) {
                 switch (type) {
                     case AbstractionLayer.BT_PROPERTY_BDNAME:
-                        mName = new String(val);
+                        mName = props.getString();
                         intent = new Intent(BluetoothAdapter.ACTION_LOCAL_NAME_CHANGED);
                         intent.putExtra(BluetoothAdapter.EXTRA_LOCAL_NAME, mName);
                         intent.addFlags(Intent.FLAG_RECEIVER_REGISTERED_ONLY_BEFORE_BOOT);
@@ -450,15 +449,15 @@ class AdapterProperties {
                         debugLog("Name is: " + mName);
                         break;
                     case AbstractionLayer.BT_PROPERTY_BDADDR:
-                        mAddress = val;
+                        mAddress = props.getBytes();
                         debugLog("Address is:" + Utils.getAddressStringFromByte(mAddress));
                         break;
                     case AbstractionLayer.BT_PROPERTY_CLASS_OF_DEVICE:
-                        mBluetoothClass = Utils.byteArrayToInt(val, 0);
+                        mBluetoothClass = props.getInt();
                         debugLog("BT Class:" + mBluetoothClass);
                         break;
                     case AbstractionLayer.BT_PROPERTY_ADAPTER_SCAN_MODE:
-                        int mode = Utils.byteArrayToInt(val, 0);
+                        int mode = props.getInt();
                         mScanMode = mService.convertScanModeFromHal(mode);
                         intent = new Intent(BluetoothAdapter.ACTION_SCAN_MODE_CHANGED);
                         intent.putExtra(BluetoothAdapter.EXTRA_SCAN_MODE, mScanMode);
@@ -471,9 +470,10 @@ class AdapterProperties {
                         }
                         break;
                     case AbstractionLayer.BT_PROPERTY_UUIDS:
-                        mUuids = Utils.byteArrayToUuid(val);
+                        mUuids = props.getUuids();
                         break;
                     case AbstractionLayer.BT_PROPERTY_ADAPTER_BONDED_DEVICES:
+                        byte[] val = props.getBytes();
                         int number = val.length/BD_ADDR_LEN;
                         byte[] addrByte = new byte[BD_ADDR_LEN];
                         for (int j = 0; j < number; j++) {
@@ -484,7 +484,7 @@ class AdapterProperties {
                         }
                         break;
                     case AbstractionLayer.BT_PROPERTY_ADAPTER_DISCOVERABLE_TIMEOUT:
-                        mDiscoverableTimeout = Utils.byteArrayToInt(val, 0);
+                        mDiscoverableTimeout = props.getInt();
                         debugLog("Discoverable Timeout:" + mDiscoverableTimeout);
                         break;
                     default:
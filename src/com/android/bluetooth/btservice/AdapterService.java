@@ -58,6 +58,7 @@ import com.android.bluetooth.Utils;
 import com.android.bluetooth.btservice.RemoteDevices.DeviceProperties;
 import java.io.FileDescriptor;
 import java.io.IOException;
+import java.io.PrintWriter;
 import java.util.ArrayList;
 import java.util.HashMap;
 import java.util.Set;
@@ -87,6 +88,10 @@ public class AdapterService extends Service {
         android.Manifest.permission.BLUETOOTH_ADMIN;
     static final String BLUETOOTH_PERM = android.Manifest.permission.BLUETOOTH;
 
+    // Sizes of the address and UUID entries of the batched socket calls
+    private static final int ADDRESS_LENGTH = 6;
+    private static final int UUID_LENGTH = 16;
+
     private static final int ADAPTER_SERVICE_TYPE=Service.START_STICKY;
 
     static {
@@ -257,6 +262,9 @@ public class AdapterService extends Service {
         mAdapterStateMachine =  AdapterState.make(this, mAdapterProperties);
         mJniCallbacks =  new JniCallbacks(mAdapterStateMachine, mAdapterProperties);
         initNative();
+        configAsyncCallbacksNative(getResources().getBoolean(R.bool.async_callbacks));
+        configDiscoveryAggregationNative(
+                getResources().getInteger(R.integer.discovery_report_interval_ms));
         mNativeAvailable=true;
         mCallbacks = new RemoteCallbackList<IBluetoothCallback>();
         //Load the name and address
@@ -1360,11 +1368,92 @@ public class AdapterService extends Service {
         return ParcelFileDescriptor.adoptFd(fd);
     }
 
+    /**
+     * Connects one socket per device in one native call. Entry i of the
+     * result is the socket to devices[i], or null if that one failed.
+     */
+    public ParcelFileDescriptor[] connectSockets(BluetoothDevice[] devices, int type,
+                                                 ParcelUuid[] uuids, int[] ports, int flag) {
+        enforceCallingOrSelfPermission(BLUETOOTH_PERM, "Need BLUETOOTH permission");
+        byte[] addresses = new byte[devices.length * ADDRESS_LENGTH];
+        byte[] uuidBytes = new byte[uuids.length * UUID_LENGTH];
+        for (int i = 0; i < devices.length; i++) {
+            System.arraycopy(Utils.getBytesFromAddress(devices[i].getAddress()), 0,
+                             addresses, i * ADDRESS_LENGTH, ADDRESS_LENGTH);
+        }
+        for (int i = 0; i < uuids.length; i++) {
+            System.arraycopy(Utils.uuidToByteArray(uuids[i]), 0,
+                             uuidBytes, i * UUID_LENGTH, UUID_LENGTH);
+        }
+        return adoptSocketFds(connectSocketsNative(addresses, type, uuidBytes, ports, flag),
+                              devices.length);
+    }
+
+    /**
+     * Creates one listening channel per service in one native call, taking
+     * them from the pool set up with configSocketPool where possible. Entry
+     * i of the result is the channel of serviceNames[i], or null if that one
+     * failed.
+     */
+    public ParcelFileDescriptor[] createSocketChannels(int type, String[] serviceNames,
+                                                       ParcelUuid[] uuids, int[] ports,
+                                                       int flag) {
+        enforceCallingOrSelfPermission(BLUETOOTH_PERM, "Need BLUETOOTH permission");
+        byte[] uuidBytes = new byte[uuids.length * UUID_LENGTH];
+        for (int i = 0; i < uuids.length; i++) {
+            System.arraycopy(Utils.uuidToByteArray(uuids[i]), 0,
+                             uuidBytes, i * UUID_LENGTH, UUID_LENGTH);
+        }
+        return adoptSocketFds(createSocketChannelsNative(type, serviceNames, uuidBytes, ports,
+                                                         flag), serviceNames.length);
+    }
+
+    /**
+     * Sets up the next listening channel of the service as soon as the server
+     * last created for it closes, so a server listening again returns without
+     * waiting for the stack. Every pooled channel is an advertised listener
+     * of its own, so none is pooled while that server is open, and the
+     * pooled one is closed shortly after if no createSocketChannel takes it.
+     * At most one channel is pooled, a depth of 0 drops the pool.
+     */
+    public boolean configSocketPool(int type, String serviceName, ParcelUuid uuid, int port,
+                                    int flag, int depth) {
+        enforceCallingOrSelfPermission(BLUETOOTH_ADMIN_PERM, "Need BLUETOOTH ADMIN permission");
+        return configSocketPoolNative(type, serviceName, Utils.uuidToByteArray(uuid), port,
+                                      flag, depth);
+    }
+
+    private ParcelFileDescriptor[] adoptSocketFds(int[] fds, int count) {
+        ParcelFileDescriptor[] result = new ParcelFileDescriptor[count];
+        if (fds == null) {
+            errorLog("Failed to set up sockets");
+            return result;
+        }
+        for (int i = 0; i < count; i++) {
+            if (fds[i] < 0) {
+                errorLog("Failed to set up socket " + i);
+                continue;
+            }
+            result[i] = ParcelFileDescriptor.adoptFd(fds[i]);
+        }
+        return result;
+    }
+
     boolean configHciSnoopLog(boolean enable) {
         enforceCallingOrSelfPermission(BLUETOOTH_PERM, "Need BLUETOOTH permission");
         return configHciSnoopLogNative(enable);
     }
 
+    @Override
+    protected void dump(FileDescriptor fd, PrintWriter writer, String[] args) {
+        if (checkCallingOrSelfPermission(android.Manifest.permission.DUMP)
+                != PackageManager.PERMISSION_GRANTED) {
+            writer.println("Permission Denial: can't dump AdapterService");
+            return;
+        }
+        writer.print(dumpCallbackStatsNative());
+    }
+
      void registerCallback(IBluetoothCallback cb) {
          mCallbacks.register(cb);
       }
@@ -1438,9 +1527,21 @@ public class AdapterService extends Service {
                                            byte[] uuid, int port, int flag);
     private native int createSocketChannelNative(int type, String serviceName,
                                                  byte[] uuid, int port, int flag);
+    private native int[] connectSocketsNative(byte[] addresses, int type,
+                                              byte[] uuids, int[] ports, int flag);
+    private native int[] createSocketChannelsNative(int type, String[] serviceNames,
+                                                    byte[] uuids, int[] ports, int flag);
+    private native boolean configSocketPoolNative(int type, String serviceName,
+                                                  byte[] uuid, int port, int flag, int depth);
 
     /*package*/ native boolean configHciSnoopLogNative(boolean enable);
 
+    private native String dumpCallbackStatsNative();
+
+    private native void configAsyncCallbacksNative(boolean enable);
+
+    private native void configDiscoveryAggregationNative(int intervalMs);
+
     protected void finalize() {
         cleanup();
         if (TRACE_REF) {
@@ -49,14 +49,40 @@ final class JniCallbacks {
         mRemoteDevices.sspRequestCallback(address, name, cod, pairingVariant,
             passkey);
     }
-    void devicePropertyChangedCallback(byte[] address, int[] types, byte[][] val) {
-        mRemoteDevices.devicePropertyChangedCallback(address, types, val);
+    void devicePropertyChangedCallback(byte[] address, byte[] packed) {
+        mRemoteDevices.devicePropertyChangedCallback(address,
+                new PackedProperties(packed, 0, packed.length));
     }
 
     void deviceFoundCallback(byte[] address) {
         mRemoteDevices.deviceFoundCallback(address);
     }
 
+    /*
+     * Aggregated discovery results, one record per device of a little
+     * endian 16 bit length, the address and the packed properties.
+     */
+    private static final int DEVICE_RECORD_HEADER_BYTES = 2;
+    private static final int ADDRESS_BYTES = 6;
+
+    void devicesFoundCallback(byte[] records) {
+        int offset = 0;
+        while (offset + DEVICE_RECORD_HEADER_BYTES + ADDRESS_BYTES <= records.length) {
+            int end = offset + DEVICE_RECORD_HEADER_BYTES
+                    + PackedProperties.readShort(records, offset);
+            if (end > records.length) break;
+            offset += DEVICE_RECORD_HEADER_BYTES;
+            byte[] address = new byte[ADDRESS_BYTES];
+            System.arraycopy(records, offset, address, 0, ADDRESS_BYTES);
+            offset += ADDRESS_BYTES;
+
+            mRemoteDevices.devicePropertyChangedCallback(address,
+                    new PackedProperties(records, offset, end));
+            mRemoteDevices.deviceFoundCallback(address);
+            offset = end;
+        }
+    }
+
     void pinRequestCallback(byte[] address, byte[] name, int cod) {
         mRemoteDevices.pinRequestCallback(address, name, cod);
     }
@@ -77,8 +103,9 @@ final class JniCallbacks {
         mAdapterProperties.discoveryStateChangeCallback(state);
     }
 
-    void adapterPropertyChangedCallback(int[] types, byte[][] val) {
-        mAdapterProperties.adapterPropertyChangedCallback(types, val);
+    void adapterPropertyChangedCallback(byte[] packed) {
+        mAdapterProperties.adapterPropertyChangedCallback(
+                new PackedProperties(packed, 0, packed.length));
     }
 
 }
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2026 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package com.android.bluetooth.btservice;
+
+import android.os.ParcelUuid;
+
+import com.android.bluetooth.Utils;
+
+import java.util.Arrays;
+
+/**
+ * Cursor over the properties the native layer packs into one array, each a
+ * little endian 16 bit type and length followed by the value. Values are
+ * read where they are, next() moves on to the following property.
+ */
+public final class PackedProperties {
+    private static final int HEADER_BYTES = 4;
+
+    private final byte[] mData;
+    private final int mEnd;
+    private int mNext;
+    private int mType;
+    private int mOffset;
+    private int mLength;
+
+    public PackedProperties(byte[] data, int offset, int end) {
+        mData = data;
+        mNext = offset;
+        mEnd = end;
+    }
+
+    /**
+     * Moves to the next property, returns false if there is none or the
+     * rest of the array is truncated.
+     */
+    public boolean next() {
+        if (mNext + HEADER_BYTES > mEnd) return false;
+        int length = readShort(mData, mNext + 2);
+        if (mNext + HEADER_BYTES + length > mEnd) return false;
+        mType = readShort(mData, mNext);
+        mOffset = mNext + HEADER_BYTES;
+        mLength = length;
+        mNext = mOffset + length;
+        return true;
+    }
+
+    public int getType() {
+        return mType;
+    }
+
+    public int getLength() {
+        return mLength;
+    }
+
+    public byte getByte() {
+        return mData[mOffset];
+    }
+
+    public int getInt() {
+        return Utils.byteArrayToInt(mData, mOffset);
+    }
+
+    public String getString() {
+        return new String(mData, mOffset, mLength);
+    }
+
+    // Copies the value, for properties that are kept as they are
+    public byte[] getBytes() {
+        return Arrays.copyOfRange(mData, mOffset, mOffset + mLength);
+    }
+
+    public ParcelUuid[] getUuids() {
+        return Utils.byteArrayToUuid(mData, mOffset, mLength);
+    }
+
+    // Returns the little endian 16 bit value at offset
+    public static int readShort(byte[] data, int offset) {
+        return (data[offset] & 0xff) | ((data[offset + 1] & 0xff) << 8);
+    }
+}
@@ -231,9 +231,8 @@ final class RemoteDevices {
         mAdapterService.sendOrderedBroadcast(intent, mAdapterService.BLUETOOTH_ADMIN_PERM);
     }
 
-    void devicePropertyChangedCallback(byte[] address, int[] types, byte[][] values) {
+    void devicePropertyChangedCallback(byte[] address, PackedProperties props) {
         Intent intent;
-        byte[] val;
         int type;
         BluetoothDevice bdDevice = getDevice(address);
         DeviceProperties device;
@@ -244,16 +243,15 @@ final class RemoteDevices {
             device = getDeviceProperties(bdDevice);
         }
 
-        for (int j = 0; j < types.length; j++) {
-            type = types[j];
-            val = values[j];
-            if(val.length <= 0)
+        while (props.next()) {
+            type = props.getType();
+            if(props.getLength() <= 0)
                 errorLog("devicePropertyChangedCallback: bdDevice: " + bdDevice + ", value is empty for type: " + type);
             else {
                 synchronized(mObject) {
                     switch (type) {
                         case AbstractionLayer.BT_PROPERTY_BDNAME:
-                            device.mName = new String(val);
+                            device.mName = props.getString();
                             intent = new Intent(BluetoothDevice.ACTION_NAME_CHANGED);
                             intent.putExtra(BluetoothDevice.EXTRA_DEVICE, bdDevice);
                             intent.putExtra(BluetoothDevice.EXTRA_NAME, device.mName);
@@ -263,18 +261,20 @@ final class RemoteDevices {
                             break;
                         case AbstractionLayer.BT_PROPERTY_REMOTE_FRIENDLY_NAME:
                             if (device.mAlias != null) {
-                                System.arraycopy(val, 0, device.mAlias, 0, val.length);
+                                System.arraycopy(props.getBytes(), 0, device.mAlias, 0,
+                                                 props.getLength());
                             }
                             else {
-                                device.mAlias = new String(val);
+                                device.mAlias = props.getString();
                             }
                             break;
                         case AbstractionLayer.BT_PROPERTY_BDADDR:
-                            device.mAddress = val;
-                            debugLog("Remote Address is:" + Utils.getAddressStringFromByte(val));
+                            device.mAddress = props.getBytes();
+                            debugLog("Remote Address is:"
+                                    + Utils.getAddressStringFromByte(device.mAddress));
                             break;
                         case AbstractionLayer.BT_PROPERTY_CLASS_OF_DEVICE:
-                            device.mBluetoothClass =  Utils.byteArrayToInt(val);
+                            device.mBluetoothClass = props.getInt();
                             intent = new Intent(BluetoothDevice.ACTION_CLASS_CHANGED);
                             intent.putExtra(BluetoothDevice.EXTRA_DEVICE, bdDevice);
                             intent.putExtra(BluetoothDevice.EXTRA_CLASS,
@@ -284,18 +284,17 @@ final class RemoteDevices {
                             debugLog("Remote class is:" + device.mBluetoothClass);
                             break;
                         case AbstractionLayer.BT_PROPERTY_UUIDS:
-                            int numUuids = val.length/AbstractionLayer.BT_UUID_SIZE;
-                            device.mUuids = Utils.byteArrayToUuid(val);
+                            device.mUuids = props.getUuids();
                             sendUuidIntent(bdDevice);
                             break;
                         case AbstractionLayer.BT_PROPERTY_TYPE_OF_DEVICE:
                             // The device type from hal layer, defined in bluetooth.h,
                             // matches the type defined in BluetoothDevice.java
-                            device.mDeviceType = Utils.byteArrayToInt(val);
+                            device.mDeviceType = props.getInt();
                             break;
                         case AbstractionLayer.BT_PROPERTY_REMOTE_RSSI:
                             // RSSI from hal is in one byte
-                            device.mRssi = val[0];
+                            device.mRssi = props.getByte();
                             break;
                     }
                 }
@@ -30,11 +30,15 @@ import android.os.ParcelUuid;
 import android.os.RemoteException;
 import android.util.Log;
 
+import com.android.bluetooth.R;
+import com.android.bluetooth.Utils;
 import com.android.bluetooth.btservice.ProfileService;
 
+import java.io.File;
 import java.nio.ByteBuffer;
 import java.nio.ByteOrder;
 import java.util.ArrayList;
+import java.util.Arrays;
 import java.util.HashMap;
 import java.util.HashSet;
 import java.util.List;
@@ -52,6 +56,56 @@ public class GattService extends ProfileService {
     private static final String TAG = GattServiceConfig.TAG_PREFIX + "GattService";
     private static final int DEFAULT_SCAN_INTERVAL_MILLIS = 200;
 
+    /**
+     * Layout of one record in a batched scan result array, see
+     * scan_batch_record_t in com_android_bluetooth_gatt.cpp.
+     */
+    private static final int BATCH_SCAN_ADDR_BYTES = 6;
+    private static final int BATCH_SCAN_ADV_DATA_BYTES = 62;
+    private static final int BATCH_SCAN_RECORD_BYTES =
+            BATCH_SCAN_ADDR_BYTES + 1 + BATCH_SCAN_ADV_DATA_BYTES;
+
+    /**
+     * Address strings of recently batched scan results, direct mapped by
+     * address. Only used on the callback thread.
+     */
+    private static final int SCAN_ADDRESS_CACHE_SIZE = 64;
+    private final long[] mScanAddressKeys = new long[SCAN_ADDRESS_CACHE_SIZE];
+    private final String[] mScanAddresses = new String[SCAN_ADDRESS_CACHE_SIZE];
+
+    /**
+     * Advertising data of the batched result being delivered. Binder copies
+     * it into the transaction, so it is reused for every result.
+     */
+    private final byte[] mBatchScanAdvData = new byte[BATCH_SCAN_ADV_DATA_BYTES];
+
+    /**
+     * Header of one record in a notification buffer: little endian value
+     * length, notify flag and one reserved byte.
+     */
+    private static final int NOTIFY_RECORD_HEADER_BYTES = 4;
+
+    /**
+     * Attribute database records, see db_discovery_finish() in
+     * com_android_bluetooth_gatt.cpp. Services use the
+     * BluetoothGattService type constants.
+     */
+    private static final int DB_RECORD_WORDS = 3;
+    private static final int DB_ATTR_INCLUDED_SERVICE = 2;
+    private static final int DB_ATTR_CHARACTERISTIC = 3;
+    private static final int DB_ATTR_DESCRIPTOR = 4;
+
+    /**
+     * Ids of one entry in a write batch, see gattClientWriteBatchNative() in
+     * com_android_bluetooth_gatt.cpp.
+     */
+    private static final int WRITE_ENTRY_WORDS = 5;
+
+    /**
+     * Directory below getFilesDir() holding discovered attribute databases.
+     */
+    private static final String GATT_CACHE_DIR = "gatt_cache";
+
     /**
      * Max packet size for ble advertising, defined in Bluetooth Specification Version 4.0 [Vol 3].
      */
@@ -97,6 +151,45 @@ public class GattService extends ProfileService {
      * Server handle map.
      */
     HandleMap mHandleMap = new HandleMap();
+
+    /**
+     * A characteristic whose notifications are collected natively in a
+     * direct buffer, see onNotifyBatch().
+     */
+    class NotifyBuffer {
+        // Unregistered, kept until native code stops announcing batches in it
+        boolean closing;
+        int connId;
+        int srvcType;
+        int srvcInstId;
+        UUID srvcUuid;
+        int charInstId;
+        UUID charUuid;
+        ByteBuffer buffer;
+    }
+
+    /**
+     * One characteristic write of a batch, see writeCharacteristicBatch().
+     */
+    static class WriteEntry {
+        int srvcType;
+        int srvcInstId;
+        UUID srvcUuid;
+        int charInstId;
+        UUID charUuid;
+        int writeType;
+        byte[] value;
+    }
+
+    /**
+     * Registered notification buffers by native id.
+     */
+    private final Map<Integer, NotifyBuffer> mNotifyBuffers =
+            new HashMap<Integer, NotifyBuffer>();
+    private int mNotifyBatchSize = 0;
+    private int mNotifyBatchMaxDelay = 0;
+    private int mNotifyBufferSize = 0;
+    private boolean mNativeDiscovery = false;
     private List<UUID> mAdvertisingServiceUuids = new ArrayList<UUID>();
 
     private int mAdvertisingClientIf = 0;
@@ -185,6 +278,36 @@ public class GattService extends ProfileService {
     protected boolean start() {
         if (DBG) Log.d(TAG, "start()");
         initializeNative();
+
+        int batchSize = getResources().getInteger(R.integer.gatt_scan_batch_size);
+        if (batchSize > 1) {
+            int maxDelay = getResources().getInteger(R.integer.gatt_scan_batch_max_delay_ms);
+            if (DBG) Log.d(TAG, "start() - batching scan results, size=" + batchSize
+                        + ", maxDelay=" + maxDelay);
+            gattClientConfigureBatchScanNative(batchSize, maxDelay);
+        }
+
+        int dedupWindow = getResources().getInteger(R.integer.gatt_scan_dedup_window_ms);
+        if (dedupWindow > 0) {
+            int rssiThreshold = getResources().getInteger(
+                    R.integer.gatt_scan_dedup_rssi_threshold);
+            if (DBG) Log.d(TAG, "start() - filtering duplicate scan results, window="
+                        + dedupWindow + ", rssiThreshold=" + rssiThreshold);
+            gattClientConfigureScanFilterNative(dedupWindow, rssiThreshold);
+        }
+
+        mNotifyBatchSize = getResources().getInteger(R.integer.gatt_notify_batch_size);
+        mNotifyBatchMaxDelay = getResources().getInteger(R.integer.gatt_notify_batch_max_delay_ms);
+        mNotifyBufferSize = getResources().getInteger(R.integer.gatt_notify_buffer_size);
+        mNativeDiscovery = getResources().getBoolean(R.bool.gatt_native_discovery);
+        if (mNativeDiscovery && getResources().getBoolean(R.bool.gatt_db_cache)) {
+            File cacheDir = new File(getFilesDir(), GATT_CACHE_DIR);
+            if (cacheDir.isDirectory() || cacheDir.mkdirs()) {
+                gattClientConfigureDbCacheNative(cacheDir.getPath());
+            } else {
+                Log.w(TAG, "start() - cannot create " + cacheDir);
+            }
+        }
         return true;
     }
 
@@ -197,6 +320,14 @@ public class GattService extends ProfileService {
         mHandleMap.clear();
         mServiceDeclarations.clear();
         mReliableQueue.clear();
+        List<Integer> notifyIds;
+        synchronized (mNotifyBuffers) {
+            notifyIds = new ArrayList<Integer>(mNotifyBuffers.keySet());
+            mNotifyBuffers.clear();
+        }
+        for (Integer id : notifyIds) {
+            gattClientUnregisterNotifyBufferNative(id);
+        }
         return true;
     }
 
@@ -623,6 +754,44 @@ public class GattService extends ProfileService {
         }
     }
 
+    void onBatchScanResults(int numResults, byte[] records) {
+        if (DBG) Log.d(TAG, "onBatchScanResults() - numResults=" + numResults);
+
+        for (int i = 0; i < numResults; ++i) {
+            int offset = i * BATCH_SCAN_RECORD_BYTES;
+            if (offset + BATCH_SCAN_RECORD_BYTES > records.length) break;
+            int rssi = records[offset + BATCH_SCAN_ADDR_BYTES];
+            System.arraycopy(records, offset + BATCH_SCAN_ADDR_BYTES + 1, mBatchScanAdvData, 0,
+                             BATCH_SCAN_ADV_DATA_BYTES);
+            onScanResult(getScanAddress(records, offset), rssi, mBatchScanAdvData);
+        }
+    }
+
+    private String getScanAddress(byte[] records, int offset) {
+        long key = batchScanAddressKey(records, offset);
+        int slot = (int) (key ^ (key >>> 24)) & (SCAN_ADDRESS_CACHE_SIZE - 1);
+        String address = mScanAddresses[slot];
+        if (address == null || mScanAddressKeys[slot] != key) {
+            address = Utils.getAddressStringFromByte(Arrays.copyOfRange(records, offset,
+                    offset + BATCH_SCAN_ADDR_BYTES));
+            mScanAddressKeys[slot] = key;
+            mScanAddresses[slot] = address;
+        }
+        return address;
+    }
+
+    /**
+     * Returns the address of the batched scan result at offset as a 48 bit
+     * number, most significant byte first as in the address string.
+     */
+    public static long batchScanAddressKey(byte[] records, int offset) {
+        long key = 0;
+        for (int i = 0; i < BATCH_SCAN_ADDR_BYTES; ++i) {
+            key = (key << 8) | (records[offset + i] & 0xff);
+        }
+        return key;
+    }
+
     void onClientRegistered(int status, int clientIf, long uuidLsb, long uuidMsb)
             throws RemoteException {
         UUID uuid = new UUID(uuidMsb, uuidLsb);
@@ -654,6 +823,7 @@ public class GattService extends ProfileService {
 
         mClientMap.removeConnection(clientIf, connId);
         mSearchQueue.removeConnId(connId);
+        removeNotifyBuffers(connId);
         ClientMap.App app = mClientMap.getById(clientIf);
         if (app != null) {
             app.callback.onClientConnectionState(status, clientIf, false, address);
@@ -782,6 +952,53 @@ public class GattService extends ProfileService {
         }
     }
 
+    void onDatabaseDiscovered(int connId, int status, long[] records)
+            throws RemoteException {
+        String address = mClientMap.addressByConnId(connId);
+
+        if (DBG) Log.d(TAG, "onDatabaseDiscovered() - address=" + address
+            + ", status=" + status + ", attributes=" + records.length / DB_RECORD_WORDS);
+
+        ClientMap.App app = mClientMap.getByConnId(connId);
+        if (app == null) return;
+
+        int srvcType = 0;
+        int srvcInstId = 0;
+        ParcelUuid srvcUuid = null;
+        int charInstId = 0;
+        ParcelUuid charUuid = null;
+        for (int i = 0; i + DB_RECORD_WORDS <= records.length; i += DB_RECORD_WORDS) {
+            int type = (int) (records[i] & 0xFF);
+            int instId = (int) ((records[i] >> 8) & 0xFF);
+            int properties = (int) ((records[i] >> 16) & 0xFFFF);
+            ParcelUuid uuid = new ParcelUuid(new UUID(records[i + 2], records[i + 1]));
+
+            switch (type) {
+                case DB_ATTR_INCLUDED_SERVICE:
+                    app.callback.onGetIncludedService(address, srvcType, srvcInstId,
+                        srvcUuid, properties, instId, uuid);
+                    break;
+                case DB_ATTR_CHARACTERISTIC:
+                    charInstId = instId;
+                    charUuid = uuid;
+                    app.callback.onGetCharacteristic(address, srvcType, srvcInstId,
+                        srvcUuid, charInstId, charUuid, properties);
+                    break;
+                case DB_ATTR_DESCRIPTOR:
+                    app.callback.onGetDescriptor(address, srvcType, srvcInstId,
+                        srvcUuid, charInstId, charUuid, instId, uuid);
+                    break;
+                default:
+                    srvcType = type;
+                    srvcInstId = instId;
+                    srvcUuid = uuid;
+                    app.callback.onGetService(address, srvcType, srvcInstId, srvcUuid);
+                    break;
+            }
+        }
+        app.callback.onSearchComplete(address, status);
+    }
+
     void onRegisterForNotifications(int connId, int status, int registered, int srvcType,
             int srvcInstId, long srvcUuidLsb, long srvcUuidMsb,
             int charInstId, long charUuidLsb, long charUuidMsb) {
@@ -813,6 +1030,50 @@ public class GattService extends ProfileService {
         }
     }
 
+    /**
+     * Delivers count records of the buffer, starting at offset. The batch
+     * saves the JNI crossing and the address and UUID objects of each
+     * record; the client callback still takes every value as a byte[] of
+     * its own, as it is copied across binder anyway.
+     */
+    void onNotifyBatch(int id, int offset, int count, int length) throws RemoteException {
+        if (DBG) Log.d(TAG, "onNotifyBatch() - id=" + id + ", count=" + count);
+
+        NotifyBuffer nb;
+        synchronized (mNotifyBuffers) {
+            nb = mNotifyBuffers.get(id);
+        }
+
+        try {
+            ClientMap.App app = nb != null ? mClientMap.getByConnId(nb.connId) : null;
+            if (app == null) return;
+            String address = mClientMap.addressByConnId(nb.connId);
+            ParcelUuid srvcUuid = new ParcelUuid(nb.srvcUuid);
+            ParcelUuid charUuid = new ParcelUuid(nb.charUuid);
+            ByteBuffer records = nb.buffer.duplicate();
+            records.position(offset);
+            for (int i = 0; i < count; ++i) {
+                app.callback.onNotify(address, nb.srvcType, nb.srvcInstId, srvcUuid,
+                                      nb.charInstId, charUuid, readNotifyRecord(records));
+            }
+        } finally {
+            if (gattClientReleaseNotifyBufferNative(id)) forgetNotifyBuffer(id);
+        }
+    }
+
+    /**
+     * Reads the notification record at the position of records and returns
+     * its value: a little endian length, an is_notify byte, a reserved byte
+     * and the value itself.
+     */
+    public static byte[] readNotifyRecord(ByteBuffer records) {
+        int len = (records.get() & 0xFF) | ((records.get() & 0xFF) << 8);
+        records.position(records.position() + 2);
+        byte[] data = new byte[len];
+        records.get(data);
+        return data;
+    }
+
     void onReadCharacteristic(int connId, int status, int srvcType,
             int srvcInstId, long srvcUuidLsb, long srvcUuidMsb,
             int charInstId, long charUuidLsb, long charUuidMsb,
@@ -853,6 +1114,17 @@ public class GattService extends ProfileService {
         }
     }
 
+    void onWriteBatchCompleted(int connId, int status, int written) throws RemoteException {
+        String address = mClientMap.addressByConnId(connId);
+        if (DBG) Log.d(TAG, "onWriteBatchCompleted() - address=" + address
+            + ", status=" + status + ", written=" + written);
+
+        ClientMap.App app = mClientMap.getByConnId(connId);
+        if (app != null) {
+            app.callback.onExecuteWrite(address, status);
+        }
+    }
+
     void onExecuteCompleted(int connId, int status) throws RemoteException {
         String address = mClientMap.addressByConnId(connId);
         if (DBG) Log.d(TAG, "onExecuteCompleted() - address=" + address
@@ -1248,12 +1520,24 @@ public class GattService extends ProfileService {
         Integer connId = mClientMap.connIdByAddress(clientIf, address);
         if (DBG) Log.d(TAG, "discoverServices() - address=" + address + ", connId=" + connId);
 
-        if (connId != null)
-            gattClientSearchServiceNative(connId, true, 0, 0);
-        else
+        if (connId != null) {
+            if (!mNativeDiscovery
+                    || !gattClientDiscoverDatabaseNative(connId, isBonded(address)))
+                gattClientSearchServiceNative(connId, true, 0, 0);
+        } else
             Log.e(TAG, "discoverServices() - No connection for " + address + "...");
     }
 
+    /**
+     * Only the databases of bonded peers are cached natively, others do not
+     * get told when their database changes.
+     */
+    private static boolean isBonded(String address) {
+        BluetoothAdapter adapter = BluetoothAdapter.getDefaultAdapter();
+        return adapter != null && adapter.getRemoteDevice(address).getBondState()
+                == BluetoothDevice.BOND_BONDED;
+    }
+
     void readCharacteristic(int clientIf, String address, int srvcType,
                             int srvcInstanceId, UUID srvcUuid,
                             int charInstanceId, UUID charUuid, int authReq) {
@@ -1293,6 +1577,50 @@ public class GattService extends ProfileService {
             Log.e(TAG, "writeCharacteristic() - No connection for " + address + "...");
     }
 
+    /**
+     * Writes all entries back to back, natively, and reports the outcome of
+     * the whole batch through onExecuteWrite(). A reliable batch is only
+     * committed if every entry was accepted.
+     */
+    boolean writeCharacteristicBatch(int clientIf, String address, List<WriteEntry> entries,
+                                     int authReq, boolean reliable) {
+        enforceCallingOrSelfPermission(BLUETOOTH_PERM, "Need BLUETOOTH permission");
+
+        if (DBG) Log.d(TAG, "writeCharacteristicBatch() - address=" + address
+            + ", entries=" + entries.size() + ", reliable=" + reliable);
+
+        Integer connId = mClientMap.connIdByAddress(clientIf, address);
+        if (connId == null) {
+            Log.e(TAG, "writeCharacteristicBatch() - No connection for " + address + "...");
+            return false;
+        }
+
+        long[] ids = new long[entries.size() * WRITE_ENTRY_WORDS];
+        int[] lengths = new int[entries.size()];
+        int total = 0;
+        for (int i = 0; i < entries.size(); ++i) {
+            WriteEntry entry = entries.get(i);
+            int offset = i * WRITE_ENTRY_WORDS;
+            ids[offset] = (entry.srvcType & 0xFF) | ((entry.srvcInstId & 0xFF) << 8)
+                    | ((entry.charInstId & 0xFF) << 16) | ((long) (entry.writeType & 0xFF) << 24);
+            ids[offset + 1] = entry.srvcUuid.getLeastSignificantBits();
+            ids[offset + 2] = entry.srvcUuid.getMostSignificantBits();
+            ids[offset + 3] = entry.charUuid.getLeastSignificantBits();
+            ids[offset + 4] = entry.charUuid.getMostSignificantBits();
+            lengths[i] = entry.value.length;
+            total += entry.value.length;
+        }
+
+        byte[] values = new byte[total];
+        int pos = 0;
+        for (WriteEntry entry : entries) {
+            System.arraycopy(entry.value, 0, values, pos, entry.value.length);
+            pos += entry.value.length;
+        }
+
+        return gattClientWriteBatchNative(connId, ids, lengths, values, authReq, reliable);
+    }
+
     void readDescriptor(int clientIf, String address, int srvcType,
                             int srvcInstanceId, UUID srvcUuid,
                             int charInstanceId, UUID charUuid,
@@ -1367,6 +1695,10 @@ public class GattService extends ProfileService {
 
         Integer connId = mClientMap.connIdByAddress(clientIf, address);
         if (connId != null) {
+            if (mNotifyBatchSize > 0) {
+                updateNotifyBuffer(connId, srvcType, srvcInstanceId, srvcUuid,
+                                   charInstanceId, charUuid, enable);
+            }
             gattClientRegisterForNotificationsNative(clientIf, address,
                 srvcType, srvcInstanceId, srvcUuid.getLeastSignificantBits(),
                 srvcUuid.getMostSignificantBits(), charInstanceId,
@@ -1377,6 +1709,81 @@ public class GattService extends ProfileService {
         }
     }
 
+    private void updateNotifyBuffer(int connId, int srvcType, int srvcInstanceId,
+                UUID srvcUuid, int charInstanceId, UUID charUuid, boolean enable) {
+        Integer unregisterId = null;
+        synchronized (mNotifyBuffers) {
+            for (Map.Entry<Integer, NotifyBuffer> entry : mNotifyBuffers.entrySet()) {
+                NotifyBuffer nb = entry.getValue();
+                if (!nb.closing && nb.connId == connId && nb.srvcType == srvcType
+                        && nb.srvcInstId == srvcInstanceId && nb.srvcUuid.equals(srvcUuid)
+                        && nb.charInstId == charInstanceId && nb.charUuid.equals(charUuid)) {
+                    if (enable) return;
+                    unregisterId = entry.getKey();
+                    break;
+                }
+            }
+        }
+        if (unregisterId != null) {
+            unregisterNotifyBuffer(unregisterId);
+            return;
+        }
+        if (!enable) return;
+
+        synchronized (mNotifyBuffers) {
+            NotifyBuffer nb = new NotifyBuffer();
+            nb.connId = connId;
+            nb.srvcType = srvcType;
+            nb.srvcInstId = srvcInstanceId;
+            nb.srvcUuid = srvcUuid;
+            nb.charInstId = charInstanceId;
+            nb.charUuid = charUuid;
+            nb.buffer = ByteBuffer.allocateDirect(mNotifyBufferSize);
+            int id = gattClientRegisterNotifyBufferNative(connId, srvcType, srvcInstanceId,
+                    srvcUuid.getLeastSignificantBits(), srvcUuid.getMostSignificantBits(),
+                    charInstanceId, charUuid.getLeastSignificantBits(),
+                    charUuid.getMostSignificantBits(), nb.buffer, mNotifyBatchSize,
+                    mNotifyBatchMaxDelay);
+            if (id < 0) {
+                Log.w(TAG, "updateNotifyBuffer() - falling back to onNotify for " + charUuid);
+                return;
+            }
+            mNotifyBuffers.put(id, nb);
+        }
+    }
+
+    private void removeNotifyBuffers(int connId) {
+        List<Integer> ids = new ArrayList<Integer>();
+        synchronized (mNotifyBuffers) {
+            for (Map.Entry<Integer, NotifyBuffer> entry : mNotifyBuffers.entrySet()) {
+                NotifyBuffer nb = entry.getValue();
+                if (!nb.closing && nb.connId == connId) ids.add(entry.getKey());
+            }
+        }
+        for (Integer id : ids) {
+            unregisterNotifyBuffer(id);
+        }
+    }
+
+    /**
+     * Native code still announces the records pending in the buffer through
+     * onNotifyBatch(), so the buffer stays in the map until native code says
+     * it is no longer used, here or on releasing its last batch.
+     */
+    private void unregisterNotifyBuffer(int id) {
+        synchronized (mNotifyBuffers) {
+            NotifyBuffer nb = mNotifyBuffers.get(id);
+            if (nb != null) nb.closing = true;
+        }
+        if (gattClientUnregisterNotifyBufferNative(id)) forgetNotifyBuffer(id);
+    }
+
+    private void forgetNotifyBuffer(int id) {
+        synchronized (mNotifyBuffers) {
+            mNotifyBuffers.remove(id);
+        }
+    }
+
     void readRemoteRssi(int clientIf, String address) {
         enforceCallingOrSelfPermission(BLUETOOTH_PERM, "Need BLUETOOTH permission");
 
@@ -1466,6 +1873,7 @@ public class GattService extends ProfileService {
     void onServiceDeleted(int status, int serverIf, int srvcHandle) {
         if (DBG) Log.d(TAG, "onServiceDeleted() srvcHandle=" + srvcHandle
             + ", status=" + status);
+        gattServerClearCachedValuesNative(serverIf, srvcHandle);
         mHandleMap.deleteService(serverIf, srvcHandle);
     }
 
@@ -1620,6 +2028,7 @@ public class GattService extends ProfileService {
         if (DBG) Log.d(TAG, "unregisterServer() - serverIf=" + serverIf);
 
         deleteServices(serverIf);
+        gattServerClearCachedValuesNative(serverIf, 0);
 
         mServerMap.remove(serverIf);
         gattServerUnregisterAppNative(serverIf);
@@ -1746,6 +2155,66 @@ public class GattService extends ProfileService {
         }
     }
 
+    /**
+     * Sends one value to many clients with a single native call. With a
+     * null address list it goes to every client that enabled notifications,
+     * or indications if confirm is set, for the characteristic. Returns the
+     * number of clients it was sent to.
+     */
+    int sendNotificationFanOut(int serverIf, List<String> addresses, int srvcType,
+                               int srvcInstanceId, UUID srvcUuid,
+                               int charInstanceId, UUID charUuid,
+                               boolean confirm, byte[] value) {
+        enforceCallingOrSelfPermission(BLUETOOTH_PERM, "Need BLUETOOTH permission");
+
+        if (DBG) Log.d(TAG, "sendNotificationFanOut() - uuid=" + charUuid);
+
+        int srvcHandle = mHandleMap.getServiceHandle(srvcUuid, srvcType, srvcInstanceId);
+        if (srvcHandle == 0) return 0;
+
+        int charHandle = mHandleMap.getCharacteristicHandle(srvcHandle, charUuid, charInstanceId);
+        if (charHandle == 0) return 0;
+
+        int[] connIds = null;
+        if (addresses != null) {
+            connIds = new int[addresses.size()];
+            int count = 0;
+            for (String address : addresses) {
+                Integer connId = mServerMap.connIdByAddress(serverIf, address);
+                if (connId != null && connId != 0) connIds[count++] = connId;
+            }
+            if (count == 0) return 0;
+            if (count < connIds.length) connIds = Arrays.copyOf(connIds, count);
+        }
+
+        return gattServerSendFanOutNative(serverIf, charHandle, connIds, confirm, value);
+    }
+
+    /**
+     * Hands the value of a characteristic down so that read requests for it
+     * are answered natively without calling back into the app. A static
+     * value is kept until replaced, any other is refreshed by notifications
+     * and dropped when a remote device writes the characteristic. A null
+     * value stops caching.
+     */
+    boolean setCachedCharacteristicValue(int serverIf, int srvcType, int srvcInstanceId,
+                                         UUID srvcUuid, int charInstanceId, UUID charUuid,
+                                         boolean isStatic, byte[] value) {
+        enforceCallingOrSelfPermission(BLUETOOTH_PERM, "Need BLUETOOTH permission");
+
+        if (DBG) Log.d(TAG, "setCachedCharacteristicValue() - uuid=" + charUuid
+            + ", static=" + isStatic);
+
+        int srvcHandle = mHandleMap.getServiceHandle(srvcUuid, srvcType, srvcInstanceId);
+        if (srvcHandle == 0) return false;
+
+        int charHandle = mHandleMap.getCharacteristicHandle(srvcHandle, charUuid, charInstanceId);
+        if (charHandle == 0) return false;
+
+        return gattServerSetCachedValueNative(serverIf, srvcHandle, charHandle,
+                                              isStatic, value);
+    }
+
     /**************************************************************************
      * Private functions
      *************************************************************************/
@@ -1989,6 +2458,12 @@ public class GattService extends ProfileService {
 
     private native void gattClientScanNative(int clientIf, boolean start);
 
+    private native void gattClientConfigureBatchScanNative(int batchSize,
+            int maxDelayMillis);
+
+    private native void gattClientConfigureScanFilterNative(int windowMillis,
+            int rssiThreshold);
+
     private native void gattClientConnectNative(int clientIf, String address,
             boolean isDirect);
 
@@ -2000,6 +2475,10 @@ public class GattService extends ProfileService {
     private native void gattClientSearchServiceNative(int conn_id,
             boolean search_all, long service_uuid_lsb, long service_uuid_msb);
 
+    private native boolean gattClientDiscoverDatabaseNative(int conn_id, boolean bonded);
+
+    private native void gattClientConfigureDbCacheNative(String dir);
+
     private native void gattClientGetCharacteristicNative(int conn_id,
             int service_type, int service_id_inst_id, long service_id_uuid_lsb,
             long service_id_uuid_msb, int char_id_inst_id, long char_id_uuid_lsb,
@@ -2040,12 +2519,25 @@ public class GattService extends ProfileService {
 
     private native void gattClientExecuteWriteNative(int conn_id, boolean execute);
 
+    private native boolean gattClientWriteBatchNative(int conn_id, long[] ids, int[] lengths,
+            byte[] values, int auth_req, boolean reliable);
+
     private native void gattClientRegisterForNotificationsNative(int clientIf,
             String address, int service_type, int service_id_inst_id,
             long service_id_uuid_lsb, long service_id_uuid_msb,
             int char_id_inst_id, long char_id_uuid_lsb, long char_id_uuid_msb,
             boolean enable);
 
+    private native int gattClientRegisterNotifyBufferNative(int conn_id,
+            int service_type, int service_id_inst_id,
+            long service_id_uuid_lsb, long service_id_uuid_msb,
+            int char_id_inst_id, long char_id_uuid_lsb, long char_id_uuid_msb,
+            ByteBuffer buffer, int batchSize, int maxDelayMillis);
+
+    private native boolean gattClientUnregisterNotifyBufferNative(int id);
+
+    private native boolean gattClientReleaseNotifyBufferNative(int id);
+
     private native void gattClientReadRemoteRssiNative(int clientIf,
             String address);
 
@@ -2097,7 +2589,16 @@ public class GattService extends ProfileService {
     private native void gattServerSendNotificationNative (int server_if,
             int attr_handle, int conn_id, byte[] val);
 
+    private native int gattServerSendFanOutNative(int server_if,
+            int attr_handle, int[] conn_ids, boolean confirm, byte[] val);
+
     private native void gattServerSendResponseNative (int server_if,
             int conn_id, int trans_id, int status, int handle, int offset,
             byte[] val, int auth_req);
+
+    private native boolean gattServerSetCachedValueNative(int server_if,
+            int srvc_handle, int attr_handle, boolean is_static, byte[] val);
+
+    private native void gattServerClearCachedValuesNative(int server_if,
+            int srvc_handle);
 }
@@ -40,6 +40,8 @@ import com.android.bluetooth.btservice.ProfileService.IProfileServiceBinder;
 import com.android.bluetooth.Utils;
 import java.io.FileDescriptor;
 import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
 import java.util.ArrayList;
 import java.util.Collections;
 import java.util.HashMap;
@@ -69,9 +71,25 @@ public class HealthService extends ProfileService {
     private static final int MESSAGE_UNREGISTER_APPLICATION = 2;
     private static final int MESSAGE_CONNECT_CHANNEL = 3;
     private static final int MESSAGE_DISCONNECT_CHANNEL = 4;
+    private static final int MESSAGE_REGISTER_APPLICATIONS = 5;
     private static final int MESSAGE_APP_REGISTRATION_CALLBACK = 11;
     private static final int MESSAGE_CHANNEL_STATE_CALLBACK = 12;
 
+    private static final int STREAM_BUFFER_SIZE = 64 * 1024;
+
+    /**
+     * Receives the data of streamed channels, on the native reader thread.
+     * The batch holds records of a 4 byte channel id and a 4 byte length
+     * followed by that many bytes of data, and is only valid until the
+     * callback returns. A record of length 0 means the channel ended.
+     */
+    interface ChannelDataCallback {
+        void onChannelData(ByteBuffer batch);
+    }
+
+    private ByteBuffer mStreamBuffer;
+    private volatile ChannelDataCallback mChannelDataCallback;
+
     static {
         classInitNative();
     }
@@ -95,6 +113,10 @@ public class HealthService extends ProfileService {
         Looper looper = thread.getLooper();
         mHandler = new HealthServiceMessageHandler(looper);
         initializeNative();
+        mStreamBuffer = ByteBuffer.allocateDirect(STREAM_BUFFER_SIZE);
+        if (!registerStreamBufferNative(mStreamBuffer)) {
+            Log.e(TAG, "Failed to register the channel stream buffer");
+        }
         mNativeAvailable=true;
         return true;
     }
@@ -182,6 +204,46 @@ public class HealthService extends ProfileService {
                     }
                 }
                     break;
+                case MESSAGE_REGISTER_APPLICATIONS:
+                {
+                    BluetoothHealthAppConfiguration[] configs =
+                        (BluetoothHealthAppConfiguration[]) msg.obj;
+                    int[] dataTypes = new int[configs.length];
+                    int[] halRoles = new int[configs.length];
+                    int[] halChannelTypes = new int[configs.length];
+                    for (int i = 0; i < configs.length; i++) {
+                        dataTypes[i] = configs[i].getDataType();
+                        halRoles[i] = convertRoleToHal(configs[i].getRole());
+                        halChannelTypes[i] = convertChannelTypeToHal(configs[i].getChannelType());
+                    }
+                    int appId = registerHealthAppMdepsNative(configs[0].getName(), dataTypes,
+                                                             halRoles, halChannelTypes);
+                    for (int i = 0; i < configs.length; i++) {
+                        AppInfo appInfo = mApps.get(configs[i]);
+                        if (appInfo == null) continue;
+                        if (appId == -1) {
+                            callStatusCallback(configs[i],
+                                               BluetoothHealth.APP_CONFIG_REGISTRATION_FAILURE);
+                            appInfo.cleanup();
+                            mApps.remove(configs[i]);
+                            continue;
+                        }
+                        // the callback is shared, one death unregisters the whole application
+                        if (i == 0) {
+                            appInfo.mRcpObj =
+                                new BluetoothHealthDeathRecipient(HealthService.this, configs[0]);
+                            try {
+                                appInfo.mCallback.asBinder().linkToDeath(appInfo.mRcpObj, 0);
+                            } catch (RemoteException e) {
+                                Log.e(TAG,"LinktoDeath Exception:"+e);
+                            }
+                        }
+                        appInfo.mAppId = appId;
+                        callStatusCallback(configs[i],
+                                           BluetoothHealth.APP_CONFIG_REGISTRATION_SUCCESS);
+                    }
+                }
+                    break;
                 case MESSAGE_UNREGISTER_APPLICATION:
                 {
                     BluetoothHealthAppConfiguration appConfig =
@@ -198,8 +260,9 @@ public class HealthService extends ProfileService {
                 {
                     HealthChannel chan = (HealthChannel) msg.obj;
                     byte[] devAddr = Utils.getByteAddress(chan.mDevice);
-                    int appId = (mApps.get(chan.mConfig)).mAppId;
-                    chan.mChannelId = connectChannelNative(devAddr, appId);
+                    AppInfo appInfo = mApps.get(chan.mConfig);
+                    chan.mChannelId = connectChannelNative(devAddr, appInfo.mAppId,
+                                                           appInfo.mCfgIndex);
                     if (chan.mChannelId == -1) {
                         callHealthChannelCallback(chan.mConfig, chan.mDevice,
                                                   BluetoothHealth.STATE_CHANNEL_DISCONNECTING,
@@ -229,17 +292,20 @@ public class HealthService extends ProfileService {
                     break;
                 case MESSAGE_APP_REGISTRATION_CALLBACK:
                 {
-                    BluetoothHealthAppConfiguration appConfig = findAppConfigByAppId(msg.arg1);
-                    if (appConfig == null) break;
+                    List<BluetoothHealthAppConfiguration> appConfigs =
+                            findAppConfigsByAppId(msg.arg1);
+                    if (appConfigs.isEmpty()) break;
 
                     int regStatus = convertHalRegStatus(msg.arg2);
-                    callStatusCallback(appConfig, regStatus);
-                    if (regStatus == BluetoothHealth.APP_CONFIG_REGISTRATION_FAILURE ||
-                        regStatus == BluetoothHealth.APP_CONFIG_UNREGISTRATION_SUCCESS) {
-                        //unlink to death once app is unregistered
-                        AppInfo appInfo = mApps.get(appConfig);
-                        appInfo.cleanup();
-                        mApps.remove(appConfig);
+                    for (BluetoothHealthAppConfiguration appConfig : appConfigs) {
+                        callStatusCallback(appConfig, regStatus);
+                        if (regStatus == BluetoothHealth.APP_CONFIG_REGISTRATION_FAILURE ||
+                            regStatus == BluetoothHealth.APP_CONFIG_UNREGISTRATION_SUCCESS) {
+                            //unlink to death once app is unregistered
+                            AppInfo appInfo = mApps.get(appConfig);
+                            appInfo.cleanup();
+                            mApps.remove(appConfig);
+                        }
                     }
                 }
                     break;
@@ -248,7 +314,8 @@ public class HealthService extends ProfileService {
                     ChannelStateEvent channelStateEvent = (ChannelStateEvent) msg.obj;
                     HealthChannel chan = findChannelById(channelStateEvent.mChannelId);
                     BluetoothHealthAppConfiguration appConfig =
-                            findAppConfigByAppId(channelStateEvent.mAppId);
+                            findAppConfigByMdep(channelStateEvent.mAppId,
+                                                channelStateEvent.mCfgIndex);
                     int newState;
                     newState = convertHalChannelState(channelStateEvent.mState);
                     if (newState  ==  BluetoothHealth.STATE_CHANNEL_DISCONNECTED &&
@@ -256,6 +323,10 @@ public class HealthService extends ProfileService {
                         Log.e(TAG,"Disconnected for non existing app");
                         break;
                     }
+                    if (chan == null && appConfig == null) {
+                        Log.e(TAG,"Incoming channel for non existing app");
+                        break;
+                    }
                     if (chan == null) {
                         // incoming connection
 
@@ -275,6 +346,7 @@ public class HealthService extends ProfileService {
                     }
                     /*set the channel fd to null if channel state isnot equal to connected*/
                     else{
+                        stopChannelStreamNative(chan.mChannelId);
                         chan.mChannelFd = null;
                     }
                     callHealthChannelCallback(chan.mConfig, chan.mDevice, newState,
@@ -463,6 +535,57 @@ public class HealthService extends ProfileService {
         return healthChan.mChannelFd;
     }
 
+    /**
+     * Registers the configurations as one application, named after the first
+     * one, with an MDEP for each, in a single native call. Each configuration
+     * gets its own status and channel callbacks and can be connected like one
+     * registered through registerAppConfiguration(). They share one app id,
+     * so unregistering any of them unregisters them all.
+     */
+    boolean registerAppConfigurations(BluetoothHealthAppConfiguration[] configs,
+            IBluetoothHealthCallback callback) {
+        enforceCallingOrSelfPermission(BLUETOOTH_PERM, "Need BLUETOOTH permission");
+        if (configs.length == 0) return false;
+        for (BluetoothHealthAppConfiguration config : configs) {
+            if (mApps.get(config) != null) {
+                if (DBG) Log.d(TAG, "Config has already been registered");
+                return false;
+            }
+        }
+        for (int i = 0; i < configs.length; i++) {
+            AppInfo appInfo = new AppInfo(callback);
+            appInfo.mCfgIndex = i;
+            mApps.put(configs[i], appInfo);
+        }
+        Message msg = mHandler.obtainMessage(MESSAGE_REGISTER_APPLICATIONS, configs);
+        mHandler.sendMessage(msg);
+        return true;
+    }
+
+    void setChannelDataCallback(ChannelDataCallback callback) {
+        mChannelDataCallback = callback;
+    }
+
+    /**
+     * Has the native reader thread read the channel and pass its data to the
+     * ChannelDataCallback. Whoever holds the channel fd must not read it
+     * while it is streamed.
+     */
+    boolean startChannelStream(int channelId) {
+        enforceCallingOrSelfPermission(BLUETOOTH_PERM, "Need BLUETOOTH permission");
+        HealthChannel chan = findChannelById(channelId);
+        if (chan == null || chan.mChannelFd == null) {
+            Log.e(TAG, "No connected channel found for id: " + channelId);
+            return false;
+        }
+        return startChannelStreamNative(channelId, chan.mChannelFd.getFileDescriptor());
+    }
+
+    void stopChannelStream(int channelId) {
+        enforceCallingOrSelfPermission(BLUETOOTH_PERM, "Need BLUETOOTH permission");
+        stopChannelStreamNative(channelId);
+    }
+
     int getHealthDeviceConnectionState(BluetoothDevice device) {
         enforceCallingOrSelfPermission(BLUETOOTH_PERM, "Need BLUETOOTH permission");
         return getConnectionState(device);
@@ -497,6 +620,26 @@ public class HealthService extends ProfileService {
         mHandler.sendMessage(msg);
     }
 
+    private void onChannelData(int length) {
+        ChannelDataCallback callback = mChannelDataCallback;
+        if (callback == null) return;
+
+        callback.onChannelData(channelDataBatch(mStreamBuffer, length));
+    }
+
+    /**
+     * Returns a read only, native order view of the first length bytes of
+     * the stream buffer, where the reader thread put the latest batch.
+     */
+    public static ByteBuffer channelDataBatch(ByteBuffer buffer, int length) {
+        ByteBuffer batch = buffer.duplicate();
+        batch.limit(length);
+        batch.position(0);
+        batch = batch.slice().asReadOnlyBuffer();
+        batch.order(ByteOrder.nativeOrder());
+        return batch;
+    }
+
     private String getStringChannelType(int type) {
         if (type == BluetoothHealth.CHANNEL_TYPE_RELIABLE) {
             return "Reliable";
@@ -521,16 +664,33 @@ public class HealthService extends ProfileService {
         }
     }
 
-    private BluetoothHealthAppConfiguration findAppConfigByAppId(int appId) {
+    private List<BluetoothHealthAppConfiguration> findAppConfigsByAppId(int appId) {
+        List<BluetoothHealthAppConfiguration> appConfigs =
+                new ArrayList<BluetoothHealthAppConfiguration>();
+        synchronized (mApps) {
+            for (Entry<BluetoothHealthAppConfiguration, AppInfo> e : mApps.entrySet()) {
+                if (appId == (e.getValue()).mAppId) appConfigs.add(e.getKey());
+            }
+        }
+        if (appConfigs.isEmpty()) {
+            Log.e(TAG, "No appConfig found for " + appId);
+        }
+        return appConfigs;
+    }
+
+    private BluetoothHealthAppConfiguration findAppConfigByMdep(int appId, int cfgIndex) {
         BluetoothHealthAppConfiguration appConfig = null;
-        for (Entry<BluetoothHealthAppConfiguration, AppInfo> e : mApps.entrySet()) {
-            if (appId == (e.getValue()).mAppId) {
-                appConfig = e.getKey();
-                break;
+        synchronized (mApps) {
+            for (Entry<BluetoothHealthAppConfiguration, AppInfo> e : mApps.entrySet()) {
+                AppInfo appInfo = e.getValue();
+                if (appId == appInfo.mAppId && cfgIndex == appInfo.mCfgIndex) {
+                    appConfig = e.getKey();
+                    break;
+                }
             }
         }
         if (appConfig == null) {
-            Log.e(TAG, "No appConfig found for " + appId);
+            Log.e(TAG, "No appConfig found for " + appId + " mdep " + cfgIndex);
         }
         return appConfig;
     }
@@ -789,11 +949,14 @@ public class HealthService extends ProfileService {
         private IBluetoothHealthCallback mCallback;
         private BluetoothHealthDeathRecipient mRcpObj;
         private int mAppId;
+        // MDEP of the application, see registerAppConfigurations()
+        private int mCfgIndex;
 
         private AppInfo(IBluetoothHealthCallback callback) {
             mCallback = callback;
             mRcpObj = null;
             mAppId = -1;
+            mCfgIndex = 0;
         }
 
         private void cleanup(){
@@ -884,8 +1047,13 @@ public class HealthService extends ProfileService {
     private native void initializeNative();
     private native void cleanupNative();
     private native int registerHealthAppNative(int dataType, int role, String name, int channelType);
+    private native int registerHealthAppMdepsNative(String name, int[] dataTypes, int[] roles,
+                                                    int[] channelTypes);
     private native boolean unregisterHealthAppNative(int appId);
-    private native int connectChannelNative(byte[] btAddress, int appId);
+    private native int connectChannelNative(byte[] btAddress, int appId, int mdepCfgIndex);
     private native boolean disconnectChannelNative(int channelId);
+    private native boolean registerStreamBufferNative(ByteBuffer buffer);
+    private native boolean startChannelStreamNative(int channelId, FileDescriptor fd);
+    private native void stopChannelStreamNative(int channelId);
 
 }
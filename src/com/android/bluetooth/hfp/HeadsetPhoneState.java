@@ -21,6 +21,7 @@ import android.telephony.PhoneStateListener;
 import android.telephony.ServiceState;
 import android.telephony.SignalStrength;
 import android.telephony.TelephonyManager;
+import android.text.TextUtils;
 import android.util.Log;
 
 // Note:
@@ -174,6 +175,15 @@ class HeadsetPhoneState {
     private PhoneStateListener mPhoneStateListener = new PhoneStateListener() {
         @Override
         public void onServiceStateChanged(ServiceState serviceState) {
+            ServiceState previous = mServiceState;
+            if (previous == null
+                    || !TextUtils.equals(previous.getOperatorAlphaLong(),
+                                         serviceState.getOperatorAlphaLong())
+                    || !TextUtils.equals(previous.getOperatorNumeric(),
+                                         serviceState.getOperatorNumeric())) {
+                HeadsetStateMachine sm = mStateMachine;
+                if (sm != null) sm.networkOperatorChanged();
+            }
             mServiceState = serviceState;
             mService = (serviceState.getState() == ServiceState.STATE_IN_SERVICE) ?
                 HeadsetHalConstants.NETWORK_STATE_AVAILABLE :
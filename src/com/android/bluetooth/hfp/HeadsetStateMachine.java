@@ -137,6 +137,12 @@ final class HeadsetStateMachine extends StateMachine {
     private IBluetoothHeadsetPhone mPhoneProxy;
     private boolean mNativeAvailable;
 
+    // Operator name last read through mPhoneProxy, on the state machine thread, and the
+    // count of network changes it was read after
+    private String mNetworkOperator;
+    private int mNetworkOperatorRead;
+    private volatile int mNetworkOperatorChanges;
+
     // mCurrentDevice is the device connected before the state changes
     // mTargetDevice is the device to be connected
     // mIncomingDevice is the device connecting to us, valid only in Pending state
@@ -1561,9 +1567,12 @@ final class HeadsetStateMachine extends StateMachine {
             try {
                 String number = mPhoneProxy.getSubscriberNumber();
                 if (number != null) {
-                    atResponseStringNative("+CNUM: ,\"" + number + "\"," +
-                                           PhoneNumberUtils.toaFromString(number) + ",,4");
+                    String response = "+CNUM: ,\"" + number + "\"," +
+                                      PhoneNumberUtils.toaFromString(number) + ",,4";
+                    atResponseStringNative(response);
                     atResponseCodeNative(HeadsetHalConstants.AT_RESPONSE_OK, 0);
+                    // Answers the next AT+CNUM of this headset without coming up to us
+                    setCnumResponseNative(response);
                 }
             } catch (RemoteException e) {
                 Log.e(TAG, Log.getStackTraceString(new Throwable()));
@@ -1596,20 +1605,30 @@ final class HeadsetStateMachine extends StateMachine {
     }
 
     private void processAtCops() {
-        if (mPhoneProxy != null) {
-            try {
-                String operatorName = mPhoneProxy.getNetworkOperator();
-                if (operatorName == null) {
-                    operatorName = "";
-                } 
-                copsResponseNative(operatorName);
-            } catch (RemoteException e) {
-                Log.e(TAG, Log.getStackTraceString(new Throwable()));
-                copsResponseNative("");
-            }
-        } else {
-            Log.e(TAG, "Handsfree phone proxy null for At+COPS");
-            copsResponseNative("");
+        if (mPhoneProxy == null) Log.e(TAG, "Handsfree phone proxy null for At+COPS");
+        String operatorName = getNetworkOperator();
+        copsResponseNative((operatorName != null) ? operatorName : "");
+    }
+
+    /* Told by HeadsetPhoneState when the registered network changed */
+    void networkOperatorChanged() {
+        mNetworkOperatorChanges++;
+    }
+
+    /* Returns null if the phone proxy cannot be asked. It is asked only again
+     * once the network changed. */
+    private String getNetworkOperator() {
+        int changes = mNetworkOperatorChanges;
+        if (mNetworkOperator != null && mNetworkOperatorRead == changes) return mNetworkOperator;
+        if (mPhoneProxy == null) return null;
+        try {
+            String operatorName = mPhoneProxy.getNetworkOperator();
+            mNetworkOperator = (operatorName != null) ? operatorName : "";
+            mNetworkOperatorRead = changes;
+            return mNetworkOperator;
+        } catch (RemoteException e) {
+            Log.e(TAG, Log.getStackTraceString(new Throwable()));
+            return null;
         }
     }
 
@@ -1914,6 +1933,15 @@ final class HeadsetStateMachine extends StateMachine {
     }
 
     private void processDeviceStateChanged(HeadsetDeviceState deviceState) {
+        // Lets the stack answer AT+CIND and AT+COPS without coming up to us, with what
+        // processAtCind() and processAtCops() would answer
+        if (isVirtualCallInProgress()) {
+            setCallStateNative(1, 0, mPhoneState.getCallState());
+        } else {
+            setCallStateNative(mPhoneState.getNumActiveCall(), mPhoneState.getNumHeldCall(),
+                               mPhoneState.getCallState());
+        }
+        setOperatorNameNative(getNetworkOperator());
         notifyDeviceStatusNative(deviceState.mService, deviceState.mRoam, deviceState.mSignal,
                                  deviceState.mBatteryCharge);
     }
@@ -2081,6 +2109,9 @@ final class HeadsetStateMachine extends StateMachine {
     private native boolean clccResponseNative(int index, int dir, int status, int mode,
                                               boolean mpty, String number, int type);
     private native boolean copsResponseNative(String operatorName);
+    private native void setOperatorNameNative(String operatorName);
+    private native void setCallStateNative(int numActive, int numHeld, int callState);
+    private native void setCnumResponseNative(String response);
 
     private native boolean phoneStateChangeNative(int numActive, int numHeld, int callState,
                                                   String number, int type);
@@ -31,9 +31,11 @@ import android.os.RemoteException;
 import android.os.ServiceManager;
 import android.provider.Settings;
 import android.util.Log;
+import android.util.SparseArray;
 import com.android.bluetooth.btservice.AdapterService;
 import com.android.bluetooth.btservice.ProfileService;
 import com.android.bluetooth.Utils;
+import java.nio.ByteBuffer;
 import java.util.ArrayList;
 import java.util.Collections;
 import java.util.HashMap;
@@ -68,6 +70,36 @@ public class HidService extends ProfileService {
     private static final int MESSAGE_SEND_DATA = 11;
     private static final int MESSAGE_ON_VIRTUAL_UNPLUG = 12;
 
+    // Replies to getReport requests land in slots of this buffer, one per
+    // outstanding request
+    private static final int REPORT_SLOTS = 32;
+    private static final int REPORT_SLOT_SIZE = 512;
+
+    /** Status passed to {@link ReportCallback} for requests that timed out */
+    static final int REPORT_STATUS_TIMEOUT = -1;
+
+    /**
+     * Receives the reply to a getReport request, on a Bluetooth thread and
+     * not the service handler. The report is only valid until the callback
+     * returns, and null unless status is 0.
+     */
+    interface ReportCallback {
+        void onReport(BluetoothDevice device, int status, ByteBuffer report);
+    }
+
+    private static class PendingReport {
+        final BluetoothDevice mDevice;
+        final ReportCallback mCallback;
+
+        PendingReport(BluetoothDevice device, ReportCallback callback) {
+            mDevice = device;
+            mCallback = callback;
+        }
+    }
+
+    private ByteBuffer mReportBuffer;
+    private final SparseArray<PendingReport> mPendingReports = new SparseArray<PendingReport>();
+
     static {
         classInitNative();
     }
@@ -83,6 +115,10 @@ public class HidService extends ProfileService {
     protected boolean start() {
         mInputDevices = Collections.synchronizedMap(new HashMap<BluetoothDevice, Integer>());
         initializeNative();
+        mReportBuffer = ByteBuffer.allocateDirect(REPORT_SLOTS * REPORT_SLOT_SIZE);
+        if (!registerReportBufferNative(mReportBuffer, REPORT_SLOT_SIZE)) {
+            Log.e(TAG, "Failed to register the report buffer");
+        }
         mNativeAvailable=true;
         setHidService(this);
         return true;
@@ -99,6 +135,10 @@ public class HidService extends ProfileService {
             mNativeAvailable=false;
         }
 
+        synchronized (mPendingReports) {
+            mPendingReports.clear();
+        }
+
         if(mInputDevices != null) {
             mInputDevices.clear();
         }
@@ -537,7 +577,118 @@ public class HidService extends ProfileService {
         mHandler.sendMessage(msg);
         return true ;*/
     }
+
+    /**
+     * Binary counterparts of setReport and sendData. The report is passed as
+     * bytes rather than hex text and goes to the stack on the calling thread.
+     */
+    boolean setReport(BluetoothDevice device, byte reportType, byte[] report, int offset,
+                      int length) {
+        enforceCallingOrSelfPermission(BLUETOOTH_ADMIN_PERM,
+                                                   "Need BLUETOOTH_ADMIN permission");
+        int state = this.getConnectionState(device);
+        if (state != BluetoothInputDevice.STATE_CONNECTED) {
+            return false;
+        }
+
+        return setReportBytesNative(Utils.getByteAddress(device), reportType, report, offset,
+                                    length);
+    }
+
+    boolean sendData(BluetoothDevice device, byte[] report, int offset, int length) {
+        enforceCallingOrSelfPermission(BLUETOOTH_ADMIN_PERM,
+                                                   "Need BLUETOOTH_ADMIN permission");
+        int state = this.getConnectionState(device);
+        if (state != BluetoothInputDevice.STATE_CONNECTED) {
+            return false;
+        }
+
+        return sendDataBytesNative(Utils.getByteAddress(device), report, offset, length);
+    }
+
+    // The buffer must be direct
+    boolean sendData(BluetoothDevice device, ByteBuffer report, int offset, int length) {
+        enforceCallingOrSelfPermission(BLUETOOTH_ADMIN_PERM,
+                                                   "Need BLUETOOTH_ADMIN permission");
+        int state = this.getConnectionState(device);
+        if (state != BluetoothInputDevice.STATE_CONNECTED) {
+            return false;
+        }
+
+        return sendDataBufferNative(Utils.getByteAddress(device), report, offset, length);
+    }
+
+    /**
+     * Sends the reports found at offsets[i] in reports, lengths[i] bytes each,
+     * in one native call. Returns how many were sent, which is less than
+     * offsets.length if one failed.
+     */
+    int sendDataBatch(BluetoothDevice device, byte[] reports, int[] offsets, int[] lengths) {
+        enforceCallingOrSelfPermission(BLUETOOTH_ADMIN_PERM,
+                                                   "Need BLUETOOTH_ADMIN permission");
+        int state = this.getConnectionState(device);
+        if (state != BluetoothInputDevice.STATE_CONNECTED) {
+            return 0;
+        }
+
+        return sendDataBatchNative(Utils.getByteAddress(device), reports, offsets, lengths);
+    }
     
+    /**
+     * Requests a report and returns at once. The reply, or the timeout after
+     * timeoutMs, is passed to callback. Returns false if the request could
+     * not be sent.
+     */
+    boolean getReport(BluetoothDevice device, byte reportType, byte reportId, int bufferSize,
+                      int timeoutMs, ReportCallback callback) {
+        enforceCallingOrSelfPermission(BLUETOOTH_ADMIN_PERM,
+                                       "Need BLUETOOTH_ADMIN permission");
+        int state = this.getConnectionState(device);
+        if (state != BluetoothInputDevice.STATE_CONNECTED) {
+            return false;
+        }
+
+        // Held across the native call so that the reply cannot be handled
+        // before the request is recorded
+        synchronized (mPendingReports) {
+            int requestId = getReportRequestNative(Utils.getByteAddress(device), reportType,
+                                                   reportId, bufferSize, timeoutMs);
+            if (requestId < 0) return false;
+            mPendingReports.put(requestId, new PendingReport(device, callback));
+        }
+        return true;
+    }
+
+    private void onGetReportDone(int requestId, int slot, int status, int length) {
+        PendingReport pending;
+        synchronized (mPendingReports) {
+            pending = mPendingReports.get(requestId);
+            mPendingReports.remove(requestId);
+        }
+
+        try {
+            if (pending == null) return;
+            ByteBuffer report = null;
+            if (slot >= 0 && status == 0) {
+                report = reportSlot(mReportBuffer, slot, REPORT_SLOT_SIZE, length);
+            }
+            pending.mCallback.onReport(pending.mDevice, status, report);
+        } finally {
+            if (slot >= 0) releaseReportSlotNative(slot);
+        }
+    }
+
+    /**
+     * Returns a read only view of the first length bytes of the given slot
+     * of the report buffer.
+     */
+    public static ByteBuffer reportSlot(ByteBuffer buffer, int slot, int slotSize, int length) {
+        ByteBuffer report = buffer.duplicate();
+        report.limit(slot * slotSize + length);
+        report.position(slot * slotSize);
+        return report.slice().asReadOnlyBuffer();
+    }
+
     private void onGetProtocolMode(byte[] address, int mode) {
         Message msg = mHandler.obtainMessage(MESSAGE_ON_GET_PROTOCOL_MODE);
         msg.obj = address;
@@ -647,4 +798,16 @@ public class HidService extends ProfileService {
     private native boolean getReportNative(byte[]btAddress, byte reportType, byte reportId, int bufferSize);
     private native boolean setReportNative(byte[] btAddress, byte reportType, String report);
     private native boolean sendDataNative(byte[] btAddress, String report);
+    private native boolean setReportBytesNative(byte[] btAddress, byte reportType, byte[] report,
+                                                int offset, int length);
+    private native boolean sendDataBytesNative(byte[] btAddress, byte[] report, int offset,
+                                               int length);
+    private native boolean sendDataBufferNative(byte[] btAddress, ByteBuffer report, int offset,
+                                                int length);
+    private native int sendDataBatchNative(byte[] btAddress, byte[] reports, int[] offsets,
+                                           int[] lengths);
+    private native boolean registerReportBufferNative(ByteBuffer buffer, int slotSize);
+    private native int getReportRequestNative(byte[] btAddress, byte reportType, byte reportId,
+                                              int bufferSize, int timeoutMs);
+    private native void releaseReportSlotNative(int slot);
 }
@@ -40,6 +40,7 @@ import java.util.Map;
 import java.io.FileDescriptor;
 import java.io.FileOutputStream;
 import java.io.IOException;
+import java.nio.ByteBuffer;
 
 /**
  * Provides Bluetooth IAP2 profile, as a service in
@@ -310,6 +311,26 @@ public class Iap2Service extends ProfileService {
         if (connectionState != BluetoothProfile.STATE_CONNECTED) {
             return false;
         }
+        if (data == null || len < 0 || len > data.length) {
+            return false;
+        }
+        mStateMachine.sendMessage(Iap2StateMachine.SEND_DATA, len, 0, data);
+        return true;
+    }
+
+    /**
+     * Sends the remaining bytes of data without copying them into a new array.
+     * The buffer is read asynchronously and must not be modified afterwards.
+     */
+    boolean sendData(BluetoothDevice device, ByteBuffer data) {
+        enforceCallingOrSelfPermission(BLUETOOTH_PERM, "Need BLUETOOTH permission");
+        int connectionState = mStateMachine.getConnectionState(device);
+        if (connectionState != BluetoothProfile.STATE_CONNECTED) {
+            return false;
+        }
+        if (!data.isDirect() && !data.hasArray()) {
+            return false;
+        }
         mStateMachine.sendMessage(Iap2StateMachine.SEND_DATA, data);
         return true;
     }
@@ -61,6 +61,7 @@ import java.util.List;
 import java.util.Map;
 import java.util.Set;
 import java.io.FileDescriptor;
+import java.nio.ByteBuffer;
 
 final class Iap2StateMachine extends StateMachine {
     private static final String TAG = "Iap2StateMachine";
@@ -76,6 +77,11 @@ final class Iap2StateMachine extends StateMachine {
 
     private static final int CONNECT_TIMEOUT = 201;
 
+    // Direct buffers the native layer writes inbound data into. Chunks that
+    // do not fit or arrive while all buffers are busy use onDataRx instead.
+    private static final int RX_BUFFER_COUNT = 8;
+    private static final int RX_BUFFER_SIZE = 4096;
+
     private static final ParcelUuid[] IAP2_UUIDS = {
         BluetoothUuid.AppleIAP2,
     };
@@ -90,6 +96,7 @@ final class Iap2StateMachine extends StateMachine {
 
     private BluetoothAdapter mAdapter;
     private boolean mNativeAvailable;
+    private ByteBuffer[] mRxBuffers;
 
     // mCurrentDevice is the device connected before the state changes
     // mTargetDevice is the device to be connected
@@ -131,6 +138,15 @@ final class Iap2StateMachine extends StateMachine {
         initializeNative();
         mNativeAvailable=true;
 
+        mRxBuffers = new ByteBuffer[RX_BUFFER_COUNT];
+        for (int i = 0; i < RX_BUFFER_COUNT; i++) {
+            mRxBuffers[i] = ByteBuffer.allocateDirect(RX_BUFFER_SIZE);
+        }
+        if (!registerRxBuffersNative(mRxBuffers)) {
+            Log.e(TAG, "Failed to register receive buffers");
+            mRxBuffers = null;
+        }
+
         mDisconnected = new Disconnected();
         mPending = new Pending();
         mConnected = new Connected();
@@ -211,6 +227,10 @@ final class Iap2StateMachine extends StateMachine {
                         case EVENT_TYPE_SERVICE_STATE_CHANGED:
                             processServiceEvent(event.valueInt, event.device, event.valueFd);
                             break;
+                        case EVENT_TYPE_DATA_BUFFER:
+                            // Not connected, drop the data but return the buffer
+                            releaseRxBufferNative(event.valueInt);
+                            break;
                         default:
                             Log.e(TAG, "Unexpected stack event: " + event.type);
                             break;
@@ -343,6 +363,10 @@ final class Iap2StateMachine extends StateMachine {
                         case EVENT_TYPE_SERVICE_STATE_CHANGED:
                             processServiceEvent(event.valueInt, event.device, event.valueFd);
                             break;
+                        case EVENT_TYPE_DATA_BUFFER:
+                            // Not connected, drop the data but return the buffer
+                            releaseRxBufferNative(event.valueInt);
+                            break;
                         default:
                             Log.e(TAG, "Unexpected event: " + event.type);
                             break;
@@ -565,8 +589,12 @@ final class Iap2StateMachine extends StateMachine {
                 }
                     break;
                 case SEND_DATA:
-                    byte[] buf = (byte[]) message.obj;
-                    processSendDataEvent(buf);
+                    if (message.obj instanceof ByteBuffer) {
+                        processSendDataEvent((ByteBuffer) message.obj);
+                    } else {
+                        byte[] buf = (byte[]) message.obj;
+                        processSendDataEvent(buf, message.arg1);
+                    }
                     break;
                 case STACK_EVENT:
                     StackEvent event = (StackEvent) message.obj;
@@ -583,6 +611,9 @@ final class Iap2StateMachine extends StateMachine {
                         case EVENT_TYPE_DATA:
                             processDataRxEvent(event.valueByteArray);
                             break;
+                        case EVENT_TYPE_DATA_BUFFER:
+                            processDataRxBufferEvent(event.valueInt, event.valueInt2);
+                            break;
                         default:
                             Log.e(TAG, "Unknown stack event: " + event.type);
                             break;
@@ -598,6 +629,16 @@ final class Iap2StateMachine extends StateMachine {
             Log.d(TAG, "processDataRxEvent called with data len " + data.length);
         }
 
+        private void processDataRxBufferEvent(int index, int len) {
+            ByteBuffer data = mRxBuffers[index].duplicate();
+            data.limit(len);
+            if (DBG) {
+                log("processDataRxBufferEvent called with data len " + data.remaining());
+            }
+            // The buffer must be handed back once its contents have been consumed
+            releaseRxBufferNative(index);
+        }
+
         // in Connected state
         private void processServiceEvent(int state, BluetoothDevice device, FileDescriptor fd) {
             switch(state) {
@@ -715,11 +756,21 @@ final class Iap2StateMachine extends StateMachine {
         return devices;
     }
 
-    private void processSendDataEvent(byte[] buf)
+    private void processSendDataEvent(byte[] buf, int len)
+    {
+        Log.d(TAG, "processSendDataEvent called with len " + len);
+        sendDataRangeNative(buf, 0, len);
+    }
+
+    private void processSendDataEvent(ByteBuffer buf)
     {
-        // ALK - TODO implement
-        Log.d(TAG, "processSendDataEvent called with len " + buf.length);
-        sendDataNative(buf.length, buf);
+        Log.d(TAG, "processSendDataEvent called with len " + buf.remaining());
+        if (buf.isDirect()) {
+            sendDataBufferNative(buf, buf.position(), buf.remaining());
+        } else {
+            sendDataRangeNative(buf.array(), buf.arrayOffset() + buf.position(),
+                                buf.remaining());
+        }
     }
 
     List<BluetoothDevice> getDevicesMatchingConnectionStates(int[] states) {
@@ -798,6 +849,17 @@ final class Iap2StateMachine extends StateMachine {
         sendMessage(STACK_EVENT, event);
     }
 
+    private void onDataRxBuffer(int index, int len) {
+        if (mRxBuffers == null || index < 0 || index >= mRxBuffers.length) {
+            Log.e(TAG, "Invalid receive buffer: " + index);
+            return;
+        }
+        StackEvent event = new StackEvent(EVENT_TYPE_DATA_BUFFER);
+        event.valueInt = index;
+        event.valueInt2 = len;
+        sendMessage(STACK_EVENT, event);
+    }
+
     private void onError(int code, String s) {
     }
 
@@ -864,6 +926,7 @@ final class Iap2StateMachine extends StateMachine {
     final private static int EVENT_TYPE_CONNECTION_STATE_CHANGED = 1;
     final private static int EVENT_TYPE_SERVICE_STATE_CHANGED = 2;
     final private static int EVENT_TYPE_DATA = 3;
+    final private static int EVENT_TYPE_DATA_BUFFER = 4;
 
     private class StackEvent {
         int type = EVENT_TYPE_NONE;
@@ -885,4 +948,8 @@ final class Iap2StateMachine extends StateMachine {
     private native boolean connectIap2Native(byte[] address);
     private native boolean disconnectIap2Native(byte[] address);
     private native boolean sendDataNative(int len, byte[] data);
+    private native boolean sendDataRangeNative(byte[] data, int offset, int len);
+    private native boolean sendDataBufferNative(ByteBuffer data, int offset, int len);
+    private native boolean registerRxBuffersNative(ByteBuffer[] buffers);
+    private native void releaseRxBufferNative(int index);
 }
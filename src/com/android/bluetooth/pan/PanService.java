@@ -66,6 +66,19 @@ public class PanService extends ProfileService {
     private static final int BLUETOOTH_MAX_PAN_CONNECTIONS = 5;
     private static final int BLUETOOTH_PREFIX_LENGTH        = 24;
 
+    // Indices into the array returned by getInterfaceStats()
+    static final int STATS_UP_TIME_MS = 0;
+    static final int STATS_LOCAL_ROLE = 1;
+    static final int STATS_REMOTE_ROLE = 2;
+    static final int STATS_RX_BYTES = 3;
+    static final int STATS_RX_PACKETS = 4;
+    static final int STATS_RX_DROPPED = 5;
+    static final int STATS_RX_ERRORS = 6;
+    static final int STATS_TX_BYTES = 7;
+    static final int STATS_TX_PACKETS = 8;
+    static final int STATS_TX_DROPPED = 9;
+    static final int STATS_TX_ERRORS = 10;
+
     private HashMap<BluetoothDevice, BluetoothPanDevice> mPanDevices;
     private ArrayList<String> mBluetoothIfaceAddresses;
     private int mMaxPanDevices;
@@ -310,6 +323,19 @@ public class PanService extends ProfileService {
         return panDevice.mState;
     }
 
+    /**
+     * Returns how long the connection to device is up and what the counters
+     * of the PAN interface moved since it came up, indexed by the STATS_
+     * constants, or null if the device is not connected. These are not per
+     * connection figures: the interface is shared by all connections, so
+     * with more than one, the traffic of every connection is in the counters.
+     * The stack keeps no queue depth or round trip times to report.
+     */
+    long[] getInterfaceStats(BluetoothDevice device) {
+        enforceCallingOrSelfPermission(BLUETOOTH_PERM, "Need BLUETOOTH permission");
+        return getInterfaceStatsNative(Utils.getByteAddress(device));
+    }
+
     boolean isPanNapOn() {
         if(DBG) Log.d(TAG, "isTetheringOn call getPanLocalRoleNative");
         return (getPanLocalRoleNative() & BluetoothPan.LOCAL_NAP_ROLE) != 0;
@@ -607,5 +633,6 @@ public class PanService extends ProfileService {
     private native boolean disconnectPanNative(byte[] btAddress);
     private native boolean enablePanNative(int local_role);
     private native int getPanLocalRoleNative();
+    private native long[] getInterfaceStatsNative(byte[] btAddress);
 
 }
@@ -0,0 +1,88 @@
+package com.android.bluetooth.tests;
+
+import java.nio.BufferUnderflowException;
+import java.nio.ByteBuffer;
+import java.util.Arrays;
+
+import android.test.AndroidTestCase;
+import android.util.Log;
+
+import com.android.bluetooth.gatt.GattService;
+
+/***
+ *
+ * Test cases for the records GATT notifications and batched scan results
+ * are passed up in.
+ *
+ */
+public class GattRecordTest extends AndroidTestCase {
+    protected static String TAG = "GattRecordTest";
+    protected static final boolean D = true;
+
+    public GattRecordTest() {
+        super();
+    }
+
+    // A little endian length, an is_notify byte, a reserved byte and the value
+    private static void putNotifyRecord(ByteBuffer records, byte[] value) {
+        records.put((byte) value.length);
+        records.put((byte) (value.length >> 8));
+        records.put((byte) 1);
+        records.put((byte) 0);
+        records.put(value);
+    }
+
+    public void testNotifyRecords() {
+        byte[] large = new byte[300];
+        for (int i = 0; i < large.length; i++) large[i] = (byte) i;
+
+        ByteBuffer records = ByteBuffer.allocate(1024);
+        putNotifyRecord(records, new byte[] {0x11, 0x22});
+        putNotifyRecord(records, new byte[0]);
+        putNotifyRecord(records, large);
+        records.flip();
+
+        byte[] value = GattService.readNotifyRecord(records);
+        assertEquals(2, value.length);
+        assertEquals(0x11, value[0]);
+        assertEquals(0x22, value[1]);
+
+        assertEquals(0, GattService.readNotifyRecord(records).length);
+
+        value = GattService.readNotifyRecord(records);
+        assertEquals(300, value.length);
+        assertEquals((byte) 299, value[299]);
+
+        assertFalse(records.hasRemaining());
+        if (D) Log.d(TAG, "Read three notification records");
+    }
+
+    public void testTruncatedNotifyRecord() {
+        ByteBuffer records = ByteBuffer.allocate(8);
+        putNotifyRecord(records, new byte[] {1, 2, 3, 4});
+        records.flip();
+        records.limit(records.limit() - 1);
+        try {
+            GattService.readNotifyRecord(records);
+            fail("Read a truncated notification record");
+        } catch (BufferUnderflowException e) {
+            // expected
+        }
+    }
+
+    public void testBatchScanAddressKey() {
+        byte[] records = {
+            (byte) 0xff, (byte) 0x00, (byte) 0x11, (byte) 0x22, (byte) 0x33,
+            (byte) 0x44, (byte) 0x55, (byte) 0xaa
+        };
+        assertEquals(0x001122334455L, GattService.batchScanAddressKey(records, 1));
+        assertEquals(0xff0011223344L, GattService.batchScanAddressKey(records, 0));
+        assertEquals(0x1122334455aaL, GattService.batchScanAddressKey(records, 2));
+    }
+
+    public void testBatchScanAddressKeyIsUnsigned() {
+        byte[] records = new byte[6];
+        Arrays.fill(records, (byte) 0xff);
+        assertEquals(0xffffffffffffL, GattService.batchScanAddressKey(records, 0));
+    }
+}
@@ -0,0 +1,73 @@
+package com.android.bluetooth.tests;
+
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.ReadOnlyBufferException;
+
+import android.test.AndroidTestCase;
+
+import com.android.bluetooth.hdp.HealthService;
+
+/***
+ *
+ * Test cases for the batches streamed HDP channel data is passed up in.
+ *
+ */
+public class HealthStreamTest extends AndroidTestCase {
+    protected static String TAG = "HealthStreamTest";
+    protected static final boolean D = true;
+
+    public HealthStreamTest() {
+        super();
+    }
+
+    // A 4 byte channel id and a 4 byte length followed by the data
+    private static void putRecord(ByteBuffer buffer, int channelId, byte[] data) {
+        buffer.putInt(channelId);
+        buffer.putInt(data.length);
+        buffer.put(data);
+    }
+
+    public void testBatchRecords() {
+        ByteBuffer buffer = ByteBuffer.allocateDirect(64).order(ByteOrder.nativeOrder());
+        putRecord(buffer, 7, new byte[] {1, 2, 3});
+        putRecord(buffer, 9, new byte[0]);
+        int length = buffer.position();
+
+        // Left over from an earlier, longer batch
+        buffer.put(new byte[] {(byte) 0xee, (byte) 0xee});
+
+        ByteBuffer batch = HealthService.channelDataBatch(buffer, length);
+        assertEquals(ByteOrder.nativeOrder(), batch.order());
+        assertEquals(length, batch.remaining());
+
+        assertEquals(7, batch.getInt());
+        assertEquals(3, batch.getInt());
+        byte[] data = new byte[3];
+        batch.get(data);
+        assertEquals(3, data[2]);
+
+        assertEquals(9, batch.getInt());
+        assertEquals(0, batch.getInt());
+        assertFalse(batch.hasRemaining());
+    }
+
+    public void testBatchIsReadOnly() {
+        ByteBuffer buffer = ByteBuffer.allocateDirect(16);
+        ByteBuffer batch = HealthService.channelDataBatch(buffer, 8);
+        try {
+            batch.putInt(0, 1);
+            fail("Wrote to a channel data batch");
+        } catch (ReadOnlyBufferException e) {
+            // expected
+        }
+    }
+
+    public void testBufferIsUntouched() {
+        ByteBuffer buffer = ByteBuffer.allocateDirect(16);
+        buffer.position(5);
+        HealthService.channelDataBatch(buffer, 12);
+        assertEquals(5, buffer.position());
+        assertEquals(16, buffer.limit());
+    }
+}
@@ -0,0 +1,72 @@
+package com.android.bluetooth.tests;
+
+import java.nio.ByteBuffer;
+import java.nio.ReadOnlyBufferException;
+
+import android.test.AndroidTestCase;
+
+import com.android.bluetooth.hid.HidService;
+
+/***
+ *
+ * Test cases for the slots getReport replies are read from.
+ *
+ */
+public class HidReportTest extends AndroidTestCase {
+    protected static String TAG = "HidReportTest";
+    protected static final boolean D = true;
+
+    private static final int SLOT_SIZE = 16;
+
+    public HidReportTest() {
+        super();
+    }
+
+    private static ByteBuffer reportBuffer(int slots) {
+        ByteBuffer buffer = ByteBuffer.allocateDirect(slots * SLOT_SIZE);
+        for (int i = 0; i < buffer.capacity(); i++) buffer.put(i, (byte) i);
+        return buffer;
+    }
+
+    public void testReportSlot() {
+        ByteBuffer buffer = reportBuffer(4);
+        ByteBuffer report = HidService.reportSlot(buffer, 2, SLOT_SIZE, 5);
+        assertEquals(0, report.position());
+        assertEquals(5, report.remaining());
+        assertEquals((byte) (2 * SLOT_SIZE), report.get(0));
+        assertEquals((byte) (2 * SLOT_SIZE + 4), report.get(4));
+    }
+
+    public void testFullSlots() {
+        ByteBuffer buffer = reportBuffer(2);
+        assertEquals(SLOT_SIZE, HidService.reportSlot(buffer, 0, SLOT_SIZE, SLOT_SIZE).remaining());
+        ByteBuffer last = HidService.reportSlot(buffer, 1, SLOT_SIZE, SLOT_SIZE);
+        assertEquals((byte) (2 * SLOT_SIZE - 1), last.get(SLOT_SIZE - 1));
+    }
+
+    public void testEmptyReport() {
+        ByteBuffer report = HidService.reportSlot(reportBuffer(2), 1, SLOT_SIZE, 0);
+        assertFalse(report.hasRemaining());
+    }
+
+    public void testReportIsReadOnly() {
+        ByteBuffer buffer = reportBuffer(2);
+        ByteBuffer report = HidService.reportSlot(buffer, 1, SLOT_SIZE, 4);
+        try {
+            report.put(0, (byte) 0);
+            fail("Wrote to a report slot");
+        } catch (ReadOnlyBufferException e) {
+            // expected
+        }
+        assertEquals((byte) SLOT_SIZE, buffer.get(SLOT_SIZE));
+    }
+
+    public void testBufferIsUntouched() {
+        ByteBuffer buffer = reportBuffer(2);
+        buffer.position(3);
+        buffer.limit(7);
+        HidService.reportSlot(buffer, 1, SLOT_SIZE, 4);
+        assertEquals(3, buffer.position());
+        assertEquals(7, buffer.limit());
+    }
+}
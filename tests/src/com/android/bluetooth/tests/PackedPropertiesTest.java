@@ -0,0 +1,150 @@
+package com.android.bluetooth.tests;
+
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.util.UUID;
+
+import android.os.ParcelUuid;
+import android.test.AndroidTestCase;
+import android.util.Log;
+
+import com.android.bluetooth.btservice.PackedProperties;
+
+/***
+ *
+ * Test cases for the cursor over the properties packed by the native layer.
+ *
+ */
+public class PackedPropertiesTest extends AndroidTestCase {
+    protected static String TAG = "PackedPropertiesTest";
+    protected static final boolean D = true;
+
+    private static final int TYPE_NAME = 1;
+    private static final int TYPE_UUIDS = 3;
+    private static final int TYPE_CLASS = 4;
+
+    public PackedPropertiesTest() {
+        super();
+    }
+
+    // Packs the value after a little endian 16 bit type and length
+    private static byte[] pack(int type, byte[] value) {
+        byte[] property = new byte[4 + value.length];
+        property[0] = (byte) type;
+        property[1] = (byte) (type >> 8);
+        property[2] = (byte) value.length;
+        property[3] = (byte) (value.length >> 8);
+        System.arraycopy(value, 0, property, 4, value.length);
+        return property;
+    }
+
+    private static byte[] concat(byte[]... parts) {
+        int length = 0;
+        for (byte[] part : parts) length += part.length;
+        byte[] data = new byte[length];
+        int offset = 0;
+        for (byte[] part : parts) {
+            System.arraycopy(part, 0, data, offset, part.length);
+            offset += part.length;
+        }
+        return data;
+    }
+
+    private static byte[] nativeInt(int value) {
+        return ByteBuffer.allocate(4).order(ByteOrder.nativeOrder()).putInt(value).array();
+    }
+
+    public void testReadShort() {
+        byte[] data = {(byte) 0x34, (byte) 0x12, (byte) 0xff, (byte) 0xff};
+        assertEquals(0x1234, PackedProperties.readShort(data, 0));
+        assertEquals(0xffff, PackedProperties.readShort(data, 2));
+    }
+
+    public void testProperties() {
+        UUID uuid1 = UUID.fromString("0000110a-0000-1000-8000-00805f9b34fb");
+        UUID uuid2 = UUID.fromString("0000111e-0000-1000-8000-00805f9b34fb");
+        ByteBuffer uuids = ByteBuffer.allocate(32).order(ByteOrder.BIG_ENDIAN);
+        uuids.putLong(uuid1.getMostSignificantBits()).putLong(uuid1.getLeastSignificantBits());
+        uuids.putLong(uuid2.getMostSignificantBits()).putLong(uuid2.getLeastSignificantBits());
+
+        byte[] data = concat(pack(TYPE_NAME, "Headset".getBytes()),
+                             pack(TYPE_CLASS, nativeInt(0x240404)),
+                             pack(TYPE_UUIDS, uuids.array()));
+        PackedProperties props = new PackedProperties(data, 0, data.length);
+
+        assertTrue(props.next());
+        assertEquals(TYPE_NAME, props.getType());
+        assertEquals(7, props.getLength());
+        assertEquals("Headset", props.getString());
+
+        assertTrue(props.next());
+        assertEquals(TYPE_CLASS, props.getType());
+        assertEquals(4, props.getLength());
+        assertEquals(0x240404, props.getInt());
+
+        assertTrue(props.next());
+        assertEquals(TYPE_UUIDS, props.getType());
+        ParcelUuid[] parcelUuids = props.getUuids();
+        assertEquals(2, parcelUuids.length);
+        assertEquals(uuid1, parcelUuids[0].getUuid());
+        assertEquals(uuid2, parcelUuids[1].getUuid());
+
+        assertFalse(props.next());
+        if (D) Log.d(TAG, "Read three properties from " + data.length + " bytes");
+    }
+
+    public void testBytesAreCopied() {
+        byte[] data = pack(TYPE_NAME, new byte[] {1, 2, 3});
+        PackedProperties props = new PackedProperties(data, 0, data.length);
+        assertTrue(props.next());
+        byte[] value = props.getBytes();
+        assertEquals(3, value.length);
+        assertEquals(1, value[0]);
+        assertEquals(3, value[2]);
+        value[0] = 9;
+        assertEquals(1, data[4]);
+    }
+
+    public void testEmptyValue() {
+        byte[] data = concat(pack(TYPE_NAME, new byte[0]), pack(TYPE_CLASS, nativeInt(1)));
+        PackedProperties props = new PackedProperties(data, 0, data.length);
+        assertTrue(props.next());
+        assertEquals(TYPE_NAME, props.getType());
+        assertEquals(0, props.getLength());
+        assertEquals("", props.getString());
+        assertTrue(props.next());
+        assertEquals(TYPE_CLASS, props.getType());
+        assertFalse(props.next());
+    }
+
+    public void testTruncatedHeader() {
+        byte[] data = concat(pack(TYPE_CLASS, nativeInt(1)), new byte[] {TYPE_NAME, 0, 5});
+        PackedProperties props = new PackedProperties(data, 0, data.length);
+        assertTrue(props.next());
+        assertFalse(props.next());
+    }
+
+    public void testTruncatedValue() {
+        byte[] property = pack(TYPE_NAME, "Headset".getBytes());
+        PackedProperties props = new PackedProperties(property, 0, property.length - 1);
+        assertFalse(props.next());
+    }
+
+    public void testWindow() {
+        // Only the second of three properties lies within [offset, end)
+        byte[] first = pack(TYPE_NAME, "Phone".getBytes());
+        byte[] second = pack(TYPE_CLASS, nativeInt(0x5a020c));
+        byte[] data = concat(first, second, pack(TYPE_NAME, "Watch".getBytes()));
+        PackedProperties props = new PackedProperties(data, first.length,
+                                                      first.length + second.length);
+        assertTrue(props.next());
+        assertEquals(TYPE_CLASS, props.getType());
+        assertEquals(0x5a020c, props.getInt());
+        assertFalse(props.next());
+    }
+
+    public void testEmpty() {
+        PackedProperties props = new PackedProperties(new byte[0], 0, 0);
+        assertFalse(props.next());
+    }
+}